@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "batch.h"
+#include "ext2_batch.h"
+#include "minix_batch.h"
+#include "blkio.h"
+#include "emit.h"
+#include "workpool.h"
+#include "instr.h"
+
+// Audit every image named in a manifest, one path per line, in a single
+// process. ext2 and minix are told apart by the superblock magic. Images
+// are tasks on one pool and their block groups or inode chunks are tasks
+// on the same pool, so a few large images and many small ones both keep
+// every thread busy. At most max_images are open at once and each reads
+// through at most mem_limit bytes of cache, which bounds the memory used.
+// A line is printed as each image finishes, in the order they finish.
+//
+// The exit status follows fsck(8) and is or'ed over the images: 0 clean,
+// 4 problems found, 8 an image could not be audited.
+
+#define FSCK_OK 0
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR 8
+
+struct batch {
+	struct workpool *pool;
+	int backend;
+	unsigned long mem_limit;
+	int max_images;
+	struct emit *out;
+
+	pthread_mutex_t lock;
+	pthread_cond_t finished; // an image was done
+	int running;
+	unsigned long images;
+	unsigned long clean;
+	unsigned long dirty;
+	unsigned long failed;
+	int status;
+};
+
+struct image {
+	struct batch *b;
+	char *path;
+};
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Called with b->lock held, so lines and records of images do not mix.
+static void report_image(struct batch *b, const char *path, const char *fs,
+			 const struct batch_report *r, double secs)
+{
+	if (r->error)
+		printf("%s: %s%s%s\n", path, fs ? fs : "", fs ? ", " : "", r->error);
+	else
+		printf("%s: %s, %u byte blocks, %llu/%llu inodes, %llu/%llu blocks, %lu problems in %.3f s\n",
+		       path, fs, r->block_size, (unsigned long long) r->inodes,
+		       (unsigned long long) r->inodes_count, (unsigned long long) r->blocks,
+		       (unsigned long long) r->blocks_count, r->problems, secs);
+	// a reader of the pipe sees every image as soon as it is done.
+	fflush(stdout);
+
+	emit_begin(b->out, "image");
+	emit_str(b->out, "path", path, strlen(path));
+	if (fs)
+		emit_str(b->out, "fs", fs, strlen(fs));
+	if (r->error) {
+		emit_str(b->out, "error", r->error, strlen(r->error));
+	} else {
+		emit_u64(b->out, "block_size", r->block_size);
+		emit_u64(b->out, "inodes", r->inodes);
+		emit_u64(b->out, "inodes_count", r->inodes_count);
+		emit_u64(b->out, "blocks", r->blocks);
+		emit_u64(b->out, "blocks_count", r->blocks_count);
+		emit_u64(b->out, "problems", r->problems);
+	}
+	emit_u64(b->out, "usec", secs * 1e6);
+	emit_end(b->out);
+}
+
+static void audit_image(void *arg)
+{
+	struct image *img = arg;
+	struct batch *b = img->b;
+	struct batch_report r;
+	struct timespec start, end;
+	unsigned char sb[BATCH_PROBE_SIZE];
+	const char *fs = NULL;
+	struct blkio *io;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&r, 0x0, sizeof(r));
+	io = blkio_open(img->path, b->backend);
+	if (!io) {
+		r.error = "can not open";
+	} else {
+		if (blkio_read(io, sb, BATCH_PROBE_OFFSET, sizeof(sb)) != sizeof(sb)) {
+			r.error = "too small for a file system";
+		} else if (ext2_batch_probe(sb)) {
+			fs = "ext2";
+			ext2_batch_audit(io, b->mem_limit, b->pool, &r);
+		} else if (minix_batch_probe(sb)) {
+			fs = "minix";
+			minix_batch_audit(io, b->mem_limit, b->pool, &r);
+		} else {
+			r.error = "neither ext2 nor minix";
+		}
+		blkio_close(io);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	pthread_mutex_lock(&b->lock);
+	report_image(b, img->path, fs, &r, elapsed(&start, &end));
+	if (r.error) {
+		b->failed++;
+		b->status |= FSCK_ERROR;
+	} else if (r.problems) {
+		b->dirty++;
+		b->status |= FSCK_UNCORRECTED;
+	} else {
+		b->clean++;
+	}
+	b->running--;
+	pthread_cond_signal(&b->finished);
+	pthread_mutex_unlock(&b->lock);
+
+	free(img->path);
+	free(img);
+}
+
+// Queue an image once fewer than max_images are open.
+static void submit_image(struct batch *b, const char *path)
+{
+	struct image *img = malloc(sizeof(*img));
+
+	assert(img != NULL);
+	img->b = b;
+	img->path = strdup(path);
+	assert(img->path != NULL);
+
+	pthread_mutex_lock(&b->lock);
+	while (b->running >= b->max_images)
+		pthread_cond_wait(&b->finished, &b->lock);
+	b->running++;
+	b->images++;
+	pthread_mutex_unlock(&b->lock);
+
+	workpool_submit(b->pool, audit_image, img);
+}
+
+int main(int argc, char **argv)
+{
+	struct batch b;
+	struct timespec start, end;
+	const char *manifest;
+	const char *out_path = NULL;
+	int format = -1;
+	int nr_threads = 0;
+	FILE *fp;
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t len;
+	int opt;
+
+	instr_setup();
+
+	memset(&b, 0x0, sizeof(b));
+	b.backend = BLKIO_PREAD;
+	b.mem_limit = 64 * 1024 * 1024;
+
+	while ((opt = getopt(argc, argv, "t:j:m:b:e:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'j':
+			b.max_images = atoi(optarg);
+			break;
+		case 'm':
+			b.mem_limit = strtoul(optarg, NULL, 0) * 1024 * 1024;
+			break;
+		case 'b':
+			if ((b.backend = blkio_parse_backend(optarg)) < 0)
+				goto usage;
+			break;
+		case 'e':
+			if ((format = emit_parse_format(optarg)) < 0)
+				goto usage;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind + 1 != argc || !b.mem_limit || (format >= 0 && !out_path))
+		goto usage;
+	manifest = argv[optind];
+
+	fp = strcmp(manifest, "-") ? fopen(manifest, "r") : stdin;
+	if (!fp) {
+		printf("can not open %s\n", manifest);
+		exit(FSCK_ERROR);
+	}
+	if (out_path) {
+		b.out = emit_open(out_path, format < 0 ? EMIT_NDJSON : format);
+		if (!b.out) {
+			printf("can not open %s\n", out_path);
+			exit(FSCK_ERROR);
+		}
+	}
+
+	b.pool = workpool_create(nr_threads);
+	if (b.max_images <= 0)
+		b.max_images = workpool_nr_threads(b.pool);
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.finished, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((len = getline(&line, &line_cap, fp)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (!len || line[0] == '#')
+			continue;
+		submit_image(&b, line);
+	}
+	workpool_wait(b.pool);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%lu images: %lu clean, %lu with problems, %lu failed in %.3f s with %d threads\n",
+	       b.images, b.clean, b.dirty, b.failed, elapsed(&start, &end), workpool_nr_threads(b.pool));
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	workpool_destroy(b.pool);
+	pthread_cond_destroy(&b.finished);
+	pthread_mutex_destroy(&b.lock);
+
+	if (b.out) {
+		unsigned long records = emit_records(b.out);
+
+		if (emit_close(b.out) < 0) {
+			printf("writing %s failed\n", out_path);
+			exit(FSCK_ERROR);
+		}
+		printf("%lu records written to %s\n", records, out_path);
+	}
+
+	return b.status;
+
+usage:
+	printf("usage: %s [-t threads] [-j images] [-m MiB per image] [-b mmap|pread|uring] [-e ndjson|binary] [-o file] manifest|-\n", argv[0]);
+	exit(FSCK_ERROR);
+}
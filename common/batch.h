@@ -0,0 +1,23 @@
+#ifndef __MIKOOS_BATCH_H
+#define __MIKOOS_BATCH_H 1
+
+#include <sys/types.h>
+
+// What a file system audit of one image in a batch reports. Each file
+// system fills it in its own way; see ext2_batch.h and minix_batch.h.
+
+// the superblock read to tell the file systems apart.
+#define BATCH_PROBE_OFFSET 1024
+#define BATCH_PROBE_SIZE 1024
+
+struct batch_report {
+	u_int32_t block_size;
+	u_int64_t inodes; // in use
+	u_int64_t inodes_count;
+	u_int64_t blocks; // in use
+	u_int64_t blocks_count;
+	unsigned long problems;
+	const char *error; // why the image could not be audited, if it could not
+};
+
+#endif // __MIKOOS_BATCH_H
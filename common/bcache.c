@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "bcache.h"
+
+// The cache never shrinks below this many buffers, so a few callers can
+// pin blocks at once even with a tiny memory cap.
+#define BCACHE_MIN_BUFS 16
+// bcache_prefetch() reads at most this many blocks per batch.
+#define BCACHE_PREFETCH_BATCH 32
+
+enum {
+	BUF_EMPTY = 0,
+	BUF_LOADING,
+	BUF_VALID,
+};
+
+struct bcache {
+	struct blkio *io;
+	u_int32_t block_size;
+	unsigned int nr_bufs;
+	struct bcache_buf *bufs;
+	unsigned char *mem;
+	struct bcache_buf **hash;
+	unsigned int nr_hash; // power of two
+	unsigned int hand; // clock hand
+	struct bcache_stat stat;
+	pthread_mutex_t lock;
+	pthread_cond_t loaded; // a buffer left BUF_LOADING
+};
+
+static const char * const type_names[BCACHE_NR_TYPES] = {
+	[BCACHE_SUPER] = "superblock",
+	[BCACHE_GDT] = "gdt",
+	[BCACHE_BITMAP] = "bitmap",
+	[BCACHE_ITABLE] = "inode table",
+	[BCACHE_DIR] = "directory",
+	[BCACHE_DATA] = "data",
+};
+
+const char *bcache_type_name(int type)
+{
+	return type >= 0 && type < BCACHE_NR_TYPES ? type_names[type] : "unknown";
+}
+
+struct bcache *bcache_create(struct blkio *io, u_int32_t block_size, unsigned long max_bytes)
+{
+	struct bcache *bc;
+	unsigned int i;
+
+	bc = calloc(1, sizeof(*bc));
+	assert(bc != NULL);
+
+	bc->io = io;
+	bc->block_size = block_size;
+	bc->nr_bufs = max_bytes / block_size;
+	if (bc->nr_bufs < BCACHE_MIN_BUFS)
+		bc->nr_bufs = BCACHE_MIN_BUFS;
+
+	bc->nr_hash = 16;
+	while (bc->nr_hash < bc->nr_bufs)
+		bc->nr_hash *= 2;
+
+	bc->bufs = calloc(bc->nr_bufs, sizeof(*bc->bufs));
+	bc->hash = calloc(bc->nr_hash, sizeof(*bc->hash));
+	bc->mem = malloc((size_t) bc->nr_bufs * block_size);
+	assert(bc->bufs != NULL && bc->hash != NULL && bc->mem != NULL);
+
+	for (i = 0; i < bc->nr_bufs; i++)
+		bc->bufs[i].data = bc->mem + (size_t) i * block_size;
+
+	pthread_mutex_init(&bc->lock, NULL);
+	pthread_cond_init(&bc->loaded, NULL);
+
+	return bc;
+}
+
+void bcache_destroy(struct bcache *bc)
+{
+	pthread_cond_destroy(&bc->loaded);
+	pthread_mutex_destroy(&bc->lock);
+	free(bc->mem);
+	free(bc->hash);
+	free(bc->bufs);
+	free(bc);
+}
+
+static struct bcache_buf **hash_slot(struct bcache *bc, u_int64_t block)
+{
+	u_int64_t h = block * 0x9e3779b97f4a7c15ULL;
+
+	return bc->hash + ((h >> 32) & (bc->nr_hash - 1));
+}
+
+static struct bcache_buf *hash_find(struct bcache *bc, u_int64_t block)
+{
+	struct bcache_buf *b;
+
+	for (b = *hash_slot(bc, block); b; b = b->hash_next) {
+		if (b->block == block)
+			return b;
+	}
+
+	return NULL;
+}
+
+static void hash_remove(struct bcache *bc, struct bcache_buf *buf)
+{
+	struct bcache_buf **pp;
+
+	for (pp = hash_slot(bc, buf->block); *pp; pp = &(*pp)->hash_next) {
+		if (*pp == buf) {
+			*pp = buf->hash_next;
+			return ;
+		}
+	}
+}
+
+// Take an unpinned buffer with the clock. A referenced buffer gets a second
+// chance. Returns NULL if every buffer is pinned or loading.
+static struct bcache_buf *clock_evict(struct bcache *bc)
+{
+	unsigned int n;
+
+	for (n = 0; n < bc->nr_bufs * 2; n++) {
+		struct bcache_buf *b = bc->bufs + bc->hand;
+
+		bc->hand = (bc->hand + 1) % bc->nr_bufs;
+
+		if (b->pins || b->state == BUF_LOADING)
+			continue;
+
+		if (b->referenced) {
+			b->referenced = 0;
+			continue;
+		}
+
+		if (b->state == BUF_VALID) {
+			hash_remove(bc, b);
+			bc->stat.evictions++;
+		}
+		b->state = BUF_EMPTY;
+
+		return b;
+	}
+
+	return NULL;
+}
+
+// Fill buf from the backend. The tail of a block past the end of the device
+// reads as zeros.
+static int read_block(struct bcache *bc, struct bcache_buf *buf)
+{
+	u_int64_t offset = buf->block * bc->block_size;
+	u_int64_t size = blkio_size(bc->io);
+	unsigned long len = bc->block_size;
+
+	if (offset >= size)
+		return -1;
+	if (len > size - offset) {
+		len = size - offset;
+		memset(buf->data + len, 0x0, bc->block_size - len);
+	}
+
+	return blkio_read(bc->io, buf->data, offset, len) == len ? 0 : -1;
+}
+
+// Get block pinned. Returns NULL if it can not be read.
+struct bcache_buf *bcache_get(struct bcache *bc, u_int64_t block, int type)
+{
+	struct bcache_buf *b;
+	int ret;
+
+	assert(type >= 0 && type < BCACHE_NR_TYPES);
+
+	pthread_mutex_lock(&bc->lock);
+
+	while ((b = hash_find(bc, block)) && b->state == BUF_LOADING)
+		pthread_cond_wait(&bc->loaded, &bc->lock);
+
+	if (b) {
+		b->pins++;
+		b->referenced = 1;
+		bc->stat.hits[type]++;
+		pthread_mutex_unlock(&bc->lock);
+		return b;
+	}
+
+	b = clock_evict(bc);
+	if (!b) {
+		bc->stat.no_buffer++;
+		pthread_mutex_unlock(&bc->lock);
+		return NULL;
+	}
+
+	b->block = block;
+	b->state = BUF_LOADING;
+	b->pins = 1;
+	b->hash_next = *hash_slot(bc, block);
+	*hash_slot(bc, block) = b;
+	bc->stat.misses[type]++;
+
+	// others looking for this block wait on bc->loaded meanwhile.
+	pthread_mutex_unlock(&bc->lock);
+	ret = read_block(bc, b);
+	pthread_mutex_lock(&bc->lock);
+
+	if (ret < 0) {
+		hash_remove(bc, b);
+		b->state = BUF_EMPTY;
+		b->pins = 0;
+		bc->stat.io_errors++;
+		b = NULL;
+	} else {
+		b->state = BUF_VALID;
+		b->referenced = 1;
+	}
+
+	pthread_cond_broadcast(&bc->loaded);
+	pthread_mutex_unlock(&bc->lock);
+
+	return b;
+}
+
+void bcache_put(struct bcache *bc, struct bcache_buf *buf)
+{
+	pthread_mutex_lock(&bc->lock);
+	assert(buf->pins > 0);
+	buf->pins--;
+	pthread_mutex_unlock(&bc->lock);
+}
+
+// Read the blocks which are not cached yet in batches, so the backend can
+// have them in flight together. Nothing is pinned afterwards.
+void bcache_prefetch(struct bcache *bc, const u_int64_t *blocks, int nr)
+{
+	struct blkio_req reqs[BCACHE_PREFETCH_BATCH];
+	struct bcache_buf *bufs[BCACHE_PREFETCH_BATCH];
+	u_int64_t size = blkio_size(bc->io);
+	int done = 0;
+	int n, i;
+
+	// do not push out what was prefetched before it is used.
+	if (nr > bc->nr_bufs / 2)
+		nr = bc->nr_bufs / 2;
+
+	while (done < nr) {
+		pthread_mutex_lock(&bc->lock);
+		for (n = 0; done < nr && n < BCACHE_PREFETCH_BATCH; done++) {
+			u_int64_t block = blocks[done];
+			struct bcache_buf *b;
+
+			// whole blocks only; read_block() deals with the tail.
+			if ((block + 1) * bc->block_size > size || hash_find(bc, block))
+				continue;
+
+			b = clock_evict(bc);
+			if (!b)
+				break;
+
+			b->block = block;
+			b->state = BUF_LOADING;
+			b->hash_next = *hash_slot(bc, block);
+			*hash_slot(bc, block) = b;
+
+			bufs[n] = b;
+			reqs[n].offset = block * bc->block_size;
+			reqs[n].len = bc->block_size;
+			reqs[n].buf = b->data;
+			n++;
+		}
+		pthread_mutex_unlock(&bc->lock);
+
+		if (n == 0)
+			break;
+
+		blkio_submit(bc->io, reqs, n);
+
+		pthread_mutex_lock(&bc->lock);
+		for (i = 0; i < n; i++) {
+			if (reqs[i].result == reqs[i].len) {
+				bufs[i]->state = BUF_VALID;
+				bufs[i]->referenced = 1;
+				bc->stat.prefetched++;
+			} else {
+				hash_remove(bc, bufs[i]);
+				bufs[i]->state = BUF_EMPTY;
+				bc->stat.io_errors++;
+			}
+		}
+		pthread_cond_broadcast(&bc->loaded);
+		pthread_mutex_unlock(&bc->lock);
+	}
+}
+
+// Read len bytes from offset on into buf with one request, around the
+// buffers: a run of data blocks is used once and would only push out
+// metadata. Images are never written through the cache, so a cached copy of
+// one of the blocks can not differ. Returns len, or -1.
+long bcache_read(struct bcache *bc, void *buf, u_int64_t offset, unsigned long len, int type)
+{
+	long n;
+
+	assert(type >= 0 && type < BCACHE_NR_TYPES);
+
+	if (len == 0)
+		return 0;
+
+	n = blkio_read(bc->io, buf, offset, len);
+
+	pthread_mutex_lock(&bc->lock);
+	if (n == len)
+		bc->stat.misses[type] += (offset + len - 1) / bc->block_size - offset / bc->block_size + 1;
+	else
+		bc->stat.io_errors++;
+	pthread_mutex_unlock(&bc->lock);
+
+	return n == len ? n : -1;
+}
+
+void bcache_get_stat(struct bcache *bc, struct bcache_stat *st)
+{
+	pthread_mutex_lock(&bc->lock);
+	*st = bc->stat;
+	pthread_mutex_unlock(&bc->lock);
+}
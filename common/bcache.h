@@ -0,0 +1,50 @@
+#ifndef __MIKOOS_BCACHE_H
+#define __MIKOOS_BCACHE_H 1
+
+#include <sys/types.h>
+#include "blkio.h"
+
+// Buffer cache of fixed size blocks read through a blkio backend.
+// Blocks are evicted with CLOCK; a pinned block stays until it is put back.
+
+// What a block is used for. Only used for the statistics.
+enum bcache_type {
+	BCACHE_SUPER = 0,
+	BCACHE_GDT,
+	BCACHE_BITMAP,
+	BCACHE_ITABLE,
+	BCACHE_DIR,
+	BCACHE_DATA,
+	BCACHE_NR_TYPES,
+};
+
+struct bcache_buf {
+	u_int64_t block;
+	unsigned char *data;
+	int pins;
+	int state;
+	int referenced; // accessed since the clock hand passed
+	struct bcache_buf *hash_next;
+};
+
+struct bcache_stat {
+	unsigned long hits[BCACHE_NR_TYPES];
+	unsigned long misses[BCACHE_NR_TYPES];
+	unsigned long prefetched;
+	unsigned long evictions;
+	unsigned long io_errors;
+	unsigned long no_buffer; // every buffer was pinned
+};
+
+struct bcache;
+
+struct bcache *bcache_create(struct blkio *io, u_int32_t block_size, unsigned long max_bytes);
+void bcache_destroy(struct bcache *bc);
+struct bcache_buf *bcache_get(struct bcache *bc, u_int64_t block, int type);
+void bcache_put(struct bcache *bc, struct bcache_buf *buf);
+void bcache_prefetch(struct bcache *bc, const u_int64_t *blocks, int nr);
+long bcache_read(struct bcache *bc, void *buf, u_int64_t offset, unsigned long len, int type);
+void bcache_get_stat(struct bcache *bc, struct bcache_stat *st);
+const char *bcache_type_name(int type);
+
+#endif // __MIKOOS_BCACHE_H
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+// Benchmarks are linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+// so every allocation of the code under test is counted here.
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static unsigned long nr_allocs;
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+unsigned long bench_allocs(void)
+{
+	return __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED);
+}
+
+u_int64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u_int64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_header(void)
+{
+#ifndef __OPTIMIZE__
+	printf("warning: built without optimization\n");
+#endif
+	printf("%-28s %12s %12s %10s %10s\n", "benchmark", "ops", "ns/op", "MB/s", "allocs/op");
+}
+
+// Repeat fn for at least seconds (and at least once) and print the result.
+void bench_run(const char *name, bench_fn fn, void *arg, double seconds)
+{
+	u_int64_t limit = seconds * 1e9;
+	u_int64_t bytes = 0;
+	unsigned long ops = 0;
+	unsigned long allocs = bench_allocs();
+	u_int64_t start = bench_now();
+	u_int64_t elapsed;
+
+	do {
+		ops += fn(arg, &bytes);
+		elapsed = bench_now() - start;
+	} while (elapsed < limit);
+
+	allocs = bench_allocs() - allocs;
+
+	if (ops == 0) {
+		printf("%-28s %12s\n", name, "no data");
+		return ;
+	}
+
+	printf("%-28s %12lu %12.1f ", name, ops, (double) elapsed / ops);
+	if (bytes)
+		printf("%10.1f ", (double) bytes / 1e6 / (elapsed / 1e9));
+	else
+		printf("%10s ", "-");
+	printf("%10.3f\n", (double) allocs / ops);
+}
@@ -0,0 +1,15 @@
+#ifndef __MIKOOS_BENCH_H
+#define __MIKOOS_BENCH_H 1
+
+#include <sys/types.h>
+
+// One benchmark round. Returns how many operations it did and adds the
+// bytes it processed to *bytes.
+typedef unsigned long (*bench_fn)(void *arg, u_int64_t *bytes);
+
+u_int64_t bench_now(void);
+unsigned long bench_allocs(void);
+void bench_header(void);
+void bench_run(const char *name, bench_fn fn, void *arg, double seconds);
+
+#endif // __MIKOOS_BENCH_H
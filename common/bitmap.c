@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_POPCOUNT 1
+#endif
+
+#include "bitmap.h"
+
+static unsigned long popcount_scalar(const unsigned char *p, unsigned long len)
+{
+	unsigned long count = 0;
+	unsigned long i = 0;
+	uint64_t w;
+
+	for (; i + sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, p + i, sizeof(w));
+		count += __builtin_popcountll(w);
+	}
+	for (; i < len; i++)
+		count += __builtin_popcount(p[i]);
+
+	return count;
+}
+
+#ifdef HAVE_AVX2_POPCOUNT
+// Nibble lookup popcount; byte counts are summed per 64 bit lane with vpsadbw.
+__attribute__((target("avx2")))
+static unsigned long popcount_avx2(const unsigned char *p, unsigned long len)
+{
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+						0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256();
+	unsigned long i = 0;
+	uint64_t lanes[4];
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+		__m256i lo = _mm256_and_si256(v, low_mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+		__m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+					      _mm256_shuffle_epi8(lookup, hi));
+
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+
+	_mm256_storeu_si256((__m256i *) lanes, acc);
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcount_scalar(p + i, len - i);
+}
+
+static int cpu_has_avx2(void)
+{
+	static int cached = -1;
+	int has_avx2 = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+
+	// racing initialisers store the same value.
+	if (has_avx2 < 0) {
+		__builtin_cpu_init();
+		has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+		__atomic_store_n(&cached, has_avx2, __ATOMIC_RELAXED);
+	}
+
+	return has_avx2;
+}
+#endif
+
+static unsigned long popcount_bytes(const unsigned char *p, unsigned long len)
+{
+#ifdef HAVE_AVX2_POPCOUNT
+	if (cpu_has_avx2())
+		return popcount_avx2(p, len);
+#endif
+	return popcount_scalar(p, len);
+}
+
+const char *bitmap_popcount_impl(void)
+{
+#ifdef HAVE_AVX2_POPCOUNT
+	if (cpu_has_avx2())
+		return "avx2";
+#endif
+	return "scalar";
+}
+
+unsigned long bitmap_count_used(const unsigned char *map, unsigned long nbits)
+{
+	unsigned long used = popcount_bytes(map, nbits / 8);
+
+	if (nbits % 8)
+		used += __builtin_popcount(map[nbits / 8] & ((1 << (nbits % 8)) - 1));
+
+	return used;
+}
+
+// Load 64 bits starting at bit (index * 64). Bits past nbits read as used.
+static uint64_t load_word(const unsigned char *map, unsigned long nbits, unsigned long index)
+{
+	unsigned long first = index * 64;
+	uint64_t w = 0;
+
+	if (nbits - first >= 64) {
+		memcpy(&w, map + first / 8, sizeof(w));
+		return w;
+	}
+
+	memcpy(&w, map + first / 8, (nbits - first + 7) / 8);
+
+	return w | (~(uint64_t) 0 << (nbits - first));
+}
+
+// First clear bit at or after start, or nbits if there is none.
+// Whole used words are skipped with one compare.
+unsigned long bitmap_find_free(const unsigned char *map, unsigned long nbits, unsigned long start)
+{
+	unsigned long i = start / 64;
+	uint64_t w;
+
+	if (start >= nbits)
+		return nbits;
+
+	// bits below start count as used.
+	w = load_word(map, nbits, i) | (((uint64_t) 1 << (start % 64)) - 1);
+	while (w == ~(uint64_t) 0) {
+		if (++i * 64 >= nbits)
+			return nbits;
+		w = load_word(map, nbits, i);
+	}
+
+	return i * 64 + __builtin_ctzll(~w);
+}
+
+// Length of the run of clear bits starting at start, at most max.
+unsigned long bitmap_free_run(const unsigned char *map, unsigned long nbits, unsigned long start,
+			      unsigned long max)
+{
+	unsigned long n = 0;
+
+	while (n < max && start + n < nbits) {
+		unsigned long pos = start + n;
+		uint64_t w = load_word(map, nbits, pos / 64) >> (pos % 64);
+		unsigned long run = w ? __builtin_ctzll(w) : 64 - pos % 64;
+
+		n += run;
+		if (w)
+			break;
+	}
+
+	return n < max ? n : max;
+}
+
+static void close_run(struct bitmap_stat *st, unsigned long start, unsigned long len)
+{
+	if (!len)
+		return ;
+
+	st->free_runs++;
+	if (len > st->longest_free) {
+		st->longest_free = len;
+		st->longest_free_start = start;
+	}
+}
+
+// Count used and free bits and find the longest run of free bits.
+// Whole words which are completely used or free are handled in one step.
+void bitmap_analyze(const unsigned char *map, unsigned long nbits, struct bitmap_stat *st)
+{
+	unsigned long nwords = (nbits + 63) / 64;
+	unsigned long run_start = 0;
+	unsigned long run_len = 0;
+	unsigned long i;
+
+	memset(st, 0x0, sizeof(*st));
+	st->used = bitmap_count_used(map, nbits);
+	st->free = nbits - st->used;
+
+	for (i = 0; i < nwords; i++) {
+		uint64_t w = load_word(map, nbits, i);
+		unsigned int pos = 0;
+
+		if (w == 0) {
+			if (!run_len)
+				run_start = i * 64;
+			run_len += 64;
+			continue;
+		}
+
+		if (w == ~(uint64_t) 0) {
+			close_run(st, run_start, run_len);
+			run_len = 0;
+			continue;
+		}
+
+		while (pos < 64) {
+			uint64_t rest = w >> pos;
+			unsigned int n;
+
+			if (!(rest & 1)) {
+				// free bits up to the next used bit.
+				n = rest ? __builtin_ctzll(rest) : 64 - pos;
+				if (!run_len)
+					run_start = i * 64 + pos;
+				run_len += n;
+			} else {
+				n = ~rest ? __builtin_ctzll(~rest) : 64 - pos;
+				if (n > 64 - pos)
+					n = 64 - pos;
+				close_run(st, run_start, run_len);
+				run_len = 0;
+			}
+			pos += n;
+		}
+	}
+
+	close_run(st, run_start, run_len);
+}
+
+// Fold st into total; offset is the position of st's first bit in total.
+void bitmap_stat_merge(struct bitmap_stat *total, const struct bitmap_stat *st, unsigned long offset)
+{
+	total->used += st->used;
+	total->free += st->free;
+	total->free_runs += st->free_runs;
+	if (st->longest_free > total->longest_free) {
+		total->longest_free = st->longest_free;
+		total->longest_free_start = st->longest_free_start + offset;
+	}
+}
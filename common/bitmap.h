@@ -0,0 +1,23 @@
+#ifndef __MIKOOS_BITMAP_H
+#define __MIKOOS_BITMAP_H 1
+
+// On-disk allocation bitmaps: bit n lives in byte n / 8, bit n % 8.
+// A set bit means the block or inode is in use.
+
+struct bitmap_stat {
+	unsigned long used;
+	unsigned long free;
+	unsigned long free_runs; // number of maximal free runs
+	unsigned long longest_free; // length of the longest free run
+	unsigned long longest_free_start; // first bit of that run
+};
+
+unsigned long bitmap_count_used(const unsigned char *map, unsigned long nbits);
+unsigned long bitmap_find_free(const unsigned char *map, unsigned long nbits, unsigned long start);
+unsigned long bitmap_free_run(const unsigned char *map, unsigned long nbits, unsigned long start,
+			      unsigned long max);
+void bitmap_analyze(const unsigned char *map, unsigned long nbits, struct bitmap_stat *st);
+void bitmap_stat_merge(struct bitmap_stat *total, const struct bitmap_stat *st, unsigned long offset);
+const char *bitmap_popcount_impl(void);
+
+#endif // __MIKOOS_BITMAP_H
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "blkio.h"
+
+// blkio_load() reads the image in requests of this size.
+#define BLKIO_LOAD_CHUNK (1024 * 1024)
+#define BLKIO_LOAD_BATCH 64
+
+int blkio_parse_backend(const char *name)
+{
+	if (!strcmp(name, "mmap"))
+		return BLKIO_MMAP;
+	if (!strcmp(name, "pread"))
+		return BLKIO_PREAD;
+	if (!strcmp(name, "uring"))
+		return BLKIO_URING;
+
+	return -1;
+}
+
+static int get_size(int fd, u_int64_t *size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	if (S_ISBLK(st.st_mode))
+		return ioctl(fd, BLKGETSIZE64, size);
+
+	*size = st.st_size;
+
+	return 0;
+}
+
+// Open path read only. If io_uring is not usable here, pread is used instead.
+struct blkio *blkio_open(const char *path, int backend)
+{
+	static const struct blkio_ops * const backends[] = {
+		[BLKIO_MMAP] = &blkio_mmap_ops,
+		[BLKIO_PREAD] = &blkio_pread_ops,
+		[BLKIO_URING] = &blkio_uring_ops,
+	};
+	struct blkio *io;
+
+	if (backend < 0 || backend >= sizeof(backends) / sizeof(backends[0]))
+		return NULL;
+
+	io = calloc(1, sizeof(*io));
+	assert(io != NULL);
+
+	io->fd = open(path, O_RDONLY);
+	if (io->fd < 0 || get_size(io->fd, &io->size) < 0)
+		goto fail;
+
+	io->ops = backends[backend];
+	if (io->ops->init(io) == 0)
+		return io;
+
+	if (backend != BLKIO_URING)
+		goto fail;
+
+	io->ops = &blkio_pread_ops;
+	if (io->ops->init(io) == 0)
+		return io;
+
+fail:
+	if (io->fd >= 0)
+		close(io->fd);
+	free(io);
+
+	return NULL;
+}
+
+void blkio_close(struct blkio *io)
+{
+	io->ops->exit(io);
+	close(io->fd);
+	free(io);
+}
+
+const char *blkio_name(const struct blkio *io)
+{
+	return io->ops->name;
+}
+
+u_int64_t blkio_size(const struct blkio *io)
+{
+	return io->size;
+}
+
+// Complete every request. Returns -1 if any of them was not read in full;
+// see its result for why.
+int blkio_submit(struct blkio *io, struct blkio_req *reqs, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		reqs[i].result = 0;
+		if (reqs[i].offset > io->size || reqs[i].len > io->size - reqs[i].offset)
+			reqs[i].result = -EINVAL;
+	}
+
+	return io->ops->submit(io, reqs, nr);
+}
+
+long blkio_read(struct blkio *io, void *buf, u_int64_t offset, unsigned long len)
+{
+	struct blkio_req req = { offset, len, buf, 0 };
+
+	blkio_submit(io, &req, 1);
+
+	return req.result;
+}
+
+// The whole image in memory. The mmap backend hands out its mapping, the
+// others read it in batches of large requests.
+unsigned char *blkio_load(struct blkio *io)
+{
+	struct blkio_req reqs[BLKIO_LOAD_BATCH];
+	unsigned char *image;
+	u_int64_t offset = 0;
+	int nr;
+
+	if (io->map)
+		return io->map;
+
+	if (io->size != (size_t) io->size)
+		return NULL;
+
+	image = malloc(io->size ? io->size : 1);
+	if (!image)
+		return NULL;
+
+	while (offset < io->size) {
+		for (nr = 0; nr < BLKIO_LOAD_BATCH && offset < io->size; nr++) {
+			reqs[nr].offset = offset;
+			reqs[nr].len = io->size - offset < BLKIO_LOAD_CHUNK ? io->size - offset : BLKIO_LOAD_CHUNK;
+			reqs[nr].buf = image + offset;
+			offset += reqs[nr].len;
+		}
+
+		if (blkio_submit(io, reqs, nr) < 0) {
+			free(image);
+			return NULL;
+		}
+	}
+
+	return image;
+}
+
+void blkio_unload(struct blkio *io, unsigned char *image)
+{
+	if (image != io->map)
+		free(image);
+}
+
+static int mmap_init(struct blkio *io)
+{
+	void *p;
+
+	if (io->size != (size_t) io->size || io->size == 0)
+		return -1;
+
+	p = mmap(NULL, io->size, PROT_READ, MAP_PRIVATE, io->fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+
+	io->map = p;
+
+	return 0;
+}
+
+static int mmap_submit(struct blkio *io, struct blkio_req *reqs, int nr)
+{
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (reqs[i].result < 0) {
+			ret = -1;
+			continue;
+		}
+		memcpy(reqs[i].buf, io->map + reqs[i].offset, reqs[i].len);
+		reqs[i].result = reqs[i].len;
+	}
+
+	return ret;
+}
+
+static void mmap_exit(struct blkio *io)
+{
+	munmap(io->map, io->size);
+	io->map = NULL;
+}
+
+const struct blkio_ops blkio_mmap_ops = {
+	.name = "mmap",
+	.init = mmap_init,
+	.submit = mmap_submit,
+	.exit = mmap_exit,
+};
+
+static int pread_init(struct blkio *io)
+{
+	return 0;
+}
+
+static int pread_submit(struct blkio *io, struct blkio_req *reqs, int nr)
+{
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct blkio_req *req = reqs + i;
+
+		while (req->result >= 0 && req->result < req->len) {
+			ssize_t n = pread(io->fd, (char *) req->buf + req->result,
+					  req->len - req->result, req->offset + req->result);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				req->result = n < 0 ? -errno : -EIO;
+			else
+				req->result += n;
+		}
+
+		if (req->result < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+static void pread_exit(struct blkio *io)
+{
+}
+
+const struct blkio_ops blkio_pread_ops = {
+	.name = "pread",
+	.init = pread_init,
+	.submit = pread_submit,
+	.exit = pread_exit,
+};
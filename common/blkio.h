@@ -0,0 +1,53 @@
+#ifndef __MIKOOS_BLKIO_H
+#define __MIKOOS_BLKIO_H 1
+
+#include <sys/types.h>
+
+// Block I/O against an image file or a block device. Every backend takes
+// 64 bit offsets and a batch of requests which is completed as a whole.
+
+enum blkio_backend {
+	BLKIO_MMAP = 0,
+	BLKIO_PREAD,
+	BLKIO_URING,
+};
+
+struct blkio_req {
+	u_int64_t offset;
+	unsigned long len;
+	void *buf;
+	long result; // bytes read, or -errno
+};
+
+struct blkio;
+
+struct blkio_ops {
+	const char *name;
+	int (*init)(struct blkio *io);
+	int (*submit)(struct blkio *io, struct blkio_req *reqs, int nr);
+	void (*exit)(struct blkio *io);
+};
+
+struct blkio {
+	const struct blkio_ops *ops;
+	int fd;
+	u_int64_t size;
+	unsigned char *map; // whole image, mmap backend only
+	void *priv;
+};
+
+extern const struct blkio_ops blkio_mmap_ops;
+extern const struct blkio_ops blkio_pread_ops;
+extern const struct blkio_ops blkio_uring_ops;
+
+int blkio_parse_backend(const char *name);
+struct blkio *blkio_open(const char *path, int backend);
+void blkio_close(struct blkio *io);
+const char *blkio_name(const struct blkio *io);
+u_int64_t blkio_size(const struct blkio *io);
+int blkio_submit(struct blkio *io, struct blkio_req *reqs, int nr);
+long blkio_read(struct blkio *io, void *buf, u_int64_t offset, unsigned long len);
+unsigned char *blkio_load(struct blkio *io);
+void blkio_unload(struct blkio *io, unsigned char *image);
+
+#endif // __MIKOOS_BLKIO_H
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "blkio.h"
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+
+// io_uring without liburing: the rings are set up and driven by hand.
+
+#define URING_DEPTH 64
+// largest read one sqe can carry.
+#define URING_MAX_LEN (1U << 30)
+
+struct uring_wait;
+
+// What a sqe in flight belongs to. user_data of the sqe is the index of its tag.
+struct uring_tag {
+	struct uring_wait *w; // NULL once the submitter gave up on it
+	int i; // index into the submitter's reqs
+};
+
+// One uring_submit() call. Its requests are completed by whichever thread
+// reaps them, so several submitters share the rings.
+struct uring_wait {
+	struct blkio_req *reqs;
+	unsigned int inflight;
+	int ret;
+	int failed; // the rings failed; short reads are not queued again
+};
+
+struct uring {
+	pthread_mutex_t lock; // held only to fill the sq ring and reap the cq ring
+	pthread_cond_t reaped; // a reaper has routed completions
+	int reaping; // a thread is waiting in the kernel for completions
+	struct uring_tag *tags;
+	unsigned int *free_tags;
+	unsigned int nr_free; // sqes which can still be in flight
+	int fd;
+	unsigned int entries;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static void uring_unmap(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	pthread_cond_destroy(&r->reaped);
+	pthread_mutex_destroy(&r->lock);
+	free(r->tags);
+	free(r->free_tags);
+	free(r);
+}
+
+static int uring_init(struct blkio *io)
+{
+	struct io_uring_params p;
+	struct uring *r;
+	unsigned int i;
+	void *ptr;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -1;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->reaped, NULL);
+
+	memset(&p, 0x0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+	if (r->fd < 0) {
+		pthread_cond_destroy(&r->reaped);
+		pthread_mutex_destroy(&r->lock);
+		free(r);
+		return -1;
+	}
+
+	// no more sqes in flight than the sq ring holds, so the cq ring, which
+	// is at least as large, never overflows.
+	r->entries = p.sq_entries;
+	r->tags = calloc(r->entries, sizeof(*r->tags));
+	r->free_tags = calloc(r->entries, sizeof(*r->free_tags));
+	if (!r->tags || !r->free_tags)
+		goto fail;
+	for (i = 0; i < r->entries; i++)
+		r->free_tags[r->nr_free++] = i;
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+
+	ptr = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   r->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	r->sq_ring = ptr;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ring = r->sq_ring;
+	} else {
+		ptr = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			   r->fd, IORING_OFF_CQ_RING);
+		if (ptr == MAP_FAILED)
+			goto fail;
+		r->cq_ring = ptr;
+	}
+
+	ptr = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	r->sqes = ptr;
+
+	r->sq_head = (unsigned int *) ((char *) r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned int *) ((char *) r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int *) ((char *) r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *) ((char *) r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned int *) ((char *) r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *) ((char *) r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int *) ((char *) r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ring + p.cq_off.cqes);
+
+	io->priv = r;
+
+	return 0;
+
+fail:
+	uring_unmap(r);
+
+	return -1;
+}
+
+// Queue the unread rest of req under tag.
+static void queue_req(struct uring *r, int fd, struct blkio_req *req, unsigned int tag)
+{
+	unsigned int tail = *r->sq_tail;
+	unsigned int index = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = r->sqes + index;
+	unsigned long len = req->len - req->result;
+
+	memset(sqe, 0x0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) ((char *) req->buf + req->result);
+	sqe->len = len > URING_MAX_LEN ? URING_MAX_LEN : len;
+	sqe->off = req->offset + req->result;
+	sqe->user_data = tag;
+
+	r->sq_array[index] = index;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// sqes in the sq ring which the kernel has not taken yet. Only submissions
+// under r->lock take them, so the count holds while the lock is.
+static unsigned int unsubmitted(struct uring *r)
+{
+	return *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+}
+
+// Hand the queued sqes to the kernel without waiting. Called with r->lock
+// held. On failure they stay in the ring for the next flush.
+static int flush_locked(struct uring *r)
+{
+	unsigned int n;
+
+	while ((n = unsubmitted(r))) {
+		if (syscall(__NR_io_uring_enter, r->fd, n, 0, 0, NULL, 0) < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Route every completion to the submitter its tag points at, and queue the
+// rest of short reads again. Called with r->lock held.
+static void reap_locked(struct uring *r, int fd)
+{
+	unsigned int head = *r->cq_head;
+
+	while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = r->cqes + (head & *r->cq_mask);
+		unsigned int tag = cqe->user_data;
+		struct uring_wait *w = r->tags[tag].w;
+		struct blkio_req *req;
+
+		head++;
+
+		if (!w) {
+			r->free_tags[r->nr_free++] = tag;
+			continue;
+		}
+
+		req = w->reqs + r->tags[tag].i;
+		if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+			// retried below.
+		} else if (cqe->res <= 0) {
+			req->result = cqe->res < 0 ? cqe->res : -EIO;
+			w->ret = -1;
+		} else {
+			req->result += cqe->res;
+		}
+
+		if (!w->failed && req->result >= 0 && req->result < req->len) {
+			// a cqe was just consumed, so there is room for a sqe.
+			queue_req(r, fd, req, tag);
+			continue;
+		}
+
+		r->tags[tag].w = NULL;
+		r->free_tags[r->nr_free++] = tag;
+		w->inflight--;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// The rings failed under w. Its sqes the kernel has not taken yet become
+// nops which no longer point into its buffers, so only the reads already
+// submitted are left for w to wait for. Called with r->lock held.
+static void fail_locked(struct uring *r, struct uring_wait *w)
+{
+	unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int tail = *r->sq_tail;
+
+	w->ret = -1;
+	w->failed = 1;
+	for (; head != tail; head++) {
+		struct io_uring_sqe *sqe = r->sqes + r->sq_array[head & *r->sq_mask];
+		unsigned int tag = sqe->user_data;
+
+		if (r->tags[tag].w != w)
+			continue;
+
+		memset(sqe, 0x0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = tag;
+		r->tags[tag].w = NULL;
+		w->inflight--;
+	}
+}
+
+// Every submitter queues its own sqes, but only one thread at a time waits in
+// the kernel; it reaps completions for everybody and wakes the others. Even
+// when the rings fail, it returns only once the kernel is done with reqs.
+static int uring_submit(struct blkio *io, struct blkio_req *reqs, int nr)
+{
+	struct uring *r = io->priv;
+	struct uring_wait w;
+	int next = 0;
+
+	w.reqs = reqs;
+	w.inflight = 0;
+	w.ret = 0;
+	w.failed = 0;
+
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		int err = 0;
+
+		// skip requests which were refused before they were queued.
+		while (!w.failed && next < nr && r->nr_free) {
+			unsigned int tag;
+
+			if (reqs[next].result < 0 || reqs[next].len == 0) {
+				if (reqs[next].result < 0)
+					w.ret = -1;
+				next++;
+				continue;
+			}
+			tag = r->free_tags[--r->nr_free];
+			r->tags[tag].w = &w;
+			r->tags[tag].i = next;
+			queue_req(r, io->fd, reqs + next++, tag);
+			w.inflight++;
+		}
+
+		if (flush_locked(r) < 0 && !w.failed)
+			fail_locked(r, &w);
+		if ((w.failed || next >= nr) && !w.inflight)
+			break;
+
+		if (r->reaping) {
+			pthread_cond_wait(&r->reaped, &r->lock);
+			continue;
+		}
+
+		r->reaping = 1;
+		pthread_mutex_unlock(&r->lock);
+		if (syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+			err = errno;
+		pthread_mutex_lock(&r->lock);
+		reap_locked(r, io->fd);
+		r->reaping = 0;
+		pthread_cond_broadcast(&r->reaped);
+
+		if (err && err != EINTR && err != EAGAIN && !w.failed)
+			fail_locked(r, &w);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return w.ret;
+}
+
+static void uring_exit(struct blkio *io)
+{
+	uring_unmap(io->priv);
+	io->priv = NULL;
+}
+
+#else
+
+static int uring_init(struct blkio *io)
+{
+	return -1;
+}
+
+static int uring_submit(struct blkio *io, struct blkio_req *reqs, int nr)
+{
+	return -1;
+}
+
+static void uring_exit(struct blkio *io)
+{
+}
+
+#endif
+
+const struct blkio_ops blkio_uring_ops = {
+	.name = "io_uring",
+	.init = uring_init,
+	.submit = uring_submit,
+	.exit = uring_exit,
+};
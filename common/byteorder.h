@@ -0,0 +1,20 @@
+#ifndef __MIKOOS_BYTEORDER_H
+#define __MIKOOS_BYTEORDER_H 1
+
+#include <sys/types.h>
+
+// Both file systems store integers little endian. These loads work on any
+// host byte order and any alignment; gcc turns them into a single move on x86.
+
+static inline u_int16_t get_le16(const unsigned char *p)
+{
+	return (u_int16_t) p[0] | ((u_int16_t) p[1] << 8);
+}
+
+static inline u_int32_t get_le32(const unsigned char *p)
+{
+	return (u_int32_t) p[0] | ((u_int32_t) p[1] << 8) |
+		((u_int32_t) p[2] << 16) | ((u_int32_t) p[3] << 24);
+}
+
+#endif // __MIKOOS_BYTEORDER_H
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "dcache.h"
+
+struct dcache_entry {
+	struct dcache_entry *hash_next;
+	struct dcache_entry *lru_prev;
+	struct dcache_entry *lru_next;
+	u_int32_t hash;
+	u_int32_t parent;
+	u_int32_t ino;
+	int len;
+	char name[0];
+};
+
+struct dcache {
+	struct dcache_entry **buckets;
+	unsigned long nr_buckets; // power of two
+	struct dcache_entry lru; // lru.lru_next is the most recently used
+	unsigned long max_entries;
+	struct dcache_stat stat;
+	pthread_mutex_t lock;
+};
+
+// FNV-1a over the parent inode and the name.
+static u_int32_t dcache_hash(u_int32_t parent, const char *name, int len)
+{
+	u_int32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		h ^= (parent >> (i * 8)) & 0xff;
+		h *= 16777619U;
+	}
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+struct dcache *dcache_create(unsigned long max_entries)
+{
+	struct dcache *dc;
+
+	dc = calloc(1, sizeof(*dc));
+	assert(dc != NULL);
+
+	if (max_entries == 0)
+		max_entries = 1;
+
+	// keep chains short: about one entry per bucket when full.
+	dc->nr_buckets = 16;
+	while (dc->nr_buckets < max_entries)
+		dc->nr_buckets *= 2;
+
+	dc->buckets = calloc(dc->nr_buckets, sizeof(*dc->buckets));
+	assert(dc->buckets != NULL);
+
+	dc->max_entries = max_entries;
+	dc->lru.lru_next = dc->lru.lru_prev = &dc->lru;
+	pthread_mutex_init(&dc->lock, NULL);
+
+	return dc;
+}
+
+void dcache_destroy(struct dcache *dc)
+{
+	struct dcache_entry *e, *next;
+
+	for (e = dc->lru.lru_next; e != &dc->lru; e = next) {
+		next = e->lru_next;
+		free(e);
+	}
+
+	pthread_mutex_destroy(&dc->lock);
+	free(dc->buckets);
+	free(dc);
+}
+
+static void lru_unlink(struct dcache_entry *e)
+{
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void lru_push_front(struct dcache *dc, struct dcache_entry *e)
+{
+	e->lru_next = dc->lru.lru_next;
+	e->lru_prev = &dc->lru;
+	dc->lru.lru_next->lru_prev = e;
+	dc->lru.lru_next = e;
+}
+
+static struct dcache_entry **find_slot(struct dcache *dc, u_int32_t hash, u_int32_t parent,
+				       const char *name, int len)
+{
+	struct dcache_entry **pp = dc->buckets + (hash & (dc->nr_buckets - 1));
+
+	for (; *pp; pp = &(*pp)->hash_next) {
+		struct dcache_entry *e = *pp;
+
+		if (e->hash == hash && e->parent == parent && e->len == len &&
+		    !memcmp(e->name, name, len))
+			break;
+	}
+
+	return pp;
+}
+
+static void evict_one(struct dcache *dc)
+{
+	struct dcache_entry *victim = dc->lru.lru_prev;
+	struct dcache_entry **pp;
+
+	pp = find_slot(dc, victim->hash, victim->parent, victim->name, victim->len);
+	assert(*pp == victim);
+	*pp = victim->hash_next;
+
+	lru_unlink(victim);
+	free(victim);
+
+	dc->stat.entries--;
+	dc->stat.evictions++;
+}
+
+// Returns DCACHE_HIT with *ino set, DCACHE_NEGATIVE or DCACHE_MISS.
+int dcache_lookup(struct dcache *dc, u_int32_t parent, const char *name, int len, u_int32_t *ino)
+{
+	u_int32_t hash = dcache_hash(parent, name, len);
+	struct dcache_entry *e;
+	int ret = DCACHE_MISS;
+
+	pthread_mutex_lock(&dc->lock);
+
+	e = *find_slot(dc, hash, parent, name, len);
+	if (!e) {
+		dc->stat.misses++;
+	} else {
+		lru_unlink(e);
+		lru_push_front(dc, e);
+
+		if (e->ino) {
+			*ino = e->ino;
+			dc->stat.hits++;
+			ret = DCACHE_HIT;
+		} else {
+			dc->stat.negative_hits++;
+			ret = DCACHE_NEGATIVE;
+		}
+	}
+
+	pthread_mutex_unlock(&dc->lock);
+
+	return ret;
+}
+
+// Remember that name in parent is ino; ino 0 records a missing name.
+void dcache_insert(struct dcache *dc, u_int32_t parent, const char *name, int len, u_int32_t ino)
+{
+	u_int32_t hash = dcache_hash(parent, name, len);
+	struct dcache_entry **pp;
+	struct dcache_entry *e;
+
+	pthread_mutex_lock(&dc->lock);
+
+	pp = find_slot(dc, hash, parent, name, len);
+	if (*pp) {
+		(*pp)->ino = ino;
+		lru_unlink(*pp);
+		lru_push_front(dc, *pp);
+		goto out;
+	}
+
+	if (dc->stat.entries >= dc->max_entries) {
+		evict_one(dc);
+		// the victim may have been in front of our slot.
+		pp = find_slot(dc, hash, parent, name, len);
+	}
+
+	e = malloc(sizeof(*e) + len);
+	assert(e != NULL);
+
+	e->hash = hash;
+	e->parent = parent;
+	e->ino = ino;
+	e->len = len;
+	memcpy(e->name, name, len);
+	e->hash_next = NULL;
+	*pp = e;
+
+	lru_push_front(dc, e);
+	dc->stat.entries++;
+
+out:
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_get_stat(struct dcache *dc, struct dcache_stat *st)
+{
+	pthread_mutex_lock(&dc->lock);
+	*st = dc->stat;
+	pthread_mutex_unlock(&dc->lock);
+}
+
+int path_next_component(const char *path, const char **component, const char **next)
+{
+	int len = 0;
+
+	while (*path == '/')
+		path++;
+
+	while (path[len] && path[len] != '/')
+		len++;
+
+	*component = path;
+	*next = path + len;
+
+	return len;
+}
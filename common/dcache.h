@@ -0,0 +1,36 @@
+#ifndef __MIKOOS_DCACHE_H
+#define __MIKOOS_DCACHE_H 1
+
+#include <sys/types.h>
+
+// Path component cache: (parent inode, name) -> inode.
+// Inode 0 is stored as a negative entry, i.e. the name is known not to exist.
+// The least recently used entry is dropped once max_entries are cached.
+
+enum {
+	DCACHE_MISS = -1,
+	DCACHE_NEGATIVE = 0,
+	DCACHE_HIT = 1,
+};
+
+struct dcache_stat {
+	unsigned long hits;
+	unsigned long negative_hits;
+	unsigned long misses;
+	unsigned long evictions;
+	unsigned long entries;
+};
+
+struct dcache;
+
+struct dcache *dcache_create(unsigned long max_entries);
+void dcache_destroy(struct dcache *dc);
+int dcache_lookup(struct dcache *dc, u_int32_t parent, const char *name, int len, u_int32_t *ino);
+void dcache_insert(struct dcache *dc, u_int32_t parent, const char *name, int len, u_int32_t ino);
+void dcache_get_stat(struct dcache *dc, struct dcache_stat *st);
+
+// Split path at '/'. Returns the length of the next component and sets *next
+// after it, or 0 at the end of path. Empty components ("//") are skipped.
+int path_next_component(const char *path, const char **component, const char **next);
+
+#endif // __MIKOOS_DCACHE_H
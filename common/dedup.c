@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dedup.h"
+
+void dedup_builder_init(struct dedup_builder *b, u_int32_t block_size)
+{
+	memset(b, 0x0, sizeof(*b));
+	pthread_mutex_init(&b->lock, NULL);
+	b->block_size = block_size;
+}
+
+// One file and all of its blocks, so callers batch per file and the lock is
+// not taken per block.
+void dedup_builder_add(struct dedup_builder *b, const struct dedup_file *file,
+		       const struct dedup_block *blocks, unsigned long nr)
+{
+	pthread_mutex_lock(&b->lock);
+
+	if (b->nr_files == b->max_files) {
+		b->max_files = b->max_files ? b->max_files * 2 : 1024;
+		b->files = realloc(b->files, b->max_files * sizeof(*b->files));
+		assert(b->files != NULL);
+	}
+	b->files[b->nr_files++] = *file;
+
+	if (b->nr_blocks + nr > b->max_blocks) {
+		while (b->nr_blocks + nr > b->max_blocks)
+			b->max_blocks = b->max_blocks ? b->max_blocks * 2 : 4096;
+		b->blocks = realloc(b->blocks, b->max_blocks * sizeof(*b->blocks));
+		assert(b->blocks != NULL);
+	}
+	memcpy(b->blocks + b->nr_blocks, blocks, nr * sizeof(*blocks));
+	b->nr_blocks += nr;
+
+	pthread_mutex_unlock(&b->lock);
+}
+
+static int compare_file(const void *a, const void *b)
+{
+	const struct dedup_file *x = a;
+	const struct dedup_file *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+
+	return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+static int compare_block(const void *a, const void *b)
+{
+	const struct dedup_block *x = a;
+	const struct dedup_block *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+
+	return x->lblk < y->lblk ? -1 : x->lblk > y->lblk;
+}
+
+// Sort what was collected and hand it over to idx.
+void dedup_builder_finish(struct dedup_builder *b, struct dedup_index *idx)
+{
+	qsort(b->files, b->nr_files, sizeof(*b->files), compare_file);
+	qsort(b->blocks, b->nr_blocks, sizeof(*b->blocks), compare_block);
+
+	memset(idx, 0x0, sizeof(*idx));
+	idx->block_size = b->block_size;
+	idx->files = b->files;
+	idx->nr_files = b->nr_files;
+	idx->blocks = b->blocks;
+	idx->nr_blocks = b->nr_blocks;
+
+	pthread_mutex_destroy(&b->lock);
+	memset(b, 0x0, sizeof(*b));
+}
+
+// Written next to path first and renamed, so readers never see half of it.
+int dedup_index_write(const struct dedup_index *idx, const char *path)
+{
+	struct dedup_header hdr;
+	char *tmp;
+	FILE *fp;
+	int ret = -1;
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, DEDUP_MAGIC, sizeof(hdr.magic));
+	hdr.version = DEDUP_VERSION;
+	hdr.block_size = idx->block_size;
+	hdr.nr_files = idx->nr_files;
+	hdr.nr_blocks = idx->nr_blocks;
+
+	tmp = malloc(strlen(path) + 5);
+	assert(tmp != NULL);
+	sprintf(tmp, "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+		goto out;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (idx->nr_files && fwrite(idx->files, sizeof(*idx->files), idx->nr_files, fp) != idx->nr_files) ||
+	    (idx->nr_blocks && fwrite(idx->blocks, sizeof(*idx->blocks), idx->nr_blocks, fp) != idx->nr_blocks)) {
+		fclose(fp);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	free(tmp);
+
+	return ret;
+}
+
+// Map an index written by dedup_index_write(). Returns -1 if path is not one.
+int dedup_index_open(const char *path, struct dedup_index *idx)
+{
+	const struct dedup_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	memset(idx, 0x0, sizeof(*idx));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = map;
+	if (memcmp(hdr->magic, DEDUP_MAGIC, sizeof(hdr->magic)) || hdr->version != DEDUP_VERSION ||
+	    hdr->nr_files > st.st_size / sizeof(struct dedup_file) ||
+	    hdr->nr_blocks > st.st_size / sizeof(struct dedup_block) ||
+	    sizeof(*hdr) + hdr->nr_files * sizeof(struct dedup_file) +
+	    hdr->nr_blocks * sizeof(struct dedup_block) != st.st_size) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	idx->map = map;
+	idx->map_size = st.st_size;
+	idx->block_size = hdr->block_size;
+	idx->files = (const void *) ((const unsigned char *) map + sizeof(*hdr));
+	idx->nr_files = hdr->nr_files;
+	idx->blocks = (const void *) (idx->files + hdr->nr_files);
+	idx->nr_blocks = hdr->nr_blocks;
+
+	return 0;
+}
+
+void dedup_index_free(struct dedup_index *idx)
+{
+	if (idx->map) {
+		munmap(idx->map, idx->map_size);
+	} else {
+		free((void *) idx->files);
+		free((void *) idx->blocks);
+	}
+	memset(idx, 0x0, sizeof(*idx));
+}
+
+static u_int64_t record_hash(const struct dedup_index *idx, int files, u_int64_t i)
+{
+	return files ? idx->files[i].hash : idx->blocks[i].hash;
+}
+
+static void count_run(struct dedup_count *c, u_int64_t n, int shared)
+{
+	c->all += n;
+	c->unique++;
+	c->dup += n - 1;
+	if (shared)
+		c->shared += n;
+}
+
+// Walk all indexes side by side in hash order, one run of equal hashes at a
+// time. Files of size 0 are skipped; they would all be one another's copies.
+static void merge(const struct dedup_index *idx, int nr, int files, struct dedup_stat *per_image,
+		  struct dedup_stat *total, dedup_fn fn, void *arg)
+{
+	u_int64_t *pos = calloc(nr, sizeof(*pos));
+	u_int64_t *count = calloc(nr, sizeof(*count));
+	struct dedup_ref *refs = NULL;
+	unsigned long nr_refs;
+	unsigned long max_refs = 0;
+	int i;
+
+	assert(pos != NULL && count != NULL);
+
+	for (;;) {
+		u_int64_t hash = 0;
+		u_int64_t n = 0;
+		int found = 0;
+		int images = 0;
+
+		for (i = 0; i < nr; i++) {
+			u_int64_t end = files ? idx[i].nr_files : idx[i].nr_blocks;
+
+			if (pos[i] < end && (!found || record_hash(idx + i, files, pos[i]) < hash)) {
+				hash = record_hash(idx + i, files, pos[i]);
+				found = 1;
+			}
+		}
+		if (!found)
+			break;
+
+		nr_refs = 0;
+		for (i = 0; i < nr; i++) {
+			u_int64_t end = files ? idx[i].nr_files : idx[i].nr_blocks;
+
+			count[i] = 0;
+			for (; pos[i] < end && record_hash(idx + i, files, pos[i]) == hash; pos[i]++) {
+				const struct dedup_file *f = idx[i].files + pos[i];
+
+				if (!files) {
+					count[i]++;
+					continue;
+				}
+				if (!f->size)
+					continue;
+
+				count[i]++;
+				if (nr_refs == max_refs) {
+					max_refs = max_refs ? max_refs * 2 : 16;
+					refs = realloc(refs, max_refs * sizeof(*refs));
+					assert(refs != NULL);
+				}
+				refs[nr_refs].image = i;
+				refs[nr_refs].ino = f->ino;
+				refs[nr_refs].size = f->size;
+				nr_refs++;
+			}
+			if (count[i])
+				images++;
+			n += count[i];
+		}
+		if (!n)
+			continue;
+
+		count_run(files ? &total->files : &total->blocks, n, images > 1);
+		for (i = 0; i < nr; i++) {
+			if (count[i])
+				count_run(files ? &per_image[i].files : &per_image[i].blocks, count[i], images > 1);
+		}
+
+		if (files && n > 1 && fn)
+			fn(arg, hash, refs, nr_refs);
+	}
+
+	free(refs);
+	free(count);
+	free(pos);
+}
+
+// per_image has nr entries. fn, if not NULL, gets the duplicate files.
+void dedup_compare(const struct dedup_index *idx, int nr, struct dedup_stat *per_image,
+		   struct dedup_stat *total, dedup_fn fn, void *arg)
+{
+	memset(per_image, 0x0, nr * sizeof(*per_image));
+	memset(total, 0x0, sizeof(*total));
+
+	merge(idx, nr, 1, per_image, total, fn, arg);
+	merge(idx, nr, 0, per_image, total, NULL, NULL);
+}
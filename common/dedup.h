@@ -0,0 +1,97 @@
+#ifndef __MIKOOS_DEDUP_H
+#define __MIKOOS_DEDUP_H 1
+
+#include <sys/types.h>
+#include <pthread.h>
+
+// Content hash index of one image: a hash64() of every data block and of
+// every regular file, both sorted by hash so that duplicates are neighbours
+// and several indexes can be merged in one pass. Equal hashes are taken as
+// equal contents.
+//
+// Layout on disk, host byte order:
+//   header
+//   files[]   sorted by hash, then inode
+//   blocks[]  sorted by hash, then inode and logical block
+
+#define DEDUP_MAGIC "DEDUPIDX"
+#define DEDUP_VERSION 1
+
+struct dedup_header {
+	char magic[8];
+	u_int32_t version;
+	u_int32_t block_size;
+	u_int64_t nr_files;
+	u_int64_t nr_blocks;
+};
+
+struct dedup_file {
+	u_int64_t hash; // of the (logical block, block hash) pairs, seeded with the size
+	u_int64_t size;
+	u_int32_t ino;
+	u_int32_t blocks; // mapped data blocks
+};
+
+struct dedup_block {
+	u_int64_t hash;
+	u_int32_t ino;
+	u_int32_t lblk;
+};
+
+struct dedup_index {
+	u_int32_t block_size;
+	const struct dedup_file *files;
+	u_int64_t nr_files;
+	const struct dedup_block *blocks;
+	u_int64_t nr_blocks;
+	void *map; // mapped index file, or NULL if the arrays were built
+	unsigned long map_size;
+};
+
+// Collects records from many threads at once.
+struct dedup_builder {
+	pthread_mutex_t lock;
+	u_int32_t block_size;
+	struct dedup_file *files;
+	u_int64_t nr_files;
+	u_int64_t max_files;
+	struct dedup_block *blocks;
+	u_int64_t nr_blocks;
+	u_int64_t max_blocks;
+};
+
+// Duplicates over a set of indexes. A hash which shows up n times counts
+// once as unique and n - 1 times as duplicate; its n copies are shared when
+// they are spread over more than one index.
+struct dedup_count {
+	u_int64_t all;
+	u_int64_t unique;
+	u_int64_t dup;
+	u_int64_t shared;
+};
+
+struct dedup_stat {
+	struct dedup_count files; // files with data, empty ones are left out
+	struct dedup_count blocks;
+};
+
+struct dedup_ref {
+	int image; // position in the index array
+	u_int32_t ino;
+	u_int64_t size;
+};
+
+// Called once for every group of files with equal contents.
+typedef void (*dedup_fn)(void *arg, u_int64_t hash, const struct dedup_ref *refs, unsigned long nr);
+
+void dedup_builder_init(struct dedup_builder *b, u_int32_t block_size);
+void dedup_builder_add(struct dedup_builder *b, const struct dedup_file *file,
+		       const struct dedup_block *blocks, unsigned long nr);
+void dedup_builder_finish(struct dedup_builder *b, struct dedup_index *idx);
+int dedup_index_write(const struct dedup_index *idx, const char *path);
+int dedup_index_open(const char *path, struct dedup_index *idx);
+void dedup_index_free(struct dedup_index *idx);
+void dedup_compare(const struct dedup_index *idx, int nr, struct dedup_stat *per_image,
+		   struct dedup_stat *total, dedup_fn fn, void *arg);
+
+#endif // __MIKOOS_DEDUP_H
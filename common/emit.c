@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "emit.h"
+
+#define EMIT_BUF_SIZE (256 * 1024)
+// worst case of one field apart from a string value: a 255 byte type or key
+// escaped 6 bytes per byte, its framing and a u64.
+#define EMIT_MAX_FIELD (256 * 6 + 64)
+
+struct emit {
+	int fd;
+	int format;
+	int error;
+	unsigned long start; // where the current record begins in buf
+	unsigned long len;
+	unsigned long records;
+	unsigned char buf[EMIT_BUF_SIZE];
+};
+
+int emit_parse_format(const char *name)
+{
+	if (!strcmp(name, "ndjson"))
+		return EMIT_NDJSON;
+	if (!strcmp(name, "binary"))
+		return EMIT_BINARY;
+
+	return -1;
+}
+
+static int write_all(int fd, const unsigned char *p, unsigned long len)
+{
+	while (len) {
+		ssize_t ret = write(fd, p, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+// Write out every finished record; the one being built moves to the front.
+static void flush(struct emit *e)
+{
+	if (e->start && write_all(e->fd, e->buf, e->start) < 0)
+		e->error = 1;
+
+	memmove(e->buf, e->buf + e->start, e->len - e->start);
+	e->len -= e->start;
+	e->start = 0;
+}
+
+// Make room for n more bytes. A record which outgrows the whole buffer is
+// not supported; its remaining fields are dropped and the error sticks.
+static int reserve(struct emit *e, unsigned long n)
+{
+	if (e->len + n > EMIT_BUF_SIZE)
+		flush(e);
+	if (e->len + n > EMIT_BUF_SIZE) {
+		e->error = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void put(struct emit *e, const void *p, unsigned long n)
+{
+	memcpy(e->buf + e->len, p, n);
+	e->len += n;
+}
+
+static void put_le(struct emit *e, u_int64_t v, int bytes)
+{
+	int i;
+
+	for (i = 0; i < bytes; i++)
+		e->buf[e->len++] = v >> (i * 8);
+}
+
+static void put_decimal(struct emit *e, u_int64_t v)
+{
+	char tmp[20];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	while (n)
+		e->buf[e->len++] = tmp[--n];
+}
+
+static void put_json_string(struct emit *e, const char *s, unsigned int len)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned int i;
+
+	e->buf[e->len++] = '"';
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\') {
+			e->buf[e->len++] = '\\';
+			e->buf[e->len++] = c;
+		} else if (c < 0x20 || c >= 0x7f) {
+			put(e, "\\u00", 4);
+			e->buf[e->len++] = hex[c >> 4];
+			e->buf[e->len++] = hex[c & 0xf];
+		} else {
+			e->buf[e->len++] = c;
+		}
+	}
+	e->buf[e->len++] = '"';
+}
+
+static void put_key(struct emit *e, const char *key, char kind)
+{
+	unsigned int len = strlen(key);
+
+	if (e->format == EMIT_BINARY) {
+		e->buf[e->len++] = kind;
+		e->buf[e->len++] = len;
+		put(e, key, len);
+		return ;
+	}
+
+	// keys come from the program and need no escaping.
+	put(e, ",\"", 2);
+	put(e, key, len);
+	put(e, "\":", 2);
+}
+
+struct emit *emit_open(const char *path, int format)
+{
+	struct emit *e;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+
+	e->format = format;
+	e->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (e->fd < 0) {
+		free(e);
+		return NULL;
+	}
+
+	if (format == EMIT_BINARY) {
+		put(e, EMIT_BINARY_MAGIC, strlen(EMIT_BINARY_MAGIC));
+		e->start = e->len;
+	}
+
+	return e;
+}
+
+// Flush what is left. Returns -1 if anything could not be written.
+int emit_close(struct emit *e)
+{
+	int ret;
+
+	if (!e)
+		return 0;
+
+	e->start = e->len;
+	flush(e);
+	if (close(e->fd) < 0)
+		e->error = 1;
+	ret = e->error ? -1 : 0;
+	free(e);
+
+	return ret;
+}
+
+void emit_begin(struct emit *e, const char *type)
+{
+	unsigned int len;
+
+	if (!e)
+		return ;
+
+	len = strlen(type);
+	reserve(e, EMIT_MAX_FIELD);
+	if (e->format == EMIT_BINARY) {
+		put_le(e, 0, 4); // patched by emit_end()
+		e->buf[e->len++] = len;
+		put(e, type, len);
+	} else {
+		put(e, "{\"type\":", 8);
+		put_json_string(e, type, len);
+	}
+}
+
+void emit_u64(struct emit *e, const char *key, u_int64_t value)
+{
+	if (!e)
+		return ;
+
+	if (reserve(e, EMIT_MAX_FIELD) < 0)
+		return ;
+	put_key(e, key, 'u');
+	if (e->format == EMIT_BINARY)
+		put_le(e, value, 8);
+	else
+		put_decimal(e, value);
+}
+
+void emit_str(struct emit *e, const char *key, const char *s, unsigned int len)
+{
+	if (!e)
+		return ;
+
+	// the value is never cut short; one which can not fit sets the error.
+	if (reserve(e, EMIT_MAX_FIELD + (unsigned long) len * 6) < 0)
+		return ;
+	put_key(e, key, 's');
+	if (e->format == EMIT_BINARY) {
+		put_le(e, len, 4);
+		put(e, s, len);
+	} else {
+		put_json_string(e, s, len);
+	}
+}
+
+void emit_end(struct emit *e)
+{
+	unsigned long len;
+
+	if (!e)
+		return ;
+
+	if (e->format == EMIT_BINARY) {
+		unsigned long end = e->len;
+
+		len = e->len - e->start - 4;
+		e->len = e->start;
+		put_le(e, len, 4);
+		e->len = end;
+	} else {
+		if (reserve(e, 2) < 0)
+			return ;
+		put(e, "}\n", 2);
+	}
+
+	e->start = e->len;
+	e->records++;
+}
+
+unsigned long emit_records(const struct emit *e)
+{
+	return e ? e->records : 0;
+}
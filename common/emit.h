@@ -0,0 +1,41 @@
+#ifndef __MIKOOS_EMIT_H
+#define __MIKOOS_EMIT_H 1
+
+#include <sys/types.h>
+
+// Buffered record writer for machine readable listings. Records are built
+// in memory and written out in large batches, so a listing costs about as
+// much as the parsing behind it. Every call accepts a NULL emitter and does
+// nothing, which is how output is switched off.
+//
+// EMIT_NDJSON writes one JSON object per line, {"type":"...",key:value,...}.
+// Name bytes outside printable ASCII are written as \u00XX so each line is
+// valid JSON whatever the file system holds.
+//
+// EMIT_BINARY starts with the 8 byte magic "MKEMIT1\n". Then each record is
+//   u32 length of the rest of the record
+//   u8 type length, type
+//   fields until the end of the record, each one
+//     u8 kind ('u' or 's'), u8 key length, key,
+//     'u': u64 value / 's': u32 length, bytes
+// All integers are little endian.
+
+enum {
+	EMIT_NDJSON,
+	EMIT_BINARY,
+};
+
+#define EMIT_BINARY_MAGIC "MKEMIT1\n"
+
+struct emit;
+
+int emit_parse_format(const char *name);
+struct emit *emit_open(const char *path, int format);
+int emit_close(struct emit *e);
+void emit_begin(struct emit *e, const char *type);
+void emit_u64(struct emit *e, const char *key, u_int64_t value);
+void emit_str(struct emit *e, const char *key, const char *s, unsigned int len);
+void emit_end(struct emit *e);
+unsigned long emit_records(const struct emit *e);
+
+#endif // __MIKOOS_EMIT_H
@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "frag.h"
+
+int frag_hist_bucket(u_int64_t value)
+{
+	int n = 0;
+
+	while (value && n < FRAG_HIST_BUCKETS - 1) {
+		value >>= 1;
+		n++;
+	}
+
+	return n;
+}
+
+void frag_file_init(struct frag_file *f, u_int64_t ino, u_int64_t size, u_int32_t block_size)
+{
+	memset(f, 0x0, sizeof(*f));
+	f->ino = ino;
+	f->size = size;
+	f->nr_blocks = (size + block_size - 1) / block_size;
+}
+
+// Add lblk .. lblk + len - 1 mapped to pblk onwards. Jumps between extents
+// also go to st->jump_hist when st is not NULL.
+void frag_file_add_run(struct frag_file *f, struct frag_stat *st, u_int64_t lblk, u_int64_t pblk, u_int64_t len)
+{
+	if (!len)
+		return ;
+
+	if (lblk > f->next_lblk) {
+		f->holes += lblk - f->next_lblk;
+		f->hole_runs++;
+	}
+
+	if (f->blocks) {
+		u_int64_t jump = pblk > f->last_pblk ? pblk - f->last_pblk : f->last_pblk - pblk;
+
+		f->distance += jump;
+		if (jump != 1 || lblk != f->next_lblk) {
+			f->extents++;
+			if (st)
+				st->jump_hist[frag_hist_bucket(jump)]++;
+		}
+	} else {
+		f->extents = 1;
+	}
+
+	// inside the run every step is one block.
+	f->distance += len - 1;
+	f->blocks += len;
+	f->next_lblk = lblk + len;
+	f->last_pblk = pblk + len - 1;
+}
+
+// Count the holes up to the end of the file.
+void frag_file_finish(struct frag_file *f)
+{
+	if (f->nr_blocks > f->next_lblk) {
+		f->holes += f->nr_blocks - f->next_lblk;
+		f->hole_runs++;
+		f->next_lblk = f->nr_blocks;
+	}
+}
+
+// 0 when the file is one extent, 1 when no two blocks are adjacent.
+double frag_file_ratio(const struct frag_file *f)
+{
+	if (f->blocks < 2)
+		return 0;
+
+	return (double) (f->extents - 1) / (f->blocks - 1);
+}
+
+// 1 for a contiguous file.
+double frag_file_avg_distance(const struct frag_file *f)
+{
+	if (f->blocks < 2)
+		return 0;
+
+	return (double) f->distance / (f->blocks - 1);
+}
+
+void frag_stat_add(struct frag_stat *st, const struct frag_file *f)
+{
+	st->files++;
+	if (f->extents > 1)
+		st->fragmented++;
+	if (f->holes)
+		st->sparse++;
+	st->blocks += f->blocks;
+	st->extents += f->extents;
+	st->holes += f->holes;
+	st->hole_runs += f->hole_runs;
+	st->distance += f->distance;
+	if (f->blocks > 1)
+		st->pairs += f->blocks - 1;
+
+	st->extents_hist[frag_hist_bucket(f->extents)]++;
+	st->holes_hist[frag_hist_bucket(f->holes)]++;
+	st->size_hist[frag_hist_bucket(f->nr_blocks)]++;
+}
+
+void frag_stat_merge(struct frag_stat *total, const struct frag_stat *st)
+{
+	int i;
+
+	total->files += st->files;
+	total->fragmented += st->fragmented;
+	total->sparse += st->sparse;
+	total->blocks += st->blocks;
+	total->extents += st->extents;
+	total->holes += st->holes;
+	total->hole_runs += st->hole_runs;
+	total->distance += st->distance;
+	total->pairs += st->pairs;
+
+	for (i = 0; i < FRAG_HIST_BUCKETS; i++) {
+		total->extents_hist[i] += st->extents_hist[i];
+		total->holes_hist[i] += st->holes_hist[i];
+		total->jump_hist[i] += st->jump_hist[i];
+		total->size_hist[i] += st->size_hist[i];
+	}
+}
+
+// Extent boundaries per pair of consecutive blocks, over every file.
+double frag_stat_ratio(const struct frag_stat *st)
+{
+	if (!st->pairs)
+		return 0;
+
+	// files without blocks have no extents.
+	return (double) (st->extents - (st->files - st->extents_hist[0])) / st->pairs;
+}
+
+double frag_stat_avg_distance(const struct frag_stat *st)
+{
+	if (!st->pairs)
+		return 0;
+
+	return (double) st->distance / st->pairs;
+}
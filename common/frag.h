@@ -0,0 +1,53 @@
+#ifndef __MIKOOS_FRAG_H
+#define __MIKOOS_FRAG_H 1
+
+#include <sys/types.h>
+
+// Fragmentation and holes of files, fed from a resolved block map. Blocks
+// are added in logical order; an extent is a run which is contiguous both
+// logically and physically, and a hole is a logical block with no block
+// behind it below the end of the file.
+
+#define FRAG_HIST_BUCKETS 33 // bucket 0 counts 0, bucket n counts [2^(n-1), 2^n)
+
+struct frag_file {
+	u_int64_t ino;
+	u_int64_t size;
+	u_int64_t nr_blocks; // logical blocks the size spans
+	u_int64_t blocks; // mapped data blocks
+	u_int64_t extents;
+	u_int64_t holes; // unmapped logical blocks
+	u_int64_t hole_runs;
+	u_int64_t distance; // sum of |pblk - previous pblk| over mapped blocks
+	u_int64_t next_lblk; // where the last run ended
+	u_int64_t last_pblk;
+};
+
+struct frag_stat {
+	u_int64_t files;
+	u_int64_t fragmented; // files with more than one extent
+	u_int64_t sparse; // files with holes
+	u_int64_t blocks;
+	u_int64_t extents;
+	u_int64_t holes;
+	u_int64_t hole_runs;
+	u_int64_t distance;
+	u_int64_t pairs; // consecutive mapped block pairs distance was summed over
+	u_int64_t extents_hist[FRAG_HIST_BUCKETS]; // extents per file
+	u_int64_t holes_hist[FRAG_HIST_BUCKETS]; // holes per file
+	u_int64_t jump_hist[FRAG_HIST_BUCKETS]; // distance of every jump between extents
+	u_int64_t size_hist[FRAG_HIST_BUCKETS]; // file size in blocks
+};
+
+void frag_file_init(struct frag_file *f, u_int64_t ino, u_int64_t size, u_int32_t block_size);
+void frag_file_add_run(struct frag_file *f, struct frag_stat *st, u_int64_t lblk, u_int64_t pblk, u_int64_t len);
+void frag_file_finish(struct frag_file *f);
+double frag_file_ratio(const struct frag_file *f);
+double frag_file_avg_distance(const struct frag_file *f);
+void frag_stat_add(struct frag_stat *st, const struct frag_file *f);
+void frag_stat_merge(struct frag_stat *total, const struct frag_stat *st);
+double frag_stat_ratio(const struct frag_stat *st);
+double frag_stat_avg_distance(const struct frag_stat *st);
+int frag_hist_bucket(u_int64_t value);
+
+#endif // __MIKOOS_FRAG_H
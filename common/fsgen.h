@@ -0,0 +1,354 @@
+// Directory, lookup, path and read engine shared by the file systems,
+// specialized for each of them at compile time. A file system defines its
+// traits and includes this file; every function below comes out static inline
+// with names made by FSGEN_NAME(), and the traits are macros, so they are
+// inlined into the loops and nothing is dispatched at run time. Functions a
+// file does not call are not emitted, so only the users of walk_readdir link
+// against treewalk.o. The file may be included more than once in a file with
+// different traits and names.
+//
+// Traits:
+//   FSGEN_NAME(x)                      name of the generated x
+//   FSGEN_FS                           file system handle, a pointer type
+//   FSGEN_INODE                        inode type
+//   FSGEN_BLOCK                        a block in use, given back with FSGEN_PUT_BLOCK
+//   FSGEN_BLOCK_SIZE(fs)               a constant when the format has one block size
+//   FSGEN_READ_INODE(fs, ino, inode)   0, or -1 if ino can not be read
+//   FSGEN_IS_DIR(inode)
+//   FSGEN_SIZE(inode)                  file size in bytes
+//   FSGEN_BMAP(fs, inode, lblk)        block holding logical block lblk, 0 for a hole
+//   FSGEN_GET_BLOCK(fs, block, type, b)  its data, or NULL
+//   FSGEN_PUT_BLOCK(fs, b)
+//   FSGEN_DENTRY(fs, data, offset, d)  decode the entry at offset of a directory
+//                                      block into d; returns its length or -1
+//   FSGEN_ENTRY_TYPE(fs, d)            file type of an entry the dentry did not type
+//   FSGEN_FT_UNKNOWN, FSGEN_FT_DIR     file type values of the format
+// Optional:
+//   FSGEN_PREFETCH(fs, blocks, nr)     ask for directory blocks before they are read,
+//   FSGEN_CAN_PREFETCH(fs)             when this is true
+//   FSGEN_LOOKUP(fs, dir, name, len, type)  a faster lookup for FSGEN_NAME(namei)
+
+#ifndef __MIKOOS_FSGEN_H
+#define __MIKOOS_FSGEN_H 1
+
+#include <string.h>
+#include <sys/types.h>
+#include "bcache.h"
+#include "dcache.h"
+#include "treewalk.h"
+#include "instr.h"
+
+struct fsgen_dentry {
+	u_int32_t ino; // 0 for a removed entry
+	const char *name; // not '\0' terminated, valid while the block is held
+	unsigned int name_len;
+	int type; // FSGEN_FT_UNKNOWN if the entry does not say
+};
+
+// directory blocks asked for at once by FSGEN_PREFETCH.
+#define FSGEN_DIR_PREFETCH 32
+
+static inline int fsgen_is_dot(const char *name, unsigned int len)
+{
+	return (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+#endif // __MIKOOS_FSGEN_H
+
+// Without traits only the types above are wanted.
+#ifdef FSGEN_NAME
+
+// A directory being read entry by entry. One block is held at a time.
+struct FSGEN_NAME(dir) {
+	FSGEN_FS fs;
+	const FSGEN_INODE *inode;
+	u_int64_t size;
+	u_int32_t nr_blocks;
+	u_int32_t lblk; // block being read, or the next one if data is NULL
+	u_int32_t offset;
+	u_int32_t limit; // end of the entries in this block
+	u_int32_t prefetched; // blocks up to here were asked for
+	const unsigned char *data;
+	FSGEN_BLOCK b;
+	unsigned long errors; // broken blocks, which are skipped
+};
+
+static inline void FSGEN_NAME(dir_open)(struct FSGEN_NAME(dir) *it, FSGEN_FS fs, const FSGEN_INODE *inode)
+{
+	memset(it, 0x0, sizeof(*it));
+	it->fs = fs;
+	it->inode = inode;
+	it->size = FSGEN_SIZE(inode);
+	it->nr_blocks = (it->size + FSGEN_BLOCK_SIZE(fs) - 1) / FSGEN_BLOCK_SIZE(fs);
+#ifdef FSGEN_PREFETCH
+	// nothing to map ahead if it would not be used.
+	if (!FSGEN_CAN_PREFETCH(fs))
+		it->prefetched = it->nr_blocks;
+#endif
+}
+
+static inline void FSGEN_NAME(dir_release)(struct FSGEN_NAME(dir) *it)
+{
+	if (it->data) {
+		FSGEN_PUT_BLOCK(it->fs, &it->b);
+		it->data = NULL;
+	}
+	it->lblk++;
+}
+
+#ifdef FSGEN_PREFETCH
+static inline void FSGEN_NAME(dir_prefetch)(struct FSGEN_NAME(dir) *it)
+{
+	u_int64_t blocks[FSGEN_DIR_PREFETCH];
+	u_int32_t lblk;
+	int nr = 0;
+
+	for (lblk = it->lblk; lblk < it->nr_blocks && lblk < it->lblk + FSGEN_DIR_PREFETCH; lblk++) {
+		u_int32_t block = FSGEN_BMAP(it->fs, it->inode, lblk);
+
+		if (block)
+			blocks[nr++] = block;
+	}
+	it->prefetched = lblk;
+	if (nr > 1)
+		FSGEN_PREFETCH(it->fs, blocks, nr);
+}
+#endif
+
+// Next entry in on-disk order, removed ones skipped. Returns 1, or 0 at the end.
+static inline int FSGEN_NAME(dir_next)(struct FSGEN_NAME(dir) *it, struct fsgen_dentry *d)
+{
+	const u_int32_t bs = FSGEN_BLOCK_SIZE(it->fs);
+
+	for (;;) {
+		int len;
+
+		if (!it->data) {
+			u_int32_t block;
+
+			if (it->lblk >= it->nr_blocks)
+				return 0;
+#ifdef FSGEN_PREFETCH
+			if (it->lblk >= it->prefetched)
+				FSGEN_NAME(dir_prefetch)(it);
+#endif
+			block = FSGEN_BMAP(it->fs, it->inode, it->lblk);
+			if (!block) {
+				it->lblk++;
+				continue;
+			}
+			it->data = FSGEN_GET_BLOCK(it->fs, block, BCACHE_DIR, &it->b);
+			if (!it->data) {
+				it->errors++;
+				it->lblk++;
+				continue;
+			}
+			it->offset = 0;
+			it->limit = it->size - (u_int64_t) it->lblk * bs < bs ? it->size - (u_int64_t) it->lblk * bs : bs;
+		}
+
+		if (it->offset >= it->limit) {
+			FSGEN_NAME(dir_release)(it);
+			continue;
+		}
+
+		len = FSGEN_DENTRY(it->fs, it->data, it->offset, d);
+		if (len < 0) {
+			it->errors++;
+			FSGEN_NAME(dir_release)(it);
+			continue;
+		}
+		it->offset += len;
+
+		if (d->ino) {
+			INSTR_ADD(INSTR_DENTRIES, 1);
+			return 1;
+		}
+	}
+}
+
+static inline void FSGEN_NAME(dir_close)(struct FSGEN_NAME(dir) *it)
+{
+	if (it->data)
+		FSGEN_PUT_BLOCK(it->fs, &it->b);
+	it->data = NULL;
+}
+
+// Scan directory dir for name. Returns its inode number or 0; *type gets the
+// file type the entry carries.
+static inline u_int32_t FSGEN_NAME(lookup)(FSGEN_FS fs, const FSGEN_INODE *dir,
+					   const char *name, unsigned int len, int *type)
+{
+	struct FSGEN_NAME(dir) it;
+	struct fsgen_dentry d;
+	u_int32_t ino = 0;
+
+	FSGEN_NAME(dir_open)(&it, fs, dir);
+	while (FSGEN_NAME(dir_next)(&it, &d)) {
+		if (d.name_len == len && !memcmp(d.name, name, len)) {
+			ino = d.ino;
+			if (type)
+				*type = d.type;
+			break;
+		}
+	}
+	FSGEN_NAME(dir_close)(&it);
+
+	return ino;
+}
+
+static inline u_int32_t FSGEN_NAME(lookup_ino)(FSGEN_FS fs, u_int32_t dir_ino, const char *name, unsigned int len)
+{
+	FSGEN_INODE dir;
+
+	if (FSGEN_READ_INODE(fs, dir_ino, &dir) < 0 || !FSGEN_IS_DIR(&dir))
+		return 0;
+
+#ifdef FSGEN_LOOKUP
+	return FSGEN_LOOKUP(fs, &dir, name, len, NULL);
+#else
+	return FSGEN_NAME(lookup)(fs, &dir, name, len, NULL);
+#endif
+}
+
+static inline u_int32_t FSGEN_NAME(namei_walk)(FSGEN_FS fs, u_int32_t root, const char *path,
+					       unsigned int max_name, struct dcache *dcache)
+{
+	const char *name;
+	const char *next;
+	u_int32_t ino = root;
+	u_int32_t child;
+	int len;
+
+	while ((len = path_next_component(path, &name, &next)) > 0) {
+		if (len > max_name)
+			return 0;
+
+		if (!dcache) {
+			child = FSGEN_NAME(lookup_ino)(fs, ino, name, len);
+		} else {
+			switch (dcache_lookup(dcache, ino, name, len, &child)) {
+			case DCACHE_HIT:
+				break;
+			case DCACHE_NEGATIVE:
+				return 0;
+			default:
+				child = FSGEN_NAME(lookup_ino)(fs, ino, name, len);
+				dcache_insert(dcache, ino, name, len, child);
+				break;
+			}
+		}
+
+		if (!child)
+			return 0;
+
+		ino = child;
+		path = next;
+	}
+
+	return ino;
+}
+
+// Resolve an absolute path from directory root one component at a time.
+// Returns the inode number or 0. With a dcache every component result is
+// kept there, misses too.
+static inline u_int32_t FSGEN_NAME(namei)(FSGEN_FS fs, u_int32_t root, const char *path,
+					  unsigned int max_name, struct dcache *dcache)
+{
+	INSTR_START(t);
+	u_int32_t ino = FSGEN_NAME(namei_walk)(fs, root, path, max_name, dcache);
+
+	INSTR_END(INSTR_LOOKUP, t);
+	INSTR_ADD(INSTR_LOOKUP_MISSES, !ino);
+
+	return ino;
+}
+
+// treewalk_readdir_fn: hand every entry of dir but "." and ".." to the walker.
+static inline int FSGEN_NAME(walk_readdir)(void *arg, u_int64_t dir, struct treewalk_ctx *ctx)
+{
+	FSGEN_FS fs = arg;
+	FSGEN_INODE inode;
+	struct FSGEN_NAME(dir) it;
+	struct fsgen_dentry d;
+
+	if (FSGEN_READ_INODE(fs, dir, &inode) < 0 || !FSGEN_IS_DIR(&inode))
+		return -1;
+
+	FSGEN_NAME(dir_open)(&it, fs, &inode);
+	while (FSGEN_NAME(dir_next)(&it, &d)) {
+		int type;
+
+		if (fsgen_is_dot(d.name, d.name_len))
+			continue;
+
+		type = d.type == FSGEN_FT_UNKNOWN ? FSGEN_ENTRY_TYPE(fs, &d) : d.type;
+		treewalk_add(ctx, d.ino, d.name, d.name_len, type, type == FSGEN_FT_DIR);
+	}
+	FSGEN_NAME(dir_close)(&it);
+
+	return it.errors ? -1 : 0;
+}
+
+// Copy up to len bytes from pos of the file. Holes read as zeros. Returns the
+// number of bytes copied, 0 at the end of file or -1 if a block is unreadable.
+static inline long FSGEN_NAME(read)(FSGEN_FS fs, const FSGEN_INODE *inode, u_int64_t pos,
+				    void *buf, unsigned long len)
+{
+	const u_int32_t bs = FSGEN_BLOCK_SIZE(fs);
+	u_int64_t size = FSGEN_SIZE(inode);
+	unsigned char *dst = buf;
+	unsigned long done = 0;
+
+	if (pos >= size)
+		return 0;
+	if (len > size - pos)
+		len = size - pos;
+
+	while (done < len) {
+		u_int32_t off = pos % bs;
+		u_int32_t block = FSGEN_BMAP(fs, inode, pos / bs);
+		unsigned long n = bs - off;
+
+		if (n > len - done)
+			n = len - done;
+
+		if (block) {
+			FSGEN_BLOCK b;
+			const unsigned char *data = FSGEN_GET_BLOCK(fs, block, BCACHE_DATA, &b);
+
+			if (!data)
+				return done ? done : -1;
+			memcpy(dst + done, data + off, n);
+			FSGEN_PUT_BLOCK(fs, &b);
+		} else {
+			memset(dst + done, 0x0, n);
+		}
+
+		done += n;
+		pos += n;
+	}
+
+	return done;
+}
+
+#endif // FSGEN_NAME
+
+#undef FSGEN_NAME
+#undef FSGEN_FS
+#undef FSGEN_INODE
+#undef FSGEN_BLOCK
+#undef FSGEN_BLOCK_SIZE
+#undef FSGEN_READ_INODE
+#undef FSGEN_IS_DIR
+#undef FSGEN_SIZE
+#undef FSGEN_BMAP
+#undef FSGEN_GET_BLOCK
+#undef FSGEN_PUT_BLOCK
+#undef FSGEN_DENTRY
+#undef FSGEN_ENTRY_TYPE
+#undef FSGEN_FT_UNKNOWN
+#undef FSGEN_FT_DIR
+#undef FSGEN_PREFETCH
+#undef FSGEN_CAN_PREFETCH
+#undef FSGEN_LOOKUP
@@ -0,0 +1,243 @@
+#include <string.h>
+
+#include "hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HASH_X86 1
+#endif
+
+#define STRIPE 64
+#define LANES 8
+#define STRIPES_PER_BLOCK (HASH_BLOCK / STRIPE)
+#define SCRAMBLE_KEY STRIPES_PER_BLOCK // stripe n uses key[n .. n + 7]
+
+#define PRIME32_1 0x9e3779b1U
+#define PRIME32_2 0x85ebca77U
+#define PRIME32_3 0xc2b2ae3dU
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+
+// splitmix64 output, so the keys have no structure.
+static const u_int64_t key[SCRAMBLE_KEY + LANES] = {
+	0x8d7c53aa9bdfc506ULL, 0xe3c67bd6949b097aULL, 0xa382f933e6dc1a76ULL,
+	0xbf333b08b5e7f517ULL, 0x94fb778cb2a8bbb5ULL, 0x52c00d229b8d7f71ULL,
+	0xa1c78c47625fd54aULL, 0x93a3c68d2890076eULL, 0x4deb3cbc2f176f03ULL,
+	0x0e78b17eb7eeb9aaULL, 0x393f98cd2e581799ULL, 0x9f1f1c0c7022723fULL,
+	0x213955df2bc9011cULL, 0x3912b2242153f9caULL, 0x754a3135e0ddd15dULL,
+	0x98dad97a970eea31ULL, 0x74be9d75a85e9982ULL, 0xfae5bf8ed545b88aULL,
+	0xfe914b7a43ea7a20ULL, 0xe9bced0a8bd2f284ULL, 0x2d732f794b87078fULL,
+	0x6393a0142444f5a7ULL, 0xe683d4b8387ec8d3ULL, 0x5ff0f9bfb2a0cb9bULL,
+};
+
+static inline u_int64_t load_le64(const unsigned char *p)
+{
+	return (u_int64_t) p[0] | (u_int64_t) p[1] << 8 | (u_int64_t) p[2] << 16 |
+		(u_int64_t) p[3] << 24 | (u_int64_t) p[4] << 32 | (u_int64_t) p[5] << 40 |
+		(u_int64_t) p[6] << 48 | (u_int64_t) p[7] << 56;
+}
+
+// Each lane gets its neighbour's input as is and the product of the two
+// halves of its own input mixed with the key.
+static void accumulate_scalar(u_int64_t *acc, const unsigned char *p, const u_int64_t *k)
+{
+	int i;
+
+	for (i = 0; i < LANES; i++) {
+		u_int64_t d = load_le64(p + i * 8);
+		u_int64_t dk = d ^ k[i];
+
+		acc[i ^ 1] += d;
+		acc[i] += (dk & 0xffffffff) * (dk >> 32);
+	}
+}
+
+static void scramble_scalar(u_int64_t *acc, const u_int64_t *k)
+{
+	int i;
+
+	for (i = 0; i < LANES; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= k[i];
+		acc[i] *= PRIME32_1;
+	}
+}
+
+static void blocks_scalar(u_int64_t *acc, const unsigned char *p, unsigned long nr)
+{
+	int s;
+
+	while (nr--) {
+		for (s = 0; s < STRIPES_PER_BLOCK; s++)
+			accumulate_scalar(acc, p + s * STRIPE, key + s);
+		scramble_scalar(acc, key + SCRAMBLE_KEY);
+		p += HASH_BLOCK;
+	}
+}
+
+#ifdef HASH_X86
+#ifdef __SSE2__
+static void blocks_sse2(u_int64_t *acc, const unsigned char *p, unsigned long nr)
+{
+	__m128i a[LANES / 2];
+	const __m128i prime = _mm_set1_epi32(PRIME32_1);
+	int s, j;
+
+	for (j = 0; j < LANES / 2; j++)
+		a[j] = _mm_loadu_si128((const __m128i *) (acc + j * 2));
+
+	while (nr--) {
+		for (s = 0; s < STRIPES_PER_BLOCK; s++) {
+			for (j = 0; j < LANES / 2; j++) {
+				__m128i d = _mm_loadu_si128((const __m128i *) (p + s * STRIPE + j * 16));
+				__m128i dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *) (key + s + j * 2)));
+				__m128i prod = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+
+				a[j] = _mm_add_epi64(a[j], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+				a[j] = _mm_add_epi64(a[j], prod);
+			}
+		}
+
+		for (j = 0; j < LANES / 2; j++) {
+			__m128i x = a[j];
+
+			x = _mm_xor_si128(x, _mm_srli_epi64(x, 47));
+			x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *) (key + SCRAMBLE_KEY + j * 2)));
+			a[j] = _mm_add_epi64(_mm_mul_epu32(x, prime),
+					     _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), prime), 32));
+		}
+		p += HASH_BLOCK;
+	}
+
+	for (j = 0; j < LANES / 2; j++)
+		_mm_storeu_si128((__m128i *) (acc + j * 2), a[j]);
+}
+#endif
+
+// Built whatever the compiler flags are and only called if the CPU says so.
+__attribute__((target("avx2")))
+static void blocks_avx2(u_int64_t *acc, const unsigned char *p, unsigned long nr)
+{
+	__m256i a[LANES / 4];
+	const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+	int s, j;
+
+	for (j = 0; j < LANES / 4; j++)
+		a[j] = _mm256_loadu_si256((const __m256i *) (acc + j * 4));
+
+	while (nr--) {
+		for (s = 0; s < STRIPES_PER_BLOCK; s++) {
+			for (j = 0; j < LANES / 4; j++) {
+				__m256i d = _mm256_loadu_si256((const __m256i *) (p + s * STRIPE + j * 32));
+				__m256i dk = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *) (key + s + j * 4)));
+				__m256i prod = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+
+				a[j] = _mm256_add_epi64(a[j], _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+				a[j] = _mm256_add_epi64(a[j], prod);
+			}
+		}
+
+		for (j = 0; j < LANES / 4; j++) {
+			__m256i x = a[j];
+
+			x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 47));
+			x = _mm256_xor_si256(x, _mm256_loadu_si256((const __m256i *) (key + SCRAMBLE_KEY + j * 4)));
+			a[j] = _mm256_add_epi64(_mm256_mul_epu32(x, prime),
+						_mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime), 32));
+		}
+		p += HASH_BLOCK;
+	}
+
+	for (j = 0; j < LANES / 4; j++)
+		_mm256_storeu_si256((__m256i *) (acc + j * 4), a[j]);
+}
+#endif
+
+typedef void (*blocks_fn)(u_int64_t *acc, const unsigned char *p, unsigned long nr);
+
+static blocks_fn blocks;
+static const char *blocks_name;
+
+static void pick_impl(void)
+{
+	blocks_fn fn = blocks_scalar;
+	const char *name = "scalar";
+
+#ifdef HASH_X86
+#ifdef __SSE2__
+	fn = blocks_sse2;
+	name = "sse2";
+#endif
+	if (__builtin_cpu_supports("avx2")) {
+		fn = blocks_avx2;
+		name = "avx2";
+	}
+#endif
+
+	// every thread picks the same, so racing here is harmless.
+	__atomic_store_n(&blocks_name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&blocks, fn, __ATOMIC_RELEASE);
+}
+
+static inline u_int64_t mul128_fold64(u_int64_t a, u_int64_t b)
+{
+	unsigned __int128 r = (unsigned __int128) a * b;
+
+	return (u_int64_t) r ^ (u_int64_t) (r >> 64);
+}
+
+u_int64_t hash64(const void *data, unsigned long len, u_int64_t seed)
+{
+	const unsigned char *p = data;
+	u_int64_t acc[LANES] = {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+	};
+	unsigned char last[STRIPE];
+	blocks_fn fn = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+	unsigned long rest;
+	u_int64_t r;
+	int s, i;
+
+	if (!fn) {
+		pick_impl();
+		fn = blocks;
+	}
+
+	acc[0] ^= seed;
+	acc[1] += seed;
+
+	fn(acc, p, len / HASH_BLOCK);
+	p += len - len % HASH_BLOCK;
+	rest = len % HASH_BLOCK;
+
+	// whole stripes left, then the last one padded with zeros.
+	for (s = 0; rest >= STRIPE; s++, rest -= STRIPE, p += STRIPE)
+		accumulate_scalar(acc, p, key + s);
+	if (rest) {
+		memset(last, 0x0, sizeof(last));
+		memcpy(last, p, rest);
+		accumulate_scalar(acc, last, key + s);
+	}
+
+	r = len * PRIME64_1 ^ seed;
+	for (i = 0; i < LANES; i += 2)
+		r += mul128_fold64(acc[i] ^ key[i + 1], acc[i + 1] ^ key[i + 2]);
+
+	r ^= r >> 37;
+	r *= PRIME64_3;
+	r ^= r >> 32;
+
+	return r;
+}
+
+const char *hash64_impl(void)
+{
+	if (!__atomic_load_n(&blocks, __ATOMIC_ACQUIRE))
+		pick_impl();
+
+	return __atomic_load_n(&blocks_name, __ATOMIC_RELAXED);
+}
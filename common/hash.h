@@ -0,0 +1,20 @@
+#ifndef __MIKOOS_HASH_H
+#define __MIKOOS_HASH_H 1
+
+#include <sys/types.h>
+
+// 64 bit content hash in the style of XXH3: eight 64 bit lanes take 64 byte
+// stripes, each lane adds the 32x32 bit product of its key-mixed input, and
+// the lanes are scrambled every 1K. Not XXH3 compatible and not
+// cryptographic; good for finding equal blocks, which should be compared
+// byte by byte before anything is thrown away.
+//
+// The lanes run in AVX2 or SSE2 registers when the CPU has them; every
+// implementation gives the same value.
+
+#define HASH_BLOCK 1024 // input consumed between two scrambles
+
+u_int64_t hash64(const void *data, unsigned long len, u_int64_t seed);
+const char *hash64_impl(void);
+
+#endif // __MIKOOS_HASH_H
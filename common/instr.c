@@ -0,0 +1,389 @@
+#ifdef MIKOOS_INSTR
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "instr.h"
+
+#define SUB_BITS 4 // 16 buckets per power of two
+#define NR_BUCKETS ((64 - SUB_BITS + 1) << SUB_BITS)
+
+// ticks per ns are measured over at least this long before a dump.
+#define CALIBRATE_NS 10000000
+
+struct hist {
+	u_int64_t count;
+	u_int64_t sum;
+	u_int64_t max;
+	u_int64_t buckets[NR_BUCKETS];
+};
+
+struct span {
+	const char *name;
+	u_int64_t id;
+	u_int64_t start;
+	u_int64_t end;
+};
+
+// Only the owning thread writes these; a dump may read them at any time,
+// so writes are atomic stores and the reads atomic loads.
+struct instr_thread {
+	int tid;
+	u_int64_t counters[INSTR_NR_COUNTERS];
+	struct hist hists[INSTR_NR_POINTS];
+	struct span *spans; // read only at exit
+	unsigned long nr_spans;
+	unsigned long spans_cap;
+	struct instr_thread *next;
+};
+
+static const char * const point_names[INSTR_NR_POINTS] = {
+	[INSTR_BLOCK_GET] = "block_get",
+	[INSTR_INODE_READ] = "inode_read",
+	[INSTR_DIRBLOCK_PARSE] = "dirblock_parse",
+	[INSTR_LOOKUP] = "lookup",
+	[INSTR_FILE_READ] = "file_read",
+};
+
+static const char * const counter_names[INSTR_NR_COUNTERS] = {
+	[INSTR_DENTRIES] = "dentries",
+	[INSTR_LOOKUP_MISSES] = "lookup_misses",
+	[INSTR_READ_BYTES] = "read_bytes",
+};
+
+static __thread struct instr_thread *self;
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct instr_thread *threads;
+static int nr_threads;
+
+static int json;
+static int quiet;
+static const char *out_path;
+static const char *trace_path;
+static u_int64_t start_ticks;
+static u_int64_t start_ns;
+
+static u_int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u_int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct instr_thread *attach(void)
+{
+	struct instr_thread *t = calloc(1, sizeof(*t));
+
+	assert(t != NULL);
+
+	pthread_mutex_lock(&threads_lock);
+	t->tid = ++nr_threads;
+	t->next = threads;
+	threads = t;
+	pthread_mutex_unlock(&threads_lock);
+
+	self = t;
+
+	return t;
+}
+
+static inline void add(u_int64_t *p, u_int64_t n)
+{
+	__atomic_store_n(p, *p + n, __ATOMIC_RELAXED);
+}
+
+static int bucket_of(u_int64_t v)
+{
+	int e;
+
+	if (v < (1 << SUB_BITS))
+		return v;
+
+	e = 63 - __builtin_clzll(v);
+
+	return ((e - SUB_BITS + 1) << SUB_BITS) + ((v >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+}
+
+// The largest value counted in bucket b.
+static u_int64_t bucket_top(int b)
+{
+	int e = (b >> SUB_BITS) + SUB_BITS - 1;
+
+	if (b < (1 << SUB_BITS))
+		return b;
+
+	return ((u_int64_t) ((1 << SUB_BITS) + (b & ((1 << SUB_BITS) - 1)) + 1) << (e - SUB_BITS)) - 1;
+}
+
+void instr_record(int point, u_int64_t ticks)
+{
+	struct instr_thread *t = self ? self : attach();
+	struct hist *h = t->hists + point;
+
+	add(&h->count, 1);
+	add(&h->sum, ticks);
+	add(&h->buckets[bucket_of(ticks)], 1);
+	if (ticks > h->max)
+		__atomic_store_n(&h->max, ticks, __ATOMIC_RELAXED);
+}
+
+void instr_add(int counter, u_int64_t n)
+{
+	struct instr_thread *t = self ? self : attach();
+
+	add(&t->counters[counter], n);
+}
+
+void instr_span(const char *name, u_int64_t id, u_int64_t start, u_int64_t end)
+{
+	struct instr_thread *t;
+
+	if (!trace_path)
+		return ;
+
+	t = self ? self : attach();
+	if (t->nr_spans == t->spans_cap) {
+		t->spans_cap = t->spans_cap ? t->spans_cap * 2 : 256;
+		t->spans = realloc(t->spans, t->spans_cap * sizeof(*t->spans));
+		assert(t->spans != NULL);
+	}
+	t->spans[t->nr_spans++] = (struct span) { name, id, start, end };
+}
+
+// ns per tick, from the ticks and ns gone by since instr_setup().
+static double ns_per_tick(void)
+{
+	u_int64_t ns;
+	u_int64_t ticks;
+
+	// short runs wait a little, or the ratio would be mostly noise.
+	while ((ns = now_ns() - start_ns) < CALIBRATE_NS)
+		;
+	ticks = instr_ticks() - start_ticks;
+
+	return ticks ? (double) ns / ticks : 1.0;
+}
+
+static u_int64_t load(const u_int64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+// Sum of every thread. Returns the number of threads.
+static int merge(struct hist *hists, u_int64_t *counters)
+{
+	struct instr_thread *t;
+	int i, j, n = 0;
+
+	memset(hists, 0x0, sizeof(*hists) * INSTR_NR_POINTS);
+	memset(counters, 0x0, sizeof(*counters) * INSTR_NR_COUNTERS);
+
+	pthread_mutex_lock(&threads_lock);
+	for (t = threads; t; t = t->next, n++) {
+		for (i = 0; i < INSTR_NR_COUNTERS; i++)
+			counters[i] += load(t->counters + i);
+		for (i = 0; i < INSTR_NR_POINTS; i++) {
+			const struct hist *src = t->hists + i;
+			struct hist *h = hists + i;
+
+			h->count += load(&src->count);
+			h->sum += load(&src->sum);
+			if (load(&src->max) > h->max)
+				h->max = load(&src->max);
+			for (j = 0; j < NR_BUCKETS; j++)
+				h->buckets[j] += load(src->buckets + j);
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	return n;
+}
+
+// Ticks at or below which q of the samples are. Buckets are summed as
+// read, so a histogram still being written may not quite add up to count.
+static u_int64_t percentile(const struct hist *h, double q)
+{
+	// the rank of the sample, rounded up: p99.9 of 10 samples is the 10th.
+	u_int64_t want = q * h->count;
+	u_int64_t seen = 0;
+	int b;
+
+	if (want < q * h->count || want < 1)
+		want++;
+	for (b = 0; b < NR_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= want)
+			return bucket_top(b) < h->max ? bucket_top(b) : h->max;
+	}
+
+	return h->max;
+}
+
+static void dump_text(FILE *fp, const struct hist *hists, const u_int64_t *counters, int n,
+		      double scale, double secs)
+{
+	int i;
+
+	fprintf(fp, "instr: %d threads, %.3f s, latencies in ns\n", n, secs);
+	fprintf(fp, "%-16s %12s %10s %10s %10s %10s %10s %12s\n",
+		"point", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < INSTR_NR_POINTS; i++) {
+		const struct hist *h = hists + i;
+
+		if (!h->count)
+			continue;
+		fprintf(fp, "%-16s %12llu %10.1f %10.0f %10.0f %10.0f %10.0f %12.0f\n",
+			point_names[i], (unsigned long long) h->count, h->sum * scale / h->count,
+			percentile(h, 0.5) * scale, percentile(h, 0.9) * scale,
+			percentile(h, 0.99) * scale, percentile(h, 0.999) * scale, h->max * scale);
+	}
+	fprintf(fp, "counters:");
+	for (i = 0; i < INSTR_NR_COUNTERS; i++)
+		fprintf(fp, " %s %llu", counter_names[i], (unsigned long long) counters[i]);
+	fprintf(fp, "\n");
+}
+
+static void dump_json(FILE *fp, const struct hist *hists, const u_int64_t *counters, int n,
+		      double scale, double secs)
+{
+	int i;
+
+	fprintf(fp, "{\"type\":\"instr\",\"threads\":%d,\"seconds\":%.6f,\"points\":{", n, secs);
+	for (i = 0; i < INSTR_NR_POINTS; i++) {
+		const struct hist *h = hists + i;
+
+		fprintf(fp, "%s\"%s\":{\"count\":%llu", i ? "," : "", point_names[i],
+			(unsigned long long) h->count);
+		if (h->count)
+			fprintf(fp, ",\"mean_ns\":%.1f,\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p99_ns\":%.0f,"
+				"\"p999_ns\":%.0f,\"max_ns\":%.0f",
+				h->sum * scale / h->count, percentile(h, 0.5) * scale,
+				percentile(h, 0.9) * scale, percentile(h, 0.99) * scale,
+				percentile(h, 0.999) * scale, h->max * scale);
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "},\"counters\":{");
+	for (i = 0; i < INSTR_NR_COUNTERS; i++)
+		fprintf(fp, "%s\"%s\":%llu", i ? "," : "", counter_names[i],
+			(unsigned long long) counters[i]);
+	fprintf(fp, "}}\n");
+}
+
+void instr_dump(void)
+{
+	static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+	struct hist *hists;
+	u_int64_t counters[INSTR_NR_COUNTERS];
+	double scale;
+	FILE *fp = stderr;
+	int n;
+
+	if (quiet)
+		return ;
+
+	hists = malloc(sizeof(*hists) * INSTR_NR_POINTS);
+	assert(hists != NULL);
+
+	pthread_mutex_lock(&dump_lock);
+	scale = ns_per_tick();
+	n = merge(hists, counters);
+	if (out_path && !(fp = fopen(out_path, "a")))
+		fp = stderr;
+	if (json)
+		dump_json(fp, hists, counters, n, scale, (now_ns() - start_ns) / 1e9);
+	else
+		dump_text(fp, hists, counters, n, scale, (now_ns() - start_ns) / 1e9);
+	if (fp != stderr)
+		fclose(fp);
+	else
+		fflush(fp);
+	pthread_mutex_unlock(&dump_lock);
+
+	free(hists);
+}
+
+// Chrome trace event format, one complete event per span, times in us.
+static void write_trace(void)
+{
+	struct instr_thread *t;
+	double scale = ns_per_tick();
+	unsigned long i;
+	int first = 1;
+	FILE *fp;
+
+	fp = fopen(trace_path, "w");
+	if (!fp) {
+		fprintf(stderr, "can not open %s\n", trace_path);
+		return ;
+	}
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+	pthread_mutex_lock(&threads_lock);
+	for (t = threads; t; t = t->next) {
+		for (i = 0; i < t->nr_spans; i++) {
+			const struct span *s = t->spans + i;
+
+			fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%llu}}",
+				first ? "" : ",\n", s->name, t->tid,
+				(s->start - start_ticks) * scale / 1e3, (s->end - s->start) * scale / 1e3,
+				(unsigned long long) s->id);
+			first = 0;
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+}
+
+static void instr_exit(void)
+{
+	instr_dump();
+	if (trace_path)
+		write_trace();
+}
+
+static void *signal_main(void *arg)
+{
+	sigset_t *set = arg;
+	int sig;
+
+	while (!sigwait(set, &sig))
+		instr_dump();
+
+	return NULL;
+}
+
+void instr_setup(void)
+{
+	static sigset_t set;
+	const char *format = getenv("MIKOOS_INSTR");
+	pthread_t thread;
+
+	start_ns = now_ns();
+	start_ticks = instr_ticks();
+
+	json = format && !strcmp(format, "json");
+	quiet = format && !strcmp(format, "off");
+	out_path = getenv("MIKOOS_INSTR_OUT");
+	trace_path = getenv("MIKOOS_INSTR_TRACE");
+
+	// threads started later inherit the mask, so only this one takes it.
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	if (!pthread_create(&thread, NULL, signal_main, &set))
+		pthread_detach(thread);
+
+	atexit(instr_exit);
+}
+
+#endif // MIKOOS_INSTR
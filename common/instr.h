@@ -0,0 +1,80 @@
+#ifndef __MIKOOS_INSTR_H
+#define __MIKOOS_INSTR_H 1
+
+#include <sys/types.h>
+
+// Counters and latency histograms of the hot paths. Built in with
+// make INSTR=1, which defines MIKOOS_INSTR; otherwise every macro below is
+// empty and instr.c compiles to nothing.
+//
+// Each thread records into slots of its own, so a sample is a few adds
+// with no lock and no shared cache line. Latencies are kept in cycle
+// counter ticks, in log-linear buckets like an HDR histogram: 16 buckets
+// per power of two, so a value is within 1/16 of the bucket it is counted
+// in. Ticks are turned into ns when the histograms are dumped.
+//
+// instr_setup() at the start of main reads the environment:
+//   MIKOOS_INSTR=text|json|off   dump format, text if unset
+//   MIKOOS_INSTR_OUT=file        dumps are appended there instead of stderr
+//   MIKOOS_INSTR_TRACE=file      Chrome trace of the per block group tasks,
+//                                written at exit
+// It dumps at exit and on every SIGUSR1. Call it before any thread is
+// started: SIGUSR1 is blocked in all of them and waited for by its own.
+
+enum instr_point {
+	INSTR_BLOCK_GET = 0, // one block, from the cache, the disk or the image
+	INSTR_INODE_READ, // one inode decoded
+	INSTR_DIRBLOCK_PARSE, // one call of a directory block parser, up to two blocks
+	INSTR_LOOKUP, // one whole path resolved
+	INSTR_FILE_READ, // one read call on an open file
+	INSTR_NR_POINTS,
+};
+
+enum instr_counter {
+	INSTR_DENTRIES = 0, // live directory entries parsed
+	INSTR_LOOKUP_MISSES, // paths which were not found
+	INSTR_READ_BYTES, // copied by file reads
+	INSTR_NR_COUNTERS,
+};
+
+#ifdef MIKOOS_INSTR
+
+#include <time.h>
+
+static inline u_int64_t instr_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u_int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void instr_setup(void);
+void instr_record(int point, u_int64_t ticks);
+void instr_add(int counter, u_int64_t n);
+void instr_span(const char *name, u_int64_t id, u_int64_t start, u_int64_t end);
+void instr_dump(void);
+
+#define INSTR_START(t) u_int64_t t = instr_ticks()
+#define INSTR_END(point, t) instr_record(point, instr_ticks() - (t))
+#define INSTR_ADD(counter, n) instr_add(counter, n)
+#define INSTR_SPAN(name, id, t) instr_span(name, id, t, instr_ticks())
+
+#else
+
+#define instr_setup() do { } while (0)
+#define instr_dump() do { } while (0)
+
+#define INSTR_START(t) do { } while (0)
+#define INSTR_END(point, t) do { } while (0)
+#define INSTR_ADD(counter, n) do { } while (0)
+#define INSTR_SPAN(name, id, t) do { } while (0)
+
+#endif // MIKOOS_INSTR
+
+#endif // __MIKOOS_INSTR_H
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mkimg.h"
+
+// The image being built, and where it goes once it is complete.
+static char *tmp_path;
+static const char *final_path;
+
+void mkimg_rng_init(struct mkimg_rng *rng, u_int64_t seed)
+{
+	rng->state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+u_int64_t mkimg_rand(struct mkimg_rng *rng)
+{
+	u_int64_t x = rng->state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->state = x;
+
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+int mkimg_chance(struct mkimg_rng *rng, unsigned int percent)
+{
+	return percent && mkimg_rand(rng) % 100 < percent;
+}
+
+int mkimg_alloc_init(struct mkimg_alloc *a, u_int64_t base, u_int64_t nbits)
+{
+	memset(a, 0x0, sizeof(*a));
+
+	// whole 64 bit words so the search can skip full ones.
+	a->map = calloc((nbits + 63) / 64, 8);
+	if (!a->map)
+		return -1;
+
+	a->base = base;
+	a->nbits = nbits;
+	a->nr_free = nbits;
+
+	return 0;
+}
+
+void mkimg_alloc_free(struct mkimg_alloc *a)
+{
+	free(a->map);
+	a->map = NULL;
+}
+
+static int test_bit(const struct mkimg_alloc *a, u_int64_t n)
+{
+	return a->map[n / 8] & (1 << (n % 8));
+}
+
+// First clear bit at or after n, or nbits.
+static u_int64_t find_free(const struct mkimg_alloc *a, u_int64_t n)
+{
+	while (n < a->nbits) {
+		u_int64_t word;
+
+		if (!(n % 64)) {
+			memcpy(&word, a->map + n / 8, sizeof(word));
+			if (word == ~0ULL) {
+				n += 64;
+				continue;
+			}
+		}
+
+		if (!test_bit(a, n))
+			break;
+		n++;
+	}
+
+	return n < a->nbits ? n : a->nbits;
+}
+
+// Take block out of the free space, e.g. because metadata lives there.
+void mkimg_alloc_mark(struct mkimg_alloc *a, u_int64_t block)
+{
+	u_int64_t n = block - a->base;
+
+	if (block < a->base || n >= a->nbits || test_bit(a, n))
+		return ;
+
+	a->map[n / 8] |= 1 << (n % 8);
+	a->nr_free--;
+	if (n == a->first_free)
+		a->first_free = find_free(a, n + 1);
+}
+
+// Continue allocating from block, or from the first free one after it.
+void mkimg_alloc_seek(struct mkimg_alloc *a, u_int64_t block)
+{
+	a->cursor = block > a->base ? block - a->base : 0;
+}
+
+// Returns the next free block after the cursor, wrapping around once, or 0
+// if the image is full. Block 0 always holds metadata so it is never handed out.
+u_int32_t mkimg_alloc_block(struct mkimg_alloc *a)
+{
+	u_int64_t n;
+
+	if (!a->nr_free)
+		return 0;
+
+	if (a->rng && mkimg_chance(a->rng, a->gap_percent))
+		a->cursor += 1 + mkimg_rand(a->rng) % 8;
+
+	n = find_free(a, a->cursor > a->first_free ? a->cursor : a->first_free);
+	if (n == a->nbits)
+		n = find_free(a, a->first_free);
+	if (n == a->nbits)
+		return 0;
+
+	mkimg_alloc_mark(a, a->base + n);
+	a->cursor = n + 1;
+
+	return a->base + n;
+}
+
+int mkimg_bmap_init(struct mkimg_bmap *m, int fd, u_int32_t block_size, int nr_direct, struct mkimg_alloc *alloc)
+{
+	int i;
+
+	memset(m, 0x0, sizeof(*m));
+	if (nr_direct + 3 > MKIMG_MAX_ZONES)
+		return -1;
+
+	m->fd = fd;
+	m->block_size = block_size;
+	m->nr_direct = nr_direct;
+	m->alloc = alloc;
+
+	for (i = 0; i < 3; i++) {
+		m->ind[i] = malloc(block_size);
+		if (!m->ind[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+// Write out the open indirect blocks from level on.
+static int flush_indirect(struct mkimg_bmap *m, int level)
+{
+	int ret = 0;
+
+	for (; level < 3; level++) {
+		if (!m->ind_block[level])
+			continue;
+		if (mkimg_write(m->fd, m->ind[level], m->block_size, (u_int64_t) m->ind_block[level] * m->block_size) < 0)
+			ret = -1;
+		m->ind_block[level] = 0;
+	}
+
+	return ret;
+}
+
+// Allocate the data block of logical block lblk, plus whatever indirect
+// blocks lead to it. Logical blocks may be skipped to leave holes.
+// Returns the data block, or 0 if the image is full or lblk is out of reach.
+u_int32_t mkimg_bmap_add(struct mkimg_bmap *m, u_int64_t lblk)
+{
+	u_int64_t per_block = m->block_size / sizeof(u_int32_t);
+	u_int64_t span[4];
+	u_int64_t n = lblk;
+	u_int32_t block;
+	int depth, root, level;
+
+	if (n < m->nr_direct) {
+		block = mkimg_alloc_block(m->alloc);
+		if (block) {
+			m->zone[n] = block;
+			m->nr_blocks++;
+		}
+		return block;
+	}
+
+	// span[l] is how many data blocks one entry of a level l block covers.
+	n -= m->nr_direct;
+	for (depth = 1; ; depth++) {
+		u_int64_t cover = 1;
+
+		for (level = 0; level < depth; level++)
+			cover *= per_block;
+		if (n < cover)
+			break;
+		if (depth == 3)
+			return 0;
+		n -= cover;
+	}
+	span[depth - 1] = 1;
+	for (level = depth - 2; level >= 0; level--)
+		span[level] = span[level + 1] * per_block;
+	root = m->nr_direct + depth - 1;
+
+	for (level = 0; level < depth; level++) {
+		// which block of this level n falls in, unique per root.
+		u_int64_t key = ((u_int64_t) root << 56) | (n / (span[level] * per_block));
+
+		if (m->ind_block[level] && m->ind_key[level] == key)
+			continue;
+
+		if (flush_indirect(m, level) < 0)
+			return 0;
+		block = mkimg_alloc_block(m->alloc);
+		if (!block)
+			return 0;
+		m->nr_blocks++;
+
+		memset(m->ind[level], 0x0, m->block_size);
+		m->ind_block[level] = block;
+		m->ind_key[level] = key;
+		if (level)
+			m->ind[level - 1][(n / span[level - 1]) % per_block] = block;
+		else
+			m->zone[root] = block;
+	}
+
+	block = mkimg_alloc_block(m->alloc);
+	if (!block)
+		return 0;
+	m->nr_blocks++;
+	m->ind[depth - 1][n % per_block] = block;
+
+	return block;
+}
+
+int mkimg_bmap_finish(struct mkimg_bmap *m)
+{
+	int ret = flush_indirect(m, 0);
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		free(m->ind[i]);
+		m->ind[i] = NULL;
+	}
+
+	return ret;
+}
+
+int mkimg_write(int fd, const void *buf, unsigned long len, u_int64_t offset)
+{
+	const unsigned char *p = buf;
+
+	while (len) {
+		ssize_t ret = pwrite(fd, p, len, offset);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		p += ret;
+		len -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+// Open <path>.tmp for a new image. It only replaces path in mkimg_commit(),
+// so a generator which gives up half way leaves nothing at path.
+int mkimg_create(const char *path)
+{
+	int fd;
+
+	tmp_path = malloc(strlen(path) + 5);
+	if (!tmp_path)
+		return -1;
+	sprintf(tmp_path, "%s.tmp", path);
+	final_path = path;
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(tmp_path);
+		tmp_path = NULL;
+	}
+
+	return fd;
+}
+
+// Sync and close the image and move it to its path.
+int mkimg_commit(int fd)
+{
+	int ret = 0;
+
+	if (fsync(fd) < 0)
+		ret = -1;
+	if (close(fd) < 0)
+		ret = -1;
+	if (ret < 0 || rename(tmp_path, final_path) < 0) {
+		mkimg_discard();
+		return -1;
+	}
+
+	free(tmp_path);
+	tmp_path = NULL;
+
+	return 0;
+}
+
+// Remove the unfinished image, if there is one.
+void mkimg_discard(void)
+{
+	if (!tmp_path)
+		return ;
+
+	unlink(tmp_path);
+	free(tmp_path);
+	tmp_path = NULL;
+}
+
+// Deterministic file contents: the same seed always gives the same bytes.
+void mkimg_fill(void *buf, unsigned long len, u_int64_t seed)
+{
+	struct mkimg_rng rng;
+	unsigned char *p = buf;
+
+	mkimg_rng_init(&rng, seed);
+	while (len >= 8) {
+		u_int64_t x = mkimg_rand(&rng);
+
+		memcpy(p, &x, 8);
+		p += 8;
+		len -= 8;
+	}
+	memset(p, 0x0, len);
+}
+
+// "4096", "4K", "10G" and so on.
+int mkimg_parse_size(const char *s, u_int64_t *size)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (errno || end == s)
+		return -1;
+
+	switch (*end) {
+	case 'k': case 'K':
+		v <<= 10;
+		end++;
+		break;
+	case 'm': case 'M':
+		v <<= 20;
+		end++;
+		break;
+	case 'g': case 'G':
+		v <<= 30;
+		end++;
+		break;
+	case 't': case 'T':
+		v <<= 40;
+		end++;
+		break;
+	}
+
+	if (*end)
+		return -1;
+	*size = v;
+
+	return 0;
+}
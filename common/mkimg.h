@@ -0,0 +1,63 @@
+#ifndef __MIKOOS_MKIMG_H
+#define __MIKOOS_MKIMG_H 1
+
+#include <sys/types.h>
+
+// Helpers shared by the image generators. Images are written sparse with
+// pwrite, so only metadata (and file data if asked for) takes disk space.
+
+#define MKIMG_MAX_ZONES 15 // direct zones plus single, double and triple indirect
+
+// xorshift64*, seeded so the same options give the same image.
+struct mkimg_rng {
+	u_int64_t state;
+};
+
+// Allocation bitmap of one image. Bit n stands for block base + n.
+struct mkimg_alloc {
+	unsigned char *map;
+	u_int64_t nbits;
+	u_int64_t base;
+	u_int64_t cursor; // next bit to try
+	u_int64_t first_free; // every bit below is in use
+	u_int64_t nr_free;
+	unsigned int gap_percent; // chance of leaving a gap before an allocation
+	struct mkimg_rng *rng;
+};
+
+// Streams the block map of one file: blocks are allocated in logical order,
+// each indirect block right before the first block it points to.
+struct mkimg_bmap {
+	int fd;
+	u_int32_t block_size;
+	int nr_direct;
+	struct mkimg_alloc *alloc;
+	u_int32_t zone[MKIMG_MAX_ZONES];
+	u_int32_t *ind[3]; // open indirect block of each level
+	u_int32_t ind_block[3];
+	u_int64_t ind_key[3];
+	u_int64_t nr_blocks; // data and indirect blocks allocated
+};
+
+void mkimg_rng_init(struct mkimg_rng *rng, u_int64_t seed);
+u_int64_t mkimg_rand(struct mkimg_rng *rng);
+int mkimg_chance(struct mkimg_rng *rng, unsigned int percent);
+
+int mkimg_alloc_init(struct mkimg_alloc *a, u_int64_t base, u_int64_t nbits);
+void mkimg_alloc_free(struct mkimg_alloc *a);
+void mkimg_alloc_mark(struct mkimg_alloc *a, u_int64_t block);
+void mkimg_alloc_seek(struct mkimg_alloc *a, u_int64_t block);
+u_int32_t mkimg_alloc_block(struct mkimg_alloc *a);
+
+int mkimg_bmap_init(struct mkimg_bmap *m, int fd, u_int32_t block_size, int nr_direct, struct mkimg_alloc *alloc);
+u_int32_t mkimg_bmap_add(struct mkimg_bmap *m, u_int64_t lblk);
+int mkimg_bmap_finish(struct mkimg_bmap *m);
+
+int mkimg_create(const char *path);
+int mkimg_commit(int fd);
+void mkimg_discard(void);
+int mkimg_write(int fd, const void *buf, unsigned long len, u_int64_t offset);
+void mkimg_fill(void *buf, unsigned long len, u_int64_t seed);
+int mkimg_parse_size(const char *s, u_int64_t *size);
+
+#endif // __MIKOOS_MKIMG_H
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "readahead.h"
+
+// Tell the kernel that [offset, offset + len) of the mapped image is going to
+// be read soon, so the pages are read in before they are touched.
+void image_willneed(const unsigned char *image, unsigned long size, u_int64_t offset, u_int64_t len)
+{
+	static unsigned long cached_page_size;
+	unsigned long page_size = __atomic_load_n(&cached_page_size, __ATOMIC_RELAXED);
+	u_int64_t start;
+
+	// called from many threads; they all store the same value.
+	if (!page_size) {
+		page_size = sysconf(_SC_PAGESIZE);
+		__atomic_store_n(&cached_page_size, page_size, __ATOMIC_RELAXED);
+	}
+
+	if (offset >= size || len == 0)
+		return ;
+	if (len > size - offset)
+		len = size - offset;
+
+	// madvise() wants a page aligned start; the image itself is page aligned.
+	start = offset & ~((u_int64_t) page_size - 1);
+	madvise((void *) (image + start), len + (offset - start), MADV_WILLNEED);
+}
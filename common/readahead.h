@@ -0,0 +1,8 @@
+#ifndef __MIKOOS_READAHEAD_H
+#define __MIKOOS_READAHEAD_H 1
+
+#include <sys/types.h>
+
+void image_willneed(const unsigned char *image, unsigned long size, u_int64_t offset, u_int64_t len);
+
+#endif // __MIKOOS_READAHEAD_H
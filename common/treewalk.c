@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <time.h>
+
+#include "treewalk.h"
+#include "wsdeque.h"
+#include "workpool.h"
+
+// A directory waiting on a deque or being read. In ordered mode it also
+// keeps its entries until the replay, so the tree is built in memory.
+struct tw_dir {
+	u_int64_t ino;
+	unsigned int depth;
+	struct tw_rec *recs;
+	unsigned long nr_recs;
+	unsigned long recs_cap;
+	char *names;
+	unsigned long names_len;
+	unsigned long names_cap;
+};
+
+struct tw_rec {
+	u_int64_t ino;
+	unsigned long name_off;
+	unsigned int name_len;
+	unsigned int type;
+	int is_dir;
+	struct tw_dir *child; // NULL unless this walk descends into it
+};
+
+struct tw_state {
+	const struct treewalk *w;
+	int flags;
+	treewalk_fn fn;
+	void *arg;
+	unsigned char *visited; // directories already queued, by inode number
+	struct treewalk_ctx **runners;
+	int nr_runners;
+	long pending; // directories queued or being read
+	struct tw_dir *root;
+	int root_failed;
+};
+
+struct treewalk_ctx {
+	struct tw_state *s;
+	struct wsdeque dq;
+	struct tw_dir *cur;
+	u_int64_t rng;
+	struct treewalk_stat st;
+};
+
+static void *grow(void *p, unsigned long *cap, unsigned long need, size_t size)
+{
+	if (need <= *cap)
+		return p;
+
+	*cap = *cap ? *cap * 2 : 16;
+	if (*cap < need)
+		*cap = need;
+	p = realloc(p, *cap * size);
+	assert(p != NULL);
+
+	return p;
+}
+
+static struct tw_dir *dir_alloc(u_int64_t ino, unsigned int depth)
+{
+	struct tw_dir *d = calloc(1, sizeof(*d));
+
+	assert(d != NULL);
+	d->ino = ino;
+	d->depth = depth;
+
+	return d;
+}
+
+static void dir_free(struct tw_dir *d)
+{
+	free(d->recs);
+	free(d->names);
+	free(d);
+}
+
+// Atomically mark ino, returns the old bit.
+static int test_and_set_visited(struct tw_state *s, u_int64_t ino)
+{
+	unsigned char bit = 1 << (ino & 7);
+
+	return __atomic_fetch_or(&s->visited[ino >> 3], bit, __ATOMIC_RELAXED) & bit;
+}
+
+static void queue_dir(struct treewalk_ctx *ctx, struct tw_dir *d)
+{
+	__atomic_add_fetch(&ctx->s->pending, 1, __ATOMIC_RELAXED);
+	wsdeque_push(&ctx->dq, d);
+}
+
+void treewalk_add(struct treewalk_ctx *ctx, u_int64_t ino, const char *name,
+		  unsigned int name_len, unsigned int type, int is_dir)
+{
+	struct tw_state *s = ctx->s;
+	struct tw_dir *d = ctx->cur;
+	struct tw_dir *child = NULL;
+
+	if (ino == 0 || ino > s->w->max_ino) {
+		ctx->st.errors++;
+		return ;
+	}
+	ctx->st.entries++;
+
+	// a directory with more than one name is only entered once.
+	if (is_dir && !test_and_set_visited(s, ino))
+		child = dir_alloc(ino, d->depth + 1);
+
+	if (s->flags & TREEWALK_ORDERED) {
+		struct tw_rec *r;
+
+		d->recs = grow(d->recs, &d->recs_cap, d->nr_recs + 1, sizeof(*d->recs));
+		d->names = grow(d->names, &d->names_cap, d->names_len + name_len, 1);
+		r = d->recs + d->nr_recs++;
+		r->ino = ino;
+		r->name_off = d->names_len;
+		r->name_len = name_len;
+		r->type = type;
+		r->is_dir = is_dir;
+		r->child = child;
+		memcpy(d->names + d->names_len, name, name_len);
+		d->names_len += name_len;
+	} else if (s->fn) {
+		struct treewalk_entry e = {
+			.dir = d->ino,
+			.ino = ino,
+			.name = name,
+			.name_len = name_len,
+			.depth = d->depth,
+			.type = type,
+			.is_dir = is_dir,
+		};
+
+		s->fn(s->arg, &e);
+	}
+
+	if (child)
+		queue_dir(ctx, child);
+}
+
+static void read_dir(struct treewalk_ctx *ctx, struct tw_dir *d)
+{
+	struct tw_state *s = ctx->s;
+
+	ctx->cur = d;
+	ctx->st.dirs++;
+	if (s->w->readdir(s->w->fs, d->ino, ctx) < 0) {
+		ctx->st.errors++;
+		if (d == s->root)
+			s->root_failed = 1;
+	}
+	ctx->cur = NULL;
+
+	if (!(s->flags & TREEWALK_ORDERED))
+		dir_free(d);
+
+	// subdirectories were counted before this one is dropped, so pending
+	// only reaches zero when the whole tree was read.
+	__atomic_sub_fetch(&s->pending, 1, __ATOMIC_RELEASE);
+}
+
+static u_int64_t next_rand(struct treewalk_ctx *ctx)
+{
+	ctx->rng ^= ctx->rng >> 12;
+	ctx->rng ^= ctx->rng << 25;
+	ctx->rng ^= ctx->rng >> 27;
+
+	return ctx->rng * 0x2545F4914F6CDD1DULL;
+}
+
+// Try every other runner once, starting at a random one.
+static struct tw_dir *steal(struct treewalk_ctx *ctx)
+{
+	struct tw_state *s = ctx->s;
+	int n = s->nr_runners;
+	int start = next_rand(ctx) % n;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct treewalk_ctx *victim = s->runners[(start + i) % n];
+		struct tw_dir *d;
+
+		if (victim == ctx || !wsdeque_size(&victim->dq))
+			continue;
+
+		d = wsdeque_steal(&victim->dq);
+		if (d) {
+			ctx->st.steals++;
+			return d;
+		}
+	}
+
+	return NULL;
+}
+
+// Spin briefly, then sleep, while other runners may still produce work.
+static void backoff(unsigned int idle)
+{
+	struct timespec ts = { 0, 50 * 1000 };
+
+	if (idle < 64)
+		sched_yield();
+	else
+		nanosleep(&ts, NULL);
+}
+
+static void runner(void *arg, unsigned long index)
+{
+	struct tw_state *s = arg;
+	struct treewalk_ctx *ctx = s->runners[index];
+	unsigned int idle = 0;
+
+	while (1) {
+		struct tw_dir *d = wsdeque_pop(&ctx->dq);
+
+		if (!d)
+			d = steal(ctx);
+
+		if (d) {
+			read_dir(ctx, d);
+			idle = 0;
+			continue;
+		}
+
+		if (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE) == 0)
+			break;
+		backoff(idle++);
+	}
+}
+
+// Hand the saved tree to the callback depth first, freeing it on the way.
+// An explicit stack keeps deep trees off the C stack.
+static void replay(struct tw_state *s)
+{
+	struct frame {
+		struct tw_dir *d;
+		unsigned long next;
+	} *stack = NULL;
+	unsigned long cap = 0;
+	unsigned long sp = 0;
+
+	stack = grow(stack, &cap, 1, sizeof(*stack));
+	stack[sp].d = s->root;
+	stack[sp++].next = 0;
+
+	while (sp) {
+		struct tw_dir *d = stack[sp - 1].d;
+		struct tw_rec *r;
+
+		if (stack[sp - 1].next == d->nr_recs) {
+			dir_free(d);
+			sp--;
+			continue;
+		}
+		r = d->recs + stack[sp - 1].next++;
+
+		if (s->fn) {
+			struct treewalk_entry e = {
+				.dir = d->ino,
+				.ino = r->ino,
+				.name = d->names + r->name_off,
+				.name_len = r->name_len,
+				.depth = d->depth,
+				.type = r->type,
+				.is_dir = r->is_dir,
+			};
+
+			s->fn(s->arg, &e);
+		}
+
+		if (r->child) {
+			stack = grow(stack, &cap, sp + 1, sizeof(*stack));
+			stack[sp].d = r->child;
+			stack[sp++].next = 0;
+		}
+	}
+
+	free(stack);
+}
+
+// Walk the tree below w->root with every thread of the pool plus the caller.
+// Returns -1 when the root directory itself could not be read.
+int treewalk_run(const struct treewalk *w, struct workpool *pool, int flags,
+		 treewalk_fn fn, void *arg, struct treewalk_stat *st)
+{
+	struct tw_state s;
+	int i;
+
+	memset(&s, 0x0, sizeof(s));
+	memset(st, 0x0, sizeof(*st));
+
+	if (w->root == 0 || w->root > w->max_ino)
+		return -1;
+
+	s.w = w;
+	s.flags = flags;
+	s.fn = fn;
+	s.arg = arg;
+	s.visited = calloc(w->max_ino / 8 + 1, 1);
+	assert(s.visited != NULL);
+
+	s.nr_runners = workpool_nr_threads(pool) + 1;
+	s.runners = calloc(s.nr_runners, sizeof(*s.runners));
+	assert(s.runners != NULL);
+	for (i = 0; i < s.nr_runners; i++) {
+		// separate allocations keep the hot counters of runners apart.
+		s.runners[i] = calloc(1, sizeof(*s.runners[i]));
+		assert(s.runners[i] != NULL);
+		s.runners[i]->s = &s;
+		s.runners[i]->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+		wsdeque_init(&s.runners[i]->dq, 256);
+	}
+
+	s.root = dir_alloc(w->root, 0);
+	test_and_set_visited(&s, w->root);
+	queue_dir(s.runners[0], s.root);
+
+	workpool_for_each(pool, s.nr_runners, runner, &s);
+
+	if (flags & TREEWALK_ORDERED)
+		replay(&s);
+
+	for (i = 0; i < s.nr_runners; i++) {
+		struct treewalk_ctx *ctx = s.runners[i];
+
+		st->dirs += ctx->st.dirs;
+		st->entries += ctx->st.entries;
+		st->errors += ctx->st.errors;
+		st->steals += ctx->st.steals;
+		wsdeque_destroy(&ctx->dq);
+		free(ctx);
+	}
+	st->runners = s.nr_runners;
+
+	free(s.runners);
+	free(s.visited);
+
+	return s.root_failed ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+#ifndef __MIKOOS_TREEWALK_H
+#define __MIKOOS_TREEWALK_H 1
+
+#include <sys/types.h>
+
+// Parallel recursive walk of a directory tree. Every runner owns a work
+// stealing deque of directories still to be read; a runner reads its own
+// directories newest first and steals the oldest ones of other runners when
+// it runs dry. The file system only has to supply a readdir function.
+
+struct workpool;
+struct treewalk_ctx;
+
+struct treewalk_entry {
+	u_int64_t dir; // inode of the directory holding the entry
+	u_int64_t ino;
+	const char *name; // not '\0' terminated
+	unsigned int name_len;
+	unsigned int depth; // 0 for entries of the root directory
+	unsigned int type; // file type in the file system's own encoding
+	int is_dir;
+};
+
+// Called for every directory. It hands each entry except "." and ".." to
+// treewalk_add() and returns -1 when the directory could not be read.
+// Runs on any runner, so it has to be thread safe.
+typedef int (*treewalk_readdir_fn)(void *fs, u_int64_t dir, struct treewalk_ctx *ctx);
+
+// Without TREEWALK_ORDERED this is called from all runners at the same time
+// and e->name is only valid during the call.
+typedef void (*treewalk_fn)(void *arg, const struct treewalk_entry *e);
+
+struct treewalk {
+	void *fs;
+	treewalk_readdir_fn readdir;
+	u_int64_t root;
+	u_int64_t max_ino; // inode numbers run from 1 to max_ino
+};
+
+// Report the entries single threaded in depth first pre-order, each
+// directory's entries in on-disk order, once the whole tree was read.
+// The order does not depend on the number of threads or on timing.
+#define TREEWALK_ORDERED 0x1
+
+struct treewalk_stat {
+	unsigned long dirs; // directories read
+	unsigned long entries;
+	unsigned long errors; // unreadable directories or bad inode numbers
+	unsigned long steals;
+	int runners;
+};
+
+void treewalk_add(struct treewalk_ctx *ctx, u_int64_t ino, const char *name,
+		  unsigned int name_len, unsigned int type, int is_dir);
+int treewalk_run(const struct treewalk *w, struct workpool *pool, int flags,
+		 treewalk_fn fn, void *arg, struct treewalk_stat *st);
+
+#endif // __MIKOOS_TREEWALK_H
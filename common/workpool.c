@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "workpool.h"
+
+struct work {
+	workpool_fn fn;
+	void *arg;
+	struct work *next;
+};
+
+struct workpool {
+	pthread_t *threads;
+	int nr_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup; // a task was queued or the pool is shutting down
+	pthread_cond_t idle; // no task is queued or running
+	struct work *head;
+	struct work *tail;
+	unsigned long busy; // queued + running tasks
+	int shutdown;
+};
+
+// State of one workpool_for_each() call. The caller and every runner task
+// hold a reference because runners may start after the caller returned.
+struct range {
+	workpool_range_fn fn;
+	void *arg;
+	unsigned long count;
+	unsigned long next;
+	unsigned long done;
+	int refs;
+	pthread_mutex_t lock;
+	pthread_cond_t finished;
+};
+
+static void *worker_main(void *arg)
+{
+	struct workpool *pool = arg;
+	struct work *w;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->head && !pool->shutdown)
+			pthread_cond_wait(&pool->wakeup, &pool->lock);
+
+		if (!pool->head)
+			break;
+
+		w = pool->head;
+		pool->head = w->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		w->fn(w->arg);
+		free(w);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+int workpool_default_threads(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+struct workpool *workpool_create(int nr_threads)
+{
+	struct workpool *pool;
+	int i;
+
+	if (nr_threads <= 0)
+		nr_threads = workpool_default_threads();
+
+	pool = calloc(1, sizeof(*pool));
+	assert(pool != NULL);
+
+	pool->threads = calloc(nr_threads, sizeof(*pool->threads));
+	assert(pool->threads != NULL);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wakeup, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(pool->threads + i, NULL, worker_main, pool))
+			break;
+	}
+	assert(i > 0);
+	pool->nr_threads = i;
+
+	return pool;
+}
+
+void workpool_destroy(struct workpool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->wakeup);
+	pthread_mutex_unlock(&pool->lock);
+
+	// workers drain the queue before they exit.
+	for (i = 0; i < pool->nr_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->wakeup);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+int workpool_nr_threads(const struct workpool *pool)
+{
+	return pool->nr_threads;
+}
+
+void workpool_submit(struct workpool *pool, workpool_fn fn, void *arg)
+{
+	struct work *w;
+
+	w = malloc(sizeof(*w));
+	assert(w != NULL);
+
+	w->fn = fn;
+	w->arg = arg;
+	w->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = w;
+	else
+		pool->head = w;
+	pool->tail = w;
+	pool->busy++;
+	pthread_cond_signal(&pool->wakeup);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Wait until every submitted task has finished.
+void workpool_wait(struct workpool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void range_put(struct range *r)
+{
+	int last;
+
+	pthread_mutex_lock(&r->lock);
+	last = (--r->refs == 0);
+	pthread_mutex_unlock(&r->lock);
+
+	if (last) {
+		pthread_cond_destroy(&r->finished);
+		pthread_mutex_destroy(&r->lock);
+		free(r);
+	}
+}
+
+static void range_run(struct range *r)
+{
+	unsigned long i;
+	unsigned long n = 0;
+
+	while ((i = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED)) < r->count) {
+		r->fn(r->arg, i);
+		n++;
+	}
+
+	if (n) {
+		pthread_mutex_lock(&r->lock);
+		r->done += n;
+		if (r->done == r->count)
+			pthread_cond_broadcast(&r->finished);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+static void range_task(void *arg)
+{
+	struct range *r = arg;
+
+	range_run(r);
+	range_put(r);
+}
+
+// Run fn(arg, 0) ... fn(arg, count - 1) on the pool and wait for them.
+// The caller takes part in the work, so this may be called from a task.
+void workpool_for_each(struct workpool *pool, unsigned long count, workpool_range_fn fn, void *arg)
+{
+	struct range *r;
+	unsigned long runners;
+	unsigned long i;
+
+	if (count == 0)
+		return ;
+
+	runners = count - 1;
+	if (runners > (unsigned long) pool->nr_threads)
+		runners = pool->nr_threads;
+
+	r = calloc(1, sizeof(*r));
+	assert(r != NULL);
+
+	r->fn = fn;
+	r->arg = arg;
+	r->count = count;
+	r->refs = runners + 1;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->finished, NULL);
+
+	for (i = 0; i < runners; i++)
+		workpool_submit(pool, range_task, r);
+
+	range_run(r);
+
+	pthread_mutex_lock(&r->lock);
+	while (r->done < r->count)
+		pthread_cond_wait(&r->finished, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+
+	range_put(r);
+}
@@ -0,0 +1,19 @@
+#ifndef __MIKOOS_WORKPOOL_H
+#define __MIKOOS_WORKPOOL_H 1
+
+// Fixed size pool of worker threads which run submitted tasks in FIFO order.
+
+struct workpool;
+
+typedef void (*workpool_fn)(void *arg);
+typedef void (*workpool_range_fn)(void *arg, unsigned long index);
+
+struct workpool *workpool_create(int nr_threads);
+void workpool_destroy(struct workpool *pool);
+int workpool_nr_threads(const struct workpool *pool);
+void workpool_submit(struct workpool *pool, workpool_fn fn, void *arg);
+void workpool_wait(struct workpool *pool);
+void workpool_for_each(struct workpool *pool, unsigned long count, workpool_range_fn fn, void *arg);
+int workpool_default_threads(void);
+
+#endif // __MIKOOS_WORKPOOL_H
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "wsdeque.h"
+
+// "Dynamic Circular Work-Stealing Deque", Chase and Lev, with the memory
+// orderings of Le et al. "Correct and Efficient Work-Stealing for Weak
+// Memory Models".
+
+struct wsdeque_array {
+	unsigned long mask;
+	struct wsdeque_array *next; // on the retired list
+	void *slot[];
+};
+
+static struct wsdeque_array *array_alloc(unsigned long size)
+{
+	struct wsdeque_array *a = malloc(sizeof(*a) + size * sizeof(void *));
+
+	assert(a != NULL);
+	a->mask = size - 1;
+	a->next = NULL;
+
+	return a;
+}
+
+static void *array_get(struct wsdeque_array *a, long i)
+{
+	return __atomic_load_n(&a->slot[i & a->mask], __ATOMIC_RELAXED);
+}
+
+static void array_put(struct wsdeque_array *a, long i, void *p)
+{
+	__atomic_store_n(&a->slot[i & a->mask], p, __ATOMIC_RELAXED);
+}
+
+void wsdeque_init(struct wsdeque *q, unsigned long size)
+{
+	unsigned long n = 16;
+
+	while (n < size)
+		n <<= 1;
+
+	q->top = 0;
+	q->bottom = 0;
+	q->array = array_alloc(n);
+	q->retired = NULL;
+}
+
+void wsdeque_destroy(struct wsdeque *q)
+{
+	while (q->retired) {
+		struct wsdeque_array *a = q->retired;
+
+		q->retired = a->next;
+		free(a);
+	}
+	free(q->array);
+	q->array = NULL;
+}
+
+// Owner only. The old array stays around until wsdeque_destroy() because a
+// thief may have loaded it just before it was replaced.
+static struct wsdeque_array *grow(struct wsdeque *q, struct wsdeque_array *a, long top, long bottom)
+{
+	struct wsdeque_array *n = array_alloc((a->mask + 1) * 2);
+	long i;
+
+	for (i = top; i < bottom; i++)
+		array_put(n, i, array_get(a, i));
+
+	a->next = q->retired;
+	q->retired = a;
+	__atomic_store_n(&q->array, n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+void wsdeque_push(struct wsdeque *q, void *p)
+{
+	long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+	struct wsdeque_array *a = __atomic_load_n(&q->array, __ATOMIC_RELAXED);
+
+	if (b - t > (long) a->mask)
+		a = grow(q, a, t, b);
+
+	array_put(a, b, p);
+	// pairs with the acquire load of bottom in wsdeque_steal().
+	__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+void *wsdeque_pop(struct wsdeque *q)
+{
+	long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+	struct wsdeque_array *a = __atomic_load_n(&q->array, __ATOMIC_RELAXED);
+	long t;
+	void *p;
+
+	__atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+	if (t > b) {
+		// empty
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	p = array_get(a, b);
+	if (t == b) {
+		// the last one, race the thieves for it.
+		if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+						 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			p = NULL;
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+
+	return p;
+}
+
+// Returns NULL when empty or when another thread won the race.
+void *wsdeque_steal(struct wsdeque *q)
+{
+	long t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+	long b;
+	struct wsdeque_array *a;
+	void *p;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return NULL;
+
+	a = __atomic_load_n(&q->array, __ATOMIC_ACQUIRE);
+	p = array_get(a, t);
+	if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+
+	return p;
+}
+
+// A snapshot, only good as a hint when other threads are running.
+long wsdeque_size(struct wsdeque *q)
+{
+	long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+	return b > t ? b - t : 0;
+}
@@ -0,0 +1,24 @@
+#ifndef __MIKOOS_WSDEQUE_H
+#define __MIKOOS_WSDEQUE_H 1
+
+// Chase-Lev work stealing deque of pointers.
+// Only the owning thread may push and pop, at the bottom. Any other thread
+// may steal from the top. NULL can't be stored; it means empty.
+
+struct wsdeque_array;
+
+struct wsdeque {
+	long top;
+	long bottom;
+	struct wsdeque_array *array;
+	struct wsdeque_array *retired; // outgrown arrays, thieves may still read them
+};
+
+void wsdeque_init(struct wsdeque *q, unsigned long size);
+void wsdeque_destroy(struct wsdeque *q);
+void wsdeque_push(struct wsdeque *q, void *p);
+void *wsdeque_pop(struct wsdeque *q);
+void *wsdeque_steal(struct wsdeque *q);
+long wsdeque_size(struct wsdeque *q);
+
+#endif // __MIKOOS_WSDEQUE_H
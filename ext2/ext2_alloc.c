@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_alloc.h"
+#include "bitmap.h"
+
+static void set_bits(unsigned char *map, u_int32_t start, u_int32_t len)
+{
+	u_int32_t n;
+
+	for (n = start; n < start + len; n++)
+		map[n / 8] |= 1 << (n % 8);
+}
+
+static void clear_bits(unsigned char *map, u_int32_t start, u_int32_t len)
+{
+	u_int32_t n;
+
+	for (n = start; n < start + len; n++)
+		map[n / 8] &= ~(1 << (n % 8));
+}
+
+// Counters are only changed under the group lock, but other writers read
+// them without it to choose a group.
+static u_int32_t load_count(const u_int32_t *count)
+{
+	return __atomic_load_n(count, __ATOMIC_RELAXED);
+}
+
+static void add_count(u_int32_t *count, int n)
+{
+	__atomic_store_n(count, *count + n, __ATOMIC_RELAXED);
+}
+
+// The free counters are recounted from the bitmaps, so stale descriptors
+// do not matter. The image must stay mapped until ext2_alloc_destroy().
+int ext2_alloc_init(struct ext2_alloc *a, const struct ext2_fs *fs, unsigned char *image)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	u_int32_t g;
+
+	memset(a, 0x0, sizeof(*a));
+	if (!fs->group_count || sb->s_inodes_per_group > fs->block_size * 8)
+		return -1;
+
+	a->image = image;
+	a->block_size = fs->block_size;
+	a->first_data_block = sb->s_first_data_block;
+	a->blocks_per_group = sb->s_blocks_per_group;
+	a->group_count = fs->group_count;
+	a->inodes_per_group = sb->s_inodes_per_group;
+	a->first_ino = EXT2_GOOD_OLD_FIRST_INO;
+	a->prealloc_blocks = a->prealloc_dir_blocks = EXT2_DEFAULT_PREALLOC_BLOCKS;
+	if (sb->s_rev_level != EXT2_GOOD_OLD_REV) {
+		a->first_ino = sb->s_first_ino;
+		if (sb->s_prealloc_blocks)
+			a->prealloc_blocks = sb->s_prealloc_blocks;
+		if (sb->s_prealloc_dir_blocks)
+			a->prealloc_dir_blocks = sb->s_prealloc_dir_blocks;
+	}
+
+	if (posix_memalign((void **) &a->groups, 64, a->group_count * sizeof(*a->groups)))
+		return -1;
+	memset(a->groups, 0x0, a->group_count * sizeof(*a->groups));
+
+	for (g = 0; g < a->group_count; g++) {
+		const struct ext2_blockgroup *bg = fs->groups + g;
+		struct ext2_alloc_group *gr = a->groups + g;
+
+		gr->first_block = a->first_data_block + g * a->blocks_per_group;
+		gr->nr_blocks = ext2_group_nr_blocks(fs, g);
+		if (!bg->bg_block_bitmap || !bg->bg_inode_bitmap ||
+		    bg->bg_block_bitmap >= sb->s_blocks_count || bg->bg_inode_bitmap >= sb->s_blocks_count ||
+		    ((u_int64_t) bg->bg_block_bitmap + 1) * a->block_size > fs->size ||
+		    ((u_int64_t) bg->bg_inode_bitmap + 1) * a->block_size > fs->size ||
+		    gr->nr_blocks > a->block_size * 8) {
+			free(a->groups);
+			a->groups = NULL;
+			return -1;
+		}
+
+		pthread_mutex_init(&gr->lock, NULL);
+		gr->block_bitmap = image + (u_int64_t) bg->bg_block_bitmap * a->block_size;
+		gr->inode_bitmap = image + (u_int64_t) bg->bg_inode_bitmap * a->block_size;
+		gr->free_blocks = gr->nr_blocks - bitmap_count_used(gr->block_bitmap, gr->nr_blocks);
+		gr->free_inodes = a->inodes_per_group - bitmap_count_used(gr->inode_bitmap, a->inodes_per_group);
+		gr->used_dirs = bg->bg_used_dirs_count;
+	}
+
+	return 0;
+}
+
+void ext2_alloc_destroy(struct ext2_alloc *a)
+{
+	u_int32_t g;
+
+	if (!a->groups)
+		return ;
+
+	for (g = 0; g < a->group_count; g++)
+		pthread_mutex_destroy(&a->groups[g].lock);
+	free(a->groups);
+	a->groups = NULL;
+}
+
+// Store the counters in the group descriptors and the super block, once
+// every writer is done.
+void ext2_alloc_sync(const struct ext2_alloc *a, struct ext2_blockgroup *gdt, struct ext2_superblock *sb)
+{
+	u_int32_t g;
+
+	sb->s_free_blocks_count = 0;
+	sb->s_free_inodes_count = 0;
+	for (g = 0; g < a->group_count; g++) {
+		const struct ext2_alloc_group *gr = a->groups + g;
+
+		gdt[g].bg_free_blocks_count = gr->free_blocks;
+		gdt[g].bg_free_inodes_count = gr->free_inodes;
+		gdt[g].bg_used_dirs_count = gr->used_dirs;
+		sb->s_free_blocks_count += gr->free_blocks;
+		sb->s_free_inodes_count += gr->free_inodes;
+	}
+}
+
+// Writers started one after another get neighbouring home groups.
+void ext2_alloc_ctx_init(struct ext2_alloc_ctx *ctx, struct ext2_alloc *a)
+{
+	ctx->a = a;
+	ctx->home = __atomic_fetch_add(&a->next_home, 1, __ATOMIC_RELAXED) % a->group_count;
+}
+
+static u_int32_t take_inode(struct ext2_alloc *a, u_int32_t group, int dir)
+{
+	struct ext2_alloc_group *gr = a->groups + group;
+	u_int32_t ino = 0;
+	unsigned long bit;
+
+	if (!load_count(&gr->free_inodes))
+		return 0;
+
+	pthread_mutex_lock(&gr->lock);
+	// the reserved inodes are all in group 0.
+	bit = bitmap_find_free(gr->inode_bitmap, a->inodes_per_group, group ? 0 : a->first_ino - 1);
+	if (gr->free_inodes && bit < a->inodes_per_group) {
+		set_bits(gr->inode_bitmap, bit, 1);
+		add_count(&gr->free_inodes, -1);
+		if (dir)
+			add_count(&gr->used_dirs, 1);
+		ino = group * a->inodes_per_group + bit + 1;
+	}
+	pthread_mutex_unlock(&gr->lock);
+
+	return ino;
+}
+
+// A directory goes to the first group from the writer's home on that has
+// at least the average of free inodes and free blocks, so that trees are
+// spread over the image. A file goes next to its directory.
+// Returns the inode number, or 0 if every group is full.
+u_int32_t ext2_alloc_inode(struct ext2_alloc_ctx *ctx, u_int32_t parent, int dir)
+{
+	struct ext2_alloc *a = ctx->a;
+	u_int32_t start = ctx->home;
+	u_int32_t ino = 0;
+	u_int32_t i;
+
+	if (dir) {
+		u_int64_t free_inodes = 0;
+		u_int64_t free_blocks = 0;
+
+		for (i = 0; i < a->group_count; i++) {
+			free_inodes += load_count(&a->groups[i].free_inodes);
+			free_blocks += load_count(&a->groups[i].free_blocks);
+		}
+		for (i = 0; i < a->group_count && !ino; i++) {
+			struct ext2_alloc_group *gr = a->groups + (start + i) % a->group_count;
+
+			if (load_count(&gr->free_inodes) * (u_int64_t) a->group_count >= free_inodes &&
+			    load_count(&gr->free_blocks) * (u_int64_t) a->group_count >= free_blocks)
+				ino = take_inode(a, (start + i) % a->group_count, dir);
+		}
+	} else if (parent && parent <= a->group_count * a->inodes_per_group) {
+		start = (parent - 1) / a->inodes_per_group;
+	}
+
+	for (i = 0; i < a->group_count && !ino; i++)
+		ino = take_inode(a, (start + i) % a->group_count, dir);
+
+	return ino;
+}
+
+void ext2_free_inode(struct ext2_alloc_ctx *ctx, u_int32_t ino, int dir)
+{
+	struct ext2_alloc *a = ctx->a;
+	struct ext2_alloc_group *gr = a->groups + (ino - 1) / a->inodes_per_group;
+
+	pthread_mutex_lock(&gr->lock);
+	clear_bits(gr->inode_bitmap, (ino - 1) % a->inodes_per_group, 1);
+	add_count(&gr->free_inodes, 1);
+	if (dir)
+		add_count(&gr->used_dirs, -1);
+	pthread_mutex_unlock(&gr->lock);
+}
+
+// Take the run of up to want free blocks which starts at the first free
+// one from bit start on, else from the start of the group. The group is
+// locked. Returns the length of the run.
+static u_int32_t take_blocks(struct ext2_alloc_group *gr, u_int32_t start, u_int32_t want, u_int32_t *first)
+{
+	unsigned long bit;
+	unsigned long len;
+
+	if (!gr->free_blocks)
+		return 0;
+
+	bit = bitmap_find_free(gr->block_bitmap, gr->nr_blocks, start);
+	if (bit == gr->nr_blocks)
+		bit = bitmap_find_free(gr->block_bitmap, gr->nr_blocks, 0);
+	if (bit == gr->nr_blocks)
+		return 0;
+
+	len = bitmap_free_run(gr->block_bitmap, gr->nr_blocks, bit, want);
+	set_bits(gr->block_bitmap, bit, len);
+	add_count(&gr->free_blocks, -(int) len);
+	*first = gr->first_block + bit;
+
+	return len;
+}
+
+// Allocate one block, as close after goal as possible. The next blocks of
+// the run found are kept in pa, up to want blocks in all, and handed out
+// by the following calls for as long as they continue where the file
+// left off. Returns the block, or 0 if the image is full.
+u_int32_t ext2_alloc_block(struct ext2_alloc_ctx *ctx, u_int32_t goal, u_int32_t want, struct ext2_prealloc *pa)
+{
+	struct ext2_alloc *a = ctx->a;
+	struct ext2_alloc_group *gr;
+	u_int32_t group, start;
+	u_int32_t first = 0;
+	u_int32_t len = 0;
+	u_int32_t i;
+
+	if (pa->len && pa->start == goal) {
+		pa->len--;
+		return pa->start++;
+	}
+	ext2_alloc_release(ctx, pa);
+
+	group = goal >= a->first_data_block ? (goal - a->first_data_block) / a->blocks_per_group : a->group_count;
+	if (group >= a->group_count) {
+		group = ctx->home;
+		goal = a->groups[group].first_block;
+	}
+	start = goal - a->groups[group].first_block;
+	if (!want)
+		want = 1;
+
+	// if another writer holds the group of the goal, try our own first.
+	gr = a->groups + group;
+	if (pthread_mutex_trylock(&gr->lock)) {
+		struct ext2_alloc_group *home = a->groups + ctx->home;
+
+		if (home != gr && !pthread_mutex_trylock(&home->lock)) {
+			len = take_blocks(home, 0, want, &first);
+			pthread_mutex_unlock(&home->lock);
+		}
+		if (len)
+			goto out;
+		pthread_mutex_lock(&gr->lock);
+	}
+	len = take_blocks(gr, start, want, &first);
+	pthread_mutex_unlock(&gr->lock);
+
+	for (i = 1; i < a->group_count && !len; i++) {
+		gr = a->groups + (group + i) % a->group_count;
+		if (!load_count(&gr->free_blocks))
+			continue;
+
+		pthread_mutex_lock(&gr->lock);
+		len = take_blocks(gr, 0, want, &first);
+		pthread_mutex_unlock(&gr->lock);
+	}
+	if (!len)
+		return 0;
+
+out:
+	pa->start = first + 1;
+	pa->len = len - 1;
+
+	return first;
+}
+
+// Give back a run of blocks of one group.
+void ext2_free_blocks(struct ext2_alloc_ctx *ctx, u_int32_t block, u_int32_t len)
+{
+	struct ext2_alloc *a = ctx->a;
+	struct ext2_alloc_group *gr = a->groups + (block - a->first_data_block) / a->blocks_per_group;
+
+	pthread_mutex_lock(&gr->lock);
+	clear_bits(gr->block_bitmap, block - gr->first_block, len);
+	add_count(&gr->free_blocks, len);
+	pthread_mutex_unlock(&gr->lock);
+}
+
+// Return what is left of a window to the free space.
+void ext2_alloc_release(struct ext2_alloc_ctx *ctx, struct ext2_prealloc *pa)
+{
+	if (pa->len)
+		ext2_free_blocks(ctx, pa->start, pa->len);
+	pa->start = 0;
+	pa->len = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef __MIKOOS_EXT2_ALLOC_H
+#define __MIKOOS_EXT2_ALLOC_H 1
+
+#include <sys/types.h>
+#include <pthread.h>
+#include "ext2fs.h"
+
+struct ext2_blockgroup;
+
+// Block and inode allocation for writing into a mapped image. Every group
+// has its own lock over its two bitmaps, which are the ones in the image,
+// so writers working in different groups never wait for each other.
+//
+// Free bits are found a 64 bit word at a time, starting at a goal: the
+// block after the last one of the file, or the start of its inode's group.
+// A file reserves a window of blocks at once, so it takes the group lock
+// about once per window instead of once per block, and its blocks end up
+// contiguous even when other files grow in the same group.
+
+// Window size when the super block leaves s_prealloc_blocks at 0, as Linux does.
+#define EXT2_DEFAULT_PREALLOC_BLOCKS 8
+
+struct ext2_alloc_group {
+	pthread_mutex_t lock;
+	unsigned char *block_bitmap;
+	unsigned char *inode_bitmap;
+	u_int32_t first_block;
+	u_int32_t nr_blocks;
+	// changed under lock, read without it to pick a group.
+	u_int32_t free_blocks;
+	u_int32_t free_inodes;
+	u_int32_t used_dirs;
+} __attribute__((aligned(64)));
+
+struct ext2_alloc {
+	unsigned char *image;
+	u_int32_t block_size;
+	u_int32_t first_data_block;
+	u_int32_t blocks_per_group;
+	u_int32_t group_count;
+	u_int32_t inodes_per_group;
+	u_int32_t first_ino;
+	u_int32_t prealloc_blocks; // window of a regular file
+	u_int32_t prealloc_dir_blocks; // window of a directory
+	struct ext2_alloc_group *groups;
+	unsigned int next_home;
+};
+
+// One per writer thread. New directories go to the thread's home group
+// while it has an average share of free space, and data goes there when
+// the group of the goal is busy.
+struct ext2_alloc_ctx {
+	struct ext2_alloc *a;
+	u_int32_t home;
+};
+
+// Blocks taken out of the bitmap for one file but not used yet.
+struct ext2_prealloc {
+	u_int32_t start;
+	u_int32_t len;
+};
+
+int ext2_alloc_init(struct ext2_alloc *a, const struct ext2_fs *fs, unsigned char *image);
+void ext2_alloc_destroy(struct ext2_alloc *a);
+void ext2_alloc_sync(const struct ext2_alloc *a, struct ext2_blockgroup *gdt, struct ext2_superblock *sb);
+void ext2_alloc_ctx_init(struct ext2_alloc_ctx *ctx, struct ext2_alloc *a);
+u_int32_t ext2_alloc_inode(struct ext2_alloc_ctx *ctx, u_int32_t parent, int dir);
+void ext2_free_inode(struct ext2_alloc_ctx *ctx, u_int32_t ino, int dir);
+u_int32_t ext2_alloc_block(struct ext2_alloc_ctx *ctx, u_int32_t goal, u_int32_t want, struct ext2_prealloc *pa);
+void ext2_free_blocks(struct ext2_alloc_ctx *ctx, u_int32_t block, u_int32_t len);
+void ext2_alloc_release(struct ext2_alloc_ctx *ctx, struct ext2_prealloc *pa);
+
+#endif // __MIKOOS_EXT2_ALLOC_H
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_view.h"
+#include "ext2_fsck.h"
+#include "ext2_batch.h"
+#include "byteorder.h"
+#include "bcache.h"
+#include "workpool.h"
+
+// sb is BATCH_PROBE_SIZE bytes read from BATCH_PROBE_OFFSET.
+int ext2_batch_probe(const unsigned char *sb)
+{
+	return get_le16(sb + offsetof(struct ext2_superblock, s_magic)) == EXT2_SUPER_MAGIC;
+}
+
+int ext2_batch_audit(struct blkio *io, unsigned long mem_limit, struct workpool *pool,
+		     struct batch_report *r)
+{
+	struct ext2_superblock sb;
+	struct ext2_fs fs;
+	struct ext2_fsck_report *report;
+	int ret = -1;
+
+	memset(r, 0x0, sizeof(*r));
+	memset(&fs, 0x0, sizeof(fs));
+	fs.size = blkio_size(io);
+
+	// only a mapping is used in place; anything else is cached up to the limit.
+	if (io->map) {
+		struct ext2_sb_view v;
+
+		fs.image = io->map;
+		if (ext2_sb_view_get(fs.image, fs.size, &v) < 0) {
+			r->error = "bad superblock";
+			return -1;
+		}
+		memcpy(&sb, v.p, sizeof(sb));
+	} else {
+		if (blkio_read(io, &sb, SUPER_BLOCK_SIZE, sizeof(sb)) != sizeof(sb) ||
+		    sb.s_magic != EXT2_SUPER_MAGIC) {
+			r->error = "bad superblock";
+			return -1;
+		}
+	}
+	fs.sb = &sb;
+	fs.block_size = get_block_size(sb);
+	if (!fs.image)
+		fs.bcache = bcache_create(io, fs.block_size, mem_limit);
+	if (ext2_load_groups(&fs) < 0) {
+		r->error = "bad group descriptors";
+		goto out;
+	}
+
+	report = malloc(sizeof(*report));
+	assert(report != NULL);
+	if (ext2_fsck(&fs, pool, report) < 0) {
+		r->error = "file system layout is not supported";
+	} else {
+		r->block_size = fs.block_size;
+		r->inodes = report->inodes;
+		r->inodes_count = sb.s_inodes_count;
+		r->blocks = report->blocks;
+		r->blocks_count = sb.s_blocks_count;
+		r->problems = report->problems;
+		ret = 0;
+	}
+	free(report);
+	ext2_free_groups(&fs);
+
+out:
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+
+	return ret;
+}
@@ -0,0 +1,18 @@
+#ifndef __MIKOOS_EXT2_BATCH_H
+#define __MIKOOS_EXT2_BATCH_H 1
+
+#include <sys/types.h>
+#include "blkio.h"
+#include "batch.h"
+
+struct workpool;
+
+// ext2 part of a batch audit: ext2_fsck() of the image, its block groups
+// checked on the shared pool. Without the mmap backend blocks are read
+// through a block cache of at most mem_limit bytes.
+
+int ext2_batch_probe(const unsigned char *sb);
+int ext2_batch_audit(struct blkio *io, unsigned long mem_limit, struct workpool *pool,
+		     struct batch_report *r);
+
+#endif // __MIKOOS_EXT2_BATCH_H
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_bitmap.h"
+#include "bitmap.h"
+#include "workpool.h"
+#include "bcache.h"
+#include "instr.h"
+
+static int bitmap_block(const struct ext2_fs *fs, u_int32_t block, struct ext2_block *b)
+{
+	b->data = NULL;
+	b->buf = NULL;
+	if (block == 0)
+		return -1;
+
+	return ext2_get_block(fs, block, BCACHE_BITMAP, b);
+}
+
+int ext2_group_bitmaps(const struct ext2_fs *fs, u_int32_t group, struct ext2_group_bitmaps *gb)
+{
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	struct ext2_block block_map;
+	struct ext2_block inode_map;
+	int ret = 0;
+
+	memset(gb, 0x0, sizeof(*gb));
+
+	bitmap_block(fs, bg->bg_block_bitmap, &block_map);
+	bitmap_block(fs, bg->bg_inode_bitmap, &inode_map);
+
+	// one bitmap block can not describe more than block_size * 8 entries.
+	if (!block_map.data || !inode_map.data ||
+	    ext2_group_nr_blocks(fs, group) > fs->block_size * 8 ||
+	    fs->sb->s_inodes_per_group > fs->block_size * 8) {
+		gb->error = 1;
+		ret = -1;
+	} else {
+		bitmap_analyze(block_map.data, ext2_group_nr_blocks(fs, group), &gb->blocks);
+		bitmap_analyze(inode_map.data, fs->sb->s_inodes_per_group, &gb->inodes);
+	}
+
+	ext2_put_block(fs, &block_map);
+	ext2_put_block(fs, &inode_map);
+
+	return ret;
+}
+
+// Do the recounted bitmaps agree with the group descriptor counters?
+int ext2_group_bitmaps_match(const struct ext2_fs *fs, u_int32_t group, const struct ext2_group_bitmaps *gb)
+{
+	const struct ext2_blockgroup *bg = fs->groups + group;
+
+	return !gb->error &&
+		gb->blocks.free == bg->bg_free_blocks_count &&
+		gb->inodes.free == bg->bg_free_inodes_count;
+}
+
+struct check_ctx {
+	const struct ext2_fs *fs;
+	struct ext2_bitmap_report *report;
+};
+
+static void check_group(void *arg, unsigned long group)
+{
+	struct check_ctx *ctx = arg;
+	INSTR_START(t);
+
+	ext2_group_bitmaps(ctx->fs, group, ctx->report->groups + group);
+	INSTR_SPAN("bitmaps", group, t);
+}
+
+// Recount every group's bitmaps in parallel and compare with the counters.
+int ext2_check_bitmaps(const struct ext2_fs *fs, struct workpool *pool, struct ext2_bitmap_report *report)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	struct check_ctx ctx;
+	u_int32_t i;
+
+	memset(report, 0x0, sizeof(*report));
+	if (!fs->group_count)
+		return -1;
+
+	report->groups = calloc(fs->group_count, sizeof(*report->groups));
+	assert(report->groups != NULL);
+	report->group_count = fs->group_count;
+
+	ctx.fs = fs;
+	ctx.report = report;
+	workpool_for_each(pool, fs->group_count, check_group, &ctx);
+
+	for (i = 0; i < report->group_count; i++) {
+		const struct ext2_group_bitmaps *gb = report->groups + i;
+
+		if (gb->error) {
+			report->errors++;
+			continue;
+		}
+		if (!ext2_group_bitmaps_match(fs, i, gb))
+			report->bad_groups++;
+
+		bitmap_stat_merge(&report->blocks, &gb->blocks,
+				  sb->s_first_data_block + (unsigned long) i * sb->s_blocks_per_group);
+		bitmap_stat_merge(&report->inodes, &gb->inodes,
+				  (unsigned long) i * sb->s_inodes_per_group);
+	}
+
+	return 0;
+}
+
+void ext2_bitmap_report_free(struct ext2_bitmap_report *report)
+{
+	free(report->groups);
+	memset(report, 0x0, sizeof(*report));
+}
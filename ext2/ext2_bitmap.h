@@ -0,0 +1,31 @@
+#ifndef __MIKOOS_EXT2_BITMAP_H
+#define __MIKOOS_EXT2_BITMAP_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "bitmap.h"
+
+struct workpool;
+
+// Recounted block and inode bitmaps of one block group.
+struct ext2_group_bitmaps {
+	struct bitmap_stat blocks; // longest_free_start is relative to the group
+	struct bitmap_stat inodes;
+	int error; // a bitmap block lies outside the image
+};
+
+struct ext2_bitmap_report {
+	struct ext2_group_bitmaps *groups;
+	u_int32_t group_count;
+	struct bitmap_stat blocks; // longest_free_start is an absolute block number
+	struct bitmap_stat inodes; // longest_free_start is an inode number - 1
+	u_int32_t bad_groups; // groups whose descriptor counters disagree
+	u_int32_t errors;
+};
+
+int ext2_group_bitmaps(const struct ext2_fs *fs, u_int32_t group, struct ext2_group_bitmaps *gb);
+int ext2_group_bitmaps_match(const struct ext2_fs *fs, u_int32_t group, const struct ext2_group_bitmaps *gb);
+int ext2_check_bitmaps(const struct ext2_fs *fs, struct workpool *pool, struct ext2_bitmap_report *report);
+void ext2_bitmap_report_free(struct ext2_bitmap_report *report);
+
+#endif // __MIKOOS_EXT2_BITMAP_H
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_blockmap.h"
+#include "byteorder.h"
+#include "bcache.h"
+
+static int block_is_valid(const struct ext2_fs *fs, u_int32_t block);
+static int extent_list_append(struct ext2_extent_list *list, u_int32_t lblk, u_int32_t pblk);
+static int map_indirect(const struct ext2_fs *fs, struct ext2_extent_list *list,
+			u_int32_t block, int level, u_int32_t *lblk, u_int32_t nr_blocks);
+
+static int block_is_valid(const struct ext2_fs *fs, u_int32_t block)
+{
+	if (block >= fs->sb->s_blocks_count)
+		return 0;
+
+	return ((u_int64_t) block + 1) * fs->block_size <= fs->size;
+}
+
+// Number of logical blocks covered by one pointer at given indirection level.
+static u_int32_t level_span(const struct ext2_fs *fs, int level)
+{
+	u_int32_t per_block = fs->block_size / sizeof(u_int32_t);
+	u_int32_t span = 1;
+
+	while (level-- > 0)
+		span *= per_block;
+
+	return span;
+}
+
+u_int64_t ext2_inode_size(const struct ext2_inode *inode)
+{
+	u_int64_t size = inode->i_size;
+
+	// i_dir_acl holds the upper 32 bits of the size for regular files.
+	if ((inode->i_mode & 0xf000) == EXT2_S_IFREG)
+		size |= (u_int64_t) inode->i_dir_acl << 32;
+
+	return size;
+}
+
+u_int32_t ext2_inode_nr_blocks(const struct ext2_fs *fs, const struct ext2_inode *inode)
+{
+	u_int64_t nr;
+
+	// fast symlinks and device files keep no data blocks.
+	if (inode->i_blocks == 0)
+		return 0;
+
+	nr = (ext2_inode_size(inode) + fs->block_size - 1) / fs->block_size;
+	if (nr > 0xffffffffULL)
+		nr = 0xffffffffULL;
+
+	return nr;
+}
+
+void ext2_extent_list_init(struct ext2_extent_list *list)
+{
+	memset(list, 0x0, sizeof(*list));
+}
+
+void ext2_extent_list_free(struct ext2_extent_list *list)
+{
+	free(list->extents);
+	ext2_extent_list_init(list);
+}
+
+static int extent_list_append(struct ext2_extent_list *list, u_int32_t lblk, u_int32_t pblk)
+{
+	struct ext2_extent *last;
+
+	if (list->count) {
+		last = list->extents + list->count - 1;
+		// merge with the previous run if both sides are contiguous.
+		if (last->e_lblk + last->e_len == lblk &&
+		    last->e_pblk + last->e_len == pblk) {
+			last->e_len++;
+			return 0;
+		}
+	}
+
+	if (list->count == list->capacity) {
+		unsigned int capacity = list->capacity ? list->capacity * 2 : 16;
+		struct ext2_extent *p;
+
+		p = realloc(list->extents, sizeof(*p) * capacity);
+		if (!p)
+			return -1;
+
+		list->extents = p;
+		list->capacity = capacity;
+	}
+
+	last = list->extents + list->count++;
+	last->e_lblk = lblk;
+	last->e_pblk = pblk;
+	last->e_len = 1;
+
+	return 0;
+}
+
+static int map_indirect(const struct ext2_fs *fs, struct ext2_extent_list *list,
+			u_int32_t block, int level, u_int32_t *lblk, u_int32_t nr_blocks)
+{
+	u_int32_t per_block = fs->block_size / sizeof(u_int32_t);
+	u_int32_t span = level_span(fs, level - 1);
+	struct ext2_block b;
+	u_int32_t i;
+	int ret = 0;
+
+	if (!block_is_valid(fs, block) || ext2_get_block(fs, block, BCACHE_DATA, &b) < 0)
+		return -1;
+
+	list->meta_blocks++;
+
+	for (i = 0; i < per_block && *lblk < nr_blocks; i++) {
+		u_int32_t ptr = get_le32(b.data + i * sizeof(ptr));
+
+		if (ptr == 0) {
+			// hole: skip every block this pointer would cover.
+			if (nr_blocks - *lblk <= span)
+				*lblk = nr_blocks;
+			else
+				*lblk += span;
+			continue;
+		}
+
+		if (level == 1) {
+			if (!block_is_valid(fs, ptr) || extent_list_append(list, *lblk, ptr) < 0) {
+				ret = -1;
+				break;
+			}
+			(*lblk)++;
+		} else if (map_indirect(fs, list, ptr, level - 1, lblk, nr_blocks) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	ext2_put_block(fs, &b);
+
+	return ret;
+}
+
+// Resolve all data blocks of inode into runs of contiguous physical blocks.
+// Holes are not reported. Returns -1 if a block pointer is out of the image.
+int ext2_map_blocks(const struct ext2_fs *fs, const struct ext2_inode *inode, struct ext2_extent_list *list)
+{
+	u_int32_t nr_blocks = ext2_inode_nr_blocks(fs, inode);
+	u_int32_t lblk = 0;
+	int i;
+
+	for (i = 0; i < EXT2_NDIR_BLOCKS && lblk < nr_blocks; i++, lblk++) {
+		if (inode->i_block[i] == 0)
+			continue;
+		if (!block_is_valid(fs, inode->i_block[i]))
+			return -1;
+		if (extent_list_append(list, lblk, inode->i_block[i]) < 0)
+			return -1;
+	}
+
+	for (i = EXT2_IND_BLOCK; i < EXT2_N_BLOCKS && lblk < nr_blocks; i++) {
+		int level = i - EXT2_IND_BLOCK + 1;
+
+		if (inode->i_block[i] == 0) {
+			u_int32_t span = level_span(fs, level);
+
+			lblk = (nr_blocks - lblk <= span) ? nr_blocks : lblk + span;
+			continue;
+		}
+
+		if (map_indirect(fs, list, inode->i_block[i], level, &lblk, nr_blocks) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// Resolve a single logical block. Returns 0 for a hole or a bad pointer.
+u_int32_t ext2_bmap(const struct ext2_fs *fs, const struct ext2_inode *inode, u_int32_t lblk)
+{
+	u_int32_t per_block = fs->block_size / sizeof(u_int32_t);
+	u_int32_t block;
+	int level;
+
+	if (lblk >= ext2_inode_nr_blocks(fs, inode))
+		return 0;
+
+	if (lblk < EXT2_NDIR_BLOCKS)
+		return block_is_valid(fs, inode->i_block[lblk]) ? inode->i_block[lblk] : 0;
+
+	lblk -= EXT2_NDIR_BLOCKS;
+	for (level = 1; level <= 3; level++) {
+		u_int32_t span = level_span(fs, level);
+
+		if (lblk < span)
+			break;
+		lblk -= span;
+	}
+	if (level > 3)
+		return 0;
+
+	block = inode->i_block[EXT2_IND_BLOCK + level - 1];
+	while (level > 0) {
+		u_int32_t span = level_span(fs, level - 1);
+		u_int32_t idx = lblk / span;
+		struct ext2_block b;
+
+		if (block == 0 || !block_is_valid(fs, block) ||
+		    ext2_get_block(fs, block, BCACHE_DATA, &b) < 0)
+			return 0;
+
+		assert(idx < per_block);
+		block = get_le32(b.data + idx * sizeof(block));
+		ext2_put_block(fs, &b);
+		lblk %= span;
+		level--;
+	}
+
+	return block_is_valid(fs, block) ? block : 0;
+}
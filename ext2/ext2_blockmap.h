@@ -0,0 +1,36 @@
+#ifndef __MIKOOS_EXT2_BLOCKMAP_H
+#define __MIKOOS_EXT2_BLOCKMAP_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_inode.h"
+
+// i_block[] layout.
+#define EXT2_NDIR_BLOCKS 12 // direct blocks
+#define EXT2_IND_BLOCK EXT2_NDIR_BLOCKS // single indirect block
+#define EXT2_DIND_BLOCK (EXT2_IND_BLOCK + 1) // double indirect block
+#define EXT2_TIND_BLOCK (EXT2_DIND_BLOCK + 1) // triple indirect block
+#define EXT2_N_BLOCKS (EXT2_TIND_BLOCK + 1)
+
+// A run of physically contiguous blocks.
+struct ext2_extent {
+	u_int32_t e_lblk; // first logical block in the file
+	u_int32_t e_pblk; // first physical block in the image
+	u_int32_t e_len; // number of blocks
+};
+
+struct ext2_extent_list {
+	struct ext2_extent *extents;
+	unsigned int count;
+	unsigned int capacity;
+	u_int32_t meta_blocks; // indirect blocks which were read
+};
+
+u_int64_t ext2_inode_size(const struct ext2_inode *inode);
+u_int32_t ext2_inode_nr_blocks(const struct ext2_fs *fs, const struct ext2_inode *inode);
+int ext2_map_blocks(const struct ext2_fs *fs, const struct ext2_inode *inode, struct ext2_extent_list *list);
+u_int32_t ext2_bmap(const struct ext2_fs *fs, const struct ext2_inode *inode, u_int32_t lblk);
+void ext2_extent_list_init(struct ext2_extent_list *list);
+void ext2_extent_list_free(struct ext2_extent_list *list);
+
+#endif // __MIKOOS_EXT2_BLOCKMAP_H
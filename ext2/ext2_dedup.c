@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_walk.h"
+#include "ext2_dedup.h"
+#include "dedup.h"
+#include "hash.h"
+#include "treewalk.h"
+#include "readahead.h"
+#include "workpool.h"
+#include "bcache.h"
+
+#define INODES_PER_TASK 64
+#define PREFETCH_BATCH 256
+
+struct dedup_ctx {
+	const struct ext2_fs *fs;
+	unsigned char *seen; // regular files found by the walk, one bit an inode
+	u_int32_t *inodes;
+	unsigned long nr_inodes;
+	struct dedup_builder builder;
+	struct ext2_dedup_stat *st;
+};
+
+static void find_file(void *arg, const struct treewalk_entry *e)
+{
+	struct dedup_ctx *c = arg;
+
+	if (e->type != EXT2_FT_REG_FILE || e->ino > c->fs->sb->s_inodes_count)
+		return ;
+
+	__atomic_fetch_or(&c->seen[e->ino / 8], 1 << (e->ino % 8), __ATOMIC_RELAXED);
+}
+
+// Ask for blocks pblk .. pblk + len - 1 before they are hashed.
+static void prefetch(const struct ext2_fs *fs, u_int32_t pblk, u_int32_t len)
+{
+	u_int64_t blocks[PREFETCH_BATCH];
+	u_int32_t i;
+
+	if (fs->image) {
+		image_willneed(fs->image, fs->size, (u_int64_t) pblk * fs->block_size,
+			       (u_int64_t) len * fs->block_size);
+		return ;
+	}
+
+	while (len) {
+		u_int32_t n = len < PREFETCH_BATCH ? len : PREFETCH_BATCH;
+
+		for (i = 0; i < n; i++)
+			blocks[i] = pblk + i;
+		ext2_prefetch_blocks(fs, blocks, n);
+		pblk += n;
+		len -= n;
+	}
+}
+
+// Hash every block of the extent, a readahead window ahead of the hashing.
+static int hash_extent(struct dedup_ctx *c, u_int32_t ino, const struct ext2_extent *e,
+		       struct dedup_block *out)
+{
+	const struct ext2_fs *fs = c->fs;
+	u_int32_t window = EXT2_DEDUP_READAHEAD / fs->block_size;
+	u_int32_t ra = e->e_len < window ? e->e_len : window;
+	int errors = 0;
+	u_int32_t i;
+
+	prefetch(fs, e->e_pblk, ra);
+	for (i = 0; i < e->e_len; i++) {
+		struct ext2_block blk;
+
+		if (i + window / 2 >= ra && ra < e->e_len) {
+			u_int32_t n = e->e_len - ra < window ? e->e_len - ra : window;
+
+			prefetch(fs, e->e_pblk + ra, n);
+			ra += n;
+		}
+
+		out[i].ino = ino;
+		out[i].lblk = e->e_lblk + i;
+		if (ext2_get_block(fs, e->e_pblk + i, BCACHE_DATA, &blk) < 0) {
+			out[i].hash = 0;
+			errors++;
+			continue;
+		}
+		out[i].hash = hash64(blk.data, fs->block_size, 0);
+		ext2_put_block(fs, &blk);
+	}
+
+	return errors;
+}
+
+static void hash_file(struct dedup_ctx *c, u_int32_t ino)
+{
+	const struct ext2_fs *fs = c->fs;
+	struct ext2_inode inode;
+	struct ext2_extent_list list;
+	struct dedup_block *blocks = NULL;
+	struct dedup_file file;
+	u_int64_t *pairs;
+	unsigned long nr = 0;
+	unsigned int i;
+	int errors = 0;
+
+	ext2_extent_list_init(&list);
+	if (ext2_read_inode(fs, ino, &inode) < 0 || ext2_map_blocks(fs, &inode, &list) < 0) {
+		__atomic_add_fetch(&c->st->errors, 1, __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	for (i = 0; i < list.count; i++)
+		nr += list.extents[i].e_len;
+	blocks = malloc((nr ? nr : 1) * sizeof(*blocks));
+	assert(blocks != NULL);
+
+	nr = 0;
+	for (i = 0; i < list.count; i++) {
+		errors += hash_extent(c, ino, list.extents + i, blocks + nr);
+		nr += list.extents[i].e_len;
+	}
+
+	// the file hash covers where each block sits, so holes count; the
+	// blocks come in logical order.
+	pairs = malloc((nr ? nr : 1) * 2 * sizeof(*pairs));
+	assert(pairs != NULL);
+	for (i = 0; i < nr; i++) {
+		pairs[i * 2] = blocks[i].lblk;
+		pairs[i * 2 + 1] = blocks[i].hash;
+	}
+
+	file.size = ext2_inode_size(&inode);
+	file.hash = hash64(pairs, nr * 2 * sizeof(*pairs), file.size);
+	file.ino = ino;
+	file.blocks = nr;
+	free(pairs);
+
+	dedup_builder_add(&c->builder, &file, blocks, nr);
+	__atomic_add_fetch(&c->st->files, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->st->bytes, (u_int64_t) nr * fs->block_size, __ATOMIC_RELAXED);
+	if (errors)
+		__atomic_add_fetch(&c->st->errors, errors, __ATOMIC_RELAXED);
+
+out:
+	free(blocks);
+	ext2_extent_list_free(&list);
+}
+
+static void hash_files(void *arg, unsigned long index)
+{
+	struct dedup_ctx *c = arg;
+	unsigned long i;
+
+	for (i = index * INODES_PER_TASK; i < (index + 1) * INODES_PER_TASK && i < c->nr_inodes; i++)
+		hash_file(c, c->inodes[i]);
+}
+
+// Hash every regular file reachable from the root into idx. Hard links are
+// hashed once.
+int ext2_dedup_scan(const struct ext2_fs *fs, struct workpool *pool, struct dedup_index *idx,
+		    struct ext2_dedup_stat *st)
+{
+	struct dedup_ctx c;
+	struct treewalk_stat wst;
+	u_int32_t ino;
+
+	memset(st, 0x0, sizeof(*st));
+	memset(&c, 0x0, sizeof(c));
+	c.fs = fs;
+	c.st = st;
+	c.seen = calloc(1, fs->sb->s_inodes_count / 8 + 1);
+	assert(c.seen != NULL);
+
+	if (ext2_walk(fs, pool, 0, find_file, &c, &wst) < 0) {
+		free(c.seen);
+		return -1;
+	}
+	st->errors += wst.errors;
+
+	// in inode order, so neighbours in a task are close on the disk.
+	c.inodes = malloc((fs->sb->s_inodes_count + 1) * sizeof(*c.inodes));
+	assert(c.inodes != NULL);
+	for (ino = 1; ino <= fs->sb->s_inodes_count; ino++) {
+		if (c.seen[ino / 8] & (1 << (ino % 8)))
+			c.inodes[c.nr_inodes++] = ino;
+	}
+	free(c.seen);
+
+	dedup_builder_init(&c.builder, fs->block_size);
+	workpool_for_each(pool, (c.nr_inodes + INODES_PER_TASK - 1) / INODES_PER_TASK, hash_files, &c);
+	dedup_builder_finish(&c.builder, idx);
+	free(c.inodes);
+
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef __MIKOOS_EXT2_DEDUP_H
+#define __MIKOOS_EXT2_DEDUP_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "dedup.h"
+
+struct workpool;
+
+// Content hash index of an ext2 image. The regular files are found with
+// ext2_walk() and their blocks are hashed on the pool, reading ahead of
+// the hashing so that the scan waits on the disk, not on the hash.
+
+#define EXT2_DEDUP_READAHEAD (1024 * 1024)
+
+struct ext2_dedup_stat {
+	unsigned long files;
+	u_int64_t bytes; // data hashed
+	unsigned long errors; // broken block maps and unreadable blocks
+};
+
+int ext2_dedup_scan(const struct ext2_fs *fs, struct workpool *pool, struct dedup_index *idx,
+		    struct ext2_dedup_stat *st);
+
+#endif // __MIKOOS_EXT2_DEDUP_H
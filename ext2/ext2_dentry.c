@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2_dentry.h"
+
+void ext2_dentry_table_init(struct ext2_dentry_table *table)
+{
+	memset(table, 0x0, sizeof(*table));
+}
+
+void ext2_dentry_table_release(struct ext2_dentry_table *table)
+{
+	free(table->recs);
+	free(table->names);
+	ext2_dentry_table_init(table);
+}
+
+static void *grow(void *buf, unsigned long *capacity, unsigned long need, unsigned long size)
+{
+	unsigned long n = *capacity ? *capacity : 256;
+
+	if (need <= *capacity)
+		return buf;
+
+	while (n < need)
+		n *= 2;
+
+	buf = realloc(buf, n * size);
+	assert(buf != NULL);
+	*capacity = n;
+
+	return buf;
+}
+
+struct ext2_dentry_rec *ext2_dentry_table_add(struct ext2_dentry_table *table, u_int32_t inode,
+					      u_int8_t file_type, const char *name, u_int8_t name_len)
+{
+	struct ext2_dentry_rec *rec;
+
+	table->recs = grow(table->recs, &table->capacity, table->count + 1, sizeof(*rec));
+	// added one byte for '\0'.
+	table->names = grow(table->names, &table->names_capacity, table->names_len + name_len + 1, 1);
+
+	rec = table->recs + table->count++;
+	rec->inode = inode;
+	rec->name_off = table->names_len;
+	rec->name_len = name_len;
+	rec->file_type = file_type;
+
+	memcpy(table->names + table->names_len, name, name_len);
+	table->names[table->names_len + name_len] = '\0';
+	table->names_len += name_len + 1;
+
+	return rec;
+}
@@ -1,6 +1,8 @@
 #ifndef __MIKOOS_EXT2_DENTRY_H
 #define __MIKOOS_EXT2_DENTRY_H
 
+#include <sys/types.h>
+
 #define EXT2_MAX_NAME_LENGTH 255
 
 // for file_type.
@@ -28,6 +30,18 @@ enum {
 	DX_HASH_LEGACY = 0, 
 	DX_HASH_HALF_MD4,
 	DX_HASH_TEA,
+	DX_HASH_LEGACY_UNSIGNED, // in memory only, chosen by EXT2_FLAGS_UNSIGNED_HASH
+	DX_HASH_HALF_MD4_UNSIGNED,
+	DX_HASH_TEA_UNSIGNED,
+};
+
+// Follows the "." and ".." entries in block 0 of an indexed directory.
+struct ext2_dx_root_info {
+	u_int32_t reserved_zero;
+	u_int8_t hash_version;
+	u_int8_t info_length; // 8
+	u_int8_t indirect_levels;
+	u_int8_t unused_flags;
 };
 
 struct ext2_indexed_dentry {
@@ -40,9 +54,30 @@ struct ext2_indexed_entry_count_and_limit {
 	u_int16_t count;
 };
 
-struct dentry_list {
-	struct ext2_dentry *dentry;
-	struct dentry_list *next;
+// Packed record of one directory entry; the name lives in the table's pool.
+struct ext2_dentry_rec {
+	u_int32_t inode;
+	u_int32_t name_off; // offset of the '\0' terminated name in names
+	u_int8_t name_len;
+	u_int8_t file_type;
+};
+
+// Owns every entry of one scan. Records and names are bump allocated from
+// two growing buffers, so the whole scan is released with one call.
+struct ext2_dentry_table {
+	struct ext2_dentry_rec *recs;
+	unsigned long count;
+	unsigned long capacity;
+	char *names;
+	unsigned long names_len;
+	unsigned long names_capacity;
 };
 
+void ext2_dentry_table_init(struct ext2_dentry_table *table);
+void ext2_dentry_table_release(struct ext2_dentry_table *table);
+struct ext2_dentry_rec *ext2_dentry_table_add(struct ext2_dentry_table *table, u_int32_t inode,
+					      u_int8_t file_type, const char *name, u_int8_t name_len);
+
+#define ext2_dentry_rec_name(table, rec) ((table)->names + (rec)->name_off)
+
 #endif // __MIKOOS_EXT2_DENTRY_H 
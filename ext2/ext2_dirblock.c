@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_dirblock.h"
+#include "byteorder.h"
+#include "bcache.h"
+#include "instr.h"
+
+// One step along the chain at *off. Returns non zero if the entry is broken.
+// bs is a constant in the specialized parsers. data and ents are passed in
+// rather than read from the struct ext2_dirblock, since the byte stores
+// into ents could alias it and would make every step reload them.
+static inline __attribute__((always_inline))
+int parse_entry(const unsigned char *data, struct ext2_dirent *ents, u_int32_t *off, int *n,
+		const u_int32_t bs, u_int8_t type_mask)
+{
+	const unsigned char *p = data + *off;
+	u_int32_t ino = get_le32(p);
+	u_int32_t rec_len = get_le16(p + 4);
+	u_int32_t name_len = p[6];
+	// one branch for the four checks, taken by the caller. rec_len keeps
+	// entries 4 byte aligned, as ext2_scan and ext2_fsck expect.
+	int bad = (rec_len < EXT2_DIRENT_MIN_LEN) | (rec_len > bs - *off) |
+		(name_len + EXT2_DIRENT_MIN_LEN > rec_len) | ((rec_len & 3) != 0);
+
+	// written for removed and broken entries too, and then overwritten.
+	ents[*n] = (struct ext2_dirent) {
+		.inode = ino,
+		.offset = *off,
+		.name_len = name_len,
+		.file_type = p[7] & type_mask,
+	};
+	*n += (ino != 0) & !bad;
+	*off += rec_len;
+
+	return bad;
+}
+
+static inline __attribute__((always_inline))
+void parse_two(struct ext2_dirblock *a, struct ext2_dirblock *b, const u_int32_t bs, u_int8_t type_mask)
+{
+	const unsigned char *data_a = a->data, *data_b = b->data;
+	struct ext2_dirent *ents_a = a->ents, *ents_b = b->ents;
+	u_int32_t off_a = 0, off_b = 0;
+	int n_a = 0, n_b = 0;
+	int bad_a = 0, bad_b = 0;
+
+	while (off_a + EXT2_DIRENT_MIN_LEN <= bs && off_b + EXT2_DIRENT_MIN_LEN <= bs && !(bad_a | bad_b)) {
+		bad_a = parse_entry(data_a, ents_a, &off_a, &n_a, bs, type_mask);
+		bad_b = parse_entry(data_b, ents_b, &off_b, &n_b, bs, type_mask);
+	}
+	while (off_a + EXT2_DIRENT_MIN_LEN <= bs && !bad_a)
+		bad_a = parse_entry(data_a, ents_a, &off_a, &n_a, bs, type_mask);
+	while (off_b + EXT2_DIRENT_MIN_LEN <= bs && !bad_b)
+		bad_b = parse_entry(data_b, ents_b, &off_b, &n_b, bs, type_mask);
+
+	// a header cut off by the end of the block stops short of bs.
+	a->count = n_a;
+	a->broken = bad_a || off_a != bs;
+	b->count = n_b;
+	b->broken = bad_b || off_b != bs;
+}
+
+static inline __attribute__((always_inline))
+void parse_one(struct ext2_dirblock *blk, const u_int32_t bs, u_int8_t type_mask)
+{
+	const unsigned char *data = blk->data;
+	struct ext2_dirent *ents = blk->ents;
+	u_int32_t off = 0;
+	int n = 0;
+	int bad = 0;
+
+	while (off + EXT2_DIRENT_MIN_LEN <= bs && !bad)
+		bad = parse_entry(data, ents, &off, &n, bs, type_mask);
+
+	blk->count = n;
+	blk->broken = bad || off != bs;
+}
+
+static inline __attribute__((always_inline))
+void parse_blocks(struct ext2_dirblock *blocks, int nr, const u_int32_t bs, u_int8_t type_mask)
+{
+	int i;
+
+	for (i = 0; i + 1 < nr; i += 2)
+		parse_two(blocks + i, blocks + i + 1, bs, type_mask);
+	if (i < nr)
+		parse_one(blocks + i, bs, type_mask);
+}
+
+#define DEFINE_PARSER(name, size)							\
+static void name(struct ext2_dirblock *blocks, int nr, u_int32_t block_size,	\
+		 u_int8_t type_mask)							\
+{											\
+	parse_blocks(blocks, nr, (size), type_mask);					\
+}
+
+DEFINE_PARSER(parse_1k, 1024)
+DEFINE_PARSER(parse_2k, 2048)
+DEFINE_PARSER(parse_4k, 4096)
+
+static void parse_any(struct ext2_dirblock *blocks, int nr, u_int32_t block_size, u_int8_t type_mask)
+{
+	parse_blocks(blocks, nr, block_size, type_mask);
+}
+
+ext2_dirblock_fn ext2_dirblock_parser(u_int32_t block_size)
+{
+	switch (block_size) {
+	case 1024:
+		return parse_1k;
+	case 2048:
+		return parse_2k;
+	case 4096:
+		return parse_4k;
+	}
+
+	return parse_any;
+}
+
+static inline void parse(const struct ext2_fs *fs, struct ext2_dirblock *blocks, int nr, u_int8_t type_mask)
+{
+	INSTR_START(t);
+
+	fs->dir_parse(blocks, nr, fs->block_size, type_mask);
+	INSTR_END(INSTR_DIRBLOCK_PARSE, t);
+	INSTR_ADD(INSTR_DENTRIES, blocks[0].count + (nr > 1 ? blocks[1].count : 0));
+}
+
+// Parse every block of the directory mapped by list, two at a time, and
+// hand them to fn in order while they are held. Returns the number of
+// blocks which could not be read or are broken.
+unsigned long ext2_dirblock_scan(const struct ext2_fs *fs, const struct ext2_extent_list *list,
+				 ext2_dirblock_visit_fn fn, void *arg)
+{
+	struct ext2_dirent stack_ents[2 * EXT2_DIRBLOCK_MAX_ENTRIES(4096)];
+	u_int32_t max = EXT2_DIRBLOCK_MAX_ENTRIES(fs->block_size);
+	struct ext2_dirent *ents = stack_ents;
+	u_int8_t type_mask = ext2_dirblock_type_mask(fs);
+	struct ext2_dirblock blocks[2];
+	struct ext2_block b[2];
+	unsigned long errors = 0;
+	unsigned int i;
+	u_int32_t j;
+	int nr = 0;
+	int k;
+
+	if (fs->block_size > 4096) {
+		ents = malloc(2 * max * sizeof(*ents));
+		assert(ents != NULL);
+	}
+
+	for (i = 0; i < list->count; i++) {
+		for (j = 0; j < list->extents[i].e_len; j++) {
+			if (ext2_get_block(fs, list->extents[i].e_pblk + j, BCACHE_DIR, b + nr) < 0) {
+				errors++;
+				continue;
+			}
+			blocks[nr].data = b[nr].data;
+			blocks[nr].ents = ents + nr * max;
+			if (++nr < 2)
+				continue;
+
+			parse(fs, blocks, nr, type_mask);
+			for (k = 0; k < nr; k++) {
+				errors += blocks[k].broken;
+				fn(arg, blocks + k);
+				ext2_put_block(fs, b + k);
+			}
+			nr = 0;
+		}
+	}
+
+	// an odd block left at the end.
+	if (nr) {
+		parse(fs, blocks, nr, type_mask);
+		errors += blocks[0].broken;
+		fn(arg, blocks);
+		ext2_put_block(fs, b);
+	}
+
+	if (ents != stack_ents)
+		free(ents);
+
+	return errors;
+}
@@ -0,0 +1,48 @@
+#ifndef __MIKOOS_EXT2_DIRBLOCK_H
+#define __MIKOOS_EXT2_DIRBLOCK_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+
+// Directory block parsers. One pass over a block checks its whole rec_len
+// chain and packs the live entries into records. Following the chain is a
+// run of dependent loads, so blocks are parsed two at a time and the two
+// chains overlap. There are versions compiled for 1K, 2K and 4K blocks and
+// one for any size; ext2_load_groups() puts the right one in fs->dir_parse.
+
+// the smallest entry is a header with an empty name.
+#define EXT2_DIRENT_MIN_LEN 8
+#define EXT2_DIRBLOCK_MAX_ENTRIES(block_size) ((block_size) / EXT2_DIRENT_MIN_LEN)
+
+// A live entry. The name stays in the block, after the 8 byte header at offset.
+struct ext2_dirent {
+	u_int32_t inode;
+	u_int16_t offset;
+	u_int8_t name_len;
+	u_int8_t file_type; // EXT2_FT_UNKNOWN without the filetype feature
+};
+
+struct ext2_dirblock {
+	const unsigned char *data; // one whole block
+	struct ext2_dirent *ents; // room for EXT2_DIRBLOCK_MAX_ENTRIES()
+	int count; // live entries
+	int broken; // the chain breaks after the entries found
+};
+
+#define ext2_dirent_name(blk, e) ((const char *) (blk)->data + (e)->offset + EXT2_DIRENT_MIN_LEN)
+
+typedef void (*ext2_dirblock_visit_fn)(void *arg, const struct ext2_dirblock *blk);
+
+ext2_dirblock_fn ext2_dirblock_parser(u_int32_t block_size);
+unsigned long ext2_dirblock_scan(const struct ext2_fs *fs, const struct ext2_extent_list *list,
+				 ext2_dirblock_visit_fn fn, void *arg);
+
+// Without the filetype feature that byte is the high byte of name_len.
+static inline u_int8_t ext2_dirblock_type_mask(const struct ext2_fs *fs)
+{
+	return fs->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE ? 0xff : 0;
+}
+
+#endif // __MIKOOS_EXT2_DIRBLOCK_H
@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_view.h"
+#include "ext2_dirblock.h"
+#include "fsgen.h"
+#include "ext2_du.h"
+#include "workpool.h"
+#include "bcache.h"
+#include "instr.h"
+
+enum {
+	DU_FREE = 0,
+	DU_FILE,
+	DU_LINKED_FILE, // more than one name, counted once
+	DU_DIR,
+};
+
+// Per inode state of the scan, 17 bytes an inode.
+struct du_ctx {
+	const struct ext2_fs *fs;
+	u_int32_t *blocks; // i_blocks
+	u_int64_t *bytes; // i_size
+	u_int32_t *owner; // lowest directory naming the inode, 0 if none
+	u_int8_t *type;
+	u_int32_t first_ino;
+	unsigned long errors;
+};
+
+// Keep the lowest directory inode; the order directories are read in
+// does not change the result.
+static void set_owner(u_int32_t *owner, u_int32_t ino, u_int32_t dir)
+{
+	u_int32_t old = __atomic_load_n(&owner[ino], __ATOMIC_RELAXED);
+
+	while ((old == 0 || dir < old) &&
+	       !__atomic_compare_exchange_n(&owner[ino], &old, dir, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+// A directory being read by read_dir().
+struct du_dir {
+	struct du_ctx *c;
+	u_int32_t dir;
+};
+
+static void read_dirblock(void *arg, const struct ext2_dirblock *blk)
+{
+	struct du_dir *d = arg;
+	u_int32_t max_ino = d->c->fs->sb->s_inodes_count;
+	int i;
+
+	for (i = 0; i < blk->count; i++) {
+		const struct ext2_dirent *e = blk->ents + i;
+
+		if (e->inode > max_ino || fsgen_is_dot(ext2_dirent_name(blk, e), e->name_len))
+			continue;
+
+		set_owner(d->c->owner, e->inode, d->dir);
+	}
+}
+
+static void read_dir(struct du_ctx *c, u_int32_t dir, const struct ext2_inode *inode)
+{
+	struct du_dir d = { .c = c, .dir = dir };
+	struct ext2_extent_list list;
+	unsigned long errors;
+
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(c->fs, inode, &list) < 0)
+		errors = 1;
+	else
+		errors = ext2_dirblock_scan(c->fs, &list, read_dirblock, &d);
+	if (errors)
+		__atomic_add_fetch(&c->errors, errors, __ATOMIC_RELAXED);
+
+	ext2_extent_list_free(&list);
+}
+
+static void scan_group(void *arg, unsigned long group)
+{
+	struct du_ctx *c = arg;
+	const struct ext2_fs *fs = c->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	u_int32_t inode_size = get_inode_size(*sb);
+	u_int32_t per_block = fs->block_size / inode_size;
+	u_int32_t i;
+	INSTR_START(t);
+
+	for (i = 0; i < sb->s_inodes_per_group; i += per_block) {
+		struct ext2_block table;
+		u_int32_t j;
+
+		if (ext2_get_block(fs, bg->bg_inode_table + i / per_block, BCACHE_ITABLE, &table) < 0) {
+			__atomic_add_fetch(&c->errors, 1, __ATOMIC_RELAXED);
+			break;
+		}
+
+		for (j = i; j < i + per_block && j < sb->s_inodes_per_group; j++) {
+			u_int32_t ino = group * sb->s_inodes_per_group + j + 1;
+			struct ext2_inode_view v;
+			struct ext2_inode inode;
+			u_int16_t links;
+
+			v.p = table.data + (j - i) * inode_size;
+			links = ext2_inode_view_i_links_count(v);
+			if (!ext2_inode_view_i_mode(v) || !links ||
+			    (ino < c->first_ino && ino != EXT2_ROOT_INO))
+				continue;
+
+			ext2_inode_decode(v, &inode);
+			c->blocks[ino] = inode.i_blocks;
+			c->bytes[ino] = ext2_inode_size(&inode);
+			if ((inode.i_mode & 0xf000) == EXT2_S_IFDIR) {
+				c->type[ino] = DU_DIR;
+				read_dir(c, ino, &inode);
+			} else {
+				c->type[ino] = links > 1 ? DU_LINKED_FILE : DU_FILE;
+			}
+		}
+
+		ext2_put_block(fs, &table);
+	}
+	INSTR_SPAN("du scan", group, t);
+}
+
+// Depth of every directory, breaking parent loops of a corrupt tree.
+static void set_depths(struct ext2_du *du)
+{
+	u_int8_t *state = calloc(du->nr_dirs, 1); // 1 being walked, 2 done
+	u_int32_t *chain = malloc(du->nr_dirs * sizeof(*chain));
+	u_int32_t k;
+
+	assert(state != NULL && chain != NULL);
+
+	for (k = 0; k < du->nr_dirs; k++) {
+		u_int32_t n = 0;
+		u_int32_t i = k;
+
+		while (!state[i]) {
+			u_int32_t p = du->dirs[i].parent;
+
+			state[i] = 1;
+			chain[n++] = i;
+			if (p == EXT2_DU_NO_PARENT)
+				break;
+			if (state[p] == 1) {
+				du->dirs[i].parent = EXT2_DU_NO_PARENT;
+				break;
+			}
+			i = p;
+		}
+
+		while (n--) {
+			struct ext2_du_dir *d = du->dirs + chain[n];
+
+			d->depth = d->parent == EXT2_DU_NO_PARENT ? 0 : du->dirs[d->parent].depth + 1;
+			state[chain[n]] = 2;
+		}
+	}
+
+	free(chain);
+	free(state);
+}
+
+// Add every directory to its parent, deepest first.
+static void sum_up(struct ext2_du *du)
+{
+	u_int32_t max_depth = 0;
+	u_int32_t *start;
+	u_int32_t *order;
+	u_int32_t i;
+
+	for (i = 0; i < du->nr_dirs; i++) {
+		if (du->dirs[i].depth > max_depth)
+			max_depth = du->dirs[i].depth;
+	}
+
+	// counting sort by depth.
+	start = calloc(max_depth + 2, sizeof(*start));
+	order = malloc(du->nr_dirs * sizeof(*order));
+	assert(start != NULL && order != NULL);
+	for (i = 0; i < du->nr_dirs; i++)
+		start[du->dirs[i].depth + 1]++;
+	for (i = 1; i <= max_depth + 1; i++)
+		start[i] += start[i - 1];
+	for (i = 0; i < du->nr_dirs; i++)
+		order[start[du->dirs[i].depth]++] = i;
+
+	for (i = du->nr_dirs; i-- > 0; ) {
+		struct ext2_du_dir *d = du->dirs + order[i];
+		struct ext2_du_dir *p;
+
+		if (d->parent == EXT2_DU_NO_PARENT)
+			continue;
+		p = du->dirs + d->parent;
+		p->blocks += d->blocks;
+		p->bytes += d->bytes;
+		p->inodes += d->inodes;
+	}
+
+	free(order);
+	free(start);
+}
+
+int ext2_du_scan(const struct ext2_fs *fs, struct workpool *pool, struct ext2_du *du)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	unsigned long nr = (unsigned long) sb->s_inodes_count + 1;
+	struct du_ctx c;
+	u_int32_t ino;
+	u_int32_t k;
+
+	memset(du, 0x0, sizeof(*du));
+	if (!fs->group_count)
+		return -1;
+
+	memset(&c, 0x0, sizeof(c));
+	c.fs = fs;
+	c.first_ino = sb->s_rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_FIRST_INO : sb->s_first_ino;
+	c.blocks = calloc(nr, sizeof(*c.blocks));
+	c.bytes = calloc(nr, sizeof(*c.bytes));
+	c.owner = calloc(nr, sizeof(*c.owner));
+	c.type = calloc(nr, sizeof(*c.type));
+	assert(c.blocks != NULL && c.bytes != NULL && c.owner != NULL && c.type != NULL);
+
+	workpool_for_each(pool, fs->group_count, scan_group, &c);
+	du->errors = c.errors;
+
+	for (ino = 1; ino < nr; ino++) {
+		if (c.type[ino] == DU_DIR)
+			du->nr_dirs++;
+	}
+	du->dirs = calloc(du->nr_dirs ? du->nr_dirs : 1, sizeof(*du->dirs));
+	assert(du->dirs != NULL);
+
+	// from here on the owner of a directory is its index in dirs[].
+	for (ino = 1, k = 0; ino < nr; ino++) {
+		struct ext2_du_dir *d = du->dirs + k;
+
+		if (c.type[ino] != DU_DIR)
+			continue;
+		d->ino = ino;
+		d->parent = c.owner[ino];
+		d->blocks = c.blocks[ino];
+		d->bytes = c.bytes[ino];
+		d->inodes = 1;
+		c.owner[ino] = k++;
+	}
+	for (k = 0; k < du->nr_dirs; k++) {
+		struct ext2_du_dir *d = du->dirs + k;
+
+		d->parent = d->parent ? c.owner[d->parent] : EXT2_DU_NO_PARENT;
+	}
+
+	for (ino = 1; ino < nr; ino++) {
+		struct ext2_du_dir *d;
+
+		if (c.type[ino] != DU_FILE && c.type[ino] != DU_LINKED_FILE)
+			continue;
+
+		du->files++;
+		if (c.type[ino] == DU_LINKED_FILE)
+			du->hard_links++;
+		if (!c.owner[ino]) {
+			du->unattached++;
+			continue;
+		}
+
+		d = du->dirs + c.owner[c.owner[ino]];
+		d->blocks += c.blocks[ino];
+		d->bytes += c.bytes[ino];
+		d->inodes++;
+	}
+
+	free(c.blocks);
+	free(c.bytes);
+	free(c.owner);
+	free(c.type);
+
+	set_depths(du);
+	sum_up(du);
+
+	du->root = ext2_du_find(du, EXT2_ROOT_INO);
+	for (k = 0; k < du->nr_dirs; k++) {
+		if (du->dirs[k].parent == EXT2_DU_NO_PARENT && k != du->root)
+			du->unattached++;
+	}
+
+	return 0;
+}
+
+void ext2_du_free(struct ext2_du *du)
+{
+	free(du->dirs);
+	memset(du, 0x0, sizeof(*du));
+}
+
+// Index of directory ino in dirs[], or EXT2_DU_NO_PARENT.
+u_int32_t ext2_du_find(const struct ext2_du *du, u_int32_t ino)
+{
+	u_int32_t lo = 0;
+	u_int32_t hi = du->nr_dirs;
+
+	while (lo < hi) {
+		u_int32_t mid = lo + (hi - lo) / 2;
+
+		if (du->dirs[mid].ino == ino)
+			return mid;
+		if (du->dirs[mid].ino < ino)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return EXT2_DU_NO_PARENT;
+}
+
+static u_int64_t du_key(const struct ext2_du *du, u_int32_t i, int by_bytes)
+{
+	return by_bytes ? du->dirs[i].bytes : du->dirs[i].blocks;
+}
+
+static void sift_down(const struct ext2_du *du, u_int32_t *heap, unsigned long n, unsigned long i, int by_bytes)
+{
+	while (1) {
+		unsigned long l = 2 * i + 1;
+		unsigned long m = i;
+		u_int32_t tmp;
+
+		if (l < n && du_key(du, heap[l], by_bytes) < du_key(du, heap[m], by_bytes))
+			m = l;
+		if (l + 1 < n && du_key(du, heap[l + 1], by_bytes) < du_key(du, heap[m], by_bytes))
+			m = l + 1;
+		if (m == i)
+			return ;
+
+		tmp = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+// The n heaviest directories into top[], heaviest first, by i_blocks or
+// by i_size. Returns how many there are.
+unsigned long ext2_du_top(const struct ext2_du *du, unsigned long n, int by_bytes, u_int32_t *top)
+{
+	unsigned long nr = 0;
+	unsigned long i;
+	u_int32_t k;
+
+	if (!n)
+		return 0;
+
+	// min-heap of the n largest seen so far.
+	for (k = 0; k < du->nr_dirs; k++) {
+		if (nr < n) {
+			top[nr++] = k;
+			if (nr == n) {
+				for (i = n / 2; i-- > 0; )
+					sift_down(du, top, nr, i, by_bytes);
+			}
+		} else if (du_key(du, k, by_bytes) > du_key(du, top[0], by_bytes)) {
+			top[0] = k;
+			sift_down(du, top, nr, 0, by_bytes);
+		}
+	}
+	if (nr < n) {
+		for (i = nr / 2; i-- > 0; )
+			sift_down(du, top, nr, i, by_bytes);
+	}
+
+	// pop the smallest to the back.
+	for (i = nr; i > 1; i--) {
+		u_int32_t tmp = top[0];
+
+		top[0] = top[i - 1];
+		top[i - 1] = tmp;
+		sift_down(du, top, i - 1, 0, by_bytes);
+	}
+
+	return nr;
+}
+
+// Copy the name dir gives child into name. Returns its length or -1.
+static int find_name(const struct ext2_fs *fs, u_int32_t dir, u_int32_t child, char *name)
+{
+	struct ext2_inode inode;
+	u_int32_t nr_blocks;
+	u_int32_t lblk;
+
+	if (ext2_read_inode(fs, dir, &inode) < 0)
+		return -1;
+
+	nr_blocks = ext2_inode_nr_blocks(fs, &inode);
+	for (lblk = 0; lblk < nr_blocks; lblk++) {
+		u_int32_t block = ext2_bmap(fs, &inode, lblk);
+		struct ext2_block blk;
+		u_int32_t offset = 0;
+
+		if (!block || ext2_get_block(fs, block, BCACHE_DIR, &blk) < 0)
+			continue;
+
+		while (offset < fs->block_size) {
+			struct ext2_dentry_view d;
+			int rec_len = ext2_dentry_view_get(blk.data, offset, fs->block_size, &d);
+
+			if (rec_len < 0)
+				break;
+			offset += rec_len;
+
+			if (ext2_dentry_view_inode(d) == child &&
+			    !ext2_dentry_view_name_is(d, ".", 1) && !ext2_dentry_view_name_is(d, "..", 2)) {
+				int len = ext2_dentry_view_name_len(d);
+
+				memcpy(name, ext2_dentry_view_name(d), len);
+				ext2_put_block(fs, &blk);
+				return len;
+			}
+		}
+
+		ext2_put_block(fs, &blk);
+	}
+
+	return -1;
+}
+
+// Path of dirs[index]. Subtrees no one names start with "<ino>".
+// Returns -1 if it does not fit in len bytes.
+int ext2_du_path(const struct ext2_fs *fs, const struct ext2_du *du, u_int32_t index, char *buf, unsigned long len)
+{
+	u_int32_t depth = du->dirs[index].depth;
+	u_int32_t *chain = malloc((depth + 1) * sizeof(*chain));
+	unsigned long pos;
+	u_int32_t i;
+	int ret = 0;
+
+	assert(chain != NULL);
+	for (i = depth; i > 0; i--) {
+		chain[i] = index;
+		index = du->dirs[index].parent;
+	}
+	chain[0] = index;
+
+	if (chain[0] == du->root)
+		pos = snprintf(buf, len, "%s", depth ? "" : "/");
+	else
+		pos = snprintf(buf, len, "<%u>", du->dirs[chain[0]].ino);
+
+	for (i = 1; i <= depth && pos < len; i++) {
+		char name[EXT2_MAX_NAME_LENGTH];
+		int n = find_name(fs, du->dirs[chain[i - 1]].ino, du->dirs[chain[i]].ino, name);
+
+		if (n < 0)
+			pos += snprintf(buf + pos, len - pos, "/<%u>", du->dirs[chain[i]].ino);
+		else
+			pos += snprintf(buf + pos, len - pos, "/%.*s", n, name);
+	}
+	if (pos >= len)
+		ret = -1;
+
+	free(chain);
+
+	return ret;
+}
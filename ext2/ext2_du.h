@@ -0,0 +1,42 @@
+#ifndef __MIKOOS_EXT2_DU_H
+#define __MIKOOS_EXT2_DU_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+
+struct workpool;
+
+// Space used below every directory, like du(1) without mounting. The
+// inode tables are read once, in parallel by block group, and the directory
+// blocks are parsed on the way to learn which directory owns each inode.
+// A file with several names is counted once, under the directory with the
+// lowest inode number which names it. Totals are then summed bottom-up.
+
+struct ext2_du_dir {
+	u_int32_t ino;
+	u_int32_t parent; // index into dirs[], or EXT2_DU_NO_PARENT
+	u_int32_t depth; // 0 for the root and for directories no one names
+	u_int64_t blocks; // i_blocks of the subtree, 512 byte sectors
+	u_int64_t bytes; // i_size of the subtree
+	u_int64_t inodes; // inodes of the subtree, itself included
+};
+
+#define EXT2_DU_NO_PARENT 0xffffffffU
+
+struct ext2_du {
+	struct ext2_du_dir *dirs; // sorted by inode number
+	u_int32_t nr_dirs;
+	u_int32_t root; // index of EXT2_ROOT_INO, or EXT2_DU_NO_PARENT
+	unsigned long files; // inodes which are not directories
+	unsigned long hard_links; // files with more than one name
+	unsigned long unattached; // inodes in use which no directory names
+	unsigned long errors; // unreadable directories
+};
+
+int ext2_du_scan(const struct ext2_fs *fs, struct workpool *pool, struct ext2_du *du);
+void ext2_du_free(struct ext2_du *du);
+u_int32_t ext2_du_find(const struct ext2_du *du, u_int32_t ino);
+unsigned long ext2_du_top(const struct ext2_du *du, unsigned long n, int by_bytes, u_int32_t *top);
+int ext2_du_path(const struct ext2_fs *fs, const struct ext2_du *du, u_int32_t index, char *buf, unsigned long len);
+
+#endif // __MIKOOS_EXT2_DU_H
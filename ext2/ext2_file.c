@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_blockmap.h"
+#include "ext2_file.h"
+#include "bcache.h"
+#include "readahead.h"
+#include "instr.h"
+
+int ext2_file_open(const struct ext2_fs *fs, u_int32_t ino, struct ext2_file *file)
+{
+	memset(file, 0x0, sizeof(*file));
+
+	if (ext2_read_inode(fs, ino, &file->inode) < 0)
+		return -1;
+
+	file->fs = fs;
+	file->ino = ino;
+	file->size = ext2_inode_size(&file->inode);
+
+	ext2_extent_list_init(&file->map);
+	if (ext2_map_blocks(fs, &file->inode, &file->map) < 0) {
+		ext2_extent_list_free(&file->map);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ext2_file_close(struct ext2_file *file)
+{
+	ext2_extent_list_free(&file->map);
+}
+
+// Index of the first extent which ends after lblk, or map.count.
+// Sequential reads are answered from the current or the next extent.
+static unsigned int seek_extent(struct ext2_file *file, u_int32_t lblk)
+{
+	const struct ext2_extent *e = file->map.extents;
+	unsigned int lo = 0;
+	unsigned int hi = file->map.count;
+
+	if (file->cur < hi && e[file->cur].e_lblk <= lblk) {
+		lo = file->cur;
+		if (lblk < e[lo].e_lblk + e[lo].e_len)
+			return lo;
+		lo++;
+		if (lo == hi || lblk < e[lo].e_lblk + e[lo].e_len)
+			return file->cur = lo;
+	}
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (e[mid].e_lblk + e[mid].e_len <= lblk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return file->cur = lo;
+}
+
+// Ask for the blocks of the next window once half of the last one was read.
+// Only the image needs it: without it every run is one large read, which
+// the kernel reads ahead of on its own.
+static void file_readahead(struct ext2_file *file)
+{
+	const struct ext2_fs *fs = file->fs;
+	u_int32_t bs = fs->block_size;
+	u_int64_t start = file->ra_next;
+	u_int64_t end;
+	unsigned int cur = file->cur;
+	unsigned int i;
+
+	if (start < file->pos)
+		start = file->pos;
+	if (start >= file->size || start >= file->pos + EXT2_READAHEAD_SIZE / 2)
+		return ;
+
+	end = file->pos + EXT2_READAHEAD_SIZE;
+	if (end > file->size)
+		end = file->size;
+	file->ra_next = end;
+
+	// found from the extent of the last read on; cur stays there for the
+	// reads which follow.
+	i = seek_extent(file, start / bs);
+	file->cur = cur;
+
+	for (; i < file->map.count; i++) {
+		const struct ext2_extent *e = file->map.extents + i;
+		u_int64_t e_start = (u_int64_t) e->e_lblk * bs;
+		u_int64_t e_end = e_start + (u_int64_t) e->e_len * bs;
+		u_int64_t from, to;
+
+		if (e_end <= start)
+			continue;
+		if (e_start >= end)
+			break;
+
+		from = e_start > start ? e_start : start;
+		to = e_end < end ? e_end : end;
+		image_willneed(fs->image, fs->size, (u_int64_t) e->e_pblk * bs + from - e_start, to - from);
+	}
+}
+
+static inline long file_read(struct ext2_file *file, void *buf, unsigned long len)
+{
+	const struct ext2_fs *fs = file->fs;
+	u_int32_t bs = fs->block_size;
+	unsigned char *dst = buf;
+	unsigned long done = 0;
+
+	if (file->pos >= file->size)
+		return 0;
+
+	if (len > file->size - file->pos)
+		len = file->size - file->pos;
+
+	if (fs->image)
+		file_readahead(file);
+	else if (!fs->bcache)
+		return -1;
+
+	// one copy, or one read without the image, per extent or hole.
+	while (done < len) {
+		u_int32_t lblk = file->pos / bs;
+		u_int32_t off = file->pos % bs;
+		unsigned int i = seek_extent(file, lblk);
+		const struct ext2_extent *e = i < file->map.count ? file->map.extents + i : NULL;
+		u_int64_t n;
+
+		if (e && e->e_lblk <= lblk) {
+			u_int64_t from = ((u_int64_t) e->e_pblk + lblk - e->e_lblk) * bs + off;
+
+			n = (u_int64_t) (e->e_lblk + e->e_len - lblk) * bs - off;
+			if (n > len - done)
+				n = len - done;
+			if (fs->image)
+				memcpy(dst + done, fs->image + from, n);
+			else if (bcache_read(fs->bcache, dst + done, from, n, BCACHE_DATA) < 0)
+				return done ? (long) done : -1;
+		} else {
+			// hole up to the next extent or the end of file.
+			n = e ? (u_int64_t) (e->e_lblk - lblk) * bs - off : len - done;
+			if (n > len - done)
+				n = len - done;
+			memset(dst + done, 0x0, n);
+		}
+
+		done += n;
+		file->pos += n;
+	}
+
+	return done;
+}
+
+// Copy up to len bytes from the current position. Holes read as zeros.
+// Returns the number of bytes read, 0 at the end of file.
+long ext2_file_read(struct ext2_file *file, void *buf, unsigned long len)
+{
+	INSTR_START(t);
+	long n = file_read(file, buf, len);
+
+	INSTR_END(INSTR_FILE_READ, t);
+	INSTR_ADD(INSTR_READ_BYTES, n > 0 ? n : 0);
+
+	return n;
+}
+
+int64_t ext2_file_seek(struct ext2_file *file, int64_t offset, int whence)
+{
+	int64_t pos;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = file->pos + offset;
+		break;
+	case SEEK_END:
+		pos = file->size + offset;
+		break;
+	default:
+		return -1;
+	}
+
+	if (pos < 0)
+		return -1;
+
+	file->pos = pos;
+	// restart readahead from the new position.
+	file->ra_next = pos;
+
+	return pos;
+}
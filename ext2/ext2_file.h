@@ -0,0 +1,30 @@
+#ifndef __MIKOOS_EXT2_FILE_H
+#define __MIKOOS_EXT2_FILE_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_blockmap.h"
+
+// Readahead window ahead of the read position.
+#define EXT2_READAHEAD_SIZE (1024 * 1024)
+
+// An open file. Data is copied straight from the image into the caller's
+// buffer, so memory use does not depend on the file size.
+struct ext2_file {
+	const struct ext2_fs *fs;
+	u_int32_t ino;
+	struct ext2_inode inode;
+	u_int64_t size;
+	u_int64_t pos;
+	u_int64_t ra_next; // readahead was issued up to here
+	struct ext2_extent_list map;
+	unsigned int cur; // extent of the last read
+};
+
+int ext2_file_open(const struct ext2_fs *fs, u_int32_t ino, struct ext2_file *file);
+long ext2_file_read(struct ext2_file *file, void *buf, unsigned long len);
+int64_t ext2_file_seek(struct ext2_file *file, int64_t offset, int whence);
+void ext2_file_close(struct ext2_file *file);
+
+#endif // __MIKOOS_EXT2_FILE_H
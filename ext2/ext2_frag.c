@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_blockmap.h"
+#include "ext2_view.h"
+#include "ext2_frag.h"
+#include "frag.h"
+#include "workpool.h"
+#include "bcache.h"
+#include "instr.h"
+
+struct frag_ctx {
+	const struct ext2_fs *fs;
+	struct ext2_frag_report *report;
+	ext2_frag_fn fn;
+	void *arg;
+	u_int32_t first_ino;
+};
+
+static void scan_inode(struct frag_ctx *c, u_int32_t group, u_int32_t ino, const struct ext2_inode *inode)
+{
+	const struct ext2_fs *fs = c->fs;
+	struct frag_stat *st = c->report->groups + group;
+	struct ext2_extent_list list;
+	struct frag_file f;
+	unsigned int i;
+
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(fs, inode, &list) < 0) {
+		__atomic_add_fetch(&c->report->errors, 1, __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	// the extents come in logical order with the holes left out.
+	frag_file_init(&f, ino, ext2_inode_size(inode), fs->block_size);
+	for (i = 0; i < list.count; i++)
+		frag_file_add_run(&f, st, list.extents[i].e_lblk, list.extents[i].e_pblk, list.extents[i].e_len);
+	frag_file_finish(&f);
+
+	frag_stat_add(st, &f);
+	if (c->fn)
+		c->fn(c->arg, group, &f);
+
+out:
+	ext2_extent_list_free(&list);
+}
+
+static void scan_group(void *arg, unsigned long group)
+{
+	struct frag_ctx *c = arg;
+	const struct ext2_fs *fs = c->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	u_int32_t inode_size = get_inode_size(*sb);
+	u_int32_t per_block = fs->block_size / inode_size;
+	u_int32_t i;
+	INSTR_START(t);
+
+	for (i = 0; i < sb->s_inodes_per_group; i += per_block) {
+		struct ext2_block table;
+		u_int32_t j;
+
+		if (ext2_get_block(fs, bg->bg_inode_table + i / per_block, BCACHE_ITABLE, &table) < 0) {
+			__atomic_add_fetch(&c->report->errors, 1, __ATOMIC_RELAXED);
+			break;
+		}
+
+		for (j = i; j < i + per_block && j < sb->s_inodes_per_group; j++) {
+			struct ext2_inode_view v;
+			struct ext2_inode inode;
+			u_int32_t ino = group * sb->s_inodes_per_group + j + 1;
+			u_int16_t type;
+
+			// reserved inodes such as the resize inode are not files.
+			if (ino < c->first_ino && ino != EXT2_ROOT_INO)
+				continue;
+
+			v.p = table.data + (j - i) * inode_size;
+			type = ext2_inode_view_i_mode(v) & 0xf000;
+			if (!ext2_inode_view_i_links_count(v) || (type != EXT2_S_IFREG && type != EXT2_S_IFDIR))
+				continue;
+
+			ext2_inode_decode(v, &inode);
+			scan_inode(c, group, ino, &inode);
+		}
+
+		ext2_put_block(fs, &table);
+	}
+	INSTR_SPAN("frag scan", group, t);
+}
+
+int ext2_frag_scan(const struct ext2_fs *fs, struct workpool *pool, ext2_frag_fn fn, void *arg,
+		   struct ext2_frag_report *report)
+{
+	struct frag_ctx c;
+	u_int32_t i;
+
+	memset(report, 0x0, sizeof(*report));
+	if (!fs->group_count)
+		return -1;
+
+	report->groups = calloc(fs->group_count, sizeof(*report->groups));
+	assert(report->groups != NULL);
+	report->group_count = fs->group_count;
+
+	c.fs = fs;
+	c.report = report;
+	c.fn = fn;
+	c.arg = arg;
+	c.first_ino = fs->sb->s_rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_FIRST_INO : fs->sb->s_first_ino;
+	workpool_for_each(pool, fs->group_count, scan_group, &c);
+
+	for (i = 0; i < report->group_count; i++)
+		frag_stat_merge(&report->total, report->groups + i);
+
+	return 0;
+}
+
+void ext2_frag_report_free(struct ext2_frag_report *report)
+{
+	free(report->groups);
+	memset(report, 0x0, sizeof(*report));
+}
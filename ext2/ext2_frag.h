@@ -0,0 +1,29 @@
+#ifndef __MIKOOS_EXT2_FRAG_H
+#define __MIKOOS_EXT2_FRAG_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "frag.h"
+
+struct workpool;
+
+// Fragmentation and holes of every regular file and directory, per block
+// group of the inode and in total. Groups are scanned in parallel and each
+// keeps its own histograms, so nothing is shared until they are merged.
+
+struct ext2_frag_report {
+	struct frag_stat *groups;
+	u_int32_t group_count;
+	struct frag_stat total;
+	unsigned long errors; // broken block maps
+};
+
+// Called for every file from the worker scanning its group, so calls for
+// different groups run at the same time.
+typedef void (*ext2_frag_fn)(void *arg, u_int32_t group, const struct frag_file *f);
+
+int ext2_frag_scan(const struct ext2_fs *fs, struct workpool *pool, ext2_frag_fn fn, void *arg,
+		   struct ext2_frag_report *report);
+void ext2_frag_report_free(struct ext2_frag_report *report);
+
+#endif // __MIKOOS_EXT2_FRAG_H
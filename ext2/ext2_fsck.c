@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_bitmap.h"
+#include "ext2_view.h"
+#include "ext2_fsck.h"
+#include "bitmap.h"
+#include "workpool.h"
+#include "bcache.h"
+#include "instr.h"
+
+// Two passes over the block groups, both in parallel. The first one claims
+// every block owned by the group's metadata and by the inodes of its inode
+// table in one shared bitmap, and counts the directory entries naming each
+// inode. Claims are an atomic test-and-set, so a block claimed by two owners
+// is found whichever group gets to it first. The second pass compares the
+// result with the on-disk bitmaps, the group counters and the link counts.
+
+#define EXT2_RESIZE_INO 7
+
+struct fsck_ctx {
+	const struct ext2_fs *fs;
+	struct ext2_fsck_report *report;
+	unsigned char *blocks; // claimed blocks, bit n is block s_first_data_block + n
+	unsigned char *xattr; // xattr blocks seen, several inodes may share one
+	u_int32_t *refs; // directory entries naming each inode
+	u_int16_t *links; // i_links_count of inodes in use, 0 otherwise
+	u_int32_t *group_dirs; // directories in use per group
+	u_int32_t *group_free_blocks; // recounted from the bitmaps
+	u_int32_t *group_free_inodes;
+	u_int32_t gdt_blocks;
+	u_int32_t first_ino;
+	unsigned int claimed; // slots of report->first handed out
+};
+
+// Blocks of one inode while they are claimed.
+struct inode_walk {
+	struct fsck_ctx *c;
+	u_int32_t group;
+	u_int32_t ino;
+	u_int32_t nr_blocks; // claimed by this inode, indirect blocks included
+	int is_dir;
+	int bad_dot; // reported once per directory
+};
+
+static void problem(struct fsck_ctx *c, int type, u_int32_t group, u_int32_t ino,
+		    u_int32_t block, u_int64_t found, u_int64_t expected)
+{
+	struct ext2_fsck_report *r = c->report;
+	unsigned int slot;
+
+	__atomic_add_fetch(&r->counts[type], 1, __ATOMIC_RELAXED);
+
+	slot = __atomic_fetch_add(&c->claimed, 1, __ATOMIC_RELAXED);
+	if (slot < EXT2_FSCK_MAX_PROBLEMS) {
+		struct ext2_fsck_problem *p = r->first + slot;
+
+		p->type = type;
+		p->group = group;
+		p->ino = ino;
+		p->block = block;
+		p->found = found;
+		p->expected = expected;
+	}
+}
+
+static int test_and_set(unsigned char *map, unsigned long bit)
+{
+	unsigned char mask = 1 << (bit & 7);
+
+	return __atomic_fetch_or(&map[bit >> 3], mask, __ATOMIC_RELAXED) & mask;
+}
+
+static int block_in_fs(const struct ext2_fs *fs, u_int32_t block)
+{
+	return block >= fs->sb->s_first_data_block && block < fs->sb->s_blocks_count;
+}
+
+// Returns -1 if the block can not be claimed at all.
+static int claim_block(struct fsck_ctx *c, u_int32_t group, u_int32_t ino, u_int32_t block)
+{
+	const struct ext2_fs *fs = c->fs;
+
+	if (!block_in_fs(fs, block)) {
+		problem(c, EXT2_FSCK_BAD_BLOCK, group, ino, block, 0, 0);
+		return -1;
+	}
+
+	if (test_and_set(c->blocks, block - fs->sb->s_first_data_block))
+		problem(c, EXT2_FSCK_DUP_BLOCK, group, ino, block, 0, 0);
+
+	return 0;
+}
+
+static int is_power_of(u_int32_t n, u_int32_t base)
+{
+	while (n > 1 && n % base == 0)
+		n /= base;
+
+	return n == 1;
+}
+
+static int group_has_super(const struct ext2_fs *fs, u_int32_t group)
+{
+	if (!(fs->sb->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER) || group <= 1)
+		return 1;
+
+	return is_power_of(group, 3) || is_power_of(group, 5) || is_power_of(group, 7);
+}
+
+static u_int32_t itable_blocks(const struct ext2_fs *fs)
+{
+	return ((unsigned long) fs->sb->s_inodes_per_group * get_inode_size(*fs->sb) +
+		fs->block_size - 1) / fs->block_size;
+}
+
+// Superblock and descriptor table copies, bitmaps and the inode table.
+static void claim_group_metadata(struct fsck_ctx *c, u_int32_t group)
+{
+	const struct ext2_fs *fs = c->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	u_int32_t first = sb->s_first_data_block + group * sb->s_blocks_per_group;
+	u_int32_t n = 0;
+	u_int32_t i;
+
+	if (group_has_super(fs, group)) {
+		n = 1 + c->gdt_blocks;
+		if (sb->s_feature_compat & EXT2_FEATURE_COMPAT_RESIZE_INO)
+			n += sb->s_reserved_gdt_blocks;
+	}
+	for (i = 0; i < n; i++)
+		claim_block(c, group, 0, first + i);
+
+	claim_block(c, group, 0, bg->bg_block_bitmap);
+	claim_block(c, group, 0, bg->bg_inode_bitmap);
+	for (i = 0; i < itable_blocks(fs); i++)
+		claim_block(c, group, 0, bg->bg_inode_table + i);
+}
+
+// Check the rec_len chain of a directory block and count who it names.
+static void check_dir_block(struct inode_walk *w, const unsigned char *block, int first)
+{
+	struct fsck_ctx *c = w->c;
+	const struct ext2_fs *fs = c->fs;
+	u_int32_t offset = 0;
+	int n = 0;
+
+	while (offset < fs->block_size) {
+		struct ext2_dentry_view d;
+		int rec_len = ext2_dentry_view_get(block, offset, fs->block_size, &d);
+		u_int32_t ino;
+
+		if (rec_len < 0 || (rec_len & 3)) {
+			problem(c, EXT2_FSCK_BAD_DENTRY, w->group, w->ino, 0, offset, 0);
+			return ;
+		}
+
+		ino = ext2_dentry_view_inode(d);
+		if (ino > fs->sb->s_inodes_count)
+			problem(c, EXT2_FSCK_BAD_DENTRY, w->group, w->ino, 0, offset, ino);
+		else if (ino)
+			__atomic_add_fetch(&c->refs[ino], 1, __ATOMIC_RELAXED);
+
+		if (first && n == 0 && (!ext2_dentry_view_name_is(d, ".", 1) || ino != w->ino))
+			w->bad_dot = 1;
+		if (first && n == 1 && (!ext2_dentry_view_name_is(d, "..", 2) || !ino))
+			w->bad_dot = 1;
+
+		n++;
+		offset += rec_len;
+	}
+
+	if (first && n < 2)
+		w->bad_dot = 1;
+}
+
+static void claim_data_block(struct inode_walk *w, u_int32_t block, u_int32_t lblk)
+{
+	struct fsck_ctx *c = w->c;
+	struct ext2_block b;
+
+	if (claim_block(c, w->group, w->ino, block) < 0)
+		return ;
+	w->nr_blocks++;
+
+	if (!w->is_dir)
+		return ;
+
+	if (ext2_get_block(c->fs, block, BCACHE_DIR, &b) < 0) {
+		problem(c, EXT2_FSCK_BAD_BLOCK, w->group, w->ino, block, 0, 0);
+		return ;
+	}
+	check_dir_block(w, b.data, lblk == 0);
+	ext2_put_block(c->fs, &b);
+}
+
+// Claim an indirect block and everything below it. lblk is the first
+// logical block it maps and is advanced past it.
+static void claim_indirect(struct inode_walk *w, u_int32_t block, int level, u_int64_t *lblk)
+{
+	struct fsck_ctx *c = w->c;
+	u_int32_t per_block = c->fs->block_size / sizeof(u_int32_t);
+	u_int64_t span = 1;
+	struct ext2_block b;
+	u_int32_t i;
+	int l;
+
+	for (l = 1; l < level; l++)
+		span *= per_block;
+
+	if (claim_block(c, w->group, w->ino, block) < 0 ||
+	    ext2_get_block(c->fs, block, BCACHE_DATA, &b) < 0) {
+		*lblk += span * per_block;
+		return ;
+	}
+	w->nr_blocks++;
+
+	for (i = 0; i < per_block; i++) {
+		u_int32_t p = get_le32(b.data + i * sizeof(u_int32_t));
+
+		if (!p)
+			*lblk += span;
+		else if (level > 1)
+			claim_indirect(w, p, level - 1, lblk);
+		else
+			claim_data_block(w, p, (*lblk)++);
+	}
+
+	ext2_put_block(c->fs, &b);
+}
+
+static void claim_inode_blocks(struct inode_walk *w, const struct ext2_inode *inode)
+{
+	u_int64_t lblk = EXT2_NDIR_BLOCKS;
+	int i;
+
+	for (i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+		if (inode->i_block[i])
+			claim_data_block(w, inode->i_block[i], i);
+		else if (i == 0 && w->is_dir)
+			w->bad_dot = 1;
+	}
+
+	for (i = EXT2_IND_BLOCK; i < EXT2_N_BLOCKS; i++) {
+		if (inode->i_block[i])
+			claim_indirect(w, inode->i_block[i], i - EXT2_IND_BLOCK + 1, &lblk);
+	}
+}
+
+static void check_inode(struct fsck_ctx *c, u_int32_t group, u_int32_t ino,
+			struct ext2_inode_view v, int marked)
+{
+	const struct ext2_fs *fs = c->fs;
+	int reserved = ino < c->first_ino && ino != EXT2_ROOT_INO;
+	u_int16_t mode = ext2_inode_view_i_mode(v);
+	u_int16_t links = ext2_inode_view_i_links_count(v);
+	int in_use = reserved ? mode != 0 : mode != 0 && links != 0;
+	struct ext2_inode inode;
+	struct inode_walk w;
+	u_int32_t sectors = fs->block_size / 512;
+	int fast_symlink;
+
+	// reserved inodes are always marked, used or not.
+	if (!reserved && in_use && !marked)
+		problem(c, EXT2_FSCK_INODE_UNMARKED, group, ino, 0, 0, 0);
+	if (!reserved && !in_use && marked)
+		problem(c, EXT2_FSCK_INODE_LEAKED, group, ino, 0, 0, 0);
+
+	// the bad blocks inode owns its blocks even though it has no mode.
+	if (!in_use && ino != EXT2_BAD_INO)
+		return ;
+
+	ext2_inode_decode(v, &inode);
+
+	memset(&w, 0x0, sizeof(w));
+	w.c = c;
+	w.group = group;
+	w.ino = ino;
+	w.is_dir = in_use && (mode & 0xf000) == EXT2_S_IFDIR;
+
+	if (in_use) {
+		__atomic_add_fetch(&c->report->inodes, 1, __ATOMIC_RELAXED);
+		if (!reserved)
+			c->links[ino] = links;
+	}
+	if (w.is_dir) {
+		__atomic_add_fetch(&c->report->dirs, 1, __ATOMIC_RELAXED);
+		c->group_dirs[group]++;
+	}
+
+	// an xattr block may be shared, it is claimed by whoever sees it first.
+	if (inode.i_file_acl) {
+		if (!block_in_fs(fs, inode.i_file_acl))
+			problem(c, EXT2_FSCK_BAD_BLOCK, group, ino, inode.i_file_acl, 0, 0);
+		else if (!test_and_set(c->xattr, inode.i_file_acl - fs->sb->s_first_data_block))
+			claim_block(c, group, ino, inode.i_file_acl);
+		w.nr_blocks++;
+	}
+
+	// a fast symlink keeps its target in i_block[].
+	fast_symlink = (mode & 0xf000) == EXT2_S_IFLNK &&
+		inode.i_blocks == (inode.i_file_acl ? sectors : 0);
+
+	if (ino == EXT2_RESIZE_INO && (fs->sb->s_feature_compat & EXT2_FEATURE_COMPAT_RESIZE_INO)) {
+		// the rest of its tree are the reserved descriptor blocks
+		// which were claimed with the group metadata.
+		if (inode.i_block[EXT2_DIND_BLOCK])
+			claim_block(c, group, ino, inode.i_block[EXT2_DIND_BLOCK]);
+		return ;
+	}
+
+	switch (mode & 0xf000) {
+	case EXT2_S_IFREG:
+	case EXT2_S_IFDIR:
+		claim_inode_blocks(&w, &inode);
+		break;
+	case EXT2_S_IFLNK:
+		if (!fast_symlink)
+			claim_inode_blocks(&w, &inode);
+		break;
+	default:
+		// devices keep their number in i_block[].
+		if (ino == EXT2_BAD_INO)
+			claim_inode_blocks(&w, &inode);
+		break;
+	}
+
+	if (w.bad_dot)
+		problem(c, EXT2_FSCK_BAD_DOT, group, ino, 0, 0, 0);
+	if ((u_int64_t) w.nr_blocks * sectors != inode.i_blocks)
+		problem(c, EXT2_FSCK_I_BLOCKS, group, ino, 0, inode.i_blocks,
+			(u_int64_t) w.nr_blocks * sectors);
+}
+
+// Pass one: claim what the group owns and count directory references.
+static void claim_group(void *arg, unsigned long group)
+{
+	struct fsck_ctx *c = arg;
+	const struct ext2_fs *fs = c->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	u_int32_t inode_size = get_inode_size(*sb);
+	u_int32_t per_block = fs->block_size / inode_size;
+	struct ext2_block map;
+	u_int32_t i;
+	INSTR_START(t);
+
+	claim_group_metadata(c, group);
+
+	if (sb->s_inodes_per_group > fs->block_size * 8 ||
+	    !bg->bg_inode_bitmap || ext2_get_block(fs, bg->bg_inode_bitmap, BCACHE_BITMAP, &map) < 0) {
+		problem(c, EXT2_FSCK_BAD_GROUP, group, 0, bg->bg_inode_bitmap, 0, 0);
+		goto out;
+	}
+
+	for (i = 0; i < sb->s_inodes_per_group; i += per_block) {
+		struct ext2_block table;
+		u_int32_t j;
+
+		if (ext2_get_block(fs, bg->bg_inode_table + i / per_block, BCACHE_ITABLE, &table) < 0) {
+			problem(c, EXT2_FSCK_BAD_GROUP, group, 0, bg->bg_inode_table + i / per_block, 0, 0);
+			break;
+		}
+
+		for (j = i; j < i + per_block && j < sb->s_inodes_per_group; j++) {
+			struct ext2_inode_view v;
+
+			v.p = table.data + (j - i) * inode_size;
+			check_inode(c, group, group * sb->s_inodes_per_group + j + 1, v,
+				    map.data[j / 8] & (1 << (j % 8)));
+		}
+
+		ext2_put_block(fs, &table);
+	}
+
+	ext2_put_block(fs, &map);
+
+out:
+	INSTR_SPAN("fsck claim", group, t);
+}
+
+static void compare_block_bitmap(struct fsck_ctx *c, u_int32_t group, const unsigned char *map)
+{
+	const struct ext2_fs *fs = c->fs;
+	u_int32_t nbits = ext2_group_nr_blocks(fs, group);
+	unsigned long base = (unsigned long) group * fs->sb->s_blocks_per_group;
+	u_int32_t i;
+
+	for (i = 0; i < nbits; i++) {
+		unsigned long bit = base + i;
+		int on, used;
+
+		// whole bytes which agree are skipped; base is a multiple of 8.
+		if (!(i & 7) && i + 8 <= nbits && map[i / 8] == c->blocks[bit / 8]) {
+			i += 7;
+			continue;
+		}
+
+		on = !!(map[i / 8] & (1 << (i % 8)));
+		used = !!(c->blocks[bit / 8] & (1 << (bit % 8)));
+		if (on && !used)
+			problem(c, EXT2_FSCK_BLOCK_LEAKED, group, 0, fs->sb->s_first_data_block + bit, 0, 0);
+		else if (!on && used)
+			problem(c, EXT2_FSCK_BLOCK_UNMARKED, group, 0, fs->sb->s_first_data_block + bit, 0, 0);
+	}
+}
+
+// Pass two: bitmaps against claims, counters against bitmaps, and link
+// counts against the references counted in pass one.
+static void compare_group(void *arg, unsigned long group)
+{
+	struct fsck_ctx *c = arg;
+	const struct ext2_fs *fs = c->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	struct ext2_group_bitmaps gb;
+	struct ext2_block map;
+	u_int32_t first = group * sb->s_inodes_per_group + 1;
+	u_int32_t ino;
+	INSTR_START(t);
+
+	if (ext2_group_bitmaps(fs, group, &gb) < 0 ||
+	    ext2_get_block(fs, bg->bg_block_bitmap, BCACHE_BITMAP, &map) < 0) {
+		problem(c, EXT2_FSCK_BAD_GROUP, group, 0, bg->bg_block_bitmap, 0, 0);
+		goto out;
+	}
+	compare_block_bitmap(c, group, map.data);
+	ext2_put_block(fs, &map);
+
+	c->group_free_blocks[group] = gb.blocks.free;
+	c->group_free_inodes[group] = gb.inodes.free;
+	if (gb.blocks.free != bg->bg_free_blocks_count)
+		problem(c, EXT2_FSCK_GROUP_COUNT, group, 0, 0, bg->bg_free_blocks_count, gb.blocks.free);
+	if (gb.inodes.free != bg->bg_free_inodes_count)
+		problem(c, EXT2_FSCK_GROUP_COUNT, group, 0, 0, bg->bg_free_inodes_count, gb.inodes.free);
+	if (c->group_dirs[group] != bg->bg_used_dirs_count)
+		problem(c, EXT2_FSCK_GROUP_COUNT, group, 0, 0, bg->bg_used_dirs_count, c->group_dirs[group]);
+
+	for (ino = first; ino < first + sb->s_inodes_per_group; ino++) {
+		if (ino < c->first_ino && ino != EXT2_ROOT_INO)
+			continue;
+
+		if (!c->links[ino] && c->refs[ino])
+			problem(c, EXT2_FSCK_FREE_INODE_REF, group, ino, 0, c->refs[ino], 0);
+		else if (c->links[ino] != c->refs[ino])
+			problem(c, EXT2_FSCK_LINK_COUNT, group, ino, 0, c->links[ino], c->refs[ino]);
+	}
+
+out:
+	INSTR_SPAN("fsck compare", group, t);
+}
+
+// Check the whole file system on the pool. Returns -1 if it can not be
+// checked at all, otherwise the findings are in report.
+int ext2_fsck(const struct ext2_fs *fs, struct workpool *pool, struct ext2_fsck_report *report)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	struct fsck_ctx c;
+	unsigned long nbits;
+	u_int64_t free_blocks = 0;
+	u_int64_t free_inodes = 0;
+	u_int32_t i;
+
+	memset(report, 0x0, sizeof(*report));
+
+	// descriptor blocks are not all at the front of the group with meta_bg.
+	if (!fs->group_count || (sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_META_BG) ||
+	    sb->s_blocks_per_group % 8 || (u_int64_t) fs->group_count * sb->s_inodes_per_group != sb->s_inodes_count)
+		return -1;
+
+	memset(&c, 0x0, sizeof(c));
+	c.fs = fs;
+	c.report = report;
+	c.gdt_blocks = ((unsigned long) fs->group_count * sizeof(struct ext2_blockgroup) +
+			fs->block_size - 1) / fs->block_size;
+	c.first_ino = sb->s_rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_FIRST_INO : sb->s_first_ino;
+
+	nbits = sb->s_blocks_count - sb->s_first_data_block;
+	c.blocks = calloc(nbits / 8 + 1, 1);
+	c.xattr = calloc(nbits / 8 + 1, 1);
+	c.refs = calloc((unsigned long) sb->s_inodes_count + 1, sizeof(*c.refs));
+	c.links = calloc((unsigned long) sb->s_inodes_count + 1, sizeof(*c.links));
+	c.group_dirs = calloc(fs->group_count, sizeof(*c.group_dirs));
+	c.group_free_blocks = calloc(fs->group_count, sizeof(*c.group_free_blocks));
+	c.group_free_inodes = calloc(fs->group_count, sizeof(*c.group_free_inodes));
+	assert(c.blocks != NULL && c.xattr != NULL && c.refs != NULL && c.links != NULL);
+	assert(c.group_dirs != NULL && c.group_free_blocks != NULL && c.group_free_inodes != NULL);
+
+	workpool_for_each(pool, fs->group_count, claim_group, &c);
+	workpool_for_each(pool, fs->group_count, compare_group, &c);
+
+	for (i = 0; i < fs->group_count; i++) {
+		free_blocks += c.group_free_blocks[i];
+		free_inodes += c.group_free_inodes[i];
+	}
+	if (free_blocks != sb->s_free_blocks_count)
+		problem(&c, EXT2_FSCK_SUPER_COUNT, 0, 0, 0, sb->s_free_blocks_count, free_blocks);
+	if (free_inodes != sb->s_free_inodes_count)
+		problem(&c, EXT2_FSCK_SUPER_COUNT, 0, 0, 0, sb->s_free_inodes_count, free_inodes);
+
+	report->blocks = bitmap_count_used(c.blocks, nbits);
+	report->nr_first = c.claimed < EXT2_FSCK_MAX_PROBLEMS ? c.claimed : EXT2_FSCK_MAX_PROBLEMS;
+	for (i = 0; i < EXT2_FSCK_NR_PROBLEMS; i++)
+		report->problems += report->counts[i];
+
+	free(c.blocks);
+	free(c.xattr);
+	free(c.refs);
+	free(c.links);
+	free(c.group_dirs);
+	free(c.group_free_blocks);
+	free(c.group_free_inodes);
+
+	return 0;
+}
+
+const char *ext2_fsck_problem_name(int type)
+{
+	static const char * const names[EXT2_FSCK_NR_PROBLEMS] = {
+		[EXT2_FSCK_DUP_BLOCK] = "block claimed twice",
+		[EXT2_FSCK_BAD_BLOCK] = "bad block pointer",
+		[EXT2_FSCK_BLOCK_UNMARKED] = "used block free in bitmap",
+		[EXT2_FSCK_BLOCK_LEAKED] = "unused block marked in bitmap",
+		[EXT2_FSCK_INODE_UNMARKED] = "used inode free in bitmap",
+		[EXT2_FSCK_INODE_LEAKED] = "unused inode marked in bitmap",
+		[EXT2_FSCK_LINK_COUNT] = "wrong link count",
+		[EXT2_FSCK_FREE_INODE_REF] = "entry names unused inode",
+		[EXT2_FSCK_BAD_DENTRY] = "broken directory entry",
+		[EXT2_FSCK_BAD_DOT] = "missing . or ..",
+		[EXT2_FSCK_I_BLOCKS] = "wrong i_blocks",
+		[EXT2_FSCK_GROUP_COUNT] = "wrong group counter",
+		[EXT2_FSCK_SUPER_COUNT] = "wrong superblock counter",
+		[EXT2_FSCK_BAD_GROUP] = "unreadable group metadata",
+	};
+
+	if (type < 0 || type >= EXT2_FSCK_NR_PROBLEMS)
+		return "unknown";
+
+	return names[type];
+}
@@ -0,0 +1,55 @@
+#ifndef __MIKOOS_EXT2_FSCK_H
+#define __MIKOOS_EXT2_FSCK_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+
+struct workpool;
+
+// Read-only consistency check, the parts of e2fsck -n which do not need a
+// tree walk: block ownership, link counts, bitmaps and counters, and the
+// rec_len chains of every directory block.
+
+enum ext2_fsck_problem_type {
+	EXT2_FSCK_DUP_BLOCK = 0, // block claimed twice
+	EXT2_FSCK_BAD_BLOCK, // block pointer outside the file system
+	EXT2_FSCK_BLOCK_UNMARKED, // block in use but free in the bitmap
+	EXT2_FSCK_BLOCK_LEAKED, // block marked in the bitmap but not used
+	EXT2_FSCK_INODE_UNMARKED, // inode in use but free in the bitmap
+	EXT2_FSCK_INODE_LEAKED, // inode marked in the bitmap but not in use
+	EXT2_FSCK_LINK_COUNT, // i_links_count differs from the entries naming it
+	EXT2_FSCK_FREE_INODE_REF, // directory entry names an inode not in use
+	EXT2_FSCK_BAD_DENTRY, // broken rec_len chain or bad inode number
+	EXT2_FSCK_BAD_DOT, // first entries are not "." and ".."
+	EXT2_FSCK_I_BLOCKS, // i_blocks differs from the blocks found
+	EXT2_FSCK_GROUP_COUNT, // group descriptor counters differ from its bitmaps
+	EXT2_FSCK_SUPER_COUNT, // superblock counters differ from the groups
+	EXT2_FSCK_BAD_GROUP, // bitmaps or inode table out of the image
+	EXT2_FSCK_NR_PROBLEMS,
+};
+
+struct ext2_fsck_problem {
+	int type;
+	u_int32_t group;
+	u_int32_t ino; // 0 for file system metadata
+	u_int32_t block;
+	u_int64_t found;
+	u_int64_t expected;
+};
+
+#define EXT2_FSCK_MAX_PROBLEMS 64 // problems kept for the report
+
+struct ext2_fsck_report {
+	unsigned long counts[EXT2_FSCK_NR_PROBLEMS];
+	unsigned long problems; // sum of counts
+	struct ext2_fsck_problem first[EXT2_FSCK_MAX_PROBLEMS];
+	unsigned int nr_first; // in the order they were found, not sorted
+	unsigned long inodes; // in use
+	unsigned long dirs;
+	unsigned long blocks; // referenced, metadata included
+};
+
+int ext2_fsck(const struct ext2_fs *fs, struct workpool *pool, struct ext2_fsck_report *report);
+const char *ext2_fsck_problem_name(int type);
+
+#endif // __MIKOOS_EXT2_FSCK_H
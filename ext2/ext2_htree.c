@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_htree.h"
+#include "ext2_view.h"
+#include "ext2_traits.h"
+#include "byteorder.h"
+#include "bcache.h"
+
+// Reference.
+// http://www.nongnu.org/ext2-doc/ext2.html#INDEXED-DIRECTORY
+// linux/fs/ext4/hash.c
+
+#define DX_ROOT_INFO_OFFSET 24 // after the "." and ".." entries
+#define DX_NODE_ENTRIES_OFFSET 8 // after the empty fake dentry
+#define DX_HASH_EOF 0x7fffffffU
+
+// One level of the path from the dx root to a leaf.
+struct dx_frame {
+	struct ext2_block blk; // index block, pinned while the frame is used
+	const unsigned char *entries; // count and limit overlay entry 0
+	u_int16_t count;
+	u_int16_t at;
+};
+
+static u_int32_t rol32(u_int32_t word, unsigned int shift)
+{
+	return (word << shift) | (word >> (32 - shift));
+}
+
+#define DELTA 0x9E3779B9
+
+static void tea_transform(u_int32_t buf[4], const u_int32_t in[4])
+{
+	u_int32_t sum = 0;
+	u_int32_t b0 = buf[0], b1 = buf[1];
+	u_int32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+// F, G and H are basic MD4 functions: selection, majority, parity.
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s) \
+	(a += f(b, c, d) + x, a = rol32(a, s))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void half_md4_transform(u_int32_t buf[4], const u_int32_t in[8])
+{
+	u_int32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	// Round 1
+	ROUND(F, a, b, c, d, in[0] + K1, 3);
+	ROUND(F, d, a, b, c, in[1] + K1, 7);
+	ROUND(F, c, d, a, b, in[2] + K1, 11);
+	ROUND(F, b, c, d, a, in[3] + K1, 19);
+	ROUND(F, a, b, c, d, in[4] + K1, 3);
+	ROUND(F, d, a, b, c, in[5] + K1, 7);
+	ROUND(F, c, d, a, b, in[6] + K1, 11);
+	ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	// Round 2
+	ROUND(G, a, b, c, d, in[1] + K2, 3);
+	ROUND(G, d, a, b, c, in[3] + K2, 5);
+	ROUND(G, c, d, a, b, in[5] + K2, 9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2, 3);
+	ROUND(G, d, a, b, c, in[2] + K2, 5);
+	ROUND(G, c, d, a, b, in[4] + K2, 9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	// Round 3
+	ROUND(H, a, b, c, d, in[3] + K3, 3);
+	ROUND(H, d, a, b, c, in[7] + K3, 9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3, 3);
+	ROUND(H, d, a, b, c, in[5] + K3, 9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+static u_int32_t dx_hack_hash(const char *name, int len, int is_unsigned)
+{
+	u_int32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	int c;
+
+	while (len--) {
+		c = is_unsigned ? (int) (unsigned char) *name : (int) (signed char) *name;
+		name++;
+
+		hash = hash1 + (hash0 ^ (c * 7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, u_int32_t *buf, int num, int is_unsigned)
+{
+	u_int32_t pad, val;
+	int c;
+	int i;
+
+	pad = (u_int32_t) len | ((u_int32_t) len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+
+	for (i = 0; i < len; i++) {
+		c = is_unsigned ? (int) (unsigned char) msg[i] : (int) (signed char) msg[i];
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+// Hash a name the same way the kernel does when it builds the index.
+u_int32_t ext2_dx_hash(const char *name, int len, int version, const u_int32_t *seed, u_int32_t *minor_hash)
+{
+	u_int32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	u_int32_t in[8];
+	u_int32_t hash = 0;
+	u_int32_t minor = 0;
+	const char *p;
+	int remain;
+	int is_unsigned = version >= DX_HASH_LEGACY_UNSIGNED;
+	int i;
+
+	// an all zero seed means the default one.
+	for (i = 0; seed && i < 4; i++) {
+		if (seed[i]) {
+			memcpy(buf, seed, sizeof(buf));
+			break;
+		}
+	}
+
+	switch (version) {
+	case DX_HASH_LEGACY:
+	case DX_HASH_LEGACY_UNSIGNED:
+		hash = dx_hack_hash(name, len, is_unsigned);
+		break;
+	case DX_HASH_HALF_MD4:
+	case DX_HASH_HALF_MD4_UNSIGNED:
+		for (p = name, remain = len; remain > 0; remain -= 32, p += 32) {
+			str2hashbuf(p, remain, in, 8, is_unsigned);
+			half_md4_transform(buf, in);
+		}
+		minor = buf[2];
+		hash = buf[1];
+		break;
+	case DX_HASH_TEA:
+	case DX_HASH_TEA_UNSIGNED:
+		for (p = name, remain = len; remain > 0; remain -= 16, p += 16) {
+			str2hashbuf(p, remain, in, 4, is_unsigned);
+			tea_transform(buf, in);
+		}
+		hash = buf[0];
+		minor = buf[1];
+		break;
+	default:
+		return 0;
+	}
+
+	hash &= ~1;
+	if (hash == (DX_HASH_EOF << 1))
+		hash = (DX_HASH_EOF - 1) << 1;
+
+	if (minor_hash)
+		*minor_hash = minor;
+
+	return hash;
+}
+
+// Map the on-disk hash version to the one which is used to hash names.
+int ext2_dx_hash_version(const struct ext2_fs *fs, u_int8_t version)
+{
+	if (version <= DX_HASH_TEA && (fs->sb->s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+		return version + DX_HASH_LEGACY_UNSIGNED;
+
+	return version;
+}
+
+static int dir_block(const struct ext2_fs *fs, const struct ext2_inode *dir, u_int32_t lblk, struct ext2_block *b)
+{
+	u_int32_t block = ext2_bmap(fs, dir, lblk);
+
+	b->data = NULL;
+	b->buf = NULL;
+	if (!block)
+		return -1;
+
+	return ext2_get_block(fs, block, BCACHE_DIR, b);
+}
+
+// Scan one directory block. Returns 1 if found, 0 if not and -1 if the block is broken.
+static int search_block(const struct ext2_fs *fs, const unsigned char *block,
+			const char *name, int len, u_int32_t *ino, u_int8_t *file_type)
+{
+	u_int32_t offset = 0;
+
+	while (offset < fs->block_size) {
+		struct ext2_dentry_view d;
+		int rec_len = ext2_dentry_view_get(block, offset, fs->block_size, &d);
+
+		if (rec_len < 0)
+			return -1;
+
+		if (ext2_dentry_view_name_len(d) == len && ext2_dentry_view_inode(d) &&
+		    !memcmp(ext2_dentry_view_name(d), name, len)) {
+			*ino = ext2_dentry_view_inode(d);
+			if (file_type)
+				*file_type = ext2_dentry_view_file_type(d);
+			return 1;
+		}
+
+		offset += rec_len;
+	}
+
+	return 0;
+}
+
+u_int32_t ext2_lookup_linear(const struct ext2_fs *fs, const struct ext2_inode *dir,
+			     const char *name, int len, u_int8_t *file_type)
+{
+	int type;
+	u_int32_t ino = ext2_gen_lookup(fs, dir, name, len, &type);
+
+	if (ino && file_type)
+		*file_type = type;
+
+	return ino;
+}
+
+static u_int32_t dx_get_hash(const struct dx_frame *frame, u_int16_t at)
+{
+	return get_le32(frame->entries + at * sizeof(struct ext2_indexed_dentry));
+}
+
+static u_int32_t dx_get_block(const struct dx_frame *frame, u_int16_t at)
+{
+	return get_le32(frame->entries + at * sizeof(struct ext2_indexed_dentry) + sizeof(u_int32_t));
+}
+
+// Set up frame for the entry array at entries and pick the entry covering hash.
+static int dx_probe_entries(const struct ext2_fs *fs, const unsigned char *block,
+			    const unsigned char *entries, u_int32_t hash, struct dx_frame *frame)
+{
+	struct ext2_indexed_entry_count_and_limit cl;
+	int lo, hi;
+
+	cl.limit = get_le16(entries + offsetof(struct ext2_indexed_entry_count_and_limit, limit));
+	cl.count = get_le16(entries + offsetof(struct ext2_indexed_entry_count_and_limit, count));
+	if (cl.count == 0 || cl.count > cl.limit ||
+	    (entries - block) + cl.limit * sizeof(struct ext2_indexed_dentry) > fs->block_size)
+		return -1;
+
+	frame->entries = entries;
+	frame->count = cl.count;
+
+	// entry 0 covers every hash below entry 1's.
+	lo = 1;
+	hi = cl.count - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+
+		if (dx_get_hash(frame, mid) > hash)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	frame->at = lo - 1;
+
+	return 0;
+}
+
+// Replaces the block frame had pinned.
+static int dx_probe_node(const struct ext2_fs *fs, const struct ext2_inode *dir,
+			 u_int32_t lblk, u_int32_t hash, struct dx_frame *frame)
+{
+	ext2_put_block(fs, &frame->blk);
+
+	if (dir_block(fs, dir, lblk, &frame->blk) < 0)
+		return -1;
+
+	return dx_probe_entries(fs, frame->blk.data, frame->blk.data + DX_NODE_ENTRIES_OFFSET, hash, frame);
+}
+
+// Step to the next leaf if it may continue the run of entries with this hash.
+// Returns 1 and the leaf's logical block, 0 if there is none or -1 on a broken node.
+static int dx_next_leaf(const struct ext2_fs *fs, const struct ext2_inode *dir,
+			struct dx_frame *frames, int levels, u_int32_t hash, u_int32_t *lblk)
+{
+	int level;
+
+	for (level = levels; level >= 0; level--) {
+		if (frames[level].at + 1 < frames[level].count)
+			break;
+	}
+	if (level < 0)
+		return 0;
+
+	frames[level].at++;
+	// a set low bit marks a leaf which continues a hash collision.
+	if ((dx_get_hash(frames + level, frames[level].at) & ~1) != hash)
+		return 0;
+
+	while (level < levels) {
+		if (dx_probe_node(fs, dir, dx_get_block(frames + level, frames[level].at), 0, frames + level + 1) < 0)
+			return -1;
+		frames[++level].at = 0;
+	}
+
+	*lblk = dx_get_block(frames + levels, frames[levels].at);
+
+	return 1;
+}
+
+// Returns 1 if found, 0 if not found and -1 if the index can not be used.
+static int dx_lookup(const struct ext2_fs *fs, const struct ext2_inode *dir,
+		     const char *name, int len, u_int32_t *ino, u_int8_t *file_type)
+{
+	struct dx_frame frames[EXT2_DX_MAX_LEVELS];
+	struct ext2_dx_root_info info;
+	const unsigned char *root;
+	u_int32_t hash;
+	u_int32_t lblk;
+	int level;
+	int ret = -1;
+
+	memset(frames, 0x0, sizeof(frames));
+
+	if (dir_block(fs, dir, 0, &frames[0].blk) < 0)
+		return -1;
+	root = frames[0].blk.data;
+
+	memcpy(&info, root + DX_ROOT_INFO_OFFSET, sizeof(info));
+	info.reserved_zero = get_le32(root + DX_ROOT_INFO_OFFSET);
+	if (info.reserved_zero || info.info_length != sizeof(info) ||
+	    info.hash_version > DX_HASH_TEA || info.indirect_levels >= EXT2_DX_MAX_LEVELS)
+		goto out;
+
+	hash = ext2_dx_hash(name, len, ext2_dx_hash_version(fs, info.hash_version),
+			    fs->sb->s_hash_seed, NULL);
+
+	if (dx_probe_entries(fs, root, root + DX_ROOT_INFO_OFFSET + info.info_length, hash, frames) < 0)
+		goto out;
+
+	for (level = 0; level < info.indirect_levels; level++) {
+		if (dx_probe_node(fs, dir, dx_get_block(frames + level, frames[level].at),
+				  hash, frames + level + 1) < 0)
+			goto out;
+	}
+	lblk = dx_get_block(frames + level, frames[level].at);
+
+	while (1) {
+		struct ext2_block leaf;
+
+		if (dir_block(fs, dir, lblk, &leaf) < 0) {
+			ret = -1;
+			break;
+		}
+
+		ret = search_block(fs, leaf.data, name, len, ino, file_type);
+		ext2_put_block(fs, &leaf);
+		if (ret)
+			break;
+
+		ret = dx_next_leaf(fs, dir, frames, info.indirect_levels, hash, &lblk);
+		if (ret <= 0)
+			break;
+	}
+
+out:
+	// the index blocks stay pinned until the search is over.
+	for (level = 0; level < EXT2_DX_MAX_LEVELS; level++)
+		ext2_put_block(fs, &frames[level].blk);
+
+	return ret;
+}
+
+// Find name in directory dir. Indexed directories are searched through their
+// hash tree and only one leaf block is read; others are scanned linearly.
+// Returns the inode number or 0 if name does not exist.
+u_int32_t ext2_lookup(const struct ext2_fs *fs, const struct ext2_inode *dir,
+		      const char *name, int len, u_int8_t *file_type)
+{
+	u_int32_t ino = 0;
+
+	if (len <= 0 || len > EXT2_MAX_NAME_LENGTH)
+		return 0;
+
+	// "." and ".." are always in the first block.
+	if ((dir->i_flags & EXT2_INDEX_FL) &&
+	    (fs->sb->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+	    !(name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))) {
+		int ret = dx_lookup(fs, dir, name, len, &ino, file_type);
+
+		if (ret >= 0)
+			return ret ? ino : 0;
+	}
+
+	return ext2_lookup_linear(fs, dir, name, len, file_type);
+}
@@ -0,0 +1,17 @@
+#ifndef __MIKOOS_EXT2_HTREE_H
+#define __MIKOOS_EXT2_HTREE_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_inode.h"
+
+#define EXT2_DX_MAX_LEVELS 3
+
+u_int32_t ext2_dx_hash(const char *name, int len, int version, const u_int32_t *seed, u_int32_t *minor_hash);
+int ext2_dx_hash_version(const struct ext2_fs *fs, u_int8_t version);
+u_int32_t ext2_lookup(const struct ext2_fs *fs, const struct ext2_inode *dir,
+		      const char *name, int len, u_int8_t *file_type);
+u_int32_t ext2_lookup_linear(const struct ext2_fs *fs, const struct ext2_inode *dir,
+			     const char *name, int len, u_int8_t *file_type);
+
+#endif // __MIKOOS_EXT2_HTREE_H
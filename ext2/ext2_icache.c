@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_view.h"
+#include "ext2_icache.h"
+#include "bcache.h"
+
+// Ways per set. A table block can go in any way of the set its position in
+// the inode tables selects, so blocks which collide still fit.
+#define ICACHE_WAYS 4
+// Upper bound of table blocks when the cache is sized from the inode tables.
+#define ICACHE_MAX_BLOCKS (16 * 1024)
+
+// ICACHE_WAYS inode table blocks under one lock, which is never held while
+// a table block is read.
+struct icache_set {
+	pthread_mutex_t lock;
+	u_int32_t tick; // bumped on every use, for LRU replacement
+	u_int32_t block[ICACHE_WAYS]; // inode table block, 0 if the way is empty
+	u_int32_t used[ICACHE_WAYS]; // tick of the last use
+	struct ext2_icache_stat stat; // under the lock, summed by ext2_icache_get_stat()
+};
+
+struct ext2_icache {
+	const struct ext2_fs *fs;
+	u_int32_t inode_size;
+	u_int32_t inodes_per_block;
+	u_int32_t table_blocks; // inode table blocks of one group
+	unsigned int nr_sets;
+	struct icache_set *sets; // selected by the n-th table block of all groups
+	// decoded inodes, inodes_per_block for every way of every set. Way 0 of
+	// all sets comes first, so consecutive table blocks stay adjacent.
+	struct ext2_inode *inodes;
+};
+
+// nr_blocks is the number of inode table blocks kept decoded, 0 for every
+// inode table up to ICACHE_MAX_BLOCKS. Returns NULL if the inode size in the
+// super block can not be handled.
+struct ext2_icache *ext2_icache_create(const struct ext2_fs *fs, unsigned int nr_blocks)
+{
+	struct ext2_icache *ic;
+	u_int32_t inode_size = get_inode_size(*fs->sb);
+	u_int32_t inodes_per_block;
+	u_int32_t table_blocks;
+	unsigned int i;
+
+	if (inode_size < EXT2_GOOD_OLD_INODE_SIZE || inode_size > fs->block_size ||
+	    (inode_size & (inode_size - 1)))
+		return NULL;
+
+	inodes_per_block = fs->block_size / inode_size;
+	table_blocks = (fs->sb->s_inodes_per_group + inodes_per_block - 1) / inodes_per_block;
+	if (nr_blocks == 0) {
+		u_int64_t tables = (u_int64_t) table_blocks * fs->group_count;
+
+		nr_blocks = tables < ICACHE_MAX_BLOCKS ? tables : ICACHE_MAX_BLOCKS;
+	}
+
+	ic = calloc(1, sizeof(*ic));
+	assert(ic != NULL);
+
+	ic->fs = fs;
+	ic->inode_size = inode_size;
+	ic->inodes_per_block = inodes_per_block;
+	ic->table_blocks = table_blocks;
+	ic->nr_sets = (nr_blocks + ICACHE_WAYS - 1) / ICACHE_WAYS;
+	if (ic->nr_sets == 0)
+		ic->nr_sets = 1;
+
+	ic->sets = calloc(ic->nr_sets, sizeof(*ic->sets));
+	assert(ic->sets != NULL);
+	ic->inodes = malloc(sizeof(struct ext2_inode) * ic->inodes_per_block * ic->nr_sets * ICACHE_WAYS);
+	assert(ic->inodes != NULL);
+
+	for (i = 0; i < ic->nr_sets; i++)
+		pthread_mutex_init(&ic->sets[i].lock, NULL);
+
+	return ic;
+}
+
+void ext2_icache_destroy(struct ext2_icache *ic)
+{
+	unsigned int i;
+
+	if (!ic)
+		return ;
+
+	for (i = 0; i < ic->nr_sets; i++)
+		pthread_mutex_destroy(&ic->sets[i].lock);
+
+	free(ic->inodes);
+	free(ic->sets);
+	free(ic);
+}
+
+// Way of set holding block, or -1. Called with the set lock held.
+static int find_way(const struct icache_set *set, u_int32_t block)
+{
+	int i;
+
+	for (i = 0; i < ICACHE_WAYS; i++) {
+		if (set->block[i] == block)
+			return i;
+	}
+
+	return -1;
+}
+
+// An empty way, else the least recently used one. Called with the set lock held.
+static int victim_way(const struct icache_set *set)
+{
+	int victim = 0;
+	int i;
+
+	for (i = 0; i < ICACHE_WAYS; i++) {
+		if (!set->block[i])
+			return i;
+		if ((u_int32_t) (set->tick - set->used[i]) > (u_int32_t) (set->tick - set->used[victim]))
+			victim = i;
+	}
+
+	return victim;
+}
+
+// Decoded inodes of way of set.
+static struct ext2_inode *way_inodes(struct ext2_icache *ic, struct icache_set *set, int way)
+{
+	return ic->inodes + ((size_t) way * ic->nr_sets + (set - ic->sets)) * ic->inodes_per_block;
+}
+
+// A miss reads the table block without the set lock, then decodes it into
+// a way of the set unless another thread got there first.
+int ext2_icache_get(struct ext2_icache *ic, u_int32_t ino, struct ext2_inode *inode)
+{
+	const struct ext2_fs *fs = ic->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	struct icache_set *set;
+	struct ext2_block b;
+	u_int32_t group;
+	u_int32_t index;
+	u_int32_t block;
+	u_int32_t first;
+	u_int32_t count;
+	u_int32_t i;
+	int way;
+
+	if (ino == 0 || ino > sb->s_inodes_count)
+		return -1;
+
+	group = (ino - 1) / sb->s_inodes_per_group;
+	index = (ino - 1) % sb->s_inodes_per_group;
+	if (group >= fs->group_count)
+		return -1;
+
+	// consecutive table blocks of all groups go to consecutive sets, so a
+	// cache sized for every table has no set with more blocks than ways.
+	block = fs->groups[group].bg_inode_table + index / ic->inodes_per_block;
+	set = ic->sets + ((u_int64_t) group * ic->table_blocks + index / ic->inodes_per_block) % ic->nr_sets;
+
+	pthread_mutex_lock(&set->lock);
+	way = find_way(set, block);
+	if (way >= 0) {
+		set->used[way] = ++set->tick;
+		set->stat.hits++;
+		*inode = way_inodes(ic, set, way)[index % ic->inodes_per_block];
+		pthread_mutex_unlock(&set->lock);
+		return 0;
+	}
+	set->stat.misses++;
+	pthread_mutex_unlock(&set->lock);
+
+	if (ext2_get_block(fs, block, BCACHE_ITABLE, &b) < 0)
+		return -1;
+
+	// the table may end in the middle of its last block.
+	first = index - index % ic->inodes_per_block;
+	count = ic->inodes_per_block;
+	if (sb->s_inodes_per_group - first < count)
+		count = sb->s_inodes_per_group - first;
+
+	pthread_mutex_lock(&set->lock);
+	way = find_way(set, block);
+	if (way < 0) {
+		struct ext2_inode *inodes;
+
+		way = victim_way(set);
+		inodes = way_inodes(ic, set, way);
+		for (i = 0; i < count; i++) {
+			struct ext2_inode_view v = { b.data + i * ic->inode_size };
+
+			ext2_inode_decode(v, inodes + i);
+		}
+		set->block[way] = block;
+		set->stat.table_blocks++;
+		set->stat.inodes += count;
+	}
+	set->used[way] = ++set->tick;
+	*inode = way_inodes(ic, set, way)[index % ic->inodes_per_block];
+	pthread_mutex_unlock(&set->lock);
+	ext2_put_block(fs, &b);
+
+	return 0;
+}
+
+void ext2_icache_get_stat(struct ext2_icache *ic, struct ext2_icache_stat *st)
+{
+	unsigned int i;
+
+	memset(st, 0x0, sizeof(*st));
+	for (i = 0; i < ic->nr_sets; i++) {
+		struct icache_set *set = ic->sets + i;
+
+		pthread_mutex_lock(&set->lock);
+		st->hits += set->stat.hits;
+		st->misses += set->stat.misses;
+		st->table_blocks += set->stat.table_blocks;
+		st->inodes += set->stat.inodes;
+		pthread_mutex_unlock(&set->lock);
+	}
+}
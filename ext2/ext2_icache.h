@@ -0,0 +1,26 @@
+#ifndef __MIKOOS_EXT2_ICACHE_H
+#define __MIKOOS_EXT2_ICACHE_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_inode.h"
+
+// Decoded inode cache. A miss decodes every inode of the inode table block
+// which holds the wanted one, so neighbours are hits afterwards. Table blocks
+// live in small LRU sets, enough of them for every inode table by default.
+
+struct ext2_icache_stat {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long table_blocks; // inode table blocks decoded
+	unsigned long inodes; // inodes decoded
+};
+
+struct ext2_icache;
+
+struct ext2_icache *ext2_icache_create(const struct ext2_fs *fs, unsigned int nr_blocks);
+void ext2_icache_destroy(struct ext2_icache *ic);
+int ext2_icache_get(struct ext2_icache *ic, u_int32_t ino, struct ext2_inode *inode);
+void ext2_icache_get_stat(struct ext2_icache *ic, struct ext2_icache_stat *st);
+
+#endif // __MIKOOS_EXT2_ICACHE_H
@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_bitmap.h"
+#include "ext2_index.h"
+#include "ext2_view.h"
+#include "ext2_dirblock.h"
+#include "fsgen.h"
+#include "bcache.h"
+#include "dcache.h"
+
+#define ALIGN8(x) (((x) + 7) & ~7UL)
+
+// Growing arrays used while the index is built.
+struct index_builder {
+	const struct ext2_fs *fs;
+	struct ext2_index_node *nodes;
+	unsigned long nr_nodes;
+	unsigned long nodes_cap;
+	char *names;
+	unsigned long names_len;
+	unsigned long names_cap;
+	struct ext2_index_inode *inodes;
+	unsigned long nr_inodes;
+	unsigned long inodes_cap;
+	struct ext2_extent *extents;
+	unsigned long nr_extents;
+	unsigned long extents_cap;
+	unsigned char *seen; // one bit per inode
+};
+
+// One entry of the directory being expanded.
+struct child {
+	u_int32_t name_off; // the pool may move while the directory is read
+	const char *name;
+	u_int16_t name_len;
+	u_int8_t file_type;
+	u_int32_t ino;
+};
+
+static void *grow(void *p, unsigned long *cap, unsigned long need, unsigned long size)
+{
+	unsigned long n = *cap ? *cap : 64;
+
+	if (need <= *cap)
+		return p;
+
+	while (n < need)
+		n *= 2;
+	p = realloc(p, n * size);
+	assert(p != NULL);
+	*cap = n;
+
+	return p;
+}
+
+static u_int32_t add_name(struct index_builder *b, const char *name, u_int16_t len)
+{
+	u_int32_t off = b->names_len;
+
+	b->names = grow(b->names, &b->names_cap, b->names_len + len + 1, 1);
+	memcpy(b->names + off, name, len);
+	b->names[off + len] = '\0';
+	b->names_len += len + 1;
+
+	return off;
+}
+
+static int test_and_set(unsigned char *map, u_int32_t ino)
+{
+	int ret = map[ino / 8] & (1 << (ino % 8));
+
+	map[ino / 8] |= 1 << (ino % 8);
+
+	return ret;
+}
+
+static int compare_name(const char *a, int alen, const char *b, int blen)
+{
+	int ret = memcmp(a, b, alen < blen ? alen : blen);
+
+	return ret ? ret : alen - blen;
+}
+
+static int compare_child(const void *a, const void *b)
+{
+	const struct child *x = a;
+	const struct child *y = b;
+
+	return compare_name(x->name, x->name_len, y->name, y->name_len);
+}
+
+static int compare_inode(const void *a, const void *b)
+{
+	const struct ext2_index_inode *x = a;
+	const struct ext2_index_inode *y = b;
+
+	return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+// Children of a directory being read by expand_dir().
+struct index_dir {
+	struct index_builder *b;
+	struct child *children;
+	unsigned long nr;
+	unsigned long cap;
+};
+
+static void add_children(void *arg, const struct ext2_dirblock *blk)
+{
+	struct index_dir *d = arg;
+	int i;
+
+	for (i = 0; i < blk->count; i++) {
+		const struct ext2_dirent *e = blk->ents + i;
+		const char *name = ext2_dirent_name(blk, e);
+
+		if (fsgen_is_dot(name, e->name_len))
+			continue;
+
+		d->children = grow(d->children, &d->cap, d->nr + 1, sizeof(*d->children));
+		d->children[d->nr].name_off = add_name(d->b, name, e->name_len);
+		d->children[d->nr].name_len = e->name_len;
+		d->children[d->nr].ino = e->inode;
+		d->children[d->nr].file_type = e->file_type;
+		d->nr++;
+	}
+}
+
+// Append the entries of directory node as its children, sorted by name.
+static void expand_dir(struct index_builder *b, unsigned long node)
+{
+	const struct ext2_fs *fs = b->fs;
+	struct ext2_inode inode;
+	struct ext2_extent_list list;
+	struct index_dir d = { .b = b };
+	struct child *children = NULL;
+	unsigned long nr = 0;
+	unsigned long i;
+
+	if (ext2_read_inode(fs, b->nodes[node].ino, &inode) < 0 || (inode.i_mode & 0xf000) != EXT2_S_IFDIR)
+		return ;
+
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(fs, &inode, &list) < 0)
+		goto out;
+
+	// names are copied while the block is still held. Broken blocks are
+	// skipped as before.
+	ext2_dirblock_scan(fs, &list, add_children, &d);
+	children = d.children;
+	nr = d.nr;
+
+	for (i = 0; i < nr; i++)
+		children[i].name = b->names + children[i].name_off;
+	qsort(children, nr, sizeof(*children), compare_child);
+
+	b->nodes = grow(b->nodes, &b->nodes_cap, b->nr_nodes + nr, sizeof(*b->nodes));
+	b->nodes[node].first_child = b->nr_nodes;
+	b->nodes[node].nr_children = nr;
+	for (i = 0; i < nr; i++) {
+		struct ext2_index_node *n = b->nodes + b->nr_nodes++;
+
+		memset(n, 0x0, sizeof(*n));
+		n->ino = children[i].ino;
+		n->parent = node;
+		n->name_off = children[i].name_off;
+		n->name_len = children[i].name_len;
+		n->file_type = children[i].file_type;
+	}
+
+out:
+	free(d.children);
+	ext2_extent_list_free(&list);
+}
+
+static void add_inode(struct index_builder *b, u_int32_t ino)
+{
+	const struct ext2_fs *fs = b->fs;
+	struct ext2_index_inode *rec;
+	struct ext2_inode inode;
+	struct ext2_extent_list list;
+	u_int16_t type;
+
+	b->inodes = grow(b->inodes, &b->inodes_cap, b->nr_inodes + 1, sizeof(*b->inodes));
+	rec = b->inodes + b->nr_inodes++;
+	memset(rec, 0x0, sizeof(*rec));
+	rec->ino = ino;
+	rec->first_extent = b->nr_extents;
+
+	if (ext2_read_inode(fs, ino, &inode) < 0)
+		return ;
+
+	rec->mode = inode.i_mode;
+	rec->size = ext2_inode_size(&inode);
+
+	// fast symlinks and devices keep something else in i_block.
+	type = inode.i_mode & 0xf000;
+	if (type != EXT2_S_IFREG && type != EXT2_S_IFDIR)
+		return ;
+
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(fs, &inode, &list) == 0) {
+		b->extents = grow(b->extents, &b->extents_cap, b->nr_extents + list.count, sizeof(*b->extents));
+		memcpy(b->extents + b->nr_extents, list.extents, list.count * sizeof(*list.extents));
+		b->nr_extents += list.count;
+		rec->nr_extents = list.count;
+		rec->meta_blocks = list.meta_blocks;
+	}
+	ext2_extent_list_free(&list);
+}
+
+static void build_tree(struct index_builder *b)
+{
+	unsigned long i;
+
+	b->nodes = grow(b->nodes, &b->nodes_cap, 1, sizeof(*b->nodes));
+	memset(b->nodes, 0x0, sizeof(*b->nodes));
+	b->nodes[0].ino = EXT2_ROOT_INO;
+	b->nodes[0].name_off = add_name(b, "", 0);
+	b->nodes[0].file_type = EXT2_FT_DIR;
+	b->nr_nodes = 1;
+
+	// breadth first: children are appended behind the nodes still to visit.
+	test_and_set(b->seen, EXT2_ROOT_INO);
+	for (i = 0; i < b->nr_nodes; i++) {
+		u_int32_t ino = b->nodes[i].ino;
+
+		if (ino > b->fs->sb->s_inodes_count)
+			continue;
+		if (b->nodes[i].file_type != EXT2_FT_DIR && b->nodes[i].file_type != EXT2_FT_UNKNOWN)
+			continue;
+		// a directory seen before would loop.
+		if (i && test_and_set(b->seen, ino))
+			continue;
+		expand_dir(b, i);
+	}
+
+	memset(b->seen, 0x0, b->fs->sb->s_inodes_count / 8 + 1);
+	for (i = 0; i < b->nr_nodes; i++) {
+		u_int32_t ino = b->nodes[i].ino;
+
+		if (ino <= b->fs->sb->s_inodes_count && !test_and_set(b->seen, ino))
+			add_inode(b, ino);
+	}
+	qsort(b->inodes, b->nr_inodes, sizeof(*b->inodes), compare_inode);
+}
+
+static int write_section(FILE *fp, const void *p, unsigned long len)
+{
+	static const char zero[8];
+
+	if (len && fwrite(p, len, 1, fp) != 1)
+		return -1;
+	if (ALIGN8(len) != len && fwrite(zero, ALIGN8(len) - len, 1, fp) != 1)
+		return -1;
+
+	return 0;
+}
+
+// Walk the whole file system and write the index to path. The file is
+// written next to it first and renamed, so readers never see half of it.
+int ext2_index_build(const struct ext2_fs *fs, struct workpool *pool, const char *path)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	struct index_builder b;
+	struct ext2_bitmap_report report;
+	struct ext2_index_header hdr;
+	struct ext2_index_group *groups;
+	char *tmp;
+	FILE *fp;
+	unsigned long i;
+	int ret = -1;
+
+	if (ext2_check_bitmaps(fs, pool, &report) < 0)
+		return -1;
+
+	memset(&b, 0x0, sizeof(b));
+	b.fs = fs;
+	b.seen = calloc(1, sb->s_inodes_count / 8 + 1);
+	assert(b.seen != NULL);
+	build_tree(&b);
+
+	// without the filetype feature the types come from the modes.
+	for (i = 0; i < b.nr_nodes; i++) {
+		struct ext2_index_inode key = { .ino = b.nodes[i].ino };
+		const struct ext2_index_inode *rec;
+
+		if (b.nodes[i].file_type != EXT2_FT_UNKNOWN)
+			continue;
+		rec = bsearch(&key, b.inodes, b.nr_inodes, sizeof(key), compare_inode);
+		if (rec)
+			b.nodes[i].file_type = ext2_mode_to_file_type(rec->mode);
+	}
+
+	groups = calloc(report.group_count, sizeof(*groups));
+	assert(groups != NULL);
+	for (i = 0; i < report.group_count; i++) {
+		const struct ext2_group_bitmaps *gb = report.groups + i;
+
+		groups[i].free_blocks = gb->blocks.free;
+		groups[i].free_inodes = gb->inodes.free;
+		groups[i].free_runs = gb->blocks.free_runs;
+		groups[i].longest_free = gb->blocks.longest_free;
+		groups[i].longest_free_start = sb->s_first_data_block + i * sb->s_blocks_per_group +
+			gb->blocks.longest_free_start;
+	}
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, EXT2_INDEX_MAGIC, sizeof(EXT2_INDEX_MAGIC));
+	hdr.version = EXT2_INDEX_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.image_size = fs->size;
+	hdr.s_wtime = sb->s_wtime;
+	hdr.s_mtime = sb->s_mtime;
+	memcpy(hdr.s_uuid, sb->s_uuid, sizeof(hdr.s_uuid));
+	hdr.s_blocks_count = sb->s_blocks_count;
+	hdr.s_inodes_count = sb->s_inodes_count;
+	hdr.free_blocks = report.blocks.free;
+	hdr.free_inodes = report.inodes.free;
+	hdr.free_runs = report.blocks.free_runs;
+	hdr.longest_free = report.blocks.longest_free;
+	hdr.longest_free_start = report.blocks.longest_free_start;
+
+	hdr.nodes_off = ALIGN8(sizeof(hdr));
+	hdr.nr_nodes = b.nr_nodes;
+	hdr.names_off = hdr.nodes_off + ALIGN8(b.nr_nodes * sizeof(*b.nodes));
+	hdr.names_len = b.names_len;
+	hdr.inodes_off = hdr.names_off + ALIGN8(b.names_len);
+	hdr.nr_inodes = b.nr_inodes;
+	hdr.extents_off = hdr.inodes_off + ALIGN8(b.nr_inodes * sizeof(*b.inodes));
+	hdr.nr_extents = b.nr_extents;
+	hdr.groups_off = hdr.extents_off + ALIGN8(b.nr_extents * sizeof(*b.extents));
+	hdr.nr_groups = report.group_count;
+
+	tmp = malloc(strlen(path) + 5);
+	assert(tmp != NULL);
+	sprintf(tmp, "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+		goto out;
+	if (write_section(fp, &hdr, sizeof(hdr)) < 0 ||
+	    write_section(fp, b.nodes, b.nr_nodes * sizeof(*b.nodes)) < 0 ||
+	    write_section(fp, b.names, b.names_len) < 0 ||
+	    write_section(fp, b.inodes, b.nr_inodes * sizeof(*b.inodes)) < 0 ||
+	    write_section(fp, b.extents, b.nr_extents * sizeof(*b.extents)) < 0 ||
+	    write_section(fp, groups, report.group_count * sizeof(*groups)) < 0) {
+		fclose(fp);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	free(tmp);
+	free(groups);
+	free(b.nodes);
+	free(b.names);
+	free(b.inodes);
+	free(b.extents);
+	free(b.seen);
+	ext2_bitmap_report_free(&report);
+
+	return ret;
+}
+
+static int section_ok(const struct ext2_index *idx, u_int64_t off, u_int64_t nr, unsigned long size)
+{
+	return !(off % 8) && off <= idx->size && nr <= (idx->size - off) / size;
+}
+
+// Map the index at path if it was built from this file system.
+// Returns NULL if it is missing, stale or broken; build it again then.
+struct ext2_index *ext2_index_open(const struct ext2_fs *fs, const char *path)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_index_header *hdr;
+	struct ext2_index *idx;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	idx = calloc(1, sizeof(*idx));
+	assert(idx != NULL);
+	idx->map = map;
+	idx->size = st.st_size;
+	idx->hdr = hdr = map;
+
+	if (memcmp(hdr->magic, EXT2_INDEX_MAGIC, sizeof(EXT2_INDEX_MAGIC)) ||
+	    hdr->version != EXT2_INDEX_VERSION || hdr->header_size != sizeof(*hdr) ||
+	    hdr->image_size != fs->size ||
+	    hdr->s_wtime != sb->s_wtime || hdr->s_mtime != sb->s_mtime ||
+	    memcmp(hdr->s_uuid, sb->s_uuid, sizeof(hdr->s_uuid)) ||
+	    hdr->s_blocks_count != sb->s_blocks_count || hdr->s_inodes_count != sb->s_inodes_count)
+		goto stale;
+
+	if (!hdr->nr_nodes || !hdr->names_len ||
+	    !section_ok(idx, hdr->nodes_off, hdr->nr_nodes, sizeof(*idx->nodes)) ||
+	    !section_ok(idx, hdr->names_off, hdr->names_len, 1) ||
+	    !section_ok(idx, hdr->inodes_off, hdr->nr_inodes, sizeof(*idx->inodes)) ||
+	    !section_ok(idx, hdr->extents_off, hdr->nr_extents, sizeof(*idx->extents)) ||
+	    !section_ok(idx, hdr->groups_off, hdr->nr_groups, sizeof(*idx->groups)))
+		goto stale;
+
+	idx->nodes = (const void *) (idx->map + hdr->nodes_off);
+	idx->names = (const char *) (idx->map + hdr->names_off);
+	idx->inodes = (const void *) (idx->map + hdr->inodes_off);
+	idx->extents = (const void *) (idx->map + hdr->extents_off);
+	idx->groups = (const void *) (idx->map + hdr->groups_off);
+
+	// the last name must be terminated so no lookup runs off the pool.
+	if (idx->names[hdr->names_len - 1] != '\0')
+		goto stale;
+
+	return idx;
+
+stale:
+	ext2_index_close(idx);
+
+	return NULL;
+}
+
+void ext2_index_close(struct ext2_index *idx)
+{
+	if (!idx)
+		return ;
+
+	munmap((void *) idx->map, idx->size);
+	free(idx);
+}
+
+// Binary search the sorted children of node. Returns the node index or -1.
+static long find_child(const struct ext2_index *idx, u_int32_t node, const char *name, int len)
+{
+	const struct ext2_index_node *n = idx->nodes + node;
+	u_int32_t lo = n->first_child;
+	u_int32_t hi = n->first_child + n->nr_children;
+
+	if (hi > idx->hdr->nr_nodes || lo > hi)
+		return -1;
+
+	while (lo < hi) {
+		u_int32_t mid = lo + (hi - lo) / 2;
+		const struct ext2_index_node *c = idx->nodes + mid;
+		int ret;
+
+		if (c->name_off + (u_int64_t) c->name_len >= idx->hdr->names_len)
+			return -1;
+		ret = compare_name(name, len, ext2_index_node_name(idx, c), c->name_len);
+		if (!ret)
+			return mid;
+		if (ret < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return -1;
+}
+
+// Resolve an absolute path without touching the image. Returns the inode number or 0.
+u_int32_t ext2_index_lookup(const struct ext2_index *idx, const char *path)
+{
+	const char *name;
+	const char *next;
+	u_int32_t node = 0;
+	int len;
+
+	while ((len = path_next_component(path, &name, &next)) > 0) {
+		long child;
+
+		if (len == 2 && name[0] == '.' && name[1] == '.') {
+			node = idx->nodes[node].parent;
+		} else if (!(len == 1 && name[0] == '.')) {
+			child = find_child(idx, node, name, len);
+			if (child < 0)
+				return 0;
+			node = child;
+		}
+
+		if (node >= idx->hdr->nr_nodes)
+			return 0;
+		path = next;
+	}
+
+	return idx->nodes[node].ino;
+}
+
+const struct ext2_index_inode *ext2_index_find_inode(const struct ext2_index *idx, u_int32_t ino)
+{
+	struct ext2_index_inode key = { .ino = ino };
+	const struct ext2_index_inode *rec;
+
+	rec = bsearch(&key, idx->inodes, idx->hdr->nr_inodes, sizeof(key), compare_inode);
+	if (!rec || rec->first_extent + (u_int64_t) rec->nr_extents > idx->hdr->nr_extents)
+		return NULL;
+
+	return rec;
+}
@@ -0,0 +1,109 @@
+#ifndef __MIKOOS_EXT2_INDEX_H
+#define __MIKOOS_EXT2_INDEX_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_blockmap.h"
+
+// Metadata index sidecar. Building it walks the whole tree once; opening it
+// is one mmap, after which paths, inodes, block maps and free space come
+// straight out of the mapping. The file is only trusted while s_wtime,
+// s_mtime, the UUID and the image geometry still match the super block.
+//
+// Layout, every section 8 byte aligned and in host byte order:
+//   header
+//   nodes[]    directory tree in breadth first order, node 0 is the root.
+//              The children of a node are contiguous and sorted by name.
+//   names      every entry name, '\0' terminated
+//   inodes[]   sorted by inode number
+//   extents[]  block maps of the inodes, struct ext2_extent
+//   groups[]   free space of every block group
+
+#define EXT2_INDEX_MAGIC "EXT2IDX"
+#define EXT2_INDEX_VERSION 1
+
+struct ext2_index_header {
+	char magic[8];
+	u_int32_t version;
+	u_int32_t header_size;
+	// what the index was built from.
+	u_int64_t image_size;
+	u_int32_t s_wtime;
+	u_int32_t s_mtime;
+	u_int8_t s_uuid[16];
+	u_int32_t s_blocks_count;
+	u_int32_t s_inodes_count;
+	// free space of the whole file system.
+	u_int64_t free_blocks;
+	u_int64_t free_inodes;
+	u_int64_t free_runs;
+	u_int64_t longest_free;
+	u_int64_t longest_free_start; // absolute block number
+	// sections, offsets from the start of the file.
+	u_int64_t nodes_off;
+	u_int64_t nr_nodes;
+	u_int64_t names_off;
+	u_int64_t names_len;
+	u_int64_t inodes_off;
+	u_int64_t nr_inodes;
+	u_int64_t extents_off;
+	u_int64_t nr_extents;
+	u_int64_t groups_off;
+	u_int64_t nr_groups;
+};
+
+struct ext2_index_node {
+	u_int32_t ino;
+	u_int32_t parent; // node index, the root is its own parent
+	u_int32_t name_off;
+	u_int16_t name_len;
+	u_int8_t file_type;
+	u_int8_t pad;
+	u_int32_t first_child; // node index
+	u_int32_t nr_children;
+};
+
+struct ext2_index_inode {
+	u_int32_t ino;
+	u_int16_t mode;
+	u_int16_t pad;
+	u_int64_t size;
+	u_int32_t first_extent;
+	u_int32_t nr_extents;
+	u_int32_t meta_blocks; // indirect blocks
+	u_int32_t pad2;
+};
+
+struct ext2_index_group {
+	u_int32_t free_blocks;
+	u_int32_t free_inodes;
+	u_int32_t free_runs;
+	u_int32_t longest_free; // blocks
+	u_int32_t longest_free_start; // absolute block number
+	u_int32_t pad;
+};
+
+// An opened sidecar. Everything points into the mapping.
+struct ext2_index {
+	const unsigned char *map;
+	unsigned long size;
+	const struct ext2_index_header *hdr;
+	const struct ext2_index_node *nodes;
+	const char *names;
+	const struct ext2_index_inode *inodes;
+	const struct ext2_extent *extents;
+	const struct ext2_index_group *groups;
+};
+
+struct workpool;
+
+int ext2_index_build(const struct ext2_fs *fs, struct workpool *pool, const char *path);
+struct ext2_index *ext2_index_open(const struct ext2_fs *fs, const char *path);
+void ext2_index_close(struct ext2_index *idx);
+u_int32_t ext2_index_lookup(const struct ext2_index *idx, const char *path);
+const struct ext2_index_inode *ext2_index_find_inode(const struct ext2_index *idx, u_int32_t ino);
+
+#define ext2_index_node_name(idx, node) ((idx)->names + (node)->name_off)
+#define ext2_index_inode_extents(idx, inode) ((idx)->extents + (inode)->first_extent)
+
+#endif // __MIKOOS_EXT2_INDEX_H
@@ -51,10 +51,10 @@ enum {
 #define EXT2_NOCOMPR_FL 0x00000400 // access raw compressed data
 #define EXT2_ECOMPR_FL 0x00000800 // compression error
 /* End of compression flags */
-#define EXT2_BTREE_FL 0x00010000 // b-tree format directory
-#define EXT2_INDEX_FL 0x00010000 // hash indexed directory
-#define EXT2_IMAGIC_FL 0x00020000 // AFS directory
-#define EXT3_JOURNAL_DATA_FL 0x00040000 // journal file data
+#define EXT2_BTREE_FL 0x00001000 // b-tree format directory
+#define EXT2_INDEX_FL 0x00001000 // hash indexed directory
+#define EXT2_IMAGIC_FL 0x00002000 // AFS directory
+#define EXT3_JOURNAL_DATA_FL 0x00004000 // journal file data
 #define EXT2_RESERVED_FL 0x80000000 // reserved for ext2 library
 
 // inode table.
@@ -67,6 +67,7 @@ struct ext2_inode {
 	u_int32_t i_mtime;
 	u_int32_t i_dtime;
 	u_int16_t i_gid;
+	u_int16_t i_links_count;
 	u_int32_t i_blocks;
 	u_int32_t i_flags;
 	u_int32_t i_osd1;
@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_htree.h"
+#include "ext2_namei.h"
+#include "dcache.h"
+
+// Components are looked up through the htree index where there is one.
+#define FSGEN_LOOKUP(fs, dir, name, len, type) ext2_lookup(fs, dir, name, len, type)
+#include "ext2_traits.h"
+
+// Resolve an absolute path from the root directory. Returns its inode number
+// or 0. If fs has a dcache every component result is kept there, misses too.
+u_int32_t ext2_namei(const struct ext2_fs *fs, const char *path)
+{
+	return ext2_gen_namei(fs, EXT2_ROOT_INO, path, EXT2_MAX_NAME_LENGTH, fs->dcache);
+}
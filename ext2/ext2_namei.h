@@ -0,0 +1,9 @@
+#ifndef __MIKOOS_EXT2_NAMEI_H
+#define __MIKOOS_EXT2_NAMEI_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+
+u_int32_t ext2_namei(const struct ext2_fs *fs, const char *path);
+
+#endif // __MIKOOS_EXT2_NAMEI_H
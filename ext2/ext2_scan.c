@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_scan.h"
+#include "ext2_bitmap.h"
+#include "ext2_view.h"
+#include "bcache.h"
+#include "workpool.h"
+#include "instr.h"
+
+struct scan_ctx {
+	const struct ext2_fs *fs;
+	struct ext2_scan *scan;
+};
+
+// Count live entries of one directory block. Returns -1 if the rec_len chain is broken.
+static long count_dentries(const struct ext2_fs *fs, const unsigned char *block)
+{
+	u_int32_t offset = 0;
+	long count = 0;
+
+	while (offset < fs->block_size) {
+		struct ext2_dentry_view d;
+		int rec_len = ext2_dentry_view_get(block, offset, fs->block_size, &d);
+
+		if (rec_len < 0 || (rec_len & 3))
+			return -1;
+
+		if (ext2_dentry_view_inode(d))
+			count++;
+		offset += rec_len;
+	}
+
+	return count;
+}
+
+static void scan_directory(const struct ext2_fs *fs, const struct ext2_inode *inode, struct ext2_group_stat *st)
+{
+	struct ext2_extent_list list;
+	unsigned int i;
+	u_int32_t j;
+
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(fs, inode, &list) < 0) {
+		st->errors++;
+		goto out;
+	}
+
+	for (i = 0; i < list.count; i++) {
+		for (j = 0; j < list.extents[i].e_len; j++) {
+			u_int32_t pblk = list.extents[i].e_pblk + j;
+			struct ext2_block b;
+			long n = -1;
+
+			if (pblk && ext2_get_block(fs, pblk, BCACHE_DIR, &b) == 0) {
+				n = count_dentries(fs, b.data);
+				ext2_put_block(fs, &b);
+			}
+			if (n < 0)
+				st->errors++;
+			else
+				st->dentries += n;
+		}
+	}
+
+out:
+	ext2_extent_list_free(&list);
+}
+
+static void scan_group(void *arg, unsigned long group)
+{
+	struct scan_ctx *ctx = arg;
+	const struct ext2_fs *fs = ctx->fs;
+	const struct ext2_superblock *sb = fs->sb;
+	const struct ext2_blockgroup *bg = fs->groups + group;
+	struct ext2_group_stat *st = ctx->scan->groups + group;
+	struct ext2_group_bitmaps gb;
+	struct ext2_block bitmap = { NULL, NULL };
+	struct ext2_block table_block = { NULL, NULL };
+	unsigned long table = (unsigned long) bg->bg_inode_table * fs->block_size;
+	u_int32_t inode_size = get_inode_size(*sb);
+	u_int32_t per_block = fs->block_size / inode_size;
+	u_int32_t loaded = 0; // index of table_block in the inode table
+	u_int32_t i;
+	INSTR_START(t);
+
+	memset(st, 0x0, sizeof(*st));
+
+	if (ext2_group_bitmaps(fs, group, &gb) < 0 ||
+	    table + (unsigned long) sb->s_inodes_per_group * inode_size > fs->size ||
+	    !bg->bg_inode_bitmap ||
+	    ext2_get_block(fs, bg->bg_inode_bitmap, BCACHE_BITMAP, &bitmap) < 0) {
+		st->errors++;
+		goto out;
+	}
+
+	st->free_blocks = gb.blocks.free;
+	st->free_inodes = gb.inodes.free;
+
+	for (i = 0; i < sb->s_inodes_per_group; i++) {
+		struct ext2_inode_view v;
+		struct ext2_inode inode;
+		u_int16_t mode;
+
+		if (!(bitmap.data[i / 8] & (1 << (i % 8))))
+			continue;
+
+		// keep the table block until the scan moves past it.
+		if (!table_block.data || i / per_block != loaded) {
+			ext2_put_block(fs, &table_block);
+			loaded = i / per_block;
+			if (ext2_get_block(fs, bg->bg_inode_table + loaded, BCACHE_ITABLE, &table_block) < 0) {
+				st->errors++;
+				break;
+			}
+		}
+		v.p = table_block.data + (i % per_block) * inode_size;
+		mode = ext2_inode_view_i_mode(v);
+		if (mode == 0 || ext2_inode_view_i_dtime(v))
+			continue;
+
+		switch (mode & 0xf000) {
+		case EXT2_S_IFDIR:
+			st->dirs++;
+			ext2_inode_decode(v, &inode);
+			scan_directory(fs, &inode, st);
+			break;
+		case EXT2_S_IFREG:
+			st->files++;
+			break;
+		default:
+			st->others++;
+			break;
+		}
+	}
+
+out:
+	ext2_put_block(fs, &table_block);
+	ext2_put_block(fs, &bitmap);
+	INSTR_SPAN("scan", group, t);
+}
+
+static void merge_stat(struct ext2_group_stat *total, const struct ext2_group_stat *st)
+{
+	total->free_blocks += st->free_blocks;
+	total->free_inodes += st->free_inodes;
+	total->dirs += st->dirs;
+	total->files += st->files;
+	total->others += st->others;
+	total->dentries += st->dentries;
+	total->errors += st->errors;
+}
+
+// Scan every block group on the pool and merge the per group results.
+int ext2_scan_groups(const struct ext2_fs *fs, struct workpool *pool, struct ext2_scan *scan)
+{
+	struct scan_ctx ctx;
+	u_int32_t i;
+
+	memset(scan, 0x0, sizeof(*scan));
+	if (!fs->group_count)
+		return -1;
+
+	scan->groups = calloc(fs->group_count, sizeof(*scan->groups));
+	assert(scan->groups != NULL);
+	scan->group_count = fs->group_count;
+
+	ctx.fs = fs;
+	ctx.scan = scan;
+	workpool_for_each(pool, fs->group_count, scan_group, &ctx);
+
+	for (i = 0; i < scan->group_count; i++)
+		merge_stat(&scan->total, scan->groups + i);
+
+	return 0;
+}
+
+void ext2_scan_free(struct ext2_scan *scan)
+{
+	free(scan->groups);
+	memset(scan, 0x0, sizeof(*scan));
+}
@@ -0,0 +1,29 @@
+#ifndef __MIKOOS_EXT2_SCAN_H
+#define __MIKOOS_EXT2_SCAN_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+
+struct workpool;
+
+// What one worker found in its block group.
+struct ext2_group_stat {
+	u_int32_t free_blocks; // counted from the block bitmap
+	u_int32_t free_inodes; // counted from the inode bitmap
+	u_int32_t dirs;
+	u_int32_t files;
+	u_int32_t others;
+	unsigned long dentries; // entries in directories whose inode lives here
+	u_int32_t errors; // unreadable inodes or broken directory blocks
+};
+
+struct ext2_scan {
+	struct ext2_group_stat *groups;
+	u_int32_t group_count;
+	struct ext2_group_stat total;
+};
+
+int ext2_scan_groups(const struct ext2_fs *fs, struct workpool *pool, struct ext2_scan *scan);
+void ext2_scan_free(struct ext2_scan *scan);
+
+#endif // __MIKOOS_EXT2_SCAN_H
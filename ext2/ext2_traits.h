@@ -0,0 +1,69 @@
+#ifndef __MIKOOS_EXT2_TRAITS_H
+#define __MIKOOS_EXT2_TRAITS_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_view.h"
+#include "ext2_blockmap.h"
+#include "fsgen.h"
+
+// ext2 traits of the fsgen engine. Including this file makes the ext2_gen_*
+// functions of common/fsgen.h. A file may define FSGEN_LOOKUP before it.
+
+static inline const unsigned char *ext2_gen_get_block(const struct ext2_fs *fs, u_int32_t block,
+						      int type, struct ext2_block *b)
+{
+	return ext2_get_block(fs, block, type, b) < 0 ? NULL : b->data;
+}
+
+// Revision 0 keeps the high byte of name_len where the file type is.
+static inline int ext2_gen_dentry(const struct ext2_fs *fs, const unsigned char *block,
+				  u_int32_t offset, struct fsgen_dentry *d)
+{
+	struct ext2_dentry_view v;
+	int rec_len = ext2_dentry_view_get(block, offset, fs->block_size, &v);
+
+	if (rec_len < 0)
+		return -1;
+
+	d->ino = ext2_dentry_view_inode(v);
+	d->name = ext2_dentry_view_name(v);
+	d->name_len = ext2_dentry_view_name_len(v);
+	d->type = fs->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE ?
+		ext2_dentry_view_file_type(v) : EXT2_FT_UNKNOWN;
+
+	return rec_len;
+}
+
+static inline int ext2_gen_entry_type(const struct ext2_fs *fs, const struct fsgen_dentry *d)
+{
+	struct ext2_inode inode;
+
+	if (ext2_read_inode(fs, d->ino, &inode) < 0)
+		return EXT2_FT_UNKNOWN;
+
+	return ext2_mode_to_file_type(inode.i_mode);
+}
+
+#define FSGEN_NAME(x) ext2_gen_##x
+#define FSGEN_FS const struct ext2_fs *
+#define FSGEN_INODE struct ext2_inode
+#define FSGEN_BLOCK struct ext2_block
+#define FSGEN_BLOCK_SIZE(fs) ((fs)->block_size)
+#define FSGEN_READ_INODE(fs, ino, inode) ext2_read_inode(fs, ino, inode)
+#define FSGEN_IS_DIR(inode) (((inode)->i_mode & 0xf000) == EXT2_S_IFDIR)
+#define FSGEN_SIZE(inode) ext2_inode_size(inode)
+#define FSGEN_BMAP(fs, inode, lblk) ext2_bmap(fs, inode, lblk)
+#define FSGEN_GET_BLOCK(fs, block, type, b) ext2_gen_get_block(fs, block, type, b)
+#define FSGEN_PUT_BLOCK(fs, b) ext2_put_block(fs, b)
+#define FSGEN_DENTRY(fs, data, offset, d) ext2_gen_dentry(fs, data, offset, d)
+#define FSGEN_ENTRY_TYPE(fs, d) ext2_gen_entry_type(fs, d)
+#define FSGEN_FT_UNKNOWN EXT2_FT_UNKNOWN
+#define FSGEN_FT_DIR EXT2_FT_DIR
+#define FSGEN_PREFETCH(fs, blocks, nr) ext2_prefetch_blocks(fs, blocks, nr)
+#define FSGEN_CAN_PREFETCH(fs) ((fs)->bcache != NULL)
+#include "fsgen.h"
+
+#endif // __MIKOOS_EXT2_TRAITS_H
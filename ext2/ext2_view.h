@@ -0,0 +1,131 @@
+#ifndef __MIKOOS_EXT2_VIEW_H
+#define __MIKOOS_EXT2_VIEW_H 1
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include "byteorder.h"
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+
+// Read-only views of on-disk structures inside the mapped image.
+// A view is only handed out after its bounds were checked. Fields are
+// decoded little endian on access, so nothing is copied to read one field.
+
+#define EXT2_SUPER_MAGIC 0xEF53
+
+struct ext2_sb_view {
+	const unsigned char *p;
+};
+
+struct ext2_inode_view {
+	const unsigned char *p;
+};
+
+struct ext2_dentry_view {
+	const unsigned char *p;
+};
+
+#define EXT2_VIEW_FIELD8(view, type, field) \
+static inline u_int8_t view##_##field(struct view v) \
+{ \
+	return v.p[offsetof(type, field)]; \
+}
+
+#define EXT2_VIEW_FIELD16(view, type, field) \
+static inline u_int16_t view##_##field(struct view v) \
+{ \
+	return get_le16(v.p + offsetof(type, field)); \
+}
+
+#define EXT2_VIEW_FIELD32(view, type, field) \
+static inline u_int32_t view##_##field(struct view v) \
+{ \
+	return get_le32(v.p + offsetof(type, field)); \
+}
+
+EXT2_VIEW_FIELD16(ext2_sb_view, struct ext2_superblock, s_magic)
+
+EXT2_VIEW_FIELD16(ext2_inode_view, struct ext2_inode, i_mode)
+EXT2_VIEW_FIELD32(ext2_inode_view, struct ext2_inode, i_size)
+EXT2_VIEW_FIELD32(ext2_inode_view, struct ext2_inode, i_dtime)
+EXT2_VIEW_FIELD16(ext2_inode_view, struct ext2_inode, i_links_count)
+EXT2_VIEW_FIELD32(ext2_inode_view, struct ext2_inode, i_blocks)
+EXT2_VIEW_FIELD32(ext2_inode_view, struct ext2_inode, i_flags)
+EXT2_VIEW_FIELD32(ext2_inode_view, struct ext2_inode, i_dir_acl)
+
+EXT2_VIEW_FIELD32(ext2_dentry_view, struct ext2_dentry, inode)
+EXT2_VIEW_FIELD16(ext2_dentry_view, struct ext2_dentry, rec_len)
+EXT2_VIEW_FIELD8(ext2_dentry_view, struct ext2_dentry, name_len)
+EXT2_VIEW_FIELD8(ext2_dentry_view, struct ext2_dentry, file_type)
+
+static inline u_int32_t ext2_inode_view_i_block(struct ext2_inode_view v, int index)
+{
+	return get_le32(v.p + offsetof(struct ext2_inode, i_block) + index * sizeof(u_int32_t));
+}
+
+// The name is not '\0' terminated; its length is ext2_dentry_view_name_len().
+static inline const char *ext2_dentry_view_name(struct ext2_dentry_view v)
+{
+	return (const char *) v.p + sizeof(struct ext2_dentry);
+}
+
+static inline int ext2_dentry_view_name_is(struct ext2_dentry_view v, const char *name, int len)
+{
+	return ext2_dentry_view_name_len(v) == len && !memcmp(ext2_dentry_view_name(v), name, len);
+}
+
+// dentry file type of an inode mode.
+static inline u_int8_t ext2_mode_to_file_type(u_int16_t mode)
+{
+	switch (mode & 0xf000) {
+	case EXT2_S_IFREG: return EXT2_FT_REG_FILE;
+	case EXT2_S_IFDIR: return EXT2_FT_DIR;
+	case EXT2_S_IFCHR: return EXT2_FT_CHRDEV;
+	case EXT2_S_IFBLK: return EXT2_FT_BLKDEV;
+	case EXT2_S_IFIFO: return EXT2_FT_FIFO;
+	case EXT2_S_IFSOCK: return EXT2_FT_SOCK;
+	case EXT2_S_IFLNK: return EXT2_FT_SYMLINK;
+	}
+
+	return EXT2_FT_UNKNOWN;
+}
+
+// View the super block of an image. Fails if it is cut off or the magic is wrong.
+static inline int ext2_sb_view_get(const unsigned char *image, unsigned long size, struct ext2_sb_view *v)
+{
+	if (size < SUPER_BLOCK_SIZE + sizeof(struct ext2_superblock))
+		return -1;
+
+	v->p = image + SUPER_BLOCK_SIZE;
+	if (ext2_sb_view_s_magic(*v) != EXT2_SUPER_MAGIC)
+		return -1;
+
+	return 0;
+}
+
+// View the dentry at offset in a directory block of limit bytes. Returns its
+// rec_len, or -1 if the entry is cut off or its rec_len/name_len are broken.
+static inline int ext2_dentry_view_get(const unsigned char *block, unsigned long offset,
+				       unsigned long limit, struct ext2_dentry_view *v)
+{
+	u_int16_t rec_len;
+
+	if (offset >= limit || limit - offset < sizeof(struct ext2_dentry))
+		return -1;
+
+	v->p = block + offset;
+	rec_len = ext2_dentry_view_rec_len(*v);
+	if (rec_len < sizeof(struct ext2_dentry) || rec_len > limit - offset ||
+	    ext2_dentry_view_name_len(*v) + sizeof(struct ext2_dentry) > rec_len)
+		return -1;
+
+	return rec_len;
+}
+
+int ext2_inode_view_get(const struct ext2_fs *fs, u_int32_t ino, struct ext2_inode_view *v,
+			struct ext2_block *b);
+void ext2_inode_decode(struct ext2_inode_view v, struct ext2_inode *inode);
+
+#endif // __MIKOOS_EXT2_VIEW_H
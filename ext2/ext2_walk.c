@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ext2fs.h"
+#include "ext2_walk.h"
+#include "ext2_traits.h"
+
+int ext2_walk(const struct ext2_fs *fs, struct workpool *pool, int flags,
+	      treewalk_fn fn, void *arg, struct treewalk_stat *st)
+{
+	struct treewalk w = {
+		.fs = (void *) fs,
+		.readdir = ext2_gen_walk_readdir,
+		.root = EXT2_ROOT_INO,
+		.max_ino = fs->sb->s_inodes_count,
+	};
+
+	return treewalk_run(&w, pool, flags, fn, arg, st);
+}
@@ -0,0 +1,16 @@
+#ifndef __MIKOOS_EXT2_WALK_H
+#define __MIKOOS_EXT2_WALK_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "treewalk.h"
+
+struct workpool;
+
+// Walk every directory below EXT2_ROOT_INO on the pool. e->type is an
+// EXT2_FT_* value; on file systems without the filetype feature it is
+// taken from the inode.
+int ext2_walk(const struct ext2_fs *fs, struct workpool *pool, int flags,
+	      treewalk_fn fn, void *arg, struct treewalk_stat *st);
+
+#endif // __MIKOOS_EXT2_WALK_H
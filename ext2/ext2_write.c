@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_view.h"
+#include "ext2_blockmap.h"
+#include "ext2_write.h"
+
+// Structures are written in host order like ext2mkimg does, so this
+// assumes a little endian host.
+
+#define EXT2_LINK_MAX 32000
+
+// Features whose on-disk format this code knows how to keep intact.
+#define WRITE_INCOMPAT EXT2_FEATURE_INCOMPAT_FILETYPE
+#define WRITE_RO_COMPAT (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+
+// Map an image for writing. Images with features whose structures would
+// have to be kept up to date (journal recovery, meta_bg, compression...)
+// are refused.
+int ext2_writer_open(struct ext2_writer *w, const char *path)
+{
+	struct stat st;
+	void *p;
+
+	memset(w, 0x0, sizeof(*w));
+	w->fd = open(path, O_RDWR);
+	if (w->fd < 0)
+		return -1;
+	if (fstat(w->fd, &st) < 0 || st.st_size < SUPER_BLOCK_SIZE * 2)
+		goto err_close;
+
+	p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+	if (p == MAP_FAILED)
+		goto err_close;
+	w->image = p;
+	w->size = st.st_size;
+	w->sb = (struct ext2_superblock *) (w->image + SUPER_BLOCK_SIZE);
+
+	// a file system which is mounted, or was not unmounted cleanly, is left alone.
+	if (w->sb->s_magic != EXT2_SUPER_MAGIC || w->sb->s_log_block_size > 2 ||
+	    !(w->sb->s_state & EXT2_VALID_FS) || (w->sb->s_state & EXT2_ERROR_FS))
+		goto err_unmap;
+	if (w->sb->s_rev_level != EXT2_GOOD_OLD_REV &&
+	    ((w->sb->s_feature_incompat & ~WRITE_INCOMPAT) ||
+	     (w->sb->s_feature_ro_compat & ~WRITE_RO_COMPAT)))
+		goto err_unmap;
+
+	w->fs.image = w->image;
+	w->fs.size = w->size;
+	w->fs.sb = w->sb;
+	w->fs.block_size = get_block_size(*w->sb);
+	if (ext2_load_groups(&w->fs) < 0)
+		goto err_unmap;
+	if (ext2_alloc_init(&w->alloc, &w->fs, w->image) < 0)
+		goto err_groups;
+
+	w->filetype = w->sb->s_rev_level != EXT2_GOOD_OLD_REV &&
+		(w->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE);
+	w->now = time(NULL);
+
+	return 0;
+
+err_groups:
+	ext2_free_groups(&w->fs);
+err_unmap:
+	munmap(w->image, w->size);
+err_close:
+	close(w->fd);
+
+	return -1;
+}
+
+// Every ext2_wfile must be closed. The free counts go to the primary
+// descriptors and super block only; e2fsck does not look at the backups'.
+int ext2_writer_close(struct ext2_writer *w)
+{
+	struct ext2_blockgroup *gdt = (struct ext2_blockgroup *)
+		(w->image + (u_int64_t) (w->sb->s_first_data_block + 1) * w->fs.block_size);
+	int ret = 0;
+
+	ext2_alloc_sync(&w->alloc, gdt, w->sb);
+	if (w->large_file && w->sb->s_rev_level != EXT2_GOOD_OLD_REV)
+		w->sb->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+	w->sb->s_wtime = w->now;
+
+	if (msync(w->image, w->size, MS_SYNC) < 0)
+		ret = -1;
+	munmap(w->image, w->size);
+	if (close(w->fd) < 0)
+		ret = -1;
+
+	ext2_alloc_destroy(&w->alloc);
+	ext2_free_groups(&w->fs);
+
+	return ret;
+}
+
+static unsigned char *inode_slot(struct ext2_writer *w, u_int32_t ino)
+{
+	struct ext2_inode_view v;
+	struct ext2_block b;
+
+	// the image is mapped and no cache is used, so b pins nothing.
+	if (ext2_inode_view_get(&w->fs, ino, &v, &b) < 0)
+		return NULL;
+
+	return w->image + (v.p - w->fs.image);
+}
+
+static unsigned char *block_data(struct ext2_writer *w, u_int32_t block)
+{
+	return w->image + (u_int64_t) block * w->fs.block_size;
+}
+
+static int block_in_image(const struct ext2_writer *w, u_int32_t block)
+{
+	return block && block < w->sb->s_blocks_count &&
+		((u_int64_t) block + 1) * w->fs.block_size <= w->size;
+}
+
+// Allocate a block after the last one of f. want is how many more blocks
+// the caller is about to need; the window is at least the preallocation size.
+static u_int32_t new_block(struct ext2_wfile *f, u_int32_t want)
+{
+	struct ext2_alloc *a = &f->w->alloc;
+	u_int32_t window = (f->inode.i_mode & 0xf000) == EXT2_S_IFDIR ?
+		a->prealloc_dir_blocks : a->prealloc_blocks;
+	u_int32_t block;
+
+	block = ext2_alloc_block(f->ctx, f->goal, want > window ? want : window, &f->pa);
+	if (!block)
+		return 0;
+
+	f->goal = block + 1;
+	f->inode.i_blocks += f->w->fs.block_size / 512;
+
+	return block;
+}
+
+// Where the block number of logical block lblk is kept: in i_block or in
+// an indirect block. Missing indirect blocks are allocated if create is
+// set. Returns NULL if lblk is out of reach or a block is not in the image.
+static u_int32_t *block_slot(struct ext2_wfile *f, u_int64_t lblk, int create, u_int32_t want)
+{
+	u_int64_t per_block = f->w->fs.block_size / sizeof(u_int32_t);
+	u_int64_t span = 1;
+	u_int32_t *slot;
+	int depth;
+
+	if (lblk < EXT2_NDIR_BLOCKS)
+		return f->inode.i_block + lblk;
+
+	lblk -= EXT2_NDIR_BLOCKS;
+	for (depth = 1; lblk >= span * per_block; depth++) {
+		lblk -= span * per_block;
+		span *= per_block;
+		if (depth == 3)
+			return NULL;
+	}
+
+	// span is what one entry of the top level block covers.
+	slot = f->inode.i_block + EXT2_IND_BLOCK + depth - 1;
+	for (; depth > 0; depth--) {
+		if (!*slot) {
+			u_int32_t block;
+
+			if (!create || !(block = new_block(f, want)))
+				return NULL;
+			memset(block_data(f->w, block), 0x0, f->w->fs.block_size);
+			*slot = block;
+		}
+		if (!block_in_image(f->w, *slot))
+			return NULL;
+
+		slot = (u_int32_t *) block_data(f->w, *slot) + (lblk / span) % per_block;
+		span /= per_block;
+	}
+
+	return slot;
+}
+
+// A fresh inode: its table slot is cleared, so an inode larger than
+// struct ext2_inode starts with no extra fields.
+static int new_inode(struct ext2_wfile *f, struct ext2_writer *w, struct ext2_alloc_ctx *ctx,
+		     u_int32_t ino, u_int16_t mode, u_int16_t links)
+{
+	unsigned char *p = inode_slot(w, ino);
+	u_int32_t inode_size = get_inode_size(*w->sb);
+
+	memset(f, 0x0, sizeof(*f));
+	if (!p || (u_int64_t) (p - w->image) + inode_size > w->size)
+		return -1;
+	memset(p, 0x0, inode_size);
+
+	f->w = w;
+	f->ctx = ctx;
+	f->ino = ino;
+	f->inode.i_mode = mode;
+	f->inode.i_links_count = links;
+	f->inode.i_atime = f->inode.i_ctime = f->inode.i_mtime = w->now;
+	f->goal = w->alloc.groups[(ino - 1) / w->alloc.inodes_per_group].first_block;
+
+	return 0;
+}
+
+// Undo the creation of an inode which is not in any directory. Such an
+// inode has at most its direct blocks.
+static void discard(struct ext2_wfile *f)
+{
+	int dir = (f->inode.i_mode & 0xf000) == EXT2_S_IFDIR;
+	int i;
+
+	ext2_alloc_release(f->ctx, &f->pa);
+	// fast symlinks and devices keep other things in i_block.
+	if (f->inode.i_blocks) {
+		for (i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+			if (f->inode.i_block[i])
+				ext2_free_blocks(f->ctx, f->inode.i_block[i], 1);
+		}
+	}
+	ext2_free_inode(f->ctx, f->ino, dir);
+}
+
+static int check_name(const char *name)
+{
+	int len = strlen(name);
+
+	if (!len || len > EXT2_MAX_NAME_LENGTH || strchr(name, '/') ||
+	    !strcmp(name, ".") || !strcmp(name, ".."))
+		return -1;
+
+	return len;
+}
+
+static void set_entry(const struct ext2_writer *w, struct ext2_dentry *d, const char *name, int len,
+		      u_int32_t ino, u_int8_t file_type)
+{
+	d->inode = ino;
+	d->name_len = len;
+	// revision 0 has a 16 bit name_len and no file type.
+	d->file_type = w->filetype ? file_type : 0;
+	memcpy(d->name, name, len);
+}
+
+// Put an entry in the first block from the hint on which has room for it,
+// splitting the slack off the entry before it, or else in a new block at
+// the end. Directories which existed before are searched whole for the
+// name first. Returns -1 if the name exists, a block is broken or the
+// image is full.
+static int add_entry(struct ext2_wfile *dir, const char *name, int len, u_int32_t ino, u_int8_t file_type)
+{
+	struct ext2_writer *w = dir->w;
+	u_int32_t block_size = w->fs.block_size;
+	u_int32_t need = (sizeof(struct ext2_dentry) + len + 3) & ~3;
+	u_int64_t nr = dir->size / block_size;
+	struct ext2_dentry *room = NULL;
+	u_int32_t room_used = 0;
+	u_int32_t *slot;
+	u_int64_t lblk;
+
+	for (lblk = dir->check_names ? 0 : dir->hint; lblk < nr && (!room || dir->check_names); lblk++) {
+		unsigned char *data;
+		u_int32_t off = 0;
+
+		slot = block_slot(dir, lblk, 0, 0);
+		if (!slot || !block_in_image(w, *slot))
+			return -1;
+		data = block_data(w, *slot);
+
+		while (off < block_size) {
+			struct ext2_dentry *d = (struct ext2_dentry *) (data + off);
+			u_int32_t used = d->inode ? (sizeof(*d) + d->name_len + 3) & ~3 : 0;
+
+			if (d->rec_len < sizeof(*d) || d->rec_len % 4 || off + d->rec_len > block_size ||
+			    used > d->rec_len)
+				return -1;
+			if (d->inode && d->name_len == len && !memcmp(d->name, name, len))
+				return -1;
+			if (!room && lblk >= dir->hint && d->rec_len - used >= need) {
+				room = d;
+				room_used = used;
+				dir->hint = lblk;
+				if (!dir->check_names)
+					break;
+			}
+			off += d->rec_len;
+		}
+	}
+
+	if (room) {
+		if (room_used) {
+			struct ext2_dentry *d = (struct ext2_dentry *) ((unsigned char *) room + room_used);
+
+			d->rec_len = room->rec_len - room_used;
+			room->rec_len = room_used;
+			room = d;
+		}
+		set_entry(w, room, name, len, ino, file_type);
+
+		return 0;
+	}
+
+	slot = block_slot(dir, nr, 1, 1);
+	if (!slot || !(*slot = new_block(dir, 1)))
+		return -1;
+	room = (struct ext2_dentry *) block_data(w, *slot);
+	memset(room, 0x0, block_size);
+	room->rec_len = block_size;
+	set_entry(w, room, name, len, ino, file_type);
+	dir->size += block_size;
+	dir->hint = nr;
+
+	return 0;
+}
+
+// Open a directory of the image to add entries to it. An htree index is
+// dropped because new entries would not be in it; its blocks read as
+// empty entries, so the directory stays valid as a plain one.
+int ext2_wdir_open(struct ext2_writer *w, struct ext2_alloc_ctx *ctx, u_int32_t ino, struct ext2_wfile *dir)
+{
+	u_int32_t *slot;
+
+	memset(dir, 0x0, sizeof(*dir));
+	dir->w = w;
+	dir->ctx = ctx;
+	dir->ino = ino;
+	if (ext2_read_inode(&w->fs, ino, &dir->inode) < 0 ||
+	    (dir->inode.i_mode & 0xf000) != EXT2_S_IFDIR ||
+	    !dir->inode.i_size || dir->inode.i_size % w->fs.block_size)
+		return -1;
+
+	dir->size = dir->inode.i_size;
+	dir->inode.i_flags &= ~EXT2_INDEX_FL;
+	dir->check_names = 1;
+	dir->goal = w->alloc.groups[(ino - 1) / w->alloc.inodes_per_group].first_block;
+	slot = block_slot(dir, dir->size / w->fs.block_size - 1, 0, 0);
+	if (slot && block_in_image(w, *slot))
+		dir->goal = *slot + 1;
+
+	return 0;
+}
+
+// Make a directory in dir. If child is not NULL the new directory is left
+// open there. Returns its inode number, or 0.
+u_int32_t ext2_wdir_mkdir(struct ext2_wfile *dir, const char *name, u_int16_t mode, struct ext2_wfile *child)
+{
+	struct ext2_wfile tmp;
+	struct ext2_wfile *c = child ? child : &tmp;
+	int len = check_name(name);
+	u_int32_t ino;
+
+	if (len < 0 || dir->inode.i_links_count >= EXT2_LINK_MAX)
+		return 0;
+
+	ino = ext2_alloc_inode(dir->ctx, dir->ino, 1);
+	if (!ino)
+		return 0;
+	if (new_inode(c, dir->w, dir->ctx, ino, EXT2_S_IFDIR | (mode & 07777), 2) < 0) {
+		ext2_free_inode(dir->ctx, ino, 1);
+		return 0;
+	}
+
+	if (add_entry(c, ".", 1, ino, EXT2_FT_DIR) < 0 ||
+	    add_entry(c, "..", 2, dir->ino, EXT2_FT_DIR) < 0 ||
+	    add_entry(dir, name, len, ino, EXT2_FT_DIR) < 0) {
+		discard(c);
+		return 0;
+	}
+	dir->inode.i_links_count++;
+
+	if (!child)
+		ext2_wfile_close(c);
+
+	return ino;
+}
+
+// Make an empty regular file in dir, left open in file if that is not NULL.
+u_int32_t ext2_wdir_create(struct ext2_wfile *dir, const char *name, u_int16_t mode, struct ext2_wfile *file)
+{
+	struct ext2_wfile tmp;
+	struct ext2_wfile *f = file ? file : &tmp;
+	int len = check_name(name);
+	u_int32_t ino;
+
+	if (len < 0 || !(ino = ext2_alloc_inode(dir->ctx, dir->ino, 0)))
+		return 0;
+	if (new_inode(f, dir->w, dir->ctx, ino, EXT2_S_IFREG | (mode & 07777), 1) < 0) {
+		ext2_free_inode(dir->ctx, ino, 0);
+		return 0;
+	}
+	if (add_entry(dir, name, len, ino, EXT2_FT_REG_FILE) < 0) {
+		discard(f);
+		return 0;
+	}
+
+	if (!file)
+		ext2_wfile_close(f);
+
+	return ino;
+}
+
+// Targets shorter than i_block are kept in it, longer ones in a block.
+// The link is left open in link if that is not NULL.
+u_int32_t ext2_wdir_symlink(struct ext2_wfile *dir, const char *name, const char *target, struct ext2_wfile *link)
+{
+	struct ext2_wfile tmp;
+	struct ext2_wfile *f = link ? link : &tmp;
+	int len = check_name(name);
+	unsigned long target_len = strlen(target);
+	u_int32_t ino;
+
+	if (len < 0 || !target_len || target_len >= dir->w->fs.block_size ||
+	    !(ino = ext2_alloc_inode(dir->ctx, dir->ino, 0)))
+		return 0;
+	if (new_inode(f, dir->w, dir->ctx, ino, EXT2_S_IFLNK | 0777, 1) < 0) {
+		ext2_free_inode(dir->ctx, ino, 0);
+		return 0;
+	}
+
+	if (target_len < sizeof(f->inode.i_block)) {
+		memcpy(f->inode.i_block, target, target_len);
+		f->size = target_len;
+	} else if (ext2_wfile_write(f, target, target_len) < 0) {
+		discard(f);
+		return 0;
+	}
+	if (add_entry(dir, name, len, ino, EXT2_FT_SYMLINK) < 0) {
+		discard(f);
+		return 0;
+	}
+
+	if (!link)
+		ext2_wfile_close(f);
+
+	return ino;
+}
+
+// A device, fifo or socket; mode carries the file type. The inode is left
+// open in node if that is not NULL.
+u_int32_t ext2_wdir_mknod(struct ext2_wfile *dir, const char *name, u_int16_t mode, u_int32_t major, u_int32_t minor,
+			  struct ext2_wfile *node)
+{
+	struct ext2_wfile tmp;
+	struct ext2_wfile *f = node ? node : &tmp;
+	int len = check_name(name);
+	u_int8_t file_type;
+	u_int32_t ino;
+
+	switch (mode & 0xf000) {
+	case EXT2_S_IFCHR: file_type = EXT2_FT_CHRDEV; break;
+	case EXT2_S_IFBLK: file_type = EXT2_FT_BLKDEV; break;
+	case EXT2_S_IFIFO: file_type = EXT2_FT_FIFO; break;
+	case EXT2_S_IFSOCK: file_type = EXT2_FT_SOCK; break;
+	default: return 0;
+	}
+
+	if (len < 0 || !(ino = ext2_alloc_inode(dir->ctx, dir->ino, 0)))
+		return 0;
+	if (new_inode(f, dir->w, dir->ctx, ino, mode, 1) < 0) {
+		ext2_free_inode(dir->ctx, ino, 0);
+		return 0;
+	}
+
+	// the old encoding where it fits, like Linux.
+	if (file_type == EXT2_FT_CHRDEV || file_type == EXT2_FT_BLKDEV) {
+		if (major < 256 && minor < 256)
+			f->inode.i_block[0] = major << 8 | minor;
+		else
+			f->inode.i_block[1] = (minor & 0xff) | (major << 8) | ((minor & ~0xff) << 12);
+	}
+	if (add_entry(dir, name, len, ino, file_type) < 0) {
+		discard(f);
+		return 0;
+	}
+
+	if (!node)
+		ext2_wfile_close(f);
+
+	return ino;
+}
+
+static int is_zero(const unsigned char *p, unsigned long len)
+{
+	return !len || (!p[0] && !memcmp(p, p + 1, len - 1));
+}
+
+// Append len bytes. Whole blocks of zeros are left as holes. Returns -1 if
+// the image is full or the file would be too big; what was written before
+// stays.
+int ext2_wfile_write(struct ext2_wfile *f, const void *buf, unsigned long len)
+{
+	struct ext2_writer *w = f->w;
+	u_int32_t block_size = w->fs.block_size;
+	const unsigned char *p = buf;
+
+	if (w->sb->s_rev_level == EXT2_GOOD_OLD_REV && f->size + len >= 0x80000000ULL)
+		return -1;
+
+	while (len) {
+		u_int64_t lblk = f->size / block_size;
+		u_int32_t off = f->size % block_size;
+		u_int32_t n = block_size - off < len ? block_size - off : len;
+		// blocks still to come in this call, this one included.
+		u_int32_t want = (off + len + block_size - 1) / block_size;
+		u_int32_t *slot;
+
+		if (!off && is_zero(p, n)) {
+			f->size += n;
+			p += n;
+			len -= n;
+			continue;
+		}
+
+		slot = block_slot(f, lblk, 1, want);
+		if (!slot)
+			return -1;
+		if (!*slot) {
+			u_int32_t block = new_block(f, want);
+
+			if (!block)
+				return -1;
+			// a block taken from the free space holds whatever was there.
+			if (n < block_size)
+				memset(block_data(w, block), 0x0, block_size);
+			*slot = block;
+		}
+		memcpy(block_data(w, *slot) + off, p, n);
+
+		f->size += n;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+// Write the inode back and give up the unused part of the window.
+int ext2_wfile_close(struct ext2_wfile *f)
+{
+	unsigned char *p = inode_slot(f->w, f->ino);
+
+	ext2_alloc_release(f->ctx, &f->pa);
+	if (!p)
+		return -1;
+
+	f->inode.i_size = f->size;
+	if ((f->inode.i_mode & 0xf000) == EXT2_S_IFREG && f->w->sb->s_rev_level != EXT2_GOOD_OLD_REV) {
+		f->inode.i_dir_acl = f->size >> 32; // i_size_high
+		if (f->size >= 0x80000000ULL)
+			__atomic_store_n(&f->w->large_file, 1, __ATOMIC_RELAXED);
+	}
+	memcpy(p, &f->inode, sizeof(f->inode));
+
+	return 0;
+}
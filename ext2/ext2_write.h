@@ -0,0 +1,56 @@
+#ifndef __MIKOOS_EXT2_WRITE_H
+#define __MIKOOS_EXT2_WRITE_H 1
+
+#include <sys/types.h>
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_alloc.h"
+
+// Adding files to an existing image in place, without mounting it. The
+// image is mapped shared and written through the mapping; fs reads the
+// same mapping, so lookups and the read side see what was written.
+//
+// Many threads may write at once, each with its own ext2_alloc_ctx, as
+// long as every inode is open in at most one ext2_wfile at a time. Entries
+// are only ever added: nothing is removed, renamed or truncated.
+
+struct ext2_writer {
+	int fd;
+	unsigned char *image;
+	unsigned long size;
+	struct ext2_superblock *sb; // in the image
+	struct ext2_fs fs;
+	struct ext2_alloc alloc;
+	int filetype; // entries carry a file type
+	int large_file; // a file of 2G or more was written
+	u_int32_t now;
+};
+
+// An inode open for writing. inode may be changed by the caller (owner,
+// times, mode bits) until ext2_wfile_close() writes it back. A handle may
+// move to another thread if its ctx is set to that thread's.
+struct ext2_wfile {
+	struct ext2_writer *w;
+	struct ext2_alloc_ctx *ctx;
+	u_int32_t ino;
+	struct ext2_inode inode;
+	u_int64_t size;
+	u_int32_t goal; // block after the last one allocated
+	u_int32_t hint; // directories: first block worth looking for room in
+	int check_names; // directories which existed before: refuse duplicates
+	struct ext2_prealloc pa;
+};
+
+int ext2_writer_open(struct ext2_writer *w, const char *path);
+int ext2_writer_close(struct ext2_writer *w);
+
+int ext2_wdir_open(struct ext2_writer *w, struct ext2_alloc_ctx *ctx, u_int32_t ino, struct ext2_wfile *dir);
+u_int32_t ext2_wdir_mkdir(struct ext2_wfile *dir, const char *name, u_int16_t mode, struct ext2_wfile *child);
+u_int32_t ext2_wdir_create(struct ext2_wfile *dir, const char *name, u_int16_t mode, struct ext2_wfile *file);
+u_int32_t ext2_wdir_symlink(struct ext2_wfile *dir, const char *name, const char *target, struct ext2_wfile *link);
+u_int32_t ext2_wdir_mknod(struct ext2_wfile *dir, const char *name, u_int16_t mode, u_int32_t major, u_int32_t minor,
+			  struct ext2_wfile *node);
+int ext2_wfile_write(struct ext2_wfile *f, const void *buf, unsigned long len);
+int ext2_wfile_close(struct ext2_wfile *f);
+
+#endif // __MIKOOS_EXT2_WRITE_H
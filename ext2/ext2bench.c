@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "ext2_view.h"
+#include "ext2_blockmap.h"
+#include "ext2_namei.h"
+#include "ext2_icache.h"
+#include "ext2_file.h"
+#include "ext2_traits.h"
+#include "dcache.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "bench.h"
+#include "instr.h"
+
+// Time the parsing hot paths against one image.
+// usage: ext2bench [image] [seconds per benchmark]
+
+#define MAX_PATHS 4096
+#define MAX_DEPTH 64
+#define READ_BUF_SIZE (1024 * 1024)
+
+struct bench_ctx {
+	struct ext2_fs fs;
+	struct ext2_superblock sb;
+	char **paths; // every file and directory below the root
+	u_int32_t *files; // regular files
+	unsigned long nr_paths;
+	unsigned long nr_files;
+	unsigned char *buf;
+	u_int64_t *walk_bytes; // bytes counter of the running tree walk
+};
+
+// Call fn for every live entry of directory ino. Returns the number of
+// entries, or -1 if the directory can not be read.
+static long for_each_dentry(const struct ext2_fs *fs, u_int32_t ino, u_int64_t *bytes,
+			    void (*fn)(void *arg, const struct fsgen_dentry *d), void *arg)
+{
+	struct ext2_inode dir;
+	struct ext2_gen_dir it;
+	struct fsgen_dentry d;
+	long count = 0;
+
+	if (ext2_read_inode(fs, ino, &dir) < 0 || (dir.i_mode & 0xf000) != EXT2_S_IFDIR)
+		return -1;
+
+	ext2_gen_dir_open(&it, fs, &dir);
+	while (ext2_gen_dir_next(&it, &d)) {
+		count++;
+		if (fn)
+			fn(arg, &d);
+	}
+	ext2_gen_dir_close(&it);
+	*bytes += (u_int64_t) it.nr_blocks * fs->block_size;
+
+	return count;
+}
+
+struct collect {
+	struct bench_ctx *ctx;
+	char path[4096];
+	int len;
+	int depth;
+};
+
+static void collect_dentry(void *arg, const struct fsgen_dentry *d)
+{
+	struct collect *c = arg;
+	struct bench_ctx *ctx = c->ctx;
+	const char *name = d->name;
+	int name_len = d->name_len;
+	int type = d->type;
+	u_int64_t bytes = 0;
+	int len = c->len;
+
+	if (fsgen_is_dot(name, name_len) || len + name_len + 2 > sizeof(c->path))
+		return ;
+
+	c->path[len] = '/';
+	memcpy(c->path + len + 1, name, name_len);
+	c->len = len + name_len + 1;
+	c->path[c->len] = '\0';
+
+	if (ctx->nr_paths < MAX_PATHS)
+		ctx->paths[ctx->nr_paths++] = strdup(c->path);
+
+	if (type == EXT2_FT_REG_FILE && ctx->nr_files < MAX_PATHS)
+		ctx->files[ctx->nr_files++] = d->ino;
+
+	if (type == EXT2_FT_DIR && c->depth < MAX_DEPTH) {
+		c->depth++;
+		for_each_dentry(&ctx->fs, d->ino, &bytes, collect_dentry, c);
+		c->depth--;
+	}
+
+	c->len = len;
+	c->path[len] = '\0';
+}
+
+static unsigned long bench_superblock(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	struct ext2_superblock sb;
+	struct ext2_sb_view v;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if (ext2_sb_view_get(ctx->fs.image, ctx->fs.size, &v) < 0)
+			return 0;
+		memcpy(&sb, v.p, sizeof(sb));
+		__asm__ volatile("" : : "r" (&sb) : "memory");
+	}
+	*bytes += 1000 * sizeof(sb);
+
+	return 1000;
+}
+
+static unsigned long bench_gdt(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	struct ext2_fs fs = ctx->fs;
+
+	if (ext2_load_groups(&fs) < 0)
+		return 0;
+	*bytes += fs.group_count * sizeof(struct ext2_blockgroup);
+	ext2_free_groups(&fs);
+
+	return 1;
+}
+
+static void walk_dentry(void *arg, const struct fsgen_dentry *d)
+{
+	struct bench_ctx *ctx = arg;
+
+	if (d->type == EXT2_FT_DIR && !fsgen_is_dot(d->name, d->name_len))
+		for_each_dentry(&ctx->fs, d->ino, ctx->walk_bytes, walk_dentry, ctx);
+}
+
+// Enumerate the whole tree; one op per directory entry of the root.
+static unsigned long bench_readdir(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	long n = for_each_dentry(&ctx->fs, EXT2_ROOT_INO, bytes, NULL, NULL);
+
+	return n > 0 ? n : 0;
+}
+
+static unsigned long bench_walk(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+
+	ctx->walk_bytes = bytes;
+	for_each_dentry(&ctx->fs, EXT2_ROOT_INO, bytes, walk_dentry, ctx);
+
+	return ctx->nr_paths;
+}
+
+static unsigned long bench_lookup(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	unsigned long i;
+
+	for (i = 0; i < ctx->nr_paths; i++) {
+		if (!ext2_namei(&ctx->fs, ctx->paths[i]))
+			return 0;
+	}
+
+	return ctx->nr_paths;
+}
+
+static unsigned long bench_inode(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	struct ext2_inode inode;
+	u_int32_t ino;
+	u_int32_t count = ctx->sb.s_inodes_count;
+
+	if (count > 65536)
+		count = 65536;
+
+	for (ino = 1; ino <= count; ino++) {
+		if (ext2_read_inode(&ctx->fs, ino, &inode) < 0)
+			return 0;
+	}
+	*bytes += (u_int64_t) count * get_inode_size(ctx->sb);
+
+	return count;
+}
+
+static unsigned long bench_read(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	unsigned long i;
+
+	for (i = 0; i < ctx->nr_files; i++) {
+		struct ext2_file file;
+		long len;
+
+		if (ext2_file_open(&ctx->fs, ctx->files[i], &file) < 0)
+			return 0;
+		while ((len = ext2_file_read(&file, ctx->buf, READ_BUF_SIZE)) > 0)
+			*bytes += len;
+		ext2_file_close(&file);
+	}
+
+	return ctx->nr_files;
+}
+
+int main(int argc, char **argv)
+{
+	const char *image = argc > 1 ? argv[1] : "./hda.img";
+	double seconds = argc > 2 ? atof(argv[2]) : 0.5;
+	struct bench_ctx ctx;
+	struct collect c;
+	struct blkio *io;
+	struct ext2_sb_view v;
+	u_int64_t bytes = 0;
+	unsigned long i;
+
+	instr_setup();
+
+	memset(&ctx, 0x0, sizeof(ctx));
+
+	io = blkio_open(image, BLKIO_MMAP);
+	if (!io) {
+		printf("can not open %s\n", image);
+		exit(-1);
+	}
+
+	ctx.fs.image = blkio_load(io);
+	ctx.fs.size = blkio_size(io);
+	if (!ctx.fs.image || ext2_sb_view_get(ctx.fs.image, ctx.fs.size, &v) < 0) {
+		printf("%s is not an ext2 image\n", image);
+		exit(-1);
+	}
+	memcpy(&ctx.sb, v.p, sizeof(ctx.sb));
+	ctx.fs.sb = &ctx.sb;
+	ctx.fs.block_size = get_block_size(ctx.sb);
+	if (ext2_load_groups(&ctx.fs) < 0) {
+		printf("broken block group descriptor table\n");
+		exit(-1);
+	}
+
+	ctx.paths = calloc(MAX_PATHS, sizeof(*ctx.paths));
+	ctx.files = calloc(MAX_PATHS, sizeof(*ctx.files));
+	ctx.buf = malloc(READ_BUF_SIZE);
+	assert(ctx.paths != NULL && ctx.files != NULL && ctx.buf != NULL);
+
+	memset(&c, 0x0, sizeof(c));
+	c.ctx = &ctx;
+	for_each_dentry(&ctx.fs, EXT2_ROOT_INO, &bytes, collect_dentry, &c);
+
+	printf("%s: %u byte blocks, %u groups, %lu paths, %lu regular files\n",
+	       image, ctx.fs.block_size, ctx.fs.group_count, ctx.nr_paths, ctx.nr_files);
+	bench_header();
+
+	bench_run("superblock parse", bench_superblock, &ctx, seconds);
+	bench_run("gdt load", bench_gdt, &ctx, seconds);
+	bench_run("readdir root", bench_readdir, &ctx, seconds);
+	bench_run("tree walk (per path)", bench_walk, &ctx, seconds);
+	bench_run("inode decode", bench_inode, &ctx, seconds);
+	bench_run("path lookup", bench_lookup, &ctx, seconds);
+
+	ctx.fs.icache = ext2_icache_create(&ctx.fs, 0);
+	bench_run("inode decode (icache)", bench_inode, &ctx, seconds);
+	bench_run("path lookup (icache)", bench_lookup, &ctx, seconds);
+
+	ctx.fs.dcache = dcache_create(MAX_PATHS * 2);
+	bench_run("path lookup (icache+dcache)", bench_lookup, &ctx, seconds);
+
+	bench_run("file read", bench_read, &ctx, seconds);
+
+	dcache_destroy(ctx.fs.dcache);
+	ext2_icache_destroy(ctx.fs.icache);
+	for (i = 0; i < ctx.nr_paths; i++)
+		free(ctx.paths[i]);
+	free(ctx.paths);
+	free(ctx.files);
+	free(ctx.buf);
+	ext2_free_groups(&ctx.fs);
+	blkio_unload(io, (unsigned char *) ctx.fs.image);
+	blkio_close(io);
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ext2fs.h"
+#include "ext2_view.h"
+#include "ext2_dedup.h"
+#include "dedup.h"
+#include "hash.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "workpool.h"
+#include "instr.h"
+
+// Duplicate blocks and files within and across ext2 images. Arguments are
+// images, which are hashed, or index files written earlier with -w, which
+// are just mapped.
+
+static char **names;
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int scan_image(const char *image, int backend, struct workpool *pool, struct dedup_index *idx)
+{
+	struct blkio *io;
+	struct ext2_superblock sb;
+	struct ext2_fs fs;
+	struct ext2_dedup_stat st;
+	struct timespec start, end;
+	int ret = -1;
+
+	io = blkio_open(image, backend);
+	if (!io)
+		return -1;
+
+	memset(&fs, 0x0, sizeof(fs));
+	fs.size = blkio_size(io);
+	if (backend == BLKIO_MMAP) {
+		struct ext2_sb_view v;
+
+		fs.image = blkio_load(io);
+		if (!fs.image || ext2_sb_view_get(fs.image, fs.size, &v) < 0)
+			goto out;
+		memcpy(&sb, v.p, sizeof(sb));
+	} else {
+		if (blkio_read(io, &sb, SUPER_BLOCK_SIZE, sizeof(sb)) != sizeof(sb) ||
+		    sb.s_magic != EXT2_SUPER_MAGIC)
+			goto out;
+	}
+	fs.sb = &sb;
+	fs.block_size = get_block_size(sb);
+	if (!fs.image)
+		fs.bcache = bcache_create(io, fs.block_size, 64 * 1024 * 1024);
+	if (ext2_load_groups(&fs) < 0)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = ext2_dedup_scan(&fs, pool, idx, &st);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!ret)
+		printf("%s: hashed %lu files, %.1f MiB in %.3f s (%.1f MiB/s), %lu errors\n",
+		       image, st.files, st.bytes / 1048576.0, elapsed(&start, &end),
+		       st.bytes / 1048576.0 / elapsed(&start, &end), st.errors);
+
+	ext2_free_groups(&fs);
+
+out:
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+	if (fs.image)
+		blkio_unload(io, (unsigned char *) fs.image);
+	blkio_close(io);
+
+	return ret;
+}
+
+static void print_dup_files(void *arg, u_int64_t hash, const struct dedup_ref *refs, unsigned long nr)
+{
+	unsigned long i;
+
+	printf("%016llx %llu bytes:", (unsigned long long) hash, (unsigned long long) refs[0].size);
+	for (i = 0; i < nr; i++)
+		printf(" %s:%u", names[refs[i].image], refs[i].ino);
+	printf("\n");
+}
+
+static void print_stat(const char *name, const struct dedup_stat *st)
+{
+	const struct dedup_count *b = &st->blocks;
+	const struct dedup_count *f = &st->files;
+
+	printf("%s: %llu blocks, %llu duplicate (%.1f%%), %llu shared : %llu files, %llu duplicate, %llu shared\n",
+	       name, (unsigned long long) b->all, (unsigned long long) b->dup,
+	       b->all ? 100.0 * b->dup / b->all : 0.0, (unsigned long long) b->shared,
+	       (unsigned long long) f->all, (unsigned long long) f->dup, (unsigned long long) f->shared);
+}
+
+int main(int argc, char **argv)
+{
+	int backend = BLKIO_MMAP;
+	int nr_threads = 0;
+	int verbose = 0;
+	int write_index = 0;
+	struct dedup_index *idx;
+	struct dedup_stat *per_image;
+	struct dedup_stat total;
+	struct workpool *pool;
+	int nr;
+	int i;
+	int opt;
+
+	instr_setup();
+
+	while ((opt = getopt(argc, argv, "vwt:b:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'w':
+			write_index = 1;
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'b':
+			if ((backend = blkio_parse_backend(optarg)) < 0)
+				goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+
+	names = argv + optind;
+	nr = argc - optind;
+	idx = calloc(nr, sizeof(*idx));
+	per_image = calloc(nr, sizeof(*per_image));
+	assert(idx != NULL && per_image != NULL);
+
+	printf("hash: %s\n", hash64_impl());
+	pool = workpool_create(nr_threads);
+	for (i = 0; i < nr; i++) {
+		char *path;
+
+		if (!dedup_index_open(names[i], idx + i))
+			continue;
+
+		if (scan_image(names[i], backend, pool, idx + i) < 0) {
+			printf("%s is neither an index nor a readable ext2 image\n", names[i]);
+			exit(-1);
+		}
+		if (!write_index)
+			continue;
+
+		path = malloc(strlen(names[i]) + 7);
+		assert(path != NULL);
+		sprintf(path, "%s.dedup", names[i]);
+		if (dedup_index_write(idx + i, path) < 0)
+			printf("writing %s failed\n", path);
+		free(path);
+	}
+	workpool_destroy(pool);
+
+	for (i = 1; i < nr; i++) {
+		if (idx[i].block_size != idx[0].block_size)
+			printf("warning: %s has %u byte blocks, %s has %u\n", names[i], idx[i].block_size,
+			       names[0], idx[0].block_size);
+	}
+
+	dedup_compare(idx, nr, per_image, &total, verbose ? print_dup_files : NULL, NULL);
+
+	for (i = 0; i < nr; i++)
+		print_stat(names[i], per_image + i);
+	if (nr > 1)
+		print_stat("total", &total);
+
+	for (i = 0; i < nr; i++)
+		dedup_index_free(idx + i);
+	free(per_image);
+	free(idx);
+
+	return 0;
+
+usage:
+	printf("usage: %s [-v] [-w] [-t threads] [-b mmap|pread|uring] image|index ...\n", argv[0]);
+	exit(-1);
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ext2fs.h"
+#include "ext2_view.h"
+#include "ext2_du.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "workpool.h"
+#include "emit.h"
+#include "instr.h"
+
+// Heaviest directories of an ext2 image, like du | sort -rn | head.
+// Sizes are what i_blocks says is allocated, or i_size with -a.
+
+int main(int argc, char **argv)
+{
+	const char *image;
+	const char *out_path = NULL;
+	int backend = BLKIO_MMAP;
+	int format = -1;
+	int nr_threads = 0;
+	int by_bytes = 0;
+	unsigned long nr_top = 10;
+	struct blkio *io;
+	struct ext2_superblock sb;
+	struct ext2_fs fs;
+	struct ext2_du du;
+	struct workpool *pool;
+	struct emit *out = NULL;
+	struct timespec start, end;
+	u_int32_t *top;
+	unsigned long n;
+	unsigned long i;
+	int opt;
+
+	instr_setup();
+
+	while ((opt = getopt(argc, argv, "an:t:e:o:")) != -1) {
+		switch (opt) {
+		case 'a':
+			by_bytes = 1;
+			break;
+		case 'n':
+			nr_top = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'e':
+			if ((format = emit_parse_format(optarg)) < 0)
+				goto usage;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+	image = argv[optind++];
+	if (optind < argc && (backend = blkio_parse_backend(argv[optind++])) < 0)
+		goto usage;
+	if (optind < argc || (format >= 0 && !out_path))
+		goto usage;
+
+	io = blkio_open(image, backend);
+	if (!io) {
+		printf("can not open %s\n", image);
+		exit(-1);
+	}
+
+	memset(&fs, 0x0, sizeof(fs));
+	fs.size = blkio_size(io);
+	if (backend == BLKIO_MMAP) {
+		struct ext2_sb_view v;
+
+		fs.image = blkio_load(io);
+		if (!fs.image || ext2_sb_view_get(fs.image, fs.size, &v) < 0)
+			goto bad_image;
+		memcpy(&sb, v.p, sizeof(sb));
+	} else {
+		if (blkio_read(io, &sb, SUPER_BLOCK_SIZE, sizeof(sb)) != sizeof(sb) ||
+		    sb.s_magic != EXT2_SUPER_MAGIC)
+			goto bad_image;
+	}
+	fs.sb = &sb;
+	fs.block_size = get_block_size(sb);
+	if (!fs.image)
+		fs.bcache = bcache_create(io, fs.block_size, 64 * 1024 * 1024);
+	if (ext2_load_groups(&fs) < 0)
+		goto bad_image;
+
+	if (out_path) {
+		out = emit_open(out_path, format < 0 ? EMIT_NDJSON : format);
+		if (!out) {
+			printf("can not open %s\n", out_path);
+			exit(-1);
+		}
+	}
+
+	pool = workpool_create(nr_threads);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (ext2_du_scan(&fs, pool, &du) < 0)
+		goto bad_image;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	workpool_destroy(pool);
+
+	top = malloc((nr_top ? nr_top : 1) * sizeof(*top));
+	assert(top != NULL);
+	n = ext2_du_top(&du, nr_top, by_bytes, top);
+
+	for (i = 0; i < n; i++) {
+		const struct ext2_du_dir *d = du.dirs + top[i];
+		char path[4096];
+
+		ext2_du_path(&fs, &du, top[i], path, sizeof(path));
+		printf("%12llu KiB %10llu inodes  %s\n",
+		       (unsigned long long) (by_bytes ? (d->bytes + 1023) / 1024 : d->blocks / 2),
+		       (unsigned long long) d->inodes, path);
+
+		emit_begin(out, "du");
+		emit_u64(out, "inode", d->ino);
+		emit_u64(out, "blocks", d->blocks);
+		emit_u64(out, "bytes", d->bytes);
+		emit_u64(out, "inodes", d->inodes);
+		emit_str(out, "path", path, strlen(path));
+		emit_end(out);
+	}
+
+	printf("%s: %u dirs, %lu files, %lu hard linked, %lu unattached, %lu errors in %.3f s\n",
+	       image, du.nr_dirs, du.files, du.hard_links, du.unattached, du.errors,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	free(top);
+	ext2_du_free(&du);
+	ext2_free_groups(&fs);
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+	if (fs.image)
+		blkio_unload(io, (unsigned char *) fs.image);
+	blkio_close(io);
+
+	if (out && emit_close(out) < 0) {
+		printf("writing %s failed\n", out_path);
+		exit(-1);
+	}
+
+	return 0;
+
+bad_image:
+	printf("%s is not a readable ext2 image\n", image);
+	exit(-1);
+
+usage:
+	printf("usage: %s [-a] [-n count] [-t threads] [-e ndjson|binary] [-o file] image [mmap|pread|uring]\n", argv[0]);
+	exit(-1);
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ext2fs.h"
+#include "ext2_view.h"
+#include "ext2_frag.h"
+#include "frag.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "workpool.h"
+#include "emit.h"
+#include "instr.h"
+
+// Fragmentation and holes report of an ext2 image: totals and histograms,
+// per group with -g, per file with -v.
+
+static int verbose;
+static struct emit *out;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void print_file(void *arg, u_int32_t group, const struct frag_file *f)
+{
+	if (!verbose && !out)
+		return ;
+
+	pthread_mutex_lock(&out_lock);
+	if (verbose)
+		printf("inode %llu: group %u : size %llu : %llu blocks in %llu extents : %llu holes in %llu runs : ratio %.3f : distance %.1f\n",
+		       (unsigned long long) f->ino, group, (unsigned long long) f->size,
+		       (unsigned long long) f->blocks, (unsigned long long) f->extents,
+		       (unsigned long long) f->holes, (unsigned long long) f->hole_runs,
+		       frag_file_ratio(f), frag_file_avg_distance(f));
+
+	emit_begin(out, "frag_file");
+	emit_u64(out, "inode", f->ino);
+	emit_u64(out, "group", group);
+	emit_u64(out, "size", f->size);
+	emit_u64(out, "blocks", f->blocks);
+	emit_u64(out, "extents", f->extents);
+	emit_u64(out, "holes", f->holes);
+	emit_u64(out, "hole_runs", f->hole_runs);
+	emit_u64(out, "distance", f->distance);
+	emit_end(out);
+	pthread_mutex_unlock(&out_lock);
+}
+
+static void print_stat(const char *name, const struct frag_stat *st)
+{
+	printf("%s: %llu files, %llu fragmented, %llu sparse : %llu blocks in %llu extents : %llu holes in %llu runs : ratio %.4f : distance %.2f\n",
+	       name, (unsigned long long) st->files, (unsigned long long) st->fragmented,
+	       (unsigned long long) st->sparse, (unsigned long long) st->blocks,
+	       (unsigned long long) st->extents, (unsigned long long) st->holes,
+	       (unsigned long long) st->hole_runs, frag_stat_ratio(st), frag_stat_avg_distance(st));
+}
+
+static void print_hist(const char *name, const u_int64_t *hist)
+{
+	int i;
+
+	printf("%s:\n", name);
+	for (i = 0; i < FRAG_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		if (i == 0)
+			printf("  %12s %12llu\n", "0", (unsigned long long) hist[i]);
+		else
+			printf("  %5llu-%-6llu %12llu\n", 1ULL << (i - 1), (1ULL << i) - 1,
+			       (unsigned long long) hist[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *image;
+	const char *out_path = NULL;
+	int backend = BLKIO_MMAP;
+	int format = -1;
+	int nr_threads = 0;
+	int per_group = 0;
+	struct blkio *io;
+	struct ext2_superblock sb;
+	struct ext2_fs fs;
+	struct ext2_frag_report report;
+	struct workpool *pool;
+	struct timespec start, end;
+	u_int32_t i;
+	int opt;
+
+	instr_setup();
+
+	while ((opt = getopt(argc, argv, "vgt:e:o:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'g':
+			per_group = 1;
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'e':
+			if ((format = emit_parse_format(optarg)) < 0)
+				goto usage;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+	image = argv[optind++];
+	if (optind < argc && (backend = blkio_parse_backend(argv[optind++])) < 0)
+		goto usage;
+	if (optind < argc || (format >= 0 && !out_path))
+		goto usage;
+
+	io = blkio_open(image, backend);
+	if (!io) {
+		printf("can not open %s\n", image);
+		exit(-1);
+	}
+
+	memset(&fs, 0x0, sizeof(fs));
+	fs.size = blkio_size(io);
+	if (backend == BLKIO_MMAP) {
+		struct ext2_sb_view v;
+
+		fs.image = blkio_load(io);
+		if (!fs.image || ext2_sb_view_get(fs.image, fs.size, &v) < 0)
+			goto bad_image;
+		memcpy(&sb, v.p, sizeof(sb));
+	} else {
+		if (blkio_read(io, &sb, SUPER_BLOCK_SIZE, sizeof(sb)) != sizeof(sb) ||
+		    sb.s_magic != EXT2_SUPER_MAGIC)
+			goto bad_image;
+	}
+	fs.sb = &sb;
+	fs.block_size = get_block_size(sb);
+	if (!fs.image)
+		fs.bcache = bcache_create(io, fs.block_size, 64 * 1024 * 1024);
+	if (ext2_load_groups(&fs) < 0)
+		goto bad_image;
+
+	if (out_path) {
+		out = emit_open(out_path, format < 0 ? EMIT_NDJSON : format);
+		if (!out) {
+			printf("can not open %s\n", out_path);
+			exit(-1);
+		}
+	}
+
+	pool = workpool_create(nr_threads);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (ext2_frag_scan(&fs, pool, print_file, NULL, &report) < 0)
+		goto bad_image;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	workpool_destroy(pool);
+
+	for (i = 0; i < report.group_count; i++) {
+		const struct frag_stat *st = report.groups + i;
+		char name[32];
+
+		if (per_group) {
+			snprintf(name, sizeof(name), "group %u", i);
+			print_stat(name, st);
+		}
+
+		emit_begin(out, "frag_group");
+		emit_u64(out, "group", i);
+		emit_u64(out, "files", st->files);
+		emit_u64(out, "fragmented", st->fragmented);
+		emit_u64(out, "sparse", st->sparse);
+		emit_u64(out, "blocks", st->blocks);
+		emit_u64(out, "extents", st->extents);
+		emit_u64(out, "holes", st->holes);
+		emit_u64(out, "distance", st->distance);
+		emit_end(out);
+	}
+
+	print_stat("total", &report.total);
+	print_hist("extents per file", report.total.extents_hist);
+	print_hist("holes per file", report.total.holes_hist);
+	print_hist("blocks jumped between extents", report.total.jump_hist);
+	print_hist("file size in blocks", report.total.size_hist);
+	printf("%s: %u groups, %lu errors in %.3f s\n", image, report.group_count, report.errors,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	ext2_frag_report_free(&report);
+	ext2_free_groups(&fs);
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+	if (fs.image)
+		blkio_unload(io, (unsigned char *) fs.image);
+	blkio_close(io);
+
+	if (out && emit_close(out) < 0) {
+		printf("writing %s failed\n", out_path);
+		exit(-1);
+	}
+
+	return 0;
+
+bad_image:
+	printf("%s is not a readable ext2 image\n", image);
+	exit(-1);
+
+usage:
+	printf("usage: %s [-v] [-g] [-t threads] [-e ndjson|binary] [-o file] image [mmap|pread|uring]\n", argv[0]);
+	exit(-1);
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stddef.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_view.h"
+#include "ext2_icache.h"
+#include "ext2_dirblock.h"
+#include "bcache.h"
+#include "instr.h"
+
+// Read the whole group descriptor table which follows the super block.
+// The directory block parser for the block size is picked here too.
+int ext2_load_groups(struct ext2_fs *fs)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	unsigned long address;
+	unsigned long len;
+	unsigned long done;
+
+	fs->dir_parse = ext2_dirblock_parser(fs->block_size);
+
+	if (sb->s_blocks_per_group == 0 || sb->s_inodes_per_group == 0)
+		return -1;
+
+	fs->group_count = (sb->s_blocks_count - sb->s_first_data_block +
+			   sb->s_blocks_per_group - 1) / sb->s_blocks_per_group;
+
+	address = (unsigned long) (sb->s_first_data_block + 1) * fs->block_size;
+	len = (unsigned long) fs->group_count * sizeof(struct ext2_blockgroup);
+	if (address + len > fs->size)
+		return -1;
+
+	fs->groups = malloc(len);
+	assert(fs->groups != NULL);
+
+	// the table may span several blocks.
+	for (done = 0; done < len; ) {
+		u_int32_t block = (address + done) / fs->block_size;
+		unsigned long n = fs->block_size;
+		struct ext2_block b;
+
+		if (n > len - done)
+			n = len - done;
+
+		if (ext2_get_block(fs, block, BCACHE_GDT, &b) < 0) {
+			ext2_free_groups(fs);
+			return -1;
+		}
+		memcpy((char *) fs->groups + done, b.data, n);
+		ext2_put_block(fs, &b);
+
+		done += n;
+	}
+
+	return 0;
+}
+
+void ext2_free_groups(struct ext2_fs *fs)
+{
+	free(fs->groups);
+	fs->groups = NULL;
+	fs->group_count = 0;
+}
+
+// The last group may be shorter than s_blocks_per_group.
+u_int32_t ext2_group_nr_blocks(const struct ext2_fs *fs, u_int32_t group)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	u_int32_t first = sb->s_first_data_block + group * sb->s_blocks_per_group;
+
+	if (sb->s_blocks_count - first < sb->s_blocks_per_group)
+		return sb->s_blocks_count - first;
+
+	return sb->s_blocks_per_group;
+}
+
+// The inode inside its inode table block, which is read with ext2_get_block()
+// so the image need not be in memory. Give b back once done with v.
+int ext2_inode_view_get(const struct ext2_fs *fs, u_int32_t ino, struct ext2_inode_view *v,
+			struct ext2_block *b)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	u_int32_t inode_size = get_inode_size(*sb);
+	u_int32_t per_block = fs->block_size / inode_size;
+	u_int32_t group;
+	u_int32_t index;
+
+	if (ino == 0 || ino > sb->s_inodes_count)
+		return -1;
+
+	group = (ino - 1) / sb->s_inodes_per_group;
+	index = (ino - 1) % sb->s_inodes_per_group;
+	if (group >= fs->group_count ||
+	    ext2_get_block(fs, fs->groups[group].bg_inode_table + index / per_block, BCACHE_ITABLE, b) < 0)
+		return -1;
+
+	v->p = b->data + (index % per_block) * inode_size;
+
+	return 0;
+}
+
+// Decode a whole on-disk inode for code which works on struct ext2_inode.
+void ext2_inode_decode(struct ext2_inode_view v, struct ext2_inode *inode)
+{
+	const unsigned char *p = v.p;
+	int i;
+
+	memset(inode, 0x0, sizeof(*inode));
+
+	inode->i_mode = get_le16(p + offsetof(struct ext2_inode, i_mode));
+	inode->i_uid = get_le16(p + offsetof(struct ext2_inode, i_uid));
+	inode->i_size = get_le32(p + offsetof(struct ext2_inode, i_size));
+	inode->i_atime = get_le32(p + offsetof(struct ext2_inode, i_atime));
+	inode->i_ctime = get_le32(p + offsetof(struct ext2_inode, i_ctime));
+	inode->i_mtime = get_le32(p + offsetof(struct ext2_inode, i_mtime));
+	inode->i_dtime = get_le32(p + offsetof(struct ext2_inode, i_dtime));
+	inode->i_gid = get_le16(p + offsetof(struct ext2_inode, i_gid));
+	inode->i_links_count = get_le16(p + offsetof(struct ext2_inode, i_links_count));
+	inode->i_blocks = get_le32(p + offsetof(struct ext2_inode, i_blocks));
+	inode->i_flags = get_le32(p + offsetof(struct ext2_inode, i_flags));
+	inode->i_osd1 = get_le32(p + offsetof(struct ext2_inode, i_osd1));
+	for (i = 0; i < 15; i++)
+		inode->i_block[i] = ext2_inode_view_i_block(v, i);
+	inode->i_generation = get_le32(p + offsetof(struct ext2_inode, i_generation));
+	inode->i_file_acl = get_le32(p + offsetof(struct ext2_inode, i_file_acl));
+	inode->i_dir_acl = get_le32(p + offsetof(struct ext2_inode, i_dir_acl));
+	inode->i_faddr = get_le32(p + offsetof(struct ext2_inode, i_faddr));
+	memcpy(&inode->i_osd2, p + offsetof(struct ext2_inode, i_osd2), sizeof(inode->i_osd2));
+	inode->i_osd2.l_i_uid_high = get_le16(p + offsetof(struct ext2_inode, i_osd2.l_i_uid_high));
+	inode->i_osd2.l_i_gid_high = get_le16(p + offsetof(struct ext2_inode, i_osd2.l_i_gid_high));
+}
+
+static inline int read_inode(const struct ext2_fs *fs, u_int32_t ino, struct ext2_inode *inode)
+{
+	struct ext2_inode_view v;
+	struct ext2_block b;
+
+	if (fs->icache)
+		return ext2_icache_get(fs->icache, ino, inode);
+
+	if (ext2_inode_view_get(fs, ino, &v, &b) < 0)
+		return -1;
+
+	ext2_inode_decode(v, inode);
+	ext2_put_block(fs, &b);
+
+	return 0;
+}
+
+int ext2_read_inode(const struct ext2_fs *fs, u_int32_t ino, struct ext2_inode *inode)
+{
+	INSTR_START(t);
+	int ret = read_inode(fs, ino, inode);
+
+	INSTR_END(INSTR_INODE_READ, t);
+
+	return ret;
+}
+
+static inline int get_block(const struct ext2_fs *fs, u_int32_t block, int type, struct ext2_block *b)
+{
+	b->data = NULL;
+	b->buf = NULL;
+
+	if (block >= fs->sb->s_blocks_count)
+		return -1;
+
+	if (fs->bcache) {
+		b->buf = bcache_get(fs->bcache, block, type);
+		if (!b->buf)
+			return -1;
+		b->data = b->buf->data;
+		return 0;
+	}
+
+	if (((u_int64_t) block + 1) * fs->block_size > fs->size)
+		return -1;
+
+	b->data = fs->image + (u_int64_t) block * fs->block_size;
+
+	return 0;
+}
+
+int ext2_get_block(const struct ext2_fs *fs, u_int32_t block, int type, struct ext2_block *b)
+{
+	INSTR_START(t);
+	int ret = get_block(fs, block, type, b);
+
+	INSTR_END(INSTR_BLOCK_GET, t);
+
+	return ret;
+}
+
+void ext2_put_block(const struct ext2_fs *fs, struct ext2_block *b)
+{
+	if (b->buf)
+		bcache_put(fs->bcache, b->buf);
+
+	b->data = NULL;
+	b->buf = NULL;
+}
+
+// Start reading blocks which are going to be used soon. Only does something
+// with a block cache; the image is already in memory otherwise.
+void ext2_prefetch_blocks(const struct ext2_fs *fs, const u_int64_t *blocks, int nr)
+{
+	if (fs->bcache)
+		bcache_prefetch(fs->bcache, blocks, nr);
+}
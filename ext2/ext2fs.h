@@ -69,6 +69,10 @@ enum {
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002 // Large file support, 64-bit file size
 #define EXT2_FEATURE_RO_COMPAT_BTREE_DIR 0x0004 // Binary tree sorted directory files
 
+// for s_flags.
+#define EXT2_FLAGS_SIGNED_HASH 0x0001 // Directory hash treats name bytes as signed char
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002 // Directory hash treats name bytes as unsigned char
+
 // for s_algo_bitmap.
 enum {
 	EXT2_LZV1_ALG = 0, // Binary value of 0x00000001
@@ -118,7 +122,7 @@ struct ext2_superblock {
 	/* Performance Hints */
 	u_int8_t s_prealloc_blocks;
 	u_int8_t s_prealloc_dir_blocks;
-	u_int8_t aling[2];
+	u_int16_t s_reserved_gdt_blocks; // for online resize, with resize_inode
 	/* Journaling Support */
 	u_int8_t s_journal_uuid[16];
 	u_int32_t s_journal_inum;
@@ -131,13 +135,55 @@ struct ext2_superblock {
 	/* Other options */
 	u_int32_t s_default_mount_options;
 	u_int32_t s_first_meta_bg;
-	u_int8_t reserved[760];
+	u_int8_t reserved[88];
+	u_int32_t s_flags;
+	u_int8_t reserved2[668];
 };
 
 #define MIN_BLOCK_SIZE 1024
 #define get_block_size(sb) (MIN_BLOCK_SIZE << (sb).s_log_block_size)
 #define get_fragment_size(sb) (MIN_BLOCK_SIZE << (sb).s_log_frag_size)
+#define get_inode_size(sb) ((sb).s_rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_INODE_SIZE : (sb).s_inode_size)
+
+struct ext2_blockgroup;
+struct ext2_inode;
+struct dcache;
+struct ext2_icache;
+struct bcache;
+struct bcache_buf;
+struct ext2_dirblock;
+
+// Parses directory blocks; see ext2_dirblock.h.
+typedef void (*ext2_dirblock_fn)(struct ext2_dirblock *blocks, int nr, u_int32_t block_size,
+				 u_int8_t type_mask);
+
+// A mapped file system image.
+struct ext2_fs {
+	const unsigned char *image;
+	unsigned long size;
+	const struct ext2_superblock *sb;
+	u_int32_t block_size;
+	struct ext2_blockgroup *groups; // whole group descriptor table
+	u_int32_t group_count;
+	struct dcache *dcache; // path component cache, may be NULL
+	struct ext2_icache *icache; // decoded inode cache, may be NULL
+	struct bcache *bcache; // if set, blocks are read through it instead of image
+	ext2_dirblock_fn dir_parse; // for block_size, set by ext2_load_groups()
+};
+
+// A block handed out by ext2_get_block(). Give it back with ext2_put_block().
+struct ext2_block {
+	const unsigned char *data;
+	struct bcache_buf *buf; // pinned cache buffer, NULL if data is in the image
+};
 
 void ext2_fs_init(void);
+int ext2_load_groups(struct ext2_fs *fs);
+void ext2_free_groups(struct ext2_fs *fs);
+u_int32_t ext2_group_nr_blocks(const struct ext2_fs *fs, u_int32_t group);
+int ext2_read_inode(const struct ext2_fs *fs, u_int32_t ino, struct ext2_inode *inode);
+int ext2_get_block(const struct ext2_fs *fs, u_int32_t block, int type, struct ext2_block *b);
+void ext2_put_block(const struct ext2_fs *fs, struct ext2_block *b);
+void ext2_prefetch_blocks(const struct ext2_fs *fs, const u_int64_t *blocks, int nr);
 
 #endif // __MIKOOS_EXT2FS_H
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ext2fs.h"
+#include "ext2_view.h"
+#include "ext2_fsck.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "workpool.h"
+#include "instr.h"
+
+// Read-only check of an ext2 image for scripts. Nothing is ever written.
+// The exit status follows fsck(8): 0 clean, 4 problems found, 8 the image
+// could not be checked.
+
+#define FSCK_OK 0
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR 8
+
+static void print_problem(const struct ext2_fsck_problem *p)
+{
+	printf("%s:", ext2_fsck_problem_name(p->type));
+	if (p->type != EXT2_FSCK_SUPER_COUNT)
+		printf(" group %u", p->group);
+	if (p->ino)
+		printf(" inode %u", p->ino);
+	if (p->block)
+		printf(" block %u", p->block);
+	if (p->found != p->expected)
+		printf(" : %llu, expected %llu", (unsigned long long) p->found,
+		       (unsigned long long) p->expected);
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *image;
+	int backend = BLKIO_MMAP;
+	int nr_threads = 0;
+	int verbose = 0;
+	struct blkio *io;
+	struct ext2_superblock sb;
+	struct ext2_fs fs;
+	struct ext2_fsck_report report;
+	struct workpool *pool;
+	struct timespec start, end;
+	unsigned int i;
+	int opt;
+
+	instr_setup();
+
+	while ((opt = getopt(argc, argv, "vt:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+	image = argv[optind++];
+	if (optind < argc && (backend = blkio_parse_backend(argv[optind++])) < 0)
+		goto usage;
+	if (optind < argc)
+		goto usage;
+
+	io = blkio_open(image, backend);
+	if (!io) {
+		printf("can not open %s\n", image);
+		exit(FSCK_ERROR);
+	}
+
+	// only the mmap backend has the image in memory, the others go
+	// through a block cache so a large image is never read whole.
+	memset(&fs, 0x0, sizeof(fs));
+	fs.size = blkio_size(io);
+	if (backend == BLKIO_MMAP) {
+		struct ext2_sb_view v;
+
+		fs.image = blkio_load(io);
+		if (!fs.image || ext2_sb_view_get(fs.image, fs.size, &v) < 0)
+			goto bad_image;
+		memcpy(&sb, v.p, sizeof(sb));
+	} else {
+		if (blkio_read(io, &sb, SUPER_BLOCK_SIZE, sizeof(sb)) != sizeof(sb) ||
+		    sb.s_magic != EXT2_SUPER_MAGIC)
+			goto bad_image;
+	}
+	fs.sb = &sb;
+	fs.block_size = get_block_size(sb);
+	if (!fs.image)
+		fs.bcache = bcache_create(io, fs.block_size, 64 * 1024 * 1024);
+	if (ext2_load_groups(&fs) < 0)
+		goto bad_image;
+
+	pool = workpool_create(nr_threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (ext2_fsck(&fs, pool, &report) < 0) {
+		printf("%s: file system layout is not supported\n", image);
+		exit(FSCK_ERROR);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; verbose && i < report.nr_first; i++)
+		print_problem(report.first + i);
+	for (i = 0; i < EXT2_FSCK_NR_PROBLEMS; i++) {
+		if (report.counts[i])
+			printf("%lu x %s\n", report.counts[i], ext2_fsck_problem_name(i));
+	}
+
+	printf("%s: %lu/%u inodes, %lu dirs, %lu/%u blocks, %lu problems in %.3f s with %d threads\n",
+	       image, report.inodes, sb.s_inodes_count, report.dirs, report.blocks, sb.s_blocks_count,
+	       report.problems,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+	       workpool_nr_threads(pool));
+
+	workpool_destroy(pool);
+	ext2_free_groups(&fs);
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+	if (fs.image)
+		blkio_unload(io, (unsigned char *) fs.image);
+	blkio_close(io);
+
+	return report.problems ? FSCK_UNCORRECTED : FSCK_OK;
+
+bad_image:
+	printf("%s is not an ext2 image\n", image);
+	exit(FSCK_ERROR);
+
+usage:
+	printf("usage: %s [-v] [-t threads] image [mmap|pread|uring]\n", argv[0]);
+	exit(FSCK_ERROR);
+}
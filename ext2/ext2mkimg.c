@@ -0,0 +1,586 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ext2fs.h"
+#include "ext2_blockgroup.h"
+#include "ext2_inode.h"
+#include "ext2_dentry.h"
+#include "bitmap.h"
+#include "mkimg.h"
+
+// Write a synthetic ext2 image for scale testing. Directories form a tree
+// with a fixed fan-out, spread round robin over the block groups, and each
+// one holds the same number of regular files. File data is left unwritten
+// (it reads as zeros and takes no disk space) unless -w is given.
+
+#define NR_DIRECT_BLOCKS 12
+#define HOLE_CHUNK 16 // files with holes skip every other chunk of this many blocks
+#define LOST_FOUND_INO EXT2_GOOD_OLD_FIRST_INO
+
+struct mkfs {
+	int fd;
+	int rev;
+	int sparse_super;
+	int write_data;
+	u_int32_t block_size;
+	u_int32_t first_data_block;
+	u_int32_t blocks_per_group;
+	u_int32_t inodes_per_group;
+	u_int32_t inode_size;
+	u_int32_t group_count;
+	u_int32_t gdt_blocks;
+	u_int32_t itable_blocks;
+	u_int32_t now;
+	struct ext2_superblock sb;
+	struct ext2_blockgroup *groups;
+	struct mkimg_alloc blocks;
+	struct mkimg_alloc inodes;
+	struct mkimg_rng rng;
+	unsigned long nr_dirs;
+	unsigned long fanout;
+	unsigned long files_per_dir;
+	u_int64_t file_min;
+	u_int64_t file_max;
+	unsigned int gap_percent;
+	unsigned int hole_percent;
+	u_int32_t *dir_ino; // inode of each directory, 0 is the root
+	unsigned char *buf; // one block
+	unsigned long nr_files;
+	u_int64_t data_bytes;
+	int large_file;
+};
+
+// Writes the entries of one directory a block at a time.
+struct dir_writer {
+	struct mkfs *m;
+	struct mkimg_bmap map;
+	unsigned char *block;
+	u_int32_t offset; // where the next entry goes
+	u_int32_t last; // last entry of the block, stretched to the end on flush
+	u_int64_t nr_blocks;
+};
+
+static void die(const char *msg)
+{
+	printf("%s\n", msg);
+	mkimg_discard();
+	exit(-1);
+}
+
+static int is_power_of(u_int32_t n, u_int32_t base)
+{
+	while (n > 1 && !(n % base))
+		n /= base;
+
+	return n == 1;
+}
+
+static int group_has_super(const struct mkfs *m, u_int32_t group)
+{
+	if (!m->sparse_super || group <= 1)
+		return 1;
+
+	return is_power_of(group, 3) || is_power_of(group, 5) || is_power_of(group, 7);
+}
+
+static u_int32_t group_first_block(const struct mkfs *m, u_int32_t group)
+{
+	return m->first_data_block + group * m->blocks_per_group;
+}
+
+static void write_block(struct mkfs *m, u_int32_t block, const void *buf)
+{
+	if (mkimg_write(m->fd, buf, m->block_size, (u_int64_t) block * m->block_size) < 0)
+		die("write failed");
+}
+
+static void write_inode(struct mkfs *m, u_int32_t ino, const struct ext2_inode *inode)
+{
+	u_int32_t group = (ino - 1) / m->inodes_per_group;
+	u_int64_t offset = (u_int64_t) m->groups[group].bg_inode_table * m->block_size +
+		(u_int64_t) ((ino - 1) % m->inodes_per_group) * m->inode_size;
+
+	if (mkimg_write(m->fd, inode, sizeof(*inode), offset) < 0)
+		die("write failed");
+}
+
+static void init_inode(struct mkfs *m, struct ext2_inode *inode, u_int16_t mode, u_int16_t links)
+{
+	memset(inode, 0x0, sizeof(*inode));
+	inode->i_mode = mode;
+	inode->i_links_count = links;
+	inode->i_atime = inode->i_ctime = inode->i_mtime = m->now;
+}
+
+static void set_blocks(struct mkfs *m, struct ext2_inode *inode, const struct mkimg_bmap *map)
+{
+	inode->i_blocks = map->nr_blocks * (m->block_size / 512);
+	memcpy(inode->i_block, map->zone, sizeof(inode->i_block));
+}
+
+// Lay out every group: super block and GDT copies, bitmaps, inode table.
+static void layout_groups(struct mkfs *m)
+{
+	u_int32_t g, i;
+
+	m->groups = calloc(m->group_count, sizeof(*m->groups));
+	assert(m->groups != NULL);
+
+	for (g = 0; g < m->group_count; g++) {
+		u_int32_t block = group_first_block(m, g);
+
+		if (group_has_super(m, g))
+			block += 1 + m->gdt_blocks;
+		m->groups[g].bg_block_bitmap = block;
+		m->groups[g].bg_inode_bitmap = block + 1;
+		m->groups[g].bg_inode_table = block + 2;
+
+		for (i = group_first_block(m, g); i < block + 2 + m->itable_blocks; i++)
+			mkimg_alloc_mark(&m->blocks, i);
+	}
+}
+
+static u_int32_t alloc_inode(struct mkfs *m, u_int32_t group)
+{
+	u_int32_t ino;
+
+	mkimg_alloc_seek(&m->inodes, (u_int64_t) group * m->inodes_per_group + 1);
+	ino = mkimg_alloc_block(&m->inodes);
+	if (!ino)
+		die("out of inodes, raise -i or -g");
+
+	return ino;
+}
+
+static void dir_writer_init(struct dir_writer *w, struct mkfs *m)
+{
+	memset(w, 0x0, sizeof(*w));
+	w->m = m;
+	w->block = calloc(1, m->block_size);
+	assert(w->block != NULL);
+	if (mkimg_bmap_init(&w->map, m->fd, m->block_size, NR_DIRECT_BLOCKS, &m->blocks) < 0)
+		die("out of memory");
+}
+
+static void dir_flush(struct dir_writer *w)
+{
+	struct ext2_dentry *last = (struct ext2_dentry *) (w->block + w->last);
+	u_int32_t block;
+
+	if (!w->offset)
+		return ;
+
+	last->rec_len = w->m->block_size - w->last;
+	block = mkimg_bmap_add(&w->map, w->nr_blocks++);
+	if (!block)
+		die("out of blocks, raise -g");
+	write_block(w->m, block, w->block);
+
+	memset(w->block, 0x0, w->m->block_size);
+	w->offset = 0;
+	w->last = 0;
+}
+
+static void dir_add(struct dir_writer *w, const char *name, u_int32_t ino, u_int8_t file_type)
+{
+	struct ext2_dentry *d;
+	int len = strlen(name);
+	u_int32_t rec_len = (sizeof(*d) + len + 3) & ~3;
+
+	if (w->offset + rec_len > w->m->block_size)
+		dir_flush(w);
+
+	d = (struct ext2_dentry *) (w->block + w->offset);
+	d->inode = ino;
+	d->rec_len = rec_len;
+	d->name_len = len;
+	// revision 0 has a 16 bit name_len and no file type.
+	d->file_type = w->m->rev == EXT2_GOOD_OLD_REV ? 0 : file_type;
+	memcpy(d->name, name, len);
+
+	w->last = w->offset;
+	w->offset += rec_len;
+}
+
+static void dir_finish(struct dir_writer *w, u_int32_t ino, u_int16_t links)
+{
+	struct ext2_inode inode;
+
+	dir_flush(w);
+	if (mkimg_bmap_finish(&w->map) < 0)
+		die("write failed");
+
+	init_inode(w->m, &inode, EXT2_S_IFDIR | 0755, links);
+	inode.i_size = w->nr_blocks * w->m->block_size;
+	set_blocks(w->m, &inode, &w->map);
+	write_inode(w->m, ino, &inode);
+
+	free(w->block);
+}
+
+static u_int32_t make_file(struct mkfs *m, u_int32_t group)
+{
+	struct ext2_inode inode;
+	struct mkimg_bmap map;
+	u_int32_t ino = alloc_inode(m, group);
+	u_int64_t size = m->file_min;
+	u_int64_t nr_blocks, lblk;
+	int holes = mkimg_chance(&m->rng, m->hole_percent);
+
+	if (m->file_max > m->file_min)
+		size += mkimg_rand(&m->rng) % (m->file_max - m->file_min + 1);
+	nr_blocks = (size + m->block_size - 1) / m->block_size;
+
+	mkimg_alloc_seek(&m->blocks, group_first_block(m, group));
+	if (mkimg_bmap_init(&map, m->fd, m->block_size, NR_DIRECT_BLOCKS, &m->blocks) < 0)
+		die("out of memory");
+
+	for (lblk = 0; lblk < nr_blocks; lblk++) {
+		u_int32_t block;
+
+		if (holes && (lblk / HOLE_CHUNK) % 2 && lblk != nr_blocks - 1)
+			continue;
+
+		block = mkimg_bmap_add(&map, lblk);
+		if (!block)
+			die("out of blocks or file too big for the block size, raise -g or lower -s");
+
+		if (m->write_data) {
+			u_int32_t len = m->block_size;
+
+			if (lblk == nr_blocks - 1 && size % m->block_size)
+				len = size % m->block_size;
+			mkimg_fill(m->buf, len, ((u_int64_t) ino << 32) | lblk);
+			memset(m->buf + len, 0x0, m->block_size - len);
+			write_block(m, block, m->buf);
+		}
+	}
+	if (mkimg_bmap_finish(&map) < 0)
+		die("write failed");
+
+	init_inode(m, &inode, EXT2_S_IFREG | 0644, 1);
+	inode.i_size = size;
+	if (m->rev != EXT2_GOOD_OLD_REV)
+		inode.i_dir_acl = size >> 32; // i_size_high
+	set_blocks(m, &inode, &map);
+	write_inode(m, ino, &inode);
+
+	if (size >= 0x80000000ULL)
+		m->large_file = 1;
+	m->nr_files++;
+	m->data_bytes += size;
+
+	return ino;
+}
+
+static u_int32_t dir_group(const struct mkfs *m, unsigned long dir)
+{
+	return (m->dir_ino[dir] - 1) / m->inodes_per_group;
+}
+
+static void make_dir(struct mkfs *m, unsigned long dir)
+{
+	struct dir_writer w;
+	char name[32];
+	u_int32_t group = dir_group(m, dir);
+	u_int16_t links = 2;
+	unsigned long i;
+
+	dir_writer_init(&w, m);
+	mkimg_alloc_seek(&m->blocks, group_first_block(m, group));
+
+	dir_add(&w, ".", m->dir_ino[dir], EXT2_FT_DIR);
+	dir_add(&w, "..", m->dir_ino[dir ? (dir - 1) / m->fanout : 0], EXT2_FT_DIR);
+	if (!dir) {
+		dir_add(&w, "lost+found", LOST_FOUND_INO, EXT2_FT_DIR);
+		links++;
+	}
+
+	for (i = dir * m->fanout + 1; i <= dir * m->fanout + m->fanout && i < m->nr_dirs; i++) {
+		sprintf(name, "d%lu", i);
+		dir_add(&w, name, m->dir_ino[i], EXT2_FT_DIR);
+		links++;
+	}
+
+	for (i = 0; i < m->files_per_dir; i++) {
+		u_int32_t ino = make_file(m, group);
+
+		sprintf(name, "f%lu", i);
+		dir_add(&w, name, ino, EXT2_FT_REG_FILE);
+	}
+
+	dir_finish(&w, m->dir_ino[dir], links);
+}
+
+static void make_lost_found(struct mkfs *m)
+{
+	struct dir_writer w;
+
+	dir_writer_init(&w, m);
+	mkimg_alloc_seek(&m->blocks, group_first_block(m, 0));
+	dir_add(&w, ".", LOST_FOUND_INO, EXT2_FT_DIR);
+	dir_add(&w, "..", EXT2_ROOT_INO, EXT2_FT_DIR);
+	dir_finish(&w, LOST_FOUND_INO, 2);
+}
+
+static void make_tree(struct mkfs *m)
+{
+	unsigned long i;
+
+	m->dir_ino = calloc(m->nr_dirs, sizeof(*m->dir_ino));
+	assert(m->dir_ino != NULL);
+
+	// reserved inodes, then the root and lost+found.
+	for (i = 1; i < EXT2_GOOD_OLD_FIRST_INO; i++)
+		mkimg_alloc_mark(&m->inodes, i);
+	mkimg_alloc_mark(&m->inodes, LOST_FOUND_INO);
+	m->dir_ino[0] = EXT2_ROOT_INO;
+	m->groups[0].bg_used_dirs_count = 2;
+
+	for (i = 1; i < m->nr_dirs; i++) {
+		m->dir_ino[i] = alloc_inode(m, i % m->group_count);
+		m->groups[dir_group(m, i)].bg_used_dirs_count++;
+	}
+
+	make_lost_found(m);
+	for (i = 0; i < m->nr_dirs; i++)
+		make_dir(m, i);
+}
+
+static void init_superblock(struct mkfs *m)
+{
+	struct ext2_superblock *sb = &m->sb;
+	int i;
+
+	memset(sb, 0x0, sizeof(*sb));
+	sb->s_inodes_count = m->inodes_per_group * m->group_count;
+	sb->s_blocks_count = m->first_data_block + m->blocks_per_group * m->group_count;
+	sb->s_r_blocks_count = sb->s_blocks_count / 20;
+	sb->s_first_data_block = m->first_data_block;
+	sb->s_log_block_size = sb->s_log_frag_size = __builtin_ctz(m->block_size / MIN_BLOCK_SIZE);
+	sb->s_blocks_per_group = sb->s_frags_per_group = m->blocks_per_group;
+	sb->s_inodes_per_group = m->inodes_per_group;
+	sb->s_wtime = sb->s_lastcheck = m->now;
+	sb->s_max_mnt_count = 0xffff;
+	sb->s_magic = 0xef53;
+	sb->s_state = EXT2_VALID_FS;
+	sb->s_errors = EXT2_ERRORS_CONTINUE;
+	sb->s_creator_os = EXT2_OS_LINUX;
+	sb->s_rev_level = m->rev;
+
+	if (m->rev == EXT2_GOOD_OLD_REV)
+		return ;
+
+	sb->s_first_ino = EXT2_GOOD_OLD_FIRST_INO;
+	sb->s_inode_size = m->inode_size;
+	sb->s_feature_incompat = EXT2_FEATURE_INCOMPAT_FILETYPE;
+	if (m->sparse_super)
+		sb->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER;
+	for (i = 0; i < sizeof(sb->s_uuid); i++)
+		sb->s_uuid[i] = mkimg_rand(&m->rng);
+	strcpy((char *) sb->s_volume_name, "ext2mkimg");
+}
+
+// Bitmaps, free counts, GDT and super block copies go out last.
+static void write_metadata(struct mkfs *m)
+{
+	struct ext2_superblock *sb = &m->sb;
+	unsigned long gdt_size = (unsigned long) m->gdt_blocks * m->block_size;
+	unsigned char *gdt = calloc(1, gdt_size);
+	u_int32_t g;
+
+	assert(gdt != NULL);
+
+	for (g = 0; g < m->group_count; g++) {
+		const unsigned char *bmap = m->blocks.map + (u_int64_t) g * m->blocks_per_group / 8;
+		const unsigned char *imap = m->inodes.map + (u_int64_t) g * m->inodes_per_group / 8;
+		struct ext2_blockgroup *bg = m->groups + g;
+
+		bg->bg_free_blocks_count = m->blocks_per_group - bitmap_count_used(bmap, m->blocks_per_group);
+		bg->bg_free_inodes_count = m->inodes_per_group - bitmap_count_used(imap, m->inodes_per_group);
+		sb->s_free_blocks_count += bg->bg_free_blocks_count;
+		sb->s_free_inodes_count += bg->bg_free_inodes_count;
+
+		write_block(m, bg->bg_block_bitmap, bmap);
+
+		// bits past the last inode of the group are set.
+		memset(m->buf, 0xff, m->block_size);
+		memcpy(m->buf, imap, m->inodes_per_group / 8);
+		write_block(m, bg->bg_inode_bitmap, m->buf);
+	}
+
+	if (m->large_file)
+		sb->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+	memcpy(gdt, m->groups, m->group_count * sizeof(*m->groups));
+
+	for (g = 0; g < m->group_count; g++) {
+		u_int64_t block = group_first_block(m, g);
+
+		if (!group_has_super(m, g))
+			continue;
+
+		if (m->rev != EXT2_GOOD_OLD_REV)
+			sb->s_block_group_nr = g;
+		if (mkimg_write(m->fd, sb, sizeof(*sb), g ? block * m->block_size : SUPER_BLOCK_SIZE) < 0 ||
+		    mkimg_write(m->fd, gdt, gdt_size, (block + 1) * m->block_size) < 0)
+			die("write failed");
+	}
+
+	free(gdt);
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [options] image\n"
+	       "  -r rev        revision, 0 or 1 (1)\n"
+	       "  -b size       block size, 1024, 2048 or 4096 (1024)\n"
+	       "  -g count      block groups (2)\n"
+	       "  -i count      inodes per group (one per 8K)\n"
+	       "  -I size       inode size, revision 1 only (128)\n"
+	       "  -S            no sparse_super, revision 1 only\n"
+	       "  -d count      directories, root included (16)\n"
+	       "  -f count      subdirectories per directory (4)\n"
+	       "  -n count      files per directory (8)\n"
+	       "  -s min[:max]  file size, K/M/G suffixes allowed (4K)\n"
+	       "  -F percent    chance of a gap before each block allocation (0)\n"
+	       "  -H percent    share of files with holes (0)\n"
+	       "  -w            write file data, otherwise it reads as zeros\n"
+	       "  -x seed       random seed (1)\n", prog);
+	exit(-1);
+}
+
+static void parse_file_size(struct mkfs *m, char *arg)
+{
+	char *max = strchr(arg, ':');
+
+	if (max)
+		*max++ = '\0';
+	if (mkimg_parse_size(arg, &m->file_min) < 0 ||
+	    mkimg_parse_size(max ? max : arg, &m->file_max) < 0 ||
+	    m->file_max < m->file_min)
+		die("bad file size");
+}
+
+int main(int argc, char **argv)
+{
+	struct mkfs m;
+	u_int64_t seed = 1;
+	u_int64_t overhead;
+	int opt;
+
+	memset(&m, 0x0, sizeof(m));
+	m.rev = EXT2_DYNAMIC_REV;
+	m.sparse_super = 1;
+	m.block_size = 1024;
+	m.group_count = 2;
+	m.inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+	m.nr_dirs = 16;
+	m.fanout = 4;
+	m.files_per_dir = 8;
+	m.file_min = m.file_max = 4096;
+
+	while ((opt = getopt(argc, argv, "r:b:g:i:I:Sd:f:n:s:F:H:wx:")) != -1) {
+		switch (opt) {
+		case 'r': m.rev = atoi(optarg); break;
+		case 'b': m.block_size = atoi(optarg); break;
+		case 'g': m.group_count = strtoul(optarg, NULL, 0); break;
+		case 'i': m.inodes_per_group = strtoul(optarg, NULL, 0); break;
+		case 'I': m.inode_size = atoi(optarg); break;
+		case 'S': m.sparse_super = 0; break;
+		case 'd': m.nr_dirs = strtoul(optarg, NULL, 0); break;
+		case 'f': m.fanout = strtoul(optarg, NULL, 0); break;
+		case 'n': m.files_per_dir = strtoul(optarg, NULL, 0); break;
+		case 's': parse_file_size(&m, optarg); break;
+		case 'F': m.gap_percent = atoi(optarg); break;
+		case 'H': m.hole_percent = atoi(optarg); break;
+		case 'w': m.write_data = 1; break;
+		case 'x': seed = strtoull(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if (m.rev != EXT2_GOOD_OLD_REV && m.rev != EXT2_DYNAMIC_REV)
+		die("revision must be 0 or 1");
+	if (m.block_size != 1024 && m.block_size != 2048 && m.block_size != 4096)
+		die("block size must be 1024, 2048 or 4096");
+	if (m.rev == EXT2_GOOD_OLD_REV) {
+		m.sparse_super = 0;
+		m.inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+		if (m.file_max >= 0x80000000ULL)
+			die("revision 0 files must be smaller than 2G");
+	}
+	if (m.inode_size < EXT2_GOOD_OLD_INODE_SIZE || m.inode_size > m.block_size ||
+	    (m.inode_size & (m.inode_size - 1)))
+		die("bad inode size");
+	if (!m.group_count || !m.nr_dirs || !m.fanout)
+		die("groups, directories and fan-out must not be 0");
+
+	m.first_data_block = m.block_size == 1024 ? 1 : 0;
+	m.blocks_per_group = m.block_size * 8;
+	if (!m.inodes_per_group)
+		m.inodes_per_group = (u_int64_t) m.blocks_per_group * m.block_size / 8192;
+	// whole inode table blocks and whole bitmap bytes.
+	m.inodes_per_group = (m.inodes_per_group + m.block_size / m.inode_size - 1) /
+		(m.block_size / m.inode_size) * (m.block_size / m.inode_size);
+	m.inodes_per_group = (m.inodes_per_group + 7) & ~7;
+	if (m.inodes_per_group < EXT2_GOOD_OLD_FIRST_INO + 1 || m.inodes_per_group > m.blocks_per_group)
+		die("bad inodes per group");
+	if ((u_int64_t) m.blocks_per_group * m.group_count + m.first_data_block > 0xffffffffULL)
+		die("too many groups");
+
+	m.gdt_blocks = (m.group_count * sizeof(struct ext2_blockgroup) + m.block_size - 1) / m.block_size;
+	m.itable_blocks = m.inodes_per_group * m.inode_size / m.block_size;
+	overhead = 1 + m.gdt_blocks + 2 + m.itable_blocks;
+	if (overhead >= m.blocks_per_group)
+		die("group metadata does not fit, lower -i or -g");
+
+	mkimg_rng_init(&m.rng, seed);
+	m.now = time(NULL);
+	m.buf = malloc(m.block_size);
+	assert(m.buf != NULL);
+	if (mkimg_alloc_init(&m.blocks, m.first_data_block, (u_int64_t) m.blocks_per_group * m.group_count) < 0 ||
+	    mkimg_alloc_init(&m.inodes, 1, (u_int64_t) m.inodes_per_group * m.group_count) < 0)
+		die("out of memory");
+	m.blocks.rng = &m.rng;
+	m.blocks.gap_percent = m.gap_percent;
+
+	m.fd = mkimg_create(argv[optind]);
+	if (m.fd < 0) {
+		perror(argv[optind]);
+		exit(-1);
+	}
+
+	init_superblock(&m);
+	if (ftruncate(m.fd, (u_int64_t) m.sb.s_blocks_count * m.block_size) < 0) {
+		perror("ftruncate");
+		mkimg_discard();
+		exit(-1);
+	}
+
+	layout_groups(&m);
+	make_tree(&m);
+	write_metadata(&m);
+
+	if (mkimg_commit(m.fd) < 0) {
+		perror(argv[optind]);
+		exit(-1);
+	}
+
+	printf("%s: revision %d, %u blocks of %u bytes, %u groups, %lu dirs, %lu files, %llu data bytes\n",
+	       argv[optind], m.rev, m.sb.s_blocks_count, m.block_size, m.group_count,
+	       m.nr_dirs + 1, m.nr_files, (unsigned long long) m.data_bytes);
+
+	mkimg_alloc_free(&m.blocks);
+	mkimg_alloc_free(&m.inodes);
+	free(m.groups);
+	free(m.dir_ino);
+	free(m.buf);
+
+	return 0;
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "ext2fs.h"
+#include "ext2_inode.h"
+#include "ext2_namei.h"
+#include "ext2_write.h"
+#include "workpool.h"
+#include "instr.h"
+
+// Copy a directory tree into an ext2 image without mounting it, like
+// mke2fs -d but into an image which already exists, e.g. from ext2mkimg.
+// Every source directory is a task on the pool; the files of a directory
+// are written by its task. Owners, modes and times are kept. Hard links
+// are copied as separate files.
+
+#define COPY_CHUNK (1024 * 1024)
+
+struct populate {
+	struct ext2_writer w;
+	struct workpool *pool;
+	pthread_mutex_t lock;
+	unsigned long dirs;
+	unsigned long files;
+	unsigned long symlinks;
+	unsigned long nodes;
+	u_int64_t bytes;
+	unsigned long errors;
+};
+
+// A directory to copy. One made by the parent's task comes with its
+// handle still open, so its entries are added without checking names.
+struct dir_task {
+	struct populate *p;
+	char *path;
+	u_int32_t ino;
+	int is_open;
+	struct ext2_wfile dir;
+};
+
+// Allocation context of each worker thread.
+static __thread struct ext2_alloc_ctx thread_ctx;
+
+static struct ext2_alloc_ctx *ctx_of(struct populate *p)
+{
+	if (!thread_ctx.a)
+		ext2_alloc_ctx_init(&thread_ctx, &p->w.alloc);
+
+	return &thread_ctx;
+}
+
+static void fail(struct populate *p, const char *path, const char *what)
+{
+	pthread_mutex_lock(&p->lock);
+	printf("%s: %s\n", path, what);
+	p->errors++;
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void set_attrs(struct ext2_wfile *f, const struct stat *st)
+{
+	f->inode.i_uid = st->st_uid;
+	f->inode.i_gid = st->st_gid;
+	f->inode.i_osd2.l_i_uid_high = st->st_uid >> 16;
+	f->inode.i_osd2.l_i_gid_high = st->st_gid >> 16;
+	f->inode.i_atime = st->st_atime;
+	f->inode.i_mtime = st->st_mtime;
+}
+
+// buf is the directory task's, allocated with its first file.
+static int copy_file(const char *path, struct ext2_wfile *f, unsigned char **buf, u_int64_t *bytes)
+{
+	int fd = open(path, O_RDONLY);
+	int ret = 0;
+
+	if (fd < 0)
+		return -1;
+
+	if (!*buf) {
+		*buf = malloc(COPY_CHUNK);
+		assert(*buf != NULL);
+	}
+
+	while (1) {
+		ssize_t n = read(fd, *buf, COPY_CHUNK);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			ret = n;
+			break;
+		}
+		if (ext2_wfile_write(f, *buf, n) < 0) {
+			ret = -1;
+			break;
+		}
+		*bytes += n;
+	}
+	close(fd);
+
+	return ret;
+}
+
+static void copy_dir(void *arg);
+
+static void submit_dir(struct populate *p, const char *path, u_int32_t ino, const struct ext2_wfile *dir)
+{
+	struct dir_task *t = malloc(sizeof(*t));
+
+	assert(t != NULL);
+	t->p = p;
+	t->path = strdup(path);
+	assert(t->path != NULL);
+	t->ino = ino;
+	t->is_open = dir != NULL;
+	if (dir)
+		t->dir = *dir;
+
+	workpool_submit(p->pool, copy_dir, t);
+}
+
+// Copy one entry of a source directory into dir.
+static void copy_entry(struct populate *p, struct ext2_wfile *dir, const char *path, const char *name,
+		       unsigned char **buf)
+{
+	struct ext2_wfile f;
+	struct stat st;
+	char target[4096];
+	u_int64_t bytes = 0;
+	ssize_t len;
+
+	if (lstat(path, &st) < 0) {
+		fail(p, path, strerror(errno));
+		return ;
+	}
+
+	switch (st.st_mode & S_IFMT) {
+	case S_IFDIR:
+		if (!ext2_wdir_mkdir(dir, name, st.st_mode, &f)) {
+			fail(p, path, "can not make the directory");
+			return ;
+		}
+		set_attrs(&f, &st);
+		submit_dir(p, path, f.ino, &f);
+		break;
+	case S_IFREG:
+		if (!ext2_wdir_create(dir, name, st.st_mode, &f)) {
+			fail(p, path, "can not create the file");
+			return ;
+		}
+		if (copy_file(path, &f, buf, &bytes) < 0)
+			fail(p, path, "copy failed");
+		set_attrs(&f, &st);
+		ext2_wfile_close(&f);
+		break;
+	case S_IFLNK:
+		len = readlink(path, target, sizeof(target) - 1);
+		if (len <= 0) {
+			fail(p, path, "can not read the link");
+			return ;
+		}
+		target[len] = '\0';
+		if (!ext2_wdir_symlink(dir, name, target, &f)) {
+			fail(p, path, "can not make the symlink");
+			return ;
+		}
+		set_attrs(&f, &st);
+		ext2_wfile_close(&f);
+		break;
+	case S_IFCHR:
+	case S_IFBLK:
+	case S_IFIFO:
+	case S_IFSOCK:
+		// the S_IF* values are the same as ext2's.
+		if (!ext2_wdir_mknod(dir, name, st.st_mode, major(st.st_rdev), minor(st.st_rdev), &f)) {
+			fail(p, path, "can not make the node");
+			return ;
+		}
+		set_attrs(&f, &st);
+		ext2_wfile_close(&f);
+		break;
+	default:
+		fail(p, path, "unknown file type");
+		return ;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	switch (st.st_mode & S_IFMT) {
+	case S_IFDIR: p->dirs++; break;
+	case S_IFREG: p->files++; p->bytes += bytes; break;
+	case S_IFLNK: p->symlinks++; break;
+	default: p->nodes++; break;
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void copy_dir(void *arg)
+{
+	struct dir_task *t = arg;
+	struct populate *p = t->p;
+	struct ext2_wfile *dir = &t->dir;
+	struct dirent *de;
+	DIR *d;
+	char *path = NULL;
+	unsigned long cap = 0;
+	unsigned char *buf = NULL;
+
+	if (t->is_open) {
+		dir->ctx = ctx_of(p);
+	} else if (ext2_wdir_open(&p->w, ctx_of(p), t->ino, dir) < 0) {
+		fail(p, t->path, "can not open the directory in the image");
+		goto out;
+	}
+
+	d = opendir(t->path);
+	if (!d) {
+		fail(p, t->path, strerror(errno));
+		goto out_close;
+	}
+
+	while ((de = readdir(d))) {
+		unsigned long len = strlen(t->path) + strlen(de->d_name) + 2;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (len > cap) {
+			cap = len * 2;
+			path = realloc(path, cap);
+			assert(path != NULL);
+		}
+		sprintf(path, "%s/%s", t->path, de->d_name);
+		copy_entry(p, dir, path, de->d_name, &buf);
+	}
+	closedir(d);
+
+out_close:
+	if (ext2_wfile_close(dir) < 0)
+		fail(p, t->path, "can not write the directory");
+out:
+	free(buf);
+	free(path);
+	free(t->path);
+	free(t);
+}
+
+int main(int argc, char **argv)
+{
+	struct populate p;
+	struct timespec start, end;
+	const char *image;
+	const char *source;
+	const char *target = "/";
+	int nr_threads = 0;
+	u_int32_t ino;
+	int threads;
+	int opt;
+
+	instr_setup();
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind + 2 > argc || optind + 3 < argc)
+		goto usage;
+	image = argv[optind];
+	source = argv[optind + 1];
+	if (optind + 2 < argc)
+		target = argv[optind + 2];
+
+	memset(&p, 0x0, sizeof(p));
+	if (ext2_writer_open(&p.w, image) < 0) {
+		printf("can not open %s for writing, or it is not a clean ext2 image\n", image);
+		exit(-1);
+	}
+	ino = ext2_namei(&p.w.fs, target);
+	if (!ino) {
+		printf("%s not found in %s\n", target, image);
+		ext2_writer_close(&p.w);
+		exit(-1);
+	}
+
+	pthread_mutex_init(&p.lock, NULL);
+	p.pool = workpool_create(nr_threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	submit_dir(&p, source, ino, NULL);
+	workpool_wait(p.pool);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	threads = workpool_nr_threads(p.pool);
+	workpool_destroy(p.pool);
+	pthread_mutex_destroy(&p.lock);
+	if (ext2_writer_close(&p.w) < 0) {
+		printf("writing %s failed\n", image);
+		exit(-1);
+	}
+
+	printf("%s: %lu dirs, %lu files, %llu bytes, %lu symlinks, %lu other, %lu errors in %.3f s with %d threads\n",
+	       image, p.dirs, p.files, (unsigned long long) p.bytes, p.symlinks, p.nodes, p.errors,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, threads);
+
+	return p.errors ? -1 : 0;
+
+usage:
+	printf("usage: %s [-t threads] image source-dir [dir in image]\n", argv[0]);
+	exit(-1);
+}
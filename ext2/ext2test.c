@@ -1,89 +1,184 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <fcntl.h>
+#include <time.h>
 
 #include <assert.h>
 #include "ext2fs.h"
 #include "ext2_blockgroup.h"
 #include "ext2_inode.h"
 #include "ext2_dentry.h"
+#include "ext2_blockmap.h"
+#include "ext2_scan.h"
+#include "ext2_bitmap.h"
+#include "ext2_htree.h"
+#include "ext2_namei.h"
+#include "dcache.h"
+#include "ext2_icache.h"
+#include "ext2_file.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "ext2_view.h"
+#include "workpool.h"
+#include "emit.h"
+#include "ext2_index.h"
+#include "ext2_walk.h"
+#include "ext2_dirblock.h"
+#include "instr.h"
 
 static const char const *test_file = "./hda.img";
 static unsigned char *file_system;
+static struct blkio *image_io;
+static unsigned long file_size;
+// per entry output is off unless asked for.
+static int verbose;
+static int use_index;
+static struct emit *out;
 
-static unsigned long get_file_size(void);
-static void *map2memory(unsigned long size);
 static const char *get_os_name(struct ext2_superblock *sb);
-static void read_block_group(struct ext2_superblock *sb,  struct ext2_blockgroup *bg, unsigned long offset);
 static void read_super_block(struct ext2_superblock *sb);
-static u_int32_t blockid2address(struct ext2_superblock *sb, u_int32_t id);
+static u_int64_t blockid2address(struct ext2_superblock *sb, u_int32_t id);
 static unsigned long get_block_data_address(struct ext2_superblock *sb, struct ext2_blockgroup *bg);
-static int get_all_directories(struct dentry_list *head, unsigned long address, struct ext2_blockgroup *blk_group);
-static u_int16_t read_dentry_rec_len(unsigned long address, unsigned long offset);
-static void read_dentry(struct ext2_dentry *dentry, unsigned address, 
-			unsigned long offset, u_int16_t rec_len);
-static void directory_walk(struct dentry_list *head, struct ext2_superblock *sb, struct ext2_blockgroup *bg);
-static u_int8_t get_file_type(struct ext2_dentry *dentry);
-
-static unsigned long get_file_size(void)
+static int get_all_directories(struct ext2_dentry_table *table, const struct ext2_fs *fs, unsigned long address, struct ext2_blockgroup *blk_group);
+static void directory_walk(const struct ext2_dentry_table *table, const struct ext2_fs *fs);
+static unsigned long get_inode_address(const struct ext2_fs *fs, u_int32_t ino);
+static u_int8_t get_file_type(const struct ext2_dentry_rec *rec);
+static void print_extents(const struct ext2_fs *fs, u_int32_t ino);
+static void emit_inode(const struct ext2_fs *fs, const struct ext2_dentry_rec *rec, const char *name, unsigned long address);
+static void print_scan(const struct ext2_fs *fs, const struct ext2_scan *scan);
+static void print_bitmaps(const struct ext2_fs *fs, const struct ext2_bitmap_report *report);
+static void lookup_test(const struct ext2_fs *fs);
+static void namei_test(const struct ext2_fs *fs);
+static void dirblock_test(const struct ext2_fs *fs);
+static void print_icache(const struct ext2_fs *fs);
+static void print_bcache(const struct ext2_fs *fs);
+static void index_test(const struct ext2_fs *fs, struct workpool *pool);
+static void walk_test(const struct ext2_fs *fs, struct workpool *pool);
+static void read_file(const struct ext2_fs *fs, const char *fname);
+static void read_file_test(const struct ext2_fs *fs);
+
+static u_int8_t get_file_type(const struct ext2_dentry_rec *rec)
 {
-	struct stat st;
-
-	assert(stat(test_file, &st) != -1);
-
-	return st.st_size;
+	return rec->file_type;
 }
 
-static void *map2memory(unsigned long size)
+static void print_extents(const struct ext2_fs *fs, u_int32_t ino)
 {
-	int fd;
-	void *ret;
+	struct ext2_inode inode;
+	struct ext2_extent_list list;
+	unsigned int i;
 
-	fd = open(test_file, O_RDONLY);
-	assert(fd >= 0);
+	if (ext2_read_inode(fs, ino, &inode) < 0) {
+		printf("inode[0x%x] is not readable\n", ino);
+		return ;
+	}
 
-	ret = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-	assert(ret != MAP_FAILED);
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(fs, &inode, &list) < 0) {
+		printf("inode[0x%x] has a broken block map\n", ino);
+		ext2_extent_list_free(&list);
+		return ;
+	}
 
-	close(fd);
+	printf("size %llu : %u extents : %u indirect blocks\n",
+	       (unsigned long long) ext2_inode_size(&inode), list.count, list.meta_blocks);
+	for (i = 0; i < list.count; i++)
+		printf("extent[%u]: logical 0x%x -> physical 0x%x (%u blocks)\n", i,
+		       list.extents[i].e_lblk, list.extents[i].e_pblk, list.extents[i].e_len);
 
-	return ret;
+	ext2_extent_list_free(&list);
 }
 
-static u_int8_t get_file_type(struct ext2_dentry *dentry)
+// One "inode" record, followed by an "extent" record per extent.
+static void emit_inode(const struct ext2_fs *fs, const struct ext2_dentry_rec *rec, const char *name, unsigned long address)
 {
-	return dentry->file_type;
+	struct ext2_inode inode;
+	struct ext2_extent_list list;
+	unsigned int i;
+
+	if (!out || ext2_read_inode(fs, rec->inode, &inode) < 0)
+		return ;
+
+	ext2_extent_list_init(&list);
+	if (ext2_map_blocks(fs, &inode, &list) < 0)
+		list.count = 0;
+
+	emit_begin(out, "inode");
+	emit_u64(out, "ino", rec->inode);
+	emit_str(out, "name", name, rec->name_len);
+	emit_u64(out, "file_type", rec->file_type);
+	emit_u64(out, "address", address);
+	emit_u64(out, "mode", inode.i_mode);
+	emit_u64(out, "size", ext2_inode_size(&inode));
+	emit_u64(out, "extents", list.count);
+	emit_u64(out, "indirect_blocks", list.meta_blocks);
+	emit_end(out);
+
+	for (i = 0; i < list.count; i++) {
+		emit_begin(out, "extent");
+		emit_u64(out, "ino", rec->inode);
+		emit_u64(out, "lblk", list.extents[i].e_lblk);
+		emit_u64(out, "pblk", list.extents[i].e_pblk);
+		emit_u64(out, "len", list.extents[i].e_len);
+		emit_end(out);
+	}
+
+	ext2_extent_list_free(&list);
 }
 
-static void directory_walk(struct dentry_list *head, struct ext2_superblock *sb, struct ext2_blockgroup *bg)
+// Where the inode is in the image, taking its block group and s_inode_size into account.
+static unsigned long get_inode_address(const struct ext2_fs *fs, u_int32_t ino)
 {
-	struct dentry_list *p;
+	const struct ext2_superblock *sb = fs->sb;
+	unsigned long address;
+	u_int32_t group;
+
+	if (ino == 0 || ino > sb->s_inodes_count)
+		return 0;
+
+	group = (ino - 1) / sb->s_inodes_per_group;
+	if (group >= fs->group_count)
+		return 0;
+
+	address = (unsigned long) fs->groups[group].bg_inode_table * fs->block_size +
+		(unsigned long) ((ino - 1) % sb->s_inodes_per_group) * get_inode_size(*sb);
+	if (address + sizeof(struct ext2_inode) > fs->size)
+		return 0;
+
+	return address;
+}
+
+static void directory_walk(const struct ext2_dentry_table *table, const struct ext2_fs *fs)
+{
+	const struct ext2_dentry_rec *p;
+	const char *name;
 	u_int8_t ftype;
 	unsigned long block_address = 0;
-	unsigned long bass_address = blockid2address(sb, bg->bg_inode_table);
 
-	for (p = head->next; p; p = p->next) {
-		ftype = get_file_type(p->dentry);
+	for (p = table->recs; p < table->recs + table->count; p++) {
+		name = ext2_dentry_rec_name(table, p);
+		ftype = get_file_type(p);
+		block_address = get_inode_address(fs, p->inode);
+		emit_inode(fs, p, name, block_address);
+		if (!verbose)
+			continue;
+
 		switch (ftype) {
 		case EXT2_FT_UNKNOWN:
-			printf("unknown file type %s\n", p->dentry->name);
+			printf("unknown file type %s\n", name);
 			break;
 		case EXT2_FT_REG_FILE:
-			printf("%s is a regular file: inode[0x%x]\n", p->dentry->name, p->dentry->inode);
-			block_address = (p->dentry->inode * sizeof(struct ext2_inode)) + bass_address;
-			printf("file's block address is %lx(%x * %x + %x)\n", block_address, 
-			       p->dentry->inode, sizeof(struct ext2_inode),
-			       bass_address);
+			printf("%s is a regular file: inode[0x%x]\n", name, p->inode);
+			printf("file's inode address is %lx(inode size %x)\n", block_address,
+			       get_inode_size(*fs->sb));
+			print_extents(fs, p->inode);
 			break;
 		case EXT2_FT_DIR:
-			printf("%s is a directory: inode[0x%x]\n", p->dentry->name, p->dentry->inode);
-			block_address = (p->dentry->inode * sizeof(struct ext2_inode)) + bass_address;
-			printf("dir's block address is %lx\n", block_address);
+			printf("%s is a directory: inode[0x%x]\n", name, p->inode);
+			printf("dir's inode address is %lx\n", block_address);
+			print_extents(fs, p->inode);
 			break;
 		default:
 			break;
@@ -92,81 +187,434 @@ static void directory_walk(struct dentry_list *head, struct ext2_superblock *sb,
 
 }
 
-static void read_dentry(struct ext2_dentry *dentry, unsigned address, 
-			unsigned long offset, u_int16_t rec_len)
+static int get_all_directories(struct ext2_dentry_table *table, const struct ext2_fs *fs, unsigned long address, struct ext2_blockgroup *blk_group)
 {
-	memcpy(dentry, file_system + address + offset, rec_len);
+	int i;
+	int rec_len;
+	u_int32_t block = address / fs->block_size;
+	unsigned long offset = address % fs->block_size;
+	u_int16_t count = blk_group->bg_used_dirs_count + 2; // Add "." and ".." to directory count.
+	struct ext2_block b = { NULL, NULL };
+	
+	for (i = 0; i < count; i++) {
+		struct ext2_dentry_view dentry;
+		struct ext2_dentry_rec *rec;
+
+		// entries never cross a block, so go on with the next one.
+		if (offset >= fs->block_size) {
+			ext2_put_block(fs, &b);
+			block += offset / fs->block_size;
+			offset %= fs->block_size;
+		}
+		if (!b.data && ext2_get_block(fs, block, BCACHE_DIR, &b) < 0)
+			break;
+
+		rec_len = ext2_dentry_view_get(b.data, offset, fs->block_size, &dentry);
+		if (rec_len < 0)
+			break;
+
+		rec = ext2_dentry_table_add(table, ext2_dentry_view_inode(dentry),
+					    ext2_dentry_view_file_type(dentry),
+					    ext2_dentry_view_name(dentry),
+					    ext2_dentry_view_name_len(dentry));
+
+		emit_begin(out, "dentry");
+		emit_u64(out, "ino", rec->inode);
+		emit_u64(out, "rec_len", rec_len);
+		emit_u64(out, "file_type", rec->file_type);
+		emit_str(out, "name", ext2_dentry_rec_name(table, rec), rec->name_len);
+		emit_end(out);
+
+		if (verbose) {
+			printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
+			printf("dentry->inode: 0x%x\n", ext2_dentry_view_inode(dentry));
+			printf("dentry->rec_len: 0x%x\n", rec_len);
+			printf("dentry->name_len:0x%x\n", ext2_dentry_view_name_len(dentry));
+			printf("dentry->file_type:0x%x\n", ext2_dentry_view_file_type(dentry));
+			printf("dentry->name:%s\n", ext2_dentry_rec_name(table, rec));
+			printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n\n");
+		}
+		offset += rec_len;
+	}
+	ext2_put_block(fs, &b);
+
+	return 0;
+}
+
+static unsigned long get_block_data_address(struct ext2_superblock *sb, struct ext2_blockgroup *bg)
+{
+	return (unsigned long) sb->s_inodes_per_group * get_inode_size(*sb)
+				+  blockid2address(sb, bg->bg_inode_table);
 }
 
-static u_int16_t read_dentry_rec_len(unsigned long address, unsigned long offset)
+static u_int64_t blockid2address(struct ext2_superblock *sb, u_int32_t id)
 {
-	u_int16_t len = 0;
+	return (u_int64_t) get_block_size(*sb) * id;
+}
 
-	// ignore inode.
-	memcpy(&len, file_system + address + offset + 4, sizeof(len));
+static void print_scan(const struct ext2_fs *fs, const struct ext2_scan *scan)
+{
+	const struct ext2_group_stat *t = &scan->total;
+	u_int32_t i;
+
+	printf("Scanned %u block groups\n", scan->group_count);
+	printf("directories %u : regular files %u : others %u : dentries %lu\n",
+	       t->dirs, t->files, t->others, t->dentries);
+	printf("free blocks %u (super block says %u)\n", t->free_blocks, fs->sb->s_free_blocks_count);
+	printf("free inodes %u (super block says %u)\n", t->free_inodes, fs->sb->s_free_inodes_count);
+	if (t->errors)
+		printf("%u errors found\n", t->errors);
+
+	for (i = 0; i < scan->group_count; i++) {
+		const struct ext2_group_stat *st = scan->groups + i;
+		const struct ext2_blockgroup *bg = fs->groups + i;
+
+		if (st->free_blocks != bg->bg_free_blocks_count ||
+		    st->free_inodes != bg->bg_free_inodes_count ||
+		    st->dirs != bg->bg_used_dirs_count)
+			printf("block group[%u]: counters differ: free blocks %u/%u free inodes %u/%u dirs %u/%u\n",
+			       i, st->free_blocks, bg->bg_free_blocks_count,
+			       st->free_inodes, bg->bg_free_inodes_count,
+			       st->dirs, bg->bg_used_dirs_count);
+	}
+}
 
-	return len;
+static void print_bitmaps(const struct ext2_fs *fs, const struct ext2_bitmap_report *report)
+{
+	const struct ext2_superblock *sb = fs->sb;
+	u_int32_t i;
+
+	printf("Bitmaps recounted with %s popcount\n", bitmap_popcount_impl());
+	printf("free blocks %lu (super block says %u) in %lu runs\n",
+	       report->blocks.free, sb->s_free_blocks_count, report->blocks.free_runs);
+	printf("free inodes %lu (super block says %u)\n", report->inodes.free, sb->s_free_inodes_count);
+	printf("longest free run %lu blocks at 0x%lx\n",
+	       report->blocks.longest_free, report->blocks.longest_free_start);
+	if (report->bad_groups || report->errors)
+		printf("%u groups disagree with their descriptors, %u groups unreadable\n",
+		       report->bad_groups, report->errors);
+
+	for (i = 0; i < report->group_count; i++) {
+		const struct ext2_group_bitmaps *gb = report->groups + i;
+
+		if (gb->error) {
+			printf("block group[%u]: bitmaps are out of the image\n", i);
+			continue;
+		}
+		if (!verbose && ext2_group_bitmaps_match(fs, i, gb))
+			continue;
+		printf("block group[%u]: free blocks %lu/%u : free inodes %lu/%u : longest free run %lu blocks at 0x%lx%s\n",
+		       i, gb->blocks.free, fs->groups[i].bg_free_blocks_count,
+		       gb->inodes.free, fs->groups[i].bg_free_inodes_count,
+		       gb->blocks.longest_free,
+		       sb->s_first_data_block + (unsigned long) i * sb->s_blocks_per_group + gb->blocks.longest_free_start,
+		       ext2_group_bitmaps_match(fs, i, gb) ? "" : " (counters differ)");
+	}
 }
 
-static int get_all_directories(struct dentry_list *head, unsigned long address, struct ext2_blockgroup *blk_group)
+static void lookup_test(const struct ext2_fs *fs)
 {
+	static const char * const names[] = {
+		"test.txt",
+		"dir_a",
+		"lost+found",
+		"..",
+		"no_such_file",
+	};
+	struct ext2_inode root;
+	u_int32_t ino;
+	u_int8_t ftype = EXT2_FT_UNKNOWN;
 	int i;
-	u_int16_t rec_len;
-	unsigned long offset = 0;
-	u_int16_t count = blk_group->bg_used_dirs_count + 2; // Add "." and ".." to directory count.
-	
-	for (i = 0; i < count; i++) {
-		struct ext2_dentry *dentry;
-		struct dentry_list *p;
 
-		rec_len = read_dentry_rec_len(address, offset);
+	printf(">>>>>>>>>>ext2_lookup() test <<<<<<<<<<<<<<<<\n");
+	if (ext2_read_inode(fs, EXT2_ROOT_INO, &root) < 0) {
+		printf("root inode is not readable\n");
+		return ;
+	}
 
-		// added one byte for '\0'.
-		dentry = malloc(rec_len + 1);
-		assert(dentry != NULL);
+	printf("root directory is %s (default hash version %u)\n",
+	       (root.i_flags & EXT2_INDEX_FL) ? "hash indexed" : "linear",
+	       fs->sb->s_def_hash_version);
 
-		read_dentry(dentry, address, offset, rec_len);
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		ino = ext2_lookup(fs, &root, names[i], strlen(names[i]), &ftype);
+		if (ino)
+			printf("file %s Found: inode[0x%x] type 0x%x\n", names[i], ino, ftype);
+		else
+			printf("file %s Not found\n", names[i]);
+	}
+	printf(">>>>>>>>>>ext2_lookup() test <<<<<<<<<<<<<<<<\n");
+}
 
-		p = malloc(sizeof(*p));
-		assert(p != NULL);
+static void put_dirent(unsigned char *block, u_int32_t offset, u_int32_t ino, u_int16_t rec_len, const char *name)
+{
+	unsigned char *p = block + offset;
+	u_int8_t len = strlen(name);
+
+	p[0] = ino;
+	p[1] = ino >> 8;
+	p[2] = ino >> 16;
+	p[3] = ino >> 24;
+	p[4] = rec_len;
+	p[5] = rec_len >> 8;
+	p[6] = len;
+	p[7] = EXT2_FT_REG_FILE;
+	memcpy(p + EXT2_DIRENT_MIN_LEN, name, len);
+}
 
-		p->dentry = dentry;
-		p->next = head->next;
-		head->next = p;
+// Feed the block parsers a good block and one whose chain reaches the end of
+// the block through a rec_len which is not a multiple of 4.
+static void dirblock_test(const struct ext2_fs *fs)
+{
+	ext2_dirblock_fn parsers[2];
+	struct ext2_dirblock blocks[2];
+	unsigned char *good = calloc(2, fs->block_size);
+	unsigned char *odd = good + fs->block_size;
+	struct ext2_dirent *ents = calloc(2 * EXT2_DIRBLOCK_MAX_ENTRIES(fs->block_size), sizeof(*ents));
+	int failed = 0;
+	int i;
 
-		printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
-		printf("dentry->inode: 0x%x\n", dentry->inode);
-		printf("dentry->rec_len: 0x%x\n", dentry->rec_len);
-		printf("dentry->name_len:0x%x\n", dentry->name_len);
-		printf("dentry->file_type:0x%x\n", dentry->file_type);
-		printf("dentry->name:%s\n", dentry->name);
-		printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n\n");
-		offset += rec_len;
+	assert(good != NULL && ents != NULL);
+	put_dirent(good, 0, EXT2_ROOT_INO, 12, ".");
+	put_dirent(good, 12, 11, fs->block_size - 12, "file");
+	put_dirent(odd, 0, EXT2_ROOT_INO, 13, ".");
+	put_dirent(odd, 13, 11, fs->block_size - 13, "file");
+
+	parsers[0] = fs->dir_parse;
+	parsers[1] = ext2_dirblock_parser(0); // the one for any block size
+	printf(">>>>>>>>>>dirblock parser test <<<<<<<<<<<<<<<<\n");
+	for (i = 0; i < 2; i++) {
+		// two at a time, then each on its own.
+		blocks[0].data = good;
+		blocks[0].ents = ents;
+		blocks[1].data = odd;
+		blocks[1].ents = ents + EXT2_DIRBLOCK_MAX_ENTRIES(fs->block_size);
+		parsers[i](blocks, 2, fs->block_size, 0xff);
+		if (blocks[0].broken || blocks[0].count != 2 || !blocks[1].broken)
+			failed++;
+
+		parsers[i](blocks + 1, 1, fs->block_size, 0xff);
+		if (!blocks[1].broken)
+			failed++;
 	}
+	printf("misaligned rec_len %s\n", failed ? "accepted: FAILED" : "rejected: ok");
+	printf(">>>>>>>>>>dirblock parser test <<<<<<<<<<<<<<<<\n");
 
-	return 0;
+	free(good);
+	free(ents);
 }
 
-static unsigned long get_block_data_address(struct ext2_superblock *sb, struct ext2_blockgroup *bg)
+static void namei_test(const struct ext2_fs *fs)
 {
-	return (unsigned long) sb->s_inodes_per_group * sizeof(struct ext2_inode) 
-				+  blockid2address(sb, bg->bg_inode_table);
+	static const char * const paths[] = {
+		"/dir_a/dir_b/foobar.txt",
+		"/dir_A/dir_B",
+		"/dir_A/dir_B/",
+		"/test.txt",
+		"/dir_A/dir_C",
+		"/test.txt/foo",
+	};
+	struct dcache_stat st;
+	u_int32_t ino;
+	int pass;
+	int i;
+
+	printf(">>>>>>>>>>ext2_namei() test <<<<<<<<<<<<<<<<\n");
+	// second pass is answered from the dcache.
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+			ino = ext2_namei(fs, paths[i]);
+			if (pass)
+				continue;
+			if (ino)
+				printf("file %s Found: inode[0x%x]\n", paths[i], ino);
+			else
+				printf("file %s Not found\n", paths[i]);
+		}
+	}
+
+	dcache_get_stat(fs->dcache, &st);
+	printf("dcache: %lu entries, %lu hits, %lu negative hits, %lu misses\n",
+	       st.entries, st.hits, st.negative_hits, st.misses);
+	printf(">>>>>>>>>>ext2_namei() test <<<<<<<<<<<<<<<<\n");
 }
 
-static u_int32_t blockid2address(struct ext2_superblock *sb, u_int32_t id)
+// Map the sidecar index next to the image, building it first if it is
+// missing or stale, and check its lookups against ext2_namei().
+static void index_test(const struct ext2_fs *fs, struct workpool *pool)
 {
-	return get_block_size(*sb) * id;
+	static const char * const paths[] = {
+		"/dir_a/dir_b/foobar.txt",
+		"/dir_A/dir_B",
+		"/dir_A/dir_B/../dir_B",
+		"/test.txt",
+		"/dir_A/dir_C",
+		"/lost+found",
+	};
+	const struct ext2_index_header *hdr;
+	struct ext2_index *idx;
+	struct timespec start, end;
+	const char *how = "loaded";
+	char path[4096];
+	int i;
+
+	printf(">>>>>>>>>>ext2_index test <<<<<<<<<<<<<<<<\n");
+	snprintf(path, sizeof(path), "%s.idx", test_file);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	idx = ext2_index_open(fs, path);
+	if (!idx) {
+		how = "built";
+		if (ext2_index_build(fs, pool, path) < 0 || !(idx = ext2_index_open(fs, path))) {
+			printf("can not build index %s\n", path);
+			return ;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	hdr = idx->hdr;
+	printf("index %s %s in %.3f ms: %llu entries, %llu inodes, %llu extents\n", path, how,
+	       (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+	       (unsigned long long) hdr->nr_nodes, (unsigned long long) hdr->nr_inodes,
+	       (unsigned long long) hdr->nr_extents);
+	printf("free blocks %llu in %llu runs : free inodes %llu : longest free run %llu blocks at 0x%llx\n",
+	       (unsigned long long) hdr->free_blocks, (unsigned long long) hdr->free_runs,
+	       (unsigned long long) hdr->free_inodes, (unsigned long long) hdr->longest_free,
+	       (unsigned long long) hdr->longest_free_start);
+
+	for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+		u_int32_t ino = ext2_index_lookup(idx, paths[i]);
+		const struct ext2_index_inode *rec = ext2_index_find_inode(idx, ino);
+
+		if (!ino || !rec) {
+			printf("file %s Not found%s\n", paths[i], ext2_namei(fs, paths[i]) ? " (namei disagrees)" : "");
+			continue;
+		}
+		printf("file %s Found: inode[0x%x] size %llu : %u extents%s\n", paths[i], ino,
+		       (unsigned long long) rec->size, rec->nr_extents,
+		       ext2_namei(fs, paths[i]) != ino ? " (namei disagrees)" : "");
+	}
+
+	ext2_index_close(idx);
+	printf(">>>>>>>>>>ext2_index test <<<<<<<<<<<<<<<<\n");
 }
 
-static void read_block_group(struct ext2_superblock *sb,  struct ext2_blockgroup *bg, unsigned long offset)
+static void print_walk_entry(void *arg, const struct treewalk_entry *e)
 {
-	memcpy(bg, file_system + offset, sizeof(struct ext2_blockgroup));
+	emit_begin(out, "walk");
+	emit_u64(out, "dir", e->dir);
+	emit_u64(out, "inode", e->ino);
+	emit_u64(out, "depth", e->depth);
+	emit_u64(out, "file_type", e->type);
+	emit_str(out, "name", e->name, e->name_len);
+	emit_end(out);
+
+	if (verbose)
+		printf("%*s%.*s inode[0x%llx]%s\n", e->depth * 2, "", e->name_len, e->name,
+		       (unsigned long long) e->ino, e->is_dir ? "/" : "");
+}
+
+// Walk the whole tree from the root on the pool. Entries are only listed in
+// the deterministic order, otherwise this just counts them.
+static void walk_test(const struct ext2_fs *fs, struct workpool *pool)
+{
+	struct treewalk_stat st;
+	struct timespec start, end;
+	int flags = verbose || out ? TREEWALK_ORDERED : 0;
+
+	printf(">>>>>>>>>>ext2_walk test <<<<<<<<<<<<<<<<\n");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (ext2_walk(fs, pool, flags, flags ? print_walk_entry : NULL, NULL, &st) < 0)
+		printf("can not read the root directory\n");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("walked %lu directories, %lu entries in %.3f ms : %d runners, %lu steals, %lu errors\n",
+	       st.dirs, st.entries,
+	       (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+	       st.runners, st.steals, st.errors);
+	printf(">>>>>>>>>>ext2_walk test <<<<<<<<<<<<<<<<\n");
+}
+
+// Stream the file through a small buffer and dump it.
+static void read_file(const struct ext2_fs *fs, const char *fname)
+{
+	u_int32_t ino;
+	struct ext2_file file;
+	unsigned char buf[4096];
+	long len;
+	int i;
+
+	ino = ext2_namei(fs, fname);
+	if (!ino || ext2_file_open(fs, ino, &file) < 0) {
+		printf("file %s not found\n", fname);
+		return ;
+	}
+
+	printf("file %s: size is 0x%llx\n", fname, (unsigned long long) file.size);
+
+	while ((len = ext2_file_read(&file, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < len; i++)
+			printf("0x%02x ", buf[i]);
+	}
+
+	printf("\n");
+
+	ext2_file_close(&file);
+}
+
+static void read_file_test(const struct ext2_fs *fs)
+{
+	printf(">>>>>>>>>>read_file() test <<<<<<<<<<<<<<<<\n");
+	read_file(fs, "/dir_a/dir_b/foobar.txt");
+	printf(">>>>>>>>>>read_file() test <<<<<<<<<<<<<<<<\n");
+	read_file(fs, "/test.txt");
+	printf(">>>>>>>>>>read_file() test <<<<<<<<<<<<<<<<\n");
+}
+
+static void print_icache(const struct ext2_fs *fs)
+{
+	struct ext2_icache_stat st;
+
+	if (!fs->icache) {
+		printf("inode cache is disabled for inode size %u\n", get_inode_size(*fs->sb));
+		return ;
+	}
+
+	ext2_icache_get_stat(fs->icache, &st);
+	printf("inode cache: %lu hits, %lu misses, %lu inodes decoded from %lu table blocks\n",
+	       st.hits, st.misses, st.inodes, st.table_blocks);
+}
+
+static void print_bcache(const struct ext2_fs *fs)
+{
+	struct bcache_stat st;
+	int i;
+
+	if (!fs->bcache)
+		return ;
+
+	bcache_get_stat(fs->bcache, &st);
+	printf("block cache:");
+	for (i = 0; i < BCACHE_NR_TYPES; i++)
+		printf(" %s %lu/%lu", bcache_type_name(i), st.hits[i], st.misses[i]);
+	printf(" (hits/misses)\n");
+	printf("block cache: %lu prefetched, %lu evicted, %lu I/O errors\n",
+	       st.prefetched, st.evictions, st.io_errors);
 }
 
 static void read_super_block(struct ext2_superblock *sb)
 {
+	struct ext2_sb_view v;
+
 	// Super block starts at address 1024. 
-	memcpy(sb, file_system + SUPER_BLOCK_SIZE, sizeof(struct ext2_superblock));
+	// It is read once and every module works on this copy.
+	if (file_system) {
+		assert(ext2_sb_view_get(file_system, file_size, &v) == 0);
+		memcpy(sb, v.p, sizeof(struct ext2_superblock));
+	} else {
+		assert(blkio_read(image_io, sb, SUPER_BLOCK_SIZE, sizeof(*sb)) == sizeof(*sb));
+		assert(sb->s_magic == EXT2_SUPER_MAGIC);
+	}
 }
 
 static const char *get_os_name(struct ext2_superblock *sb)
@@ -190,20 +638,84 @@ int main(int argc, char **argv)
 	unsigned long size = 0;
 	int block_cnt = 0;
 	struct ext2_superblock sb;
+	struct ext2_fs fs;
 	struct ext2_blockgroup *block_group;
-	struct dentry_list head;
-	struct dentry_list *p, *q;
+	struct ext2_scan scan;
+	struct ext2_bitmap_report report;
+	struct workpool *pool;
+	struct ext2_dentry_table dentries;
+	int backend = BLKIO_MMAP;
+	int format = -1;
+	const char *out_path = NULL;
+	int opt;
 	int i;
 
-	// Get HDD image file size and mmap the image.
-	size = get_file_size();
-	file_system = map2memory(size);
+	instr_setup();
+
+	while ((opt = getopt(argc, argv, "vxf:e:o:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'x':
+			use_index = 1;
+			break;
+		case 'f':
+			test_file = optarg;
+			break;
+		case 'e':
+			if ((format = emit_parse_format(optarg)) < 0)
+				goto usage;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind < argc && (backend = blkio_parse_backend(argv[optind++])) < 0)
+		goto usage;
+	if (optind < argc || (format >= 0 && !out_path))
+		goto usage;
+
+	if (out_path) {
+		out = emit_open(out_path, format < 0 ? EMIT_NDJSON : format);
+		if (!out) {
+			printf("can not open %s\n", out_path);
+			exit(-1);
+		}
+	}
+
+	image_io = blkio_open(test_file, backend);
+	assert(image_io != NULL);
+
+	// Only the mapping is used in place; other backends go through the
+	// block cache, so the image is never copied into memory.
+	size = blkio_size(image_io);
+	if (backend == BLKIO_MMAP) {
+		file_system = blkio_load(image_io);
+		assert(file_system != NULL);
+	}
+	file_size = size;
 
 	printf("file size is %ld\n", size);
+	printf("image is read with %s\n", blkio_name(image_io));
 
 	// Read super block which in block group zero.
 	read_super_block(&sb);
 
+	fs.image = file_system;
+	fs.size = size;
+	fs.sb = &sb;
+	fs.block_size = get_block_size(sb);
+	fs.dcache = dcache_create(1024);
+	fs.icache = NULL;
+	fs.bcache = NULL;
+	// without the mapping, share one cache between every block reader.
+	if (backend != BLKIO_MMAP)
+		fs.bcache = bcache_create(image_io, fs.block_size, 8 * 1024 * 1024);
+
 	// print some information.
 	printf("-----------------------------------------------------\n");
 	printf("The file system was created by %s\n", get_os_name(&sb));
@@ -222,64 +734,107 @@ int main(int argc, char **argv)
 	printf("Inode per group 0x%x\n", sb.s_inodes_per_group);
 	printf("-----------------------------------------------------\n");
 
-	// how many block groups do I have?
-	block_cnt = sb.s_blocks_count / sb.s_blocks_per_group;
-	if (sb.s_blocks_count > 8192)
-		block_cnt++;
-
-	// Allocate memory to store block group data.
-	block_group = malloc(sizeof(*block_group) * (block_cnt + 1));
-	assert(block_group != NULL);
-	memset(block_group, 0x0, sizeof(*block_group));
-
-	// Setup dentry_list.
-	head.next = NULL;
- 
-	// Read first block group descriptor.
-	read_block_group(&sb, block_group, SUPER_BLOCK_SIZE * 2);
+	// Read whole block group descriptor table.
+	if (ext2_load_groups(&fs) < 0) {
+		printf("broken block group descriptor table\n");
+		exit(-1);
+	}
+	block_group = fs.groups;
+	block_cnt = fs.group_count;
+	fs.icache = ext2_icache_create(&fs, 0);
+
+	// Setup dentry table which owns every entry of this scan.
+	ext2_dentry_table_init(&dentries);
+
 	printf("There is %d Block group\n", block_cnt);
 
 	for (i = 0; i < block_cnt ; i++) {
 		if (block_group[i].bg_block_bitmap != 0 &&
 			block_group[i].bg_inode_bitmap != 0 &&
 			block_group[i].bg_inode_table != 0) {
-			printf("block group[%d]: bg_block_bitmap is 0x%x(0x%x) : bg_inode_bitmap is 0x%x(0x%x) : bg_inode_table is0x%x(0x%x)\n",
-				i, 
-				block_group[i].bg_block_bitmap, blockid2address(&sb, block_group[i].bg_block_bitmap),
-				block_group[i].bg_inode_bitmap, blockid2address(&sb, block_group[i].bg_inode_bitmap),
-				block_group[i].bg_inode_table, blockid2address(&sb, block_group[i].bg_inode_table));
+			emit_begin(out, "group");
+			emit_u64(out, "group", i);
+			emit_u64(out, "block_bitmap", block_group[i].bg_block_bitmap);
+			emit_u64(out, "inode_bitmap", block_group[i].bg_inode_bitmap);
+			emit_u64(out, "inode_table", block_group[i].bg_inode_table);
+			emit_u64(out, "used_dirs", block_group[i].bg_used_dirs_count);
+			emit_u64(out, "free_blocks", block_group[i].bg_free_blocks_count);
+			emit_u64(out, "free_inodes", block_group[i].bg_free_inodes_count);
+			emit_end(out);
+
+			if (verbose) {
+				printf("block group[%d]: bg_block_bitmap is 0x%x(0x%llx) : bg_inode_bitmap is 0x%x(0x%llx) : bg_inode_table is0x%x(0x%llx)\n",
+				       i,
+				       block_group[i].bg_block_bitmap, (unsigned long long) blockid2address(&sb, block_group[i].bg_block_bitmap),
+				       block_group[i].bg_inode_bitmap, (unsigned long long) blockid2address(&sb, block_group[i].bg_inode_bitmap),
+				       block_group[i].bg_inode_table, (unsigned long long) blockid2address(&sb, block_group[i].bg_inode_table));
 				printf("block group[%d] has %d directories\n", i, block_group[i].bg_used_dirs_count);
 				printf("Block Data starts 0x%lx\n", get_block_data_address(&sb, block_group + i));
 				printf("Free blocks 0x%x\n",  block_group[i].bg_free_blocks_count);
 				printf("Free inodes 0x%x\n",  block_group[i].bg_free_inodes_count);
 				printf("-----------------------------------------------------\n");
+			}
 
-				// Get directory entries.
-				if (get_all_directories(&head, get_block_data_address(&sb, block_group + i), block_group + i) < 0)
-					exit(-1);
-
-				
-				// Copy of super block which exists block group zero, one and so on.
-				if (i == 0) {
-					printf("Next is 0x%x\n", (sb.s_blocks_per_group * 0x400) + (0x400 * ((i + 1) * 2)));
-					read_block_group(&sb, block_group + 1, (sb.s_blocks_per_group * 0x400) + 0x800);
-				}
+			// Get directory entries.
+			if (block_group[i].bg_used_dirs_count &&
+			    get_all_directories(&dentries, &fs, get_block_data_address(&sb, block_group + i), block_group + i) < 0)
+				exit(-1);
 		}
 	
 	}
 	printf("-----------------------------------------------------\n");
 
-	directory_walk(&head, &sb, block_group);
+	// Decode bitmaps, inode tables and directories of every group in parallel.
+	pool = workpool_create(0);
+	if (ext2_scan_groups(&fs, pool, &scan) < 0)
+		exit(-1);
+	print_scan(&fs, &scan);
+	ext2_scan_free(&scan);
+	printf("-----------------------------------------------------\n");
 
-	for (p = head.next; p != NULL; p = q) {
-//		printf("inode[%u]= [%s]\n", p->dentry->inode, p->dentry->name);
-		q = p->next;
-		free(p->dentry);
-		free(p);
-	}
+	if (ext2_check_bitmaps(&fs, pool, &report) < 0)
+		exit(-1);
+	print_bitmaps(&fs, &report);
+	ext2_bitmap_report_free(&report);
+	if (use_index)
+		index_test(&fs, pool);
+	walk_test(&fs, pool);
+	workpool_destroy(pool);
+	printf("-----------------------------------------------------\n");
 
-	munmap(file_system, size);
-	free(block_group);
+	directory_walk(&dentries, &fs);
+
+	lookup_test(&fs);
+	namei_test(&fs);
+	dirblock_test(&fs);
+	read_file_test(&fs);
+	print_icache(&fs);
+	print_bcache(&fs);
+
+	ext2_dentry_table_release(&dentries);
+
+	if (file_system)
+		blkio_unload(image_io, file_system);
+	blkio_close(image_io);
+	ext2_icache_destroy(fs.icache);
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+	ext2_free_groups(&fs);
+	dcache_destroy(fs.dcache);
+
+	if (out) {
+		unsigned long records = emit_records(out);
+
+		if (emit_close(out) < 0) {
+			printf("writing %s failed\n", out_path);
+			exit(-1);
+		}
+		printf("%lu records written to %s\n", records, out_path);
+	}
 
 	return 0;
+
+usage:
+	printf("usage: %s [-v] [-x] [-f image] [-e ndjson|binary] [-o file] [mmap|pread|uring]\n", argv[0]);
+	exit(-1);
 }
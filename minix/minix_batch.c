@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "minixfs.h"
+#include "minix_superblock.h"
+#include "minix_inode.h"
+#include "minix_file.h"
+#include "minix_frag.h"
+#include "minix_batch.h"
+#include "byteorder.h"
+#include "bitmap.h"
+#include "bcache.h"
+#include "workpool.h"
+
+#define IMAP_ADDRESS 0x800
+#define ZMAP_ADDRESS(sb) (IMAP_ADDRESS + (sb).s_imap_blocks * MINIX_BLOCK_SIZE)
+#define INODE_TABLE_ADDRESS(sb) (ZMAP_ADDRESS(sb) + (sb).s_zmap_blocks * MINIX_BLOCK_SIZE)
+#define NR_ZONES(sb) ((sb).s_zones ? (sb).s_zones : (sb).s_nzones)
+
+// sb is BATCH_PROBE_SIZE bytes read from BATCH_PROBE_OFFSET.
+int minix_batch_probe(const unsigned char *sb)
+{
+	return get_le16(sb + offsetof(struct minix_superblock, s_magic)) == MINIX_V2_MAGIC;
+}
+
+int minix_batch_audit(struct blkio *io, unsigned long mem_limit, struct workpool *pool,
+		      struct batch_report *r)
+{
+	struct minix_superblock sb;
+	struct minix_frag_report frag;
+	struct bitmap_stat inodes;
+	struct bitmap_stat zones;
+	struct minix_fs fs;
+	unsigned char *imap = NULL;
+	unsigned char *zmap = NULL;
+	unsigned long inode_bits;
+	unsigned long zone_bits;
+	int ret = -1;
+
+	memset(r, 0x0, sizeof(*r));
+	memset(&fs, 0x0, sizeof(fs));
+	fs.size = blkio_size(io);
+
+	if (fs.size < BATCH_PROBE_OFFSET + sizeof(sb) ||
+	    blkio_read(io, &sb, BATCH_PROBE_OFFSET, sizeof(sb)) != sizeof(sb)) {
+		r->error = "bad superblock";
+		return -1;
+	}
+
+	// only a mapping is used in place; anything else is cached up to the limit.
+	if (io->map)
+		fs.image = io->map;
+	else
+		fs.bcache = bcache_create(io, MINIX_BLOCK_SIZE, mem_limit);
+	fs.inode_table = INODE_TABLE_ADDRESS(sb);
+
+	// bit 0 of both maps is reserved and always set.
+	inode_bits = sb.s_ninodes + 1;
+	zone_bits = NR_ZONES(sb) - sb.s_firstdatazone + 1;
+	if (NR_ZONES(sb) < sb.s_firstdatazone ||
+	    inode_bits > sb.s_imap_blocks * MINIX_BLOCK_SIZE * 8UL ||
+	    zone_bits > sb.s_zmap_blocks * MINIX_BLOCK_SIZE * 8UL ||
+	    ZMAP_ADDRESS(sb) + sb.s_zmap_blocks * (unsigned long) MINIX_BLOCK_SIZE > fs.size) {
+		r->error = "bitmaps do not fit in s_imap_blocks/s_zmap_blocks";
+		goto out;
+	}
+
+	imap = minix_copy_blocks(&fs, IMAP_ADDRESS / MINIX_BLOCK_SIZE, sb.s_imap_blocks, BCACHE_BITMAP);
+	zmap = minix_copy_blocks(&fs, ZMAP_ADDRESS(sb) / MINIX_BLOCK_SIZE, sb.s_zmap_blocks, BCACHE_BITMAP);
+	if (!imap || !zmap) {
+		r->error = "can not read the bitmaps";
+		goto out;
+	}
+	bitmap_analyze(imap, inode_bits, &inodes);
+	bitmap_analyze(zmap, zone_bits, &zones);
+
+	if (minix_frag_scan(&fs, sb.s_ninodes, pool, NULL, NULL, &frag) < 0) {
+		r->error = "no inodes";
+		goto out;
+	}
+
+	r->block_size = MINIX_BLOCK_SIZE;
+	r->inodes = sb.s_ninodes - inodes.free;
+	r->inodes_count = sb.s_ninodes;
+	// zones before the first data zone are not in the map and always used.
+	r->blocks = NR_ZONES(sb) - zones.free;
+	r->blocks_count = NR_ZONES(sb);
+	r->problems = frag.errors + !(imap[0] & 1) + !(zmap[0] & 1);
+	ret = 0;
+
+out:
+	free(imap);
+	free(zmap);
+	if (fs.bcache)
+		bcache_destroy(fs.bcache);
+
+	return ret;
+}
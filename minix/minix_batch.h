@@ -0,0 +1,19 @@
+#ifndef MIKOOS_MINIX_BATCH_H
+#define MIKOOS_MINIX_BATCH_H 1
+
+#include <sys/types.h>
+#include "blkio.h"
+#include "batch.h"
+
+struct workpool;
+
+// minix part of a batch audit: the bitmaps are recounted and the zone
+// trees scanned with minix_frag_scan(), its inode chunks on the shared
+// pool. Without the mmap backend zones and inodes are read through a block
+// cache bounded by mem_limit, so the image need not fit in memory.
+
+int minix_batch_probe(const unsigned char *sb);
+int minix_batch_audit(struct blkio *io, unsigned long mem_limit, struct workpool *pool,
+		      struct batch_report *r);
+
+#endif // MIKOOS_MINIX_BATCH_H
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "minix_inode.h"
+#include "minix_view.h"
+#include "minix_file.h"
+#include "readahead.h"
+#include "instr.h"
+
+#define ZONES_PER_BLOCK (MINIX_BLOCK_SIZE / sizeof(u_int32_t))
+// Zones handed to the block cache per prefetch call.
+#define PREFETCH_BATCH 64
+
+static int zone_is_valid(const struct minix_fs *fs, u_int32_t zone)
+{
+	return zone && ((u_int64_t) zone + 1) * MINIX_BLOCK_SIZE <= fs->size;
+}
+
+// Inode numbers start from 1. The inode is copied out of its table block.
+int minix_read_inode(const struct minix_fs *fs, u_int32_t ino, struct minix_inode *inode)
+{
+	unsigned long address = fs->inode_table + (unsigned long) (ino - 1) * sizeof(struct minix_inode);
+	const unsigned char *block;
+	struct bcache_buf *buf;
+	struct minix_inode_view v;
+
+	if (ino == 0 || address + sizeof(struct minix_inode) > fs->size)
+		return -1;
+
+	// the table starts on a zone and inodes do not cross zones.
+	block = minix_get_block(fs, address / MINIX_BLOCK_SIZE, BCACHE_ITABLE, &buf);
+	if (!block)
+		return -1;
+	v.p = block + address % MINIX_BLOCK_SIZE;
+	minix_inode_decode(v, inode);
+	minix_put_block(fs, &buf);
+
+	return 0;
+}
+
+// Copy nr zones from block on into one buffer, for structures such as the
+// bitmaps which are used as a whole. Returns the copy to free(), or NULL.
+unsigned char *minix_copy_blocks(const struct minix_fs *fs, u_int32_t block, u_int32_t nr, int type)
+{
+	unsigned char *copy = malloc((size_t) nr * MINIX_BLOCK_SIZE + 1);
+	u_int32_t i;
+
+	assert(copy != NULL);
+	for (i = 0; i < nr; i++) {
+		struct bcache_buf *buf;
+		const unsigned char *data = minix_get_block(fs, block + i, type, &buf);
+
+		if (!data) {
+			free(copy);
+			return NULL;
+		}
+		memcpy(copy + (size_t) i * MINIX_BLOCK_SIZE, data, MINIX_BLOCK_SIZE);
+		minix_put_block(fs, &buf);
+	}
+
+	return copy;
+}
+
+// Zone which holds the index'th block of the file. Returns 0 for a hole or
+// a pointer out of the image.
+u_int32_t minix_bmap(const struct minix_fs *fs, const struct minix_inode *inode, u_int32_t index)
+{
+	u_int32_t span = 1;
+	u_int32_t zone;
+	int level;
+
+	if (index < NR_DIRECT_ZONES) {
+		zone = inode->i_zone[index];
+		return zone_is_valid(fs, zone) ? zone : 0;
+	}
+
+	index -= NR_DIRECT_ZONES;
+	for (level = 1; level <= 3; level++) {
+		span *= ZONES_PER_BLOCK;
+		if (index < span)
+			break;
+		index -= span;
+	}
+	if (level > 3)
+		return 0;
+
+	zone = inode->i_zone[MINIX_IND_ZONE + level - 1];
+	while (level-- > 0) {
+		const unsigned char *block;
+		struct bcache_buf *buf;
+
+		span /= ZONES_PER_BLOCK;
+		if (!zone_is_valid(fs, zone))
+			return 0;
+		block = minix_get_block(fs, zone, BCACHE_DATA, &buf);
+		if (!block)
+			return 0;
+		zone = get_le32(block + (index / span) * sizeof(u_int32_t));
+		minix_put_block(fs, &buf);
+		index %= span;
+	}
+
+	return zone_is_valid(fs, zone) ? zone : 0;
+}
+
+int minix_file_open(const struct minix_fs *fs, u_int16_t ino, struct minix_file *file)
+{
+	memset(file, 0x0, sizeof(*file));
+
+	if (minix_read_inode(fs, ino, &file->inode) < 0)
+		return -1;
+
+	file->fs = fs;
+	file->size = file->inode.i_size;
+
+	return 0;
+}
+
+void minix_file_close(struct minix_file *file)
+{
+	memset(file, 0x0, sizeof(*file));
+}
+
+// Start reading len zones from zone on: with madvise on the image, or
+// through the block cache without it.
+static void zones_willneed(const struct minix_fs *fs, u_int32_t zone, u_int32_t len)
+{
+	u_int64_t blocks[PREFETCH_BATCH];
+	int n;
+
+	if (!fs->bcache) {
+		image_willneed(fs->image, fs->size, (u_int64_t) zone * MINIX_BLOCK_SIZE,
+			       (u_int64_t) len * MINIX_BLOCK_SIZE);
+		return ;
+	}
+
+	while (len) {
+		for (n = 0; n < PREFETCH_BATCH && len; n++, len--)
+			blocks[n] = zone++;
+		bcache_prefetch(fs->bcache, blocks, n);
+	}
+}
+
+// Ask for the zones of the next window once half of the last one was read.
+// Contiguous zones are asked for together.
+static void file_readahead(struct minix_file *file)
+{
+	u_int32_t start = file->ra_next;
+	u_int32_t end;
+	u_int32_t index;
+	u_int32_t run_start = 0;
+	u_int32_t run_len = 0;
+
+	if (start < file->pos)
+		start = file->pos;
+	if (start >= file->size || start - file->pos >= MINIX_READAHEAD_SIZE / 2)
+		return ;
+
+	end = file->size - file->pos > MINIX_READAHEAD_SIZE ? file->pos + MINIX_READAHEAD_SIZE : file->size;
+	file->ra_next = end;
+
+	for (index = start / MINIX_BLOCK_SIZE; index <= (end - 1) / MINIX_BLOCK_SIZE; index++) {
+		u_int32_t zone = minix_bmap(file->fs, &file->inode, index);
+
+		if (run_len && zone == run_start + run_len) {
+			run_len++;
+			continue;
+		}
+
+		if (run_len)
+			zones_willneed(file->fs, run_start, run_len);
+
+		run_start = zone;
+		run_len = zone ? 1 : 0;
+	}
+
+	if (run_len)
+		zones_willneed(file->fs, run_start, run_len);
+}
+
+static inline long file_read(struct minix_file *file, void *buf, unsigned long len)
+{
+	unsigned char *dst = buf;
+	unsigned long done = 0;
+
+	if (file->pos >= file->size)
+		return 0;
+
+	if (len > file->size - file->pos)
+		len = file->size - file->pos;
+
+	file_readahead(file);
+
+	while (done < len) {
+		u_int32_t off = file->pos % MINIX_BLOCK_SIZE;
+		u_int32_t zone = minix_bmap(file->fs, &file->inode, file->pos / MINIX_BLOCK_SIZE);
+		unsigned long n = MINIX_BLOCK_SIZE - off;
+
+		if (n > len - done)
+			n = len - done;
+
+		if (zone) {
+			struct bcache_buf *b;
+			const unsigned char *data = minix_get_block(file->fs, zone, BCACHE_DATA, &b);
+
+			if (!data)
+				return done ? done : -1;
+			memcpy(dst + done, data + off, n);
+			minix_put_block(file->fs, &b);
+		} else {
+			memset(dst + done, 0x0, n);
+		}
+
+		done += n;
+		file->pos += n;
+	}
+
+	return done;
+}
+
+// Copy up to len bytes from the current position. Holes read as zeros.
+// Returns the number of bytes read, 0 at the end of file or -1 if a zone
+// can not be read.
+long minix_file_read(struct minix_file *file, void *buf, unsigned long len)
+{
+	INSTR_START(t);
+	long n = file_read(file, buf, len);
+
+	INSTR_END(INSTR_FILE_READ, t);
+	INSTR_ADD(INSTR_READ_BYTES, n > 0 ? n : 0);
+
+	return n;
+}
+
+long minix_file_seek(struct minix_file *file, long offset, int whence)
+{
+	long pos;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (long) file->pos + offset;
+		break;
+	case SEEK_END:
+		pos = (long) file->size + offset;
+		break;
+	default:
+		return -1;
+	}
+
+	// i_size is 32 bits.
+	if (pos < 0 || pos > 0xffffffffL)
+		return -1;
+
+	file->pos = pos;
+	// restart readahead from the new position.
+	file->ra_next = pos;
+
+	return pos;
+}
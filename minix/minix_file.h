@@ -0,0 +1,68 @@
+#ifndef MIKOOS_MINIX_FILE_H
+#define MIKOOS_MINIX_FILE_H 1
+
+#include <sys/types.h>
+#include "minix_inode.h"
+#include "minix_view.h"
+#include "bcache.h"
+#include "instr.h"
+
+// Readahead window ahead of the read position.
+#define MINIX_READAHEAD_SIZE (256 * 1024)
+
+// A minix image. Zones are read through bcache if it is set, else straight
+// from the image in memory, so a large image or a device need not be loaded.
+struct minix_fs {
+	const unsigned char *image;
+	unsigned long size;
+	unsigned long inode_table;
+	struct bcache *bcache;
+};
+
+// An open file. Data is copied zone by zone into the caller's buffer, so
+// memory use does not depend on the file size.
+struct minix_file {
+	const struct minix_fs *fs;
+	struct minix_inode inode;
+	u_int32_t size;
+	u_int32_t pos;
+	u_int32_t ra_next; // readahead was issued up to here
+};
+
+// A zone handed out by minix_get_block(). Give it back with minix_put_block().
+static inline const unsigned char *minix_get_block(const struct minix_fs *fs, u_int32_t block,
+						   int type, struct bcache_buf **buf)
+{
+	const unsigned char *data;
+	INSTR_START(t);
+
+	*buf = NULL;
+
+	if (!fs->bcache) {
+		data = ((u_int64_t) block + 1) * MINIX_BLOCK_SIZE <= fs->size ?
+			fs->image + (u_int64_t) block * MINIX_BLOCK_SIZE : NULL;
+	} else {
+		*buf = bcache_get(fs->bcache, block, type);
+		data = *buf ? (*buf)->data : NULL;
+	}
+	INSTR_END(INSTR_BLOCK_GET, t);
+
+	return data;
+}
+
+static inline void minix_put_block(const struct minix_fs *fs, struct bcache_buf **buf)
+{
+	if (*buf)
+		bcache_put(fs->bcache, *buf);
+	*buf = NULL;
+}
+
+int minix_read_inode(const struct minix_fs *fs, u_int32_t ino, struct minix_inode *inode);
+unsigned char *minix_copy_blocks(const struct minix_fs *fs, u_int32_t block, u_int32_t nr, int type);
+u_int32_t minix_bmap(const struct minix_fs *fs, const struct minix_inode *inode, u_int32_t index);
+int minix_file_open(const struct minix_fs *fs, u_int16_t ino, struct minix_file *file);
+long minix_file_read(struct minix_file *file, void *buf, unsigned long len);
+long minix_file_seek(struct minix_file *file, long offset, int whence);
+void minix_file_close(struct minix_file *file);
+
+#endif // MIKOOS_MINIX_FILE_H
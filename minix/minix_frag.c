@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "minixfs.h"
+#include "minix_inode.h"
+#include "minix_view.h"
+#include "minix_file.h"
+#include "minix_frag.h"
+#include "frag.h"
+#include "workpool.h"
+#include "instr.h"
+
+#define ZONES_PER_BLOCK (MINIX_BLOCK_SIZE / sizeof(u_int32_t))
+#define INODES_PER_CHUNK 1024
+
+struct chunk {
+	struct frag_stat st;
+	unsigned long errors;
+};
+
+struct frag_ctx {
+	const struct minix_fs *fs;
+	u_int16_t ninodes;
+	struct chunk *chunks;
+	minix_frag_fn fn;
+	void *arg;
+};
+
+// Feed the zones under zone, level levels of indirection above the data,
+// whose first block is lblk. A zero pointer is a hole of its whole span.
+static void walk_zone(struct frag_ctx *c, struct chunk *ch, struct frag_file *f,
+		      u_int32_t zone, int level, u_int64_t lblk)
+{
+	const unsigned char *block;
+	struct bcache_buf *buf;
+	u_int64_t span = 1;
+	unsigned int i;
+
+	if (!zone || lblk >= f->nr_blocks)
+		return ;
+
+	if (((u_int64_t) zone + 1) * MINIX_BLOCK_SIZE > c->fs->size) {
+		ch->errors++;
+		return ;
+	}
+
+	if (!level) {
+		frag_file_add_run(f, &ch->st, lblk, zone, 1);
+		return ;
+	}
+
+	for (i = 1; i < level; i++)
+		span *= ZONES_PER_BLOCK;
+
+	block = minix_get_block(c->fs, zone, BCACHE_DATA, &buf);
+	if (!block) {
+		ch->errors++;
+		return ;
+	}
+	for (i = 0; i < ZONES_PER_BLOCK; i++)
+		walk_zone(c, ch, f, get_le32(block + i * sizeof(u_int32_t)), level - 1, lblk + i * span);
+	minix_put_block(c->fs, &buf);
+}
+
+static void scan_chunk(void *arg, unsigned long index)
+{
+	struct frag_ctx *c = arg;
+	struct chunk *ch = c->chunks + index;
+	u_int32_t first = index * INODES_PER_CHUNK + 1;
+	u_int32_t ino;
+	INSTR_START(t);
+
+	for (ino = first; ino < first + INODES_PER_CHUNK && ino <= c->ninodes; ino++) {
+		struct minix_inode inode;
+		struct frag_file f;
+		u_int64_t lblk = NR_DIRECT_ZONES;
+		u_int64_t span = 1;
+		u_int16_t mode;
+		int i;
+
+		if (minix_read_inode(c->fs, ino, &inode) < 0) {
+			ch->errors++;
+			break;
+		}
+
+		mode = inode.i_mode & I_TYPE;
+		if (!inode.i_nlinks || (mode != I_REGULAR && mode != I_DIRECTORY))
+			continue;
+
+		frag_file_init(&f, ino, inode.i_size, MINIX_BLOCK_SIZE);
+		for (i = 0; i < NR_DIRECT_ZONES; i++)
+			walk_zone(c, ch, &f, inode.i_zone[i], 0, i);
+		for (i = MINIX_IND_ZONE; i <= MINIX_TIND_ZONE; i++) {
+			span *= ZONES_PER_BLOCK;
+			walk_zone(c, ch, &f, inode.i_zone[i], i - MINIX_IND_ZONE + 1, lblk);
+			lblk += span;
+		}
+		frag_file_finish(&f);
+
+		frag_stat_add(&ch->st, &f);
+		if (c->fn)
+			c->fn(c->arg, &f);
+	}
+	INSTR_SPAN("frag chunk", index, t);
+}
+
+int minix_frag_scan(const struct minix_fs *fs, u_int16_t ninodes, struct workpool *pool,
+		    minix_frag_fn fn, void *arg, struct minix_frag_report *report)
+{
+	struct frag_ctx c;
+	unsigned long nr_chunks = (ninodes + INODES_PER_CHUNK - 1) / INODES_PER_CHUNK;
+	unsigned long i;
+
+	memset(report, 0x0, sizeof(*report));
+	if (!ninodes)
+		return -1;
+
+	c.fs = fs;
+	c.ninodes = ninodes;
+	c.chunks = calloc(nr_chunks, sizeof(*c.chunks));
+	assert(c.chunks != NULL);
+	c.fn = fn;
+	c.arg = arg;
+	workpool_for_each(pool, nr_chunks, scan_chunk, &c);
+
+	for (i = 0; i < nr_chunks; i++) {
+		frag_stat_merge(&report->total, &c.chunks[i].st);
+		report->errors += c.chunks[i].errors;
+	}
+	free(c.chunks);
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef MIKOOS_MINIX_FRAG_H
+#define MIKOOS_MINIX_FRAG_H 1
+
+#include <sys/types.h>
+#include "frag.h"
+
+struct workpool;
+struct minix_fs;
+
+// Fragmentation and holes of every regular file and directory, from the
+// i_zone trees. The inode table is cut into chunks which are scanned in
+// parallel, each with its own histograms. Inodes and indirect zones are read
+// through minix_get_block(), so the image need not be in memory.
+
+struct minix_frag_report {
+	struct frag_stat total;
+	unsigned long errors; // zone pointers out of the image
+};
+
+// Called from the worker scanning the chunk of the inode, so calls run at
+// the same time.
+typedef void (*minix_frag_fn)(void *arg, const struct frag_file *f);
+
+int minix_frag_scan(const struct minix_fs *fs, u_int16_t ninodes, struct workpool *pool,
+		    minix_frag_fn fn, void *arg, struct minix_frag_report *report);
+
+#endif // MIKOOS_MINIX_FRAG_H
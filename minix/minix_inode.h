@@ -3,6 +3,14 @@
 
 #define NR_I_ZONE 10
 
+// i_zone[] layout.
+#define NR_DIRECT_ZONES 7
+#define MINIX_IND_ZONE NR_DIRECT_ZONES // single indirect zone
+#define MINIX_DIND_ZONE (MINIX_IND_ZONE + 1) // double indirect zone
+#define MINIX_TIND_ZONE (MINIX_DIND_ZONE + 1) // triple indirect zone
+
+#define MINIX_BLOCK_SIZE 0x400
+
 struct minix_inode {
 	u_int16_t i_mode;
 	u_int16_t i_nlinks;
@@ -6,6 +6,9 @@
 
 #include <sys/types.h>
 
+#define MINIX_V2_MAGIC 0x2478 // 30 character names
+#define MINIX_VALID_FS 0x0001
+
 struct minix_superblock {
 	u_int16_t s_ninodes;
 	u_int16_t s_nzones;
@@ -15,7 +18,7 @@ struct minix_superblock {
 	u_int16_t s_log_zone_size;
 	u_int32_t s_max_size;
 	u_int16_t s_magic;
-	u_int16_t s_pad;
+	u_int16_t s_state; // MINIX_VALID_FS if unmounted cleanly
 	u_int32_t s_zones;
 } __attribute__((packed));
 
@@ -0,0 +1,65 @@
+#ifndef __MIKOOS_MINIX_TRAITS_H
+#define __MIKOOS_MINIX_TRAITS_H 1
+
+#include <sys/types.h>
+#include "minixfs.h"
+#include "minix_inode.h"
+#include "minix_view.h"
+#include "minix_file.h"
+#include "bcache.h"
+#include "fsgen.h"
+#include "instr.h"
+
+// minix traits of the fsgen engine. Including this file makes the minix_gen_*
+// functions of common/fsgen.h. Zones are always MINIX_BLOCK_SIZE bytes, so
+// the block arithmetic of the engine is done with a constant. Inodes are
+// copies and every zone goes through minix_get_block(), so the engine works
+// on a bcache as well as on an image in memory.
+
+// Entries are fixed size and do not carry a file type.
+static inline int minix_gen_dentry(const struct minix_fs *fs, const unsigned char *block,
+				   u_int32_t offset, struct fsgen_dentry *d)
+{
+	struct minix_dentry_view v;
+
+	if (minix_dentry_view_get(block, MINIX_BLOCK_SIZE, 0, offset, &v) < 0)
+		return -1;
+
+	d->ino = minix_dentry_view_inode(v);
+	d->name = minix_dentry_view_name(v);
+	d->name_len = minix_dentry_view_name_len(v);
+	d->type = I_FT_UNKNOWN;
+
+	return MINIX_DENTRY_SIZE;
+}
+
+static inline int minix_gen_entry_type(const struct minix_fs *fs, const struct fsgen_dentry *d)
+{
+	struct minix_inode inode;
+
+	if (minix_read_inode(fs, d->ino, &inode) < 0)
+		return I_FT_UNKNOWN;
+
+	return minix_mode_to_file_type(inode.i_mode);
+}
+
+#define FSGEN_NAME(x) minix_gen_##x
+#define FSGEN_FS const struct minix_fs *
+#define FSGEN_INODE struct minix_inode
+#define FSGEN_BLOCK struct bcache_buf *
+#define FSGEN_BLOCK_SIZE(fs) MINIX_BLOCK_SIZE
+#define FSGEN_READ_INODE(fs, ino, inode) minix_read_inode(fs, ino, inode)
+#define FSGEN_IS_DIR(inode) (((inode)->i_mode & I_TYPE) == I_DIRECTORY)
+#define FSGEN_SIZE(inode) ((inode)->i_size)
+#define FSGEN_BMAP(fs, inode, lblk) minix_bmap(fs, inode, lblk)
+#define FSGEN_GET_BLOCK(fs, block, type, b) minix_get_block(fs, block, type, b)
+#define FSGEN_PUT_BLOCK(fs, b) minix_put_block(fs, b)
+#define FSGEN_DENTRY(fs, data, offset, d) minix_gen_dentry(fs, data, offset, d)
+#define FSGEN_ENTRY_TYPE(fs, d) minix_gen_entry_type(fs, d)
+#define FSGEN_FT_UNKNOWN I_FT_UNKNOWN
+#define FSGEN_FT_DIR I_FT_DIR
+#define FSGEN_PREFETCH(fs, blocks, nr) bcache_prefetch((fs)->bcache, blocks, nr)
+#define FSGEN_CAN_PREFETCH(fs) ((fs)->bcache != NULL)
+#include "fsgen.h"
+
+#endif // __MIKOOS_MINIX_TRAITS_H
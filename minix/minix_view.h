@@ -0,0 +1,135 @@
+#ifndef MIKOOS_MINIX_VIEW_H
+#define MIKOOS_MINIX_VIEW_H 1
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include "byteorder.h"
+#include "minix_dentry.h"
+#include "minix_inode.h"
+
+// Read-only views of on-disk structures inside the mapped image.
+// Views are bounds checked when they are made and decode fields on access.
+
+struct minix_inode_view {
+	const unsigned char *p;
+};
+
+struct minix_dentry_view {
+	const unsigned char *p;
+};
+
+// on-disk dentry size: the in-memory struct has one more byte for '\0'.
+#define MINIX_DENTRY_SIZE (sizeof(struct minix_dentry) - 1)
+#define MINIX_NAME_LEN (MINIX_DENTRY_SIZE - sizeof(u_int16_t))
+
+static inline u_int16_t minix_inode_view_i_mode(struct minix_inode_view v)
+{
+	return get_le16(v.p + offsetof(struct minix_inode, i_mode));
+}
+
+static inline u_int16_t minix_inode_view_i_nlinks(struct minix_inode_view v)
+{
+	return get_le16(v.p + offsetof(struct minix_inode, i_nlinks));
+}
+
+static inline u_int16_t minix_inode_view_i_uid(struct minix_inode_view v)
+{
+	return get_le16(v.p + offsetof(struct minix_inode, i_uid));
+}
+
+static inline u_int16_t minix_inode_view_i_gid(struct minix_inode_view v)
+{
+	return get_le16(v.p + offsetof(struct minix_inode, i_gid));
+}
+
+static inline u_int32_t minix_inode_view_i_size(struct minix_inode_view v)
+{
+	return get_le32(v.p + offsetof(struct minix_inode, i_size));
+}
+
+static inline u_int32_t minix_inode_view_i_atime(struct minix_inode_view v)
+{
+	return get_le32(v.p + offsetof(struct minix_inode, i_atime));
+}
+
+static inline u_int32_t minix_inode_view_i_mtime(struct minix_inode_view v)
+{
+	return get_le32(v.p + offsetof(struct minix_inode, i_mtime));
+}
+
+static inline u_int32_t minix_inode_view_i_ctime(struct minix_inode_view v)
+{
+	return get_le32(v.p + offsetof(struct minix_inode, i_ctime));
+}
+
+static inline u_int32_t minix_inode_view_i_zone(struct minix_inode_view v, int index)
+{
+	return get_le32(v.p + offsetof(struct minix_inode, i_zone) + index * sizeof(u_int32_t));
+}
+
+static inline u_int16_t minix_dentry_view_inode(struct minix_dentry_view v)
+{
+	return get_le16(v.p + offsetof(struct minix_dentry, inode));
+}
+
+// The name is only '\0' terminated if it is shorter than MINIX_NAME_LEN.
+static inline const char *minix_dentry_view_name(struct minix_dentry_view v)
+{
+	return (const char *) v.p + offsetof(struct minix_dentry, name);
+}
+
+static inline int minix_dentry_view_name_len(struct minix_dentry_view v)
+{
+	return strnlen(minix_dentry_view_name(v), MINIX_NAME_LEN);
+}
+
+static inline int minix_dentry_view_name_is(struct minix_dentry_view v, const char *name, int len)
+{
+	return minix_dentry_view_name_len(v) == len && !memcmp(minix_dentry_view_name(v), name, len);
+}
+
+// Inode numbers start from 1.
+static inline int minix_inode_view_get(const unsigned char *image, unsigned long size,
+				       unsigned long table, u_int16_t ino, struct minix_inode_view *v)
+{
+	unsigned long address = table + (unsigned long) (ino - 1) * sizeof(struct minix_inode);
+
+	if (ino == 0 || address + sizeof(struct minix_inode) > size)
+		return -1;
+
+	v->p = image + address;
+
+	return 0;
+}
+
+// Copy a whole on-disk inode for code which keeps it after the block is given back.
+static inline void minix_inode_decode(struct minix_inode_view v, struct minix_inode *inode)
+{
+	int i;
+
+	inode->i_mode = minix_inode_view_i_mode(v);
+	inode->i_nlinks = minix_inode_view_i_nlinks(v);
+	inode->i_uid = minix_inode_view_i_uid(v);
+	inode->i_gid = minix_inode_view_i_gid(v);
+	inode->i_size = minix_inode_view_i_size(v);
+	inode->i_atime = minix_inode_view_i_atime(v);
+	inode->i_mtime = minix_inode_view_i_mtime(v);
+	inode->i_ctime = minix_inode_view_i_ctime(v);
+	for (i = 0; i < NR_I_ZONE; i++)
+		inode->i_zone[i] = minix_inode_view_i_zone(v, i);
+}
+
+static inline int minix_dentry_view_get(const unsigned char *image, unsigned long size,
+					unsigned long address, unsigned long offset,
+					struct minix_dentry_view *v)
+{
+	if (address + offset + MINIX_DENTRY_SIZE > size)
+		return -1;
+
+	v->p = image + address + offset;
+
+	return 0;
+}
+
+#endif // MIKOOS_MINIX_VIEW_H
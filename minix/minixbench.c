@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "minixfs.h"
+#include "minix_superblock.h"
+#include "minix_dentry.h"
+#include "minix_inode.h"
+#include "minix_view.h"
+#include "minix_file.h"
+#include "minix_traits.h"
+#include "blkio.h"
+#include "bench.h"
+#include "instr.h"
+
+// Time the parsing hot paths against one minix V2 image.
+// usage: minixbench [image] [seconds per benchmark]
+
+#define MINIX_ROOT_INO 1
+#define MAX_PATHS 4096
+#define MAX_DEPTH 64
+#define READ_BUF_SIZE (1024 * 1024)
+
+#define get_inode_table_address(sb) (0x800 + ((sb).s_imap_blocks * 0x400UL) + ((sb).s_zmap_blocks * 0x400UL))
+
+struct bench_ctx {
+	struct minix_fs fs;
+	const unsigned char *image;
+	unsigned long size;
+	struct minix_superblock sb;
+	unsigned long itable;
+	char **paths; // every file and directory below the root
+	u_int16_t *files; // regular files
+	unsigned long nr_paths;
+	unsigned long nr_files;
+	unsigned char *buf;
+	u_int64_t *walk_bytes; // bytes counter of the running tree walk
+};
+
+typedef int (*dentry_fn)(void *arg, const struct fsgen_dentry *d, const struct minix_inode *inode);
+
+static int is_dir(const struct minix_inode *inode)
+{
+	return (inode->i_mode & I_TYPE) == I_DIRECTORY;
+}
+
+// Call fn for every live entry of directory ino until it returns non zero.
+// Returns what fn returned last, or -1 if ino is not a readable directory.
+static int for_each_dentry(struct bench_ctx *ctx, u_int16_t ino, u_int64_t *bytes, dentry_fn fn, void *arg)
+{
+	struct minix_inode dir;
+	struct minix_gen_dir it;
+	struct fsgen_dentry d;
+	int ret = 0;
+
+	if (minix_read_inode(&ctx->fs, ino, &dir) < 0 || !is_dir(&dir))
+		return -1;
+
+	minix_gen_dir_open(&it, &ctx->fs, &dir);
+	while (!ret && minix_gen_dir_next(&it, &d)) {
+		struct minix_inode inode;
+
+		*bytes += MINIX_DENTRY_SIZE;
+		if (minix_read_inode(&ctx->fs, d.ino, &inode) < 0)
+			continue;
+
+		if (fn)
+			ret = fn(arg, &d, &inode);
+	}
+	minix_gen_dir_close(&it);
+
+	return ret;
+}
+
+struct collect {
+	struct bench_ctx *ctx;
+	char path[4096];
+	int len;
+	int depth;
+};
+
+static int collect_dentry(void *arg, const struct fsgen_dentry *d, const struct minix_inode *inode)
+{
+	struct collect *c = arg;
+	struct bench_ctx *ctx = c->ctx;
+	const char *name = d->name;
+	int name_len = d->name_len;
+	u_int64_t bytes = 0;
+	int len = c->len;
+
+	if (fsgen_is_dot(name, name_len) || len + name_len + 2 > sizeof(c->path))
+		return 0;
+
+	c->path[len] = '/';
+	memcpy(c->path + len + 1, name, name_len);
+	c->len = len + name_len + 1;
+	c->path[c->len] = '\0';
+
+	if (ctx->nr_paths < MAX_PATHS)
+		ctx->paths[ctx->nr_paths++] = strdup(c->path);
+
+	if ((inode->i_mode & I_TYPE) == I_REGULAR && ctx->nr_files < MAX_PATHS)
+		ctx->files[ctx->nr_files++] = d->ino;
+
+	if (is_dir(inode) && c->depth < MAX_DEPTH) {
+		c->depth++;
+		for_each_dentry(ctx, d->ino, &bytes, collect_dentry, c);
+		c->depth--;
+	}
+
+	c->len = len;
+	c->path[len] = '\0';
+
+	return 0;
+}
+
+static unsigned long bench_superblock(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	struct minix_superblock sb;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		memcpy(&sb, ctx->image + 0x400, sizeof(sb));
+		if (sb.s_magic != MINIX_V2_MAGIC)
+			return 0;
+		__asm__ volatile("" : : "r" (&sb) : "memory");
+	}
+	*bytes += 1000 * sizeof(sb);
+
+	return 1000;
+}
+
+static unsigned long bench_inode(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	struct minix_inode_view v;
+	u_int32_t sum = 0;
+	u_int32_t ino;
+
+	for (ino = 1; ino <= ctx->sb.s_ninodes; ino++) {
+		if (minix_inode_view_get(ctx->image, ctx->size, ctx->itable, ino, &v) < 0)
+			return 0;
+		sum += minix_inode_view_i_mode(v) + minix_inode_view_i_size(v) + minix_inode_view_i_zone(v, 0);
+	}
+	__asm__ volatile("" : : "r" (sum));
+	*bytes += (u_int64_t) ctx->sb.s_ninodes * sizeof(struct minix_inode);
+
+	return ctx->sb.s_ninodes;
+}
+
+static int walk_dentry(void *arg, const struct fsgen_dentry *d, const struct minix_inode *inode)
+{
+	struct bench_ctx *ctx = arg;
+
+	if (is_dir(inode) && !fsgen_is_dot(d->name, d->name_len))
+		for_each_dentry(ctx, d->ino, ctx->walk_bytes, walk_dentry, ctx);
+
+	return 0;
+}
+
+static unsigned long bench_walk(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+
+	ctx->walk_bytes = bytes;
+	for_each_dentry(ctx, MINIX_ROOT_INO, bytes, walk_dentry, ctx);
+
+	return ctx->nr_paths;
+}
+
+struct match {
+	const char *name;
+	int len;
+	u_int16_t ino;
+};
+
+static int match_dentry(void *arg, const struct fsgen_dentry *d, const struct minix_inode *inode)
+{
+	struct match *m = arg;
+
+	if (d->name_len != m->len || memcmp(d->name, m->name, m->len))
+		return 0;
+
+	m->ino = d->ino;
+
+	return 1;
+}
+
+static u_int16_t lookup(struct bench_ctx *ctx, const char *path, u_int64_t *bytes)
+{
+	u_int16_t ino = MINIX_ROOT_INO;
+
+	while (*path) {
+		struct match m;
+
+		while (*path == '/')
+			path++;
+		if (!*path)
+			break;
+
+		m.name = path;
+		m.len = strcspn(path, "/");
+		m.ino = 0;
+		if (for_each_dentry(ctx, ino, bytes, match_dentry, &m) <= 0)
+			return 0;
+
+		ino = m.ino;
+		path += m.len;
+	}
+
+	return ino;
+}
+
+static unsigned long bench_lookup(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	unsigned long i;
+
+	for (i = 0; i < ctx->nr_paths; i++) {
+		if (!lookup(ctx, ctx->paths[i], bytes))
+			return 0;
+	}
+
+	return ctx->nr_paths;
+}
+
+static unsigned long bench_read(void *arg, u_int64_t *bytes)
+{
+	struct bench_ctx *ctx = arg;
+	unsigned long i;
+
+	for (i = 0; i < ctx->nr_files; i++) {
+		struct minix_file file;
+		long len;
+
+		if (minix_file_open(&ctx->fs, ctx->files[i], &file) < 0)
+			return 0;
+		while ((len = minix_file_read(&file, ctx->buf, READ_BUF_SIZE)) > 0)
+			*bytes += len;
+		minix_file_close(&file);
+	}
+
+	return ctx->nr_files;
+}
+
+int main(int argc, char **argv)
+{
+	const char *image = argc > 1 ? argv[1] : "./minix.img";
+	double seconds = argc > 2 ? atof(argv[2]) : 0.5;
+	struct bench_ctx ctx;
+	struct collect c;
+	struct blkio *io;
+	u_int64_t bytes = 0;
+	unsigned long i;
+
+	instr_setup();
+
+	memset(&ctx, 0x0, sizeof(ctx));
+
+	io = blkio_open(image, BLKIO_MMAP);
+	if (!io) {
+		printf("can not open %s\n", image);
+		exit(-1);
+	}
+
+	ctx.image = blkio_load(io);
+	ctx.size = blkio_size(io);
+	if (!ctx.image || ctx.size < 0x400 + sizeof(ctx.sb)) {
+		printf("%s is too small\n", image);
+		exit(-1);
+	}
+	memcpy(&ctx.sb, ctx.image + 0x400, sizeof(ctx.sb));
+	if (ctx.sb.s_magic != MINIX_V2_MAGIC) {
+		printf("%s is not a minix V2 image\n", image);
+		exit(-1);
+	}
+	ctx.itable = get_inode_table_address(ctx.sb);
+	ctx.fs.image = ctx.image;
+	ctx.fs.size = ctx.size;
+	ctx.fs.inode_table = ctx.itable;
+
+	ctx.paths = calloc(MAX_PATHS, sizeof(*ctx.paths));
+	ctx.files = calloc(MAX_PATHS, sizeof(*ctx.files));
+	ctx.buf = malloc(READ_BUF_SIZE);
+	assert(ctx.paths != NULL && ctx.files != NULL && ctx.buf != NULL);
+
+	memset(&c, 0x0, sizeof(c));
+	c.ctx = &ctx;
+	for_each_dentry(&ctx, MINIX_ROOT_INO, &bytes, collect_dentry, &c);
+
+	printf("%s: %u inodes, %lu paths, %lu regular files\n",
+	       image, ctx.sb.s_ninodes, ctx.nr_paths, ctx.nr_files);
+	bench_header();
+
+	bench_run("superblock parse", bench_superblock, &ctx, seconds);
+	bench_run("inode decode", bench_inode, &ctx, seconds);
+	bench_run("tree walk (per path)", bench_walk, &ctx, seconds);
+	bench_run("path lookup", bench_lookup, &ctx, seconds);
+	bench_run("file read", bench_read, &ctx, seconds);
+
+	for (i = 0; i < ctx.nr_paths; i++)
+		free(ctx.paths[i]);
+	free(ctx.paths);
+	free(ctx.files);
+	free(ctx.buf);
+	blkio_unload(io, (unsigned char *) ctx.image);
+	blkio_close(io);
+
+	return 0;
+}
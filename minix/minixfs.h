@@ -17,4 +17,22 @@ enum {
 	I_FT_NAMED_PIPE,
 };
 
+static inline int minix_mode_to_file_type(unsigned int mode)
+{
+	switch (mode & I_TYPE) {
+	case I_REGULAR:
+		return I_FT_REGULAR;
+	case I_BLOCK_SPECIAL:
+		return I_FT_BLOCK;
+	case I_DIRECTORY:
+		return I_FT_DIR;
+	case I_CHAR_SPECIAL:
+		return I_FT_CHAR;
+	case I_NAMED_PIPE:
+		return I_FT_NAMED_PIPE;
+	}
+
+	return I_FT_UNKNOWN;
+}
+
 #endif // MIKOOS_MINIXFS_H
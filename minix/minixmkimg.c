@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "minixfs.h"
+#include "minix_superblock.h"
+#include "minix_dentry.h"
+#include "minix_inode.h"
+#include "minix_view.h"
+#include "mkimg.h"
+
+// Write a synthetic minix V2 image for scale testing. Directories form a
+// tree with a fixed fan-out and each one holds the same number of regular
+// files. Zones are handed out first fit like minix does, so gaps left by -F
+// get filled by later files. File data is left unwritten (it reads as zeros
+// and takes no disk space) unless -w is given.
+
+#define MINIX_ROOT_INO 1
+#define MINIX_MAX_INODES 0xffff
+#define MINIX_MAX_FILE_SIZE 0x7fffffff
+#define BITS_PER_BLOCK (MINIX_BLOCK_SIZE * 8)
+#define HOLE_CHUNK 16 // files with holes skip every other chunk of this many zones
+
+struct mkfs {
+	int fd;
+	int write_data;
+	u_int32_t nr_zones;
+	u_int32_t nr_inodes;
+	u_int32_t itable; // first inode table block
+	u_int32_t now;
+	struct minix_superblock sb;
+	struct mkimg_alloc zones;
+	struct mkimg_alloc inodes;
+	struct mkimg_rng rng;
+	unsigned long nr_dirs;
+	unsigned long fanout;
+	unsigned long files_per_dir;
+	u_int64_t file_min;
+	u_int64_t file_max;
+	unsigned int gap_percent;
+	unsigned int hole_percent;
+	u_int16_t *dir_ino; // inode of each directory, 0 is the root
+	unsigned char buf[MINIX_BLOCK_SIZE];
+	unsigned long nr_files;
+	u_int64_t data_bytes;
+};
+
+// Writes the entries of one directory a block at a time.
+struct dir_writer {
+	struct mkfs *m;
+	struct mkimg_bmap map;
+	unsigned char block[MINIX_BLOCK_SIZE];
+	u_int32_t offset;
+	u_int64_t nr_blocks;
+	u_int32_t size;
+};
+
+static void die(const char *msg)
+{
+	printf("%s\n", msg);
+	mkimg_discard();
+	exit(-1);
+}
+
+static void write_block(struct mkfs *m, u_int32_t block, const void *buf)
+{
+	if (mkimg_write(m->fd, buf, MINIX_BLOCK_SIZE, (u_int64_t) block * MINIX_BLOCK_SIZE) < 0)
+		die("write failed");
+}
+
+static void write_inode(struct mkfs *m, u_int16_t ino, u_int16_t mode, u_int16_t links,
+			u_int32_t size, const struct mkimg_bmap *map)
+{
+	struct minix_inode inode;
+	u_int64_t offset = (u_int64_t) m->itable * MINIX_BLOCK_SIZE + (u_int64_t) (ino - 1) * sizeof(inode);
+
+	memset(&inode, 0x0, sizeof(inode));
+	inode.i_mode = mode;
+	inode.i_nlinks = links;
+	inode.i_size = size;
+	inode.i_atime = inode.i_mtime = inode.i_ctime = m->now;
+	memcpy(inode.i_zone, map->zone, sizeof(inode.i_zone));
+
+	if (mkimg_write(m->fd, &inode, sizeof(inode), offset) < 0)
+		die("write failed");
+}
+
+static u_int16_t alloc_inode(struct mkfs *m)
+{
+	u_int32_t ino = mkimg_alloc_block(&m->inodes);
+
+	if (!ino)
+		die("out of inodes, raise -i");
+
+	return ino;
+}
+
+static void dir_writer_init(struct dir_writer *w, struct mkfs *m)
+{
+	memset(w, 0x0, sizeof(*w));
+	w->m = m;
+	if (mkimg_bmap_init(&w->map, m->fd, MINIX_BLOCK_SIZE, NR_DIRECT_ZONES, &m->zones) < 0)
+		die("out of memory");
+}
+
+static void dir_flush(struct dir_writer *w)
+{
+	u_int32_t zone;
+
+	if (!w->offset)
+		return ;
+
+	zone = mkimg_bmap_add(&w->map, w->nr_blocks++);
+	if (!zone)
+		die("out of zones, raise -z");
+	write_block(w->m, zone, w->block);
+
+	memset(w->block, 0x0, sizeof(w->block));
+	w->offset = 0;
+}
+
+static void dir_add(struct dir_writer *w, const char *name, u_int16_t ino)
+{
+	int len = strlen(name);
+
+	assert(len <= MINIX_NAME_LEN);
+	if (w->offset == MINIX_BLOCK_SIZE)
+		dir_flush(w);
+
+	memcpy(w->block + w->offset + offsetof(struct minix_dentry, inode), &ino, sizeof(ino));
+	memcpy(w->block + w->offset + offsetof(struct minix_dentry, name), name, len);
+	w->offset += MINIX_DENTRY_SIZE;
+	w->size += MINIX_DENTRY_SIZE;
+}
+
+static void dir_finish(struct dir_writer *w, u_int16_t ino, u_int16_t links)
+{
+	dir_flush(w);
+	if (mkimg_bmap_finish(&w->map) < 0)
+		die("write failed");
+
+	write_inode(w->m, ino, I_DIRECTORY | 0755, links, w->size, &w->map);
+}
+
+static u_int16_t make_file(struct mkfs *m)
+{
+	struct mkimg_bmap map;
+	u_int16_t ino = alloc_inode(m);
+	u_int64_t size = m->file_min;
+	u_int64_t nr_blocks, lblk;
+	int holes = mkimg_chance(&m->rng, m->hole_percent);
+
+	if (m->file_max > m->file_min)
+		size += mkimg_rand(&m->rng) % (m->file_max - m->file_min + 1);
+	nr_blocks = (size + MINIX_BLOCK_SIZE - 1) / MINIX_BLOCK_SIZE;
+
+	// first fit, from the start of the data zones.
+	mkimg_alloc_seek(&m->zones, 0);
+	if (mkimg_bmap_init(&map, m->fd, MINIX_BLOCK_SIZE, NR_DIRECT_ZONES, &m->zones) < 0)
+		die("out of memory");
+
+	for (lblk = 0; lblk < nr_blocks; lblk++) {
+		u_int32_t zone;
+
+		if (holes && (lblk / HOLE_CHUNK) % 2 && lblk != nr_blocks - 1)
+			continue;
+
+		zone = mkimg_bmap_add(&map, lblk);
+		if (!zone)
+			die("out of zones, raise -z or lower -s");
+
+		if (m->write_data) {
+			u_int32_t len = MINIX_BLOCK_SIZE;
+
+			if (lblk == nr_blocks - 1 && size % MINIX_BLOCK_SIZE)
+				len = size % MINIX_BLOCK_SIZE;
+			mkimg_fill(m->buf, len, ((u_int64_t) ino << 32) | lblk);
+			memset(m->buf + len, 0x0, MINIX_BLOCK_SIZE - len);
+			write_block(m, zone, m->buf);
+		}
+	}
+	if (mkimg_bmap_finish(&map) < 0)
+		die("write failed");
+
+	write_inode(m, ino, I_REGULAR | 0644, 1, size, &map);
+	m->nr_files++;
+	m->data_bytes += size;
+
+	return ino;
+}
+
+static void make_dir(struct mkfs *m, unsigned long dir)
+{
+	struct dir_writer w;
+	char name[32];
+	u_int16_t links = 2;
+	unsigned long i;
+
+	dir_writer_init(&w, m);
+	dir_add(&w, ".", m->dir_ino[dir]);
+	dir_add(&w, "..", m->dir_ino[dir ? (dir - 1) / m->fanout : 0]);
+
+	for (i = dir * m->fanout + 1; i <= dir * m->fanout + m->fanout && i < m->nr_dirs; i++) {
+		sprintf(name, "d%lu", i);
+		dir_add(&w, name, m->dir_ino[i]);
+		links++;
+	}
+
+	for (i = 0; i < m->files_per_dir; i++) {
+		u_int16_t ino = make_file(m);
+
+		sprintf(name, "f%lu", i);
+		dir_add(&w, name, ino);
+	}
+
+	dir_finish(&w, m->dir_ino[dir], links);
+}
+
+static void make_tree(struct mkfs *m)
+{
+	unsigned long i;
+
+	m->dir_ino = calloc(m->nr_dirs, sizeof(*m->dir_ino));
+	assert(m->dir_ino != NULL);
+
+	// there is no inode 0.
+	mkimg_alloc_mark(&m->inodes, 0);
+	for (i = 0; i < m->nr_dirs; i++)
+		m->dir_ino[i] = alloc_inode(m);
+	assert(m->dir_ino[0] == MINIX_ROOT_INO);
+
+	for (i = 0; i < m->nr_dirs; i++)
+		make_dir(m, i);
+}
+
+// Write an allocation bitmap of nr_blocks blocks, bits past the end set.
+static void write_bitmap(struct mkfs *m, u_int32_t block, u_int32_t nr_blocks, const struct mkimg_alloc *a)
+{
+	u_int64_t bit = 0;
+	u_int32_t i;
+
+	for (i = 0; i < nr_blocks; i++) {
+		u_int32_t j;
+
+		memset(m->buf, 0xff, sizeof(m->buf));
+		for (j = 0; j < BITS_PER_BLOCK && bit < a->nbits; j++, bit++) {
+			if (!(a->map[bit / 8] & (1 << (bit % 8))))
+				m->buf[j / 8] &= ~(1 << (j % 8));
+		}
+		write_block(m, block + i, m->buf);
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [options] image\n"
+	       "  -z size       image size, K/M/G suffixes allowed (64M)\n"
+	       "  -i count      inodes, at most 65535 (one per 8K)\n"
+	       "  -d count      directories, root included (16)\n"
+	       "  -f count      subdirectories per directory (4)\n"
+	       "  -n count      files per directory (8)\n"
+	       "  -s min[:max]  file size, K/M/G suffixes allowed (4K)\n"
+	       "  -F percent    chance of a gap before each zone allocation (0)\n"
+	       "  -H percent    share of files with holes (0)\n"
+	       "  -w            write file data, otherwise it reads as zeros\n"
+	       "  -x seed       random seed (1)\n", prog);
+	exit(-1);
+}
+
+static void parse_file_size(struct mkfs *m, char *arg)
+{
+	char *max = strchr(arg, ':');
+
+	if (max)
+		*max++ = '\0';
+	if (mkimg_parse_size(arg, &m->file_min) < 0 ||
+	    mkimg_parse_size(max ? max : arg, &m->file_max) < 0 ||
+	    m->file_max < m->file_min)
+		die("bad file size");
+	if (m->file_max > MINIX_MAX_FILE_SIZE)
+		die("minix files must be smaller than 2G");
+}
+
+int main(int argc, char **argv)
+{
+	struct mkfs m;
+	struct minix_superblock *sb = &m.sb;
+	u_int64_t image_size = 64 << 20;
+	u_int64_t nr_inodes = 0;
+	u_int64_t seed = 1;
+	u_int32_t imap_blocks, zmap_blocks, itable_blocks, first_zone;
+	int opt;
+
+	memset(&m, 0x0, sizeof(m));
+	m.nr_dirs = 16;
+	m.fanout = 4;
+	m.files_per_dir = 8;
+	m.file_min = m.file_max = 4096;
+
+	while ((opt = getopt(argc, argv, "z:i:d:f:n:s:F:H:wx:")) != -1) {
+		switch (opt) {
+		case 'z':
+			if (mkimg_parse_size(optarg, &image_size) < 0)
+				die("bad image size");
+			break;
+		case 'i': nr_inodes = strtoul(optarg, NULL, 0); break;
+		case 'd': m.nr_dirs = strtoul(optarg, NULL, 0); break;
+		case 'f': m.fanout = strtoul(optarg, NULL, 0); break;
+		case 'n': m.files_per_dir = strtoul(optarg, NULL, 0); break;
+		case 's': parse_file_size(&m, optarg); break;
+		case 'F': m.gap_percent = atoi(optarg); break;
+		case 'H': m.hole_percent = atoi(optarg); break;
+		case 'w': m.write_data = 1; break;
+		case 'x': seed = strtoull(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (!m.nr_dirs || !m.fanout)
+		die("directories and fan-out must not be 0");
+
+	if (image_size / MINIX_BLOCK_SIZE > 0xffffffffULL)
+		die("image too big");
+	m.nr_zones = image_size / MINIX_BLOCK_SIZE;
+	if (!nr_inodes)
+		nr_inodes = image_size / 8192;
+	if (nr_inodes > MINIX_MAX_INODES)
+		nr_inodes = MINIX_MAX_INODES;
+	if (nr_inodes < m.nr_dirs)
+		die("fewer inodes than directories");
+	m.nr_inodes = nr_inodes;
+
+	// boot block, super block, inode map, zone map, inode table, data.
+	imap_blocks = (m.nr_inodes + 1 + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+	zmap_blocks = (m.nr_zones + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+	itable_blocks = (m.nr_inodes * sizeof(struct minix_inode) + MINIX_BLOCK_SIZE - 1) / MINIX_BLOCK_SIZE;
+	first_zone = 2 + imap_blocks + zmap_blocks + itable_blocks;
+	if (first_zone > 0xffff || first_zone >= m.nr_zones)
+		die("image too small or too big");
+	m.itable = 2 + imap_blocks + zmap_blocks;
+
+	sb->s_ninodes = m.nr_inodes;
+	sb->s_imap_blocks = imap_blocks;
+	sb->s_zmap_blocks = zmap_blocks;
+	sb->s_firstdatazone = first_zone;
+	sb->s_max_size = MINIX_MAX_FILE_SIZE;
+	sb->s_magic = MINIX_V2_MAGIC;
+	sb->s_state = MINIX_VALID_FS;
+	sb->s_zones = m.nr_zones;
+
+	mkimg_rng_init(&m.rng, seed);
+	m.now = time(NULL);
+	// zone map bit 0 is unused, bit n is zone s_firstdatazone + n - 1.
+	if (mkimg_alloc_init(&m.zones, first_zone - 1, m.nr_zones - first_zone + 1) < 0 ||
+	    mkimg_alloc_init(&m.inodes, 0, m.nr_inodes + 1) < 0)
+		die("out of memory");
+	mkimg_alloc_mark(&m.zones, first_zone - 1);
+	m.zones.rng = &m.rng;
+	m.zones.gap_percent = m.gap_percent;
+
+	m.fd = mkimg_create(argv[optind]);
+	if (m.fd < 0) {
+		perror(argv[optind]);
+		exit(-1);
+	}
+	if (ftruncate(m.fd, (u_int64_t) m.nr_zones * MINIX_BLOCK_SIZE) < 0) {
+		perror("ftruncate");
+		mkimg_discard();
+		exit(-1);
+	}
+
+	make_tree(&m);
+
+	write_bitmap(&m, 2, imap_blocks, &m.inodes);
+	write_bitmap(&m, 2 + imap_blocks, zmap_blocks, &m.zones);
+	if (mkimg_write(m.fd, sb, sizeof(*sb), MINIX_BLOCK_SIZE) < 0)
+		die("write failed");
+
+	if (mkimg_commit(m.fd) < 0) {
+		perror(argv[optind]);
+		exit(-1);
+	}
+
+	printf("%s: %u zones, %u inodes, %lu dirs, %lu files, %llu data bytes\n",
+	       argv[optind], m.nr_zones, m.nr_inodes, m.nr_dirs, m.nr_files,
+	       (unsigned long long) m.data_bytes);
+
+	mkimg_alloc_free(&m.zones);
+	mkimg_alloc_free(&m.inodes);
+	free(m.dir_ino);
+
+	return 0;
+}
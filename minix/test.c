@@ -2,253 +2,281 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <fcntl.h>
+#include <pthread.h>
 
 #include "minixfs.h"
 #include "minix_superblock.h"
 #include "minix_dentry.h"
 #include "minix_inode.h"
-
-static const char * const test_file = "./minix.img";
+#include "minix_view.h"
+#include "minix_file.h"
+#include "minix_traits.h"
+#include "bitmap.h"
+#include "dcache.h"
+#include "blkio.h"
+#include "bcache.h"
+#include "emit.h"
+#include "workpool.h"
+#include "treewalk.h"
+#include "frag.h"
+#include "minix_frag.h"
+#include "instr.h"
+
+static const char *test_file = "./minix.img";
 static unsigned char *file_system;
+static struct blkio *image_io;
+static struct bcache *bcache;
+static unsigned long file_size;
+static struct dcache *dcache;
+// the image as seen by the minix_gen_* engine.
+static struct minix_fs mfs;
+// per entry output is off unless asked for.
+static int verbose;
+static int frag;
+static struct emit *out;
 
-static void *map2memory(unsigned long size);
-static unsigned long get_file_size(void);
 static void read_superblock(struct minix_superblock *sb);
 static void print_superblock(const struct minix_superblock *sb);
-static void read_dentry(struct minix_dentry *dentry, unsigned long address, unsigned long offset);
-static void read_inode(u_int16_t inode_num, struct minix_inode *inode, unsigned long addr);
-static void directory_walk(struct minix_superblock *sb, unsigned long address);
+static void directory_walk(struct minix_superblock *sb, u_int16_t dir);
+static void print_entry(void *arg, const struct treewalk_entry *e);
 static void find_file_test(struct minix_superblock *sb);
-static u_int16_t find_file(struct minix_superblock *sb, unsigned long address, const char *fname);
+static u_int16_t find_file(struct minix_superblock *sb, const char *fname);
 static void read_file(struct minix_superblock *sb, const char *fname);
 static void read_file_test(struct minix_superblock *sb);
+static void check_bitmaps(const struct minix_superblock *sb, unsigned long size);
+static void frag_report(const struct minix_superblock *sb);
 
 #define get_first_data_zone(sb) (sb).s_firstdatazone * 0x400
 #define get_inode_table_address(sb) 0x800 + ((sb).s_imap_blocks * 0x400) + ((sb).s_zmap_blocks * 0x400)
 #define get_data_zone(zone) (zone) * 0x400
-
-static unsigned long get_file_size(void)
-{
-	struct stat st;
-
-	assert(stat(test_file, &st) != -1);
-
-	return st.st_size;
-}
-
-static void *map2memory(unsigned long size)
-{
-	int fd;
-	void *ret;
-
-	fd = open(test_file, O_RDONLY);
-	assert(fd >= 0);
-
-	ret = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-	assert(ret != MAP_FAILED);
-
-	close(fd);
-
-	return ret;
-}
-
-static int get_file_type(struct minix_inode *inode)
-{
-	u_int16_t mode = inode->i_mode;
-
-	if ((mode & I_TYPE) == I_REGULAR)
-		return I_FT_REGULAR;
-	else if ((mode & I_TYPE) == I_BLOCK_SPECIAL)
-		return I_FT_BLOCK;
-	else if ((mode & I_TYPE) == I_DIRECTORY)
-		return I_FT_DIR;
-	else if ((mode & I_TYPE) == I_CHAR_SPECIAL)
-		return I_FT_CHAR;
-	else if ((mode & I_TYPE) == I_NAMED_PIPE)
-		return I_FT_NAMED_PIPE;
-
-	return I_FT_UNKNOWN;
-}
+#define get_inode_bitmap_address(sb) 0x800
+#define get_zone_bitmap_address(sb) 0x800 + ((sb).s_imap_blocks * 0x400)
+#define get_nr_zones(sb) ((sb).s_zones ? (sb).s_zones : (sb).s_nzones)
+#define MINIX_ROOT_INO 1
 
 static void read_superblock(struct minix_superblock *sb)
 {
-	// ignore boot block.
-	memcpy(sb, file_system + 0x400, sizeof(*sb));
-}
-
-static void read_dentry(struct minix_dentry *dentry, unsigned long address, unsigned long offset)
-{
-	// dentry->name is 15 bytes which reserved for '\0'.
-	memcpy(dentry, file_system + address + offset, sizeof(*dentry) - 1);
-}
+	struct bcache_buf *buf;
+	const unsigned char *block;
 
-static void read_inode(u_int16_t inode_num, struct minix_inode *inode, unsigned long addr)
-{
-	memcpy(inode, file_system + addr + ((inode_num - 1) * sizeof(*inode)), sizeof(*inode));
+	// ignore boot block.
+	block = minix_get_block(&mfs, 1, BCACHE_SUPER, &buf);
+	assert(block != NULL);
+	memcpy(sb, block, sizeof(*sb));
+	minix_put_block(&mfs, &buf);
 }
 
-static void directory_walk(struct minix_superblock *sb, unsigned long address)
+static void print_entry(void *arg, const struct treewalk_entry *e)
 {
-	unsigned long offset = 0;
-	struct minix_dentry dentry;
 	struct minix_inode inode;
-	unsigned long inode_tbl_bass = get_inode_table_address(*sb);
+	static const char * const zone_keys[NR_I_ZONE] = {
+		"zone0", "zone1", "zone2", "zone3", "zone4",
+		"zone5", "zone6", "zone7", "zone8", "zone9",
+	};
 	int i;
 
-	while (1) {
-		// read first entry.
-		read_dentry(&dentry, address, offset);
-
-		if (dentry.inode == 0)
-			break;
+	if (minix_read_inode(&mfs, e->ino, &inode) < 0)
+		return ;
 
-		read_inode(dentry.inode, &inode, inode_tbl_bass);
-
-		printf("inode:0x%x name %s\n", dentry.inode, dentry.name);
-		printf("i_mode: 0x%x(0x%x)\n", inode.i_mode, get_file_type(&inode));
-		printf("i_nlinks: 0x%x\n", inode.i_nlinks);
-		printf("uid: 0x%x\n", inode.i_uid);
-		printf("gid: 0x%x\n", inode.i_gid);
-		printf("i_size: 0x%x\n", inode.i_size);
-		printf("i_atime: 0x%x\n", inode.i_atime);
-		printf("i_mtime: 0x%x\n", inode.i_mtime);
-		printf("i_ctime: 0x%x\n", inode.i_ctime);
+	if (out) {
+		emit_begin(out, "inode");
+		emit_u64(out, "dir", e->dir);
+		emit_u64(out, "ino", e->ino);
+		emit_str(out, "name", e->name, e->name_len);
+		emit_u64(out, "mode", inode.i_mode);
+		emit_u64(out, "nlinks", inode.i_nlinks);
+		emit_u64(out, "uid", inode.i_uid);
+		emit_u64(out, "gid", inode.i_gid);
+		emit_u64(out, "size", inode.i_size);
+		emit_u64(out, "atime", inode.i_atime);
+		emit_u64(out, "mtime", inode.i_mtime);
+		emit_u64(out, "ctime", inode.i_ctime);
 		for (i = 0; i < NR_I_ZONE; i++) {
 			if (inode.i_zone[i])
-				printf("zone[%d]: 0x%x(0x%x)\n", i, inode.i_zone[i], get_data_zone(inode.i_zone[i]));
+				emit_u64(out, zone_keys[i], inode.i_zone[i]);
 		}
+		emit_end(out);
+	}
 
-		if ((get_file_type(&inode) == I_FT_DIR) &&
-		    (strcmp(dentry.name, ".")) &&
-		    (strcmp(dentry.name, "..")))
-			directory_walk(sb, get_data_zone(inode.i_zone[0]));
+	if (!verbose)
+		return ;
 
-		offset += sizeof(dentry) - 1;
+	printf("inode:0x%x name %.*s\n", (unsigned int) e->ino, e->name_len, e->name);
+	printf("i_mode: 0x%x(0x%x)\n", inode.i_mode, minix_mode_to_file_type(inode.i_mode));
+	printf("i_nlinks: 0x%x\n", inode.i_nlinks);
+	printf("uid: 0x%x\n", inode.i_uid);
+	printf("gid: 0x%x\n", inode.i_gid);
+	printf("i_size: 0x%x\n", inode.i_size);
+	printf("i_atime: 0x%x\n", inode.i_atime);
+	printf("i_mtime: 0x%x\n", inode.i_mtime);
+	printf("i_ctime: 0x%x\n", inode.i_ctime);
+	for (i = 0; i < NR_I_ZONE; i++) {
+		u_int32_t zone = inode.i_zone[i];
+
+		if (zone)
+			printf("zone[%d]: 0x%x(0x%x)\n", i, zone, get_data_zone(zone));
 	}
 }
 
+// Walk the tree below dir on a pool, listing it depth first in on-disk
+// order whatever the number of threads.
+static void directory_walk(struct minix_superblock *sb, u_int16_t dir)
+{
+	struct treewalk w = {
+		.fs = &mfs,
+		.readdir = minix_gen_walk_readdir,
+		.root = dir,
+		.max_ino = sb->s_ninodes,
+	};
+	struct treewalk_stat st;
+	struct workpool *pool = workpool_create(0);
+
+	if (treewalk_run(&w, pool, TREEWALK_ORDERED, print_entry, sb, &st) < 0)
+		printf("can not read directory 0x%x\n", dir);
+	printf("walked %lu directories, %lu entries : %d runners, %lu steals, %lu errors\n",
+	       st.dirs, st.entries, st.runners, st.steals, st.errors);
+	workpool_destroy(pool);
+}
+
+// Stream the file through a small buffer and dump it.
 static void read_file(struct minix_superblock *sb, const char *fname)
 {
 	u_int16_t ino;
-	struct minix_inode inode;
-	unsigned long inode_tbl_bass = get_inode_table_address(*sb);
-	char *data;
+	struct minix_file file;
+	unsigned char buf[4096];
+	long len;
 	int i;
 
-	ino = find_file(sb, get_first_data_zone(*sb), fname);
-	if (!ino) {
+	ino = find_file(sb, fname);
+	if (!ino || minix_file_open(&mfs, ino, &file) < 0) {
 		printf("file %s not found\n", fname);
 		return ;
 	}
 
-	read_inode(ino, &inode, inode_tbl_bass);
-
-	printf("file %s: size is 0x%x\n", fname, inode.i_size);
-	data = malloc(inode.i_size);
-	assert(data != NULL);
-	memcpy(data, file_system + get_data_zone(inode.i_zone[0]),inode.i_size);
+	printf("file %s: size is 0x%x\n", fname, file.size);
 
-	for (i = 0; i < inode.i_size; i++)
-		printf("0x%02x ", data[i]);
+	while ((len = minix_file_read(&file, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < len; i++)
+			printf("0x%02x ", buf[i]);
+	}
 
 	printf("\n");
 
-	
+	minix_file_close(&file);
 }
 
-static int count_delimita_length(const char *str, char c)
+// Resolve an absolute path one component at a time from the root directory.
+// Every (directory, name) pair is remembered in the dcache, misses included.
+static u_int16_t find_file(struct minix_superblock *sb, const char *fname)
 {
-	int i = 0;
-	int len = strlen(str);
-
-	for (i = 0; i < len; i++) {
-		if (str[i] == c)
-			return i;
-	}
-
-	return -1;
-	
+	return minix_gen_namei(&mfs, MINIX_ROOT_INO, fname, MINIX_NAME_LEN, dcache);
 }
 
-static u_int16_t find_file(struct minix_superblock *sb, unsigned long address, const char *fname)
+int main(int argc, char **argv)
 {
-	unsigned long offset = 0;
-	struct minix_dentry dentry;
-	struct minix_inode inode;
-	unsigned long inode_tbl_bass = get_inode_table_address(*sb);
-	const char *tmp;
-	u_int16_t ret = 0;
+	struct minix_superblock sb;
+	unsigned long size = 0;
+	int backend = BLKIO_MMAP;
+	int format = -1;
+	const char *out_path = NULL;
+	int opt;
 
-	int len = 0;
-	int ftype;
-	while (1) {
-		// read first entry.
-		read_dentry(&dentry, address, offset);
+	instr_setup();
 
-		if (dentry.inode == 0)
+	while ((opt = getopt(argc, argv, "vgf:e:o:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
 			break;
-
-		read_inode(dentry.inode, &inode, inode_tbl_bass);
-
-		tmp = fname;
-		if (tmp[0] == '/') 
-			tmp = tmp + 1;
-
-		ftype = get_file_type(&inode); 
-		if (ftype == I_FT_DIR) {
-			len = count_delimita_length(tmp, '/');
-			if (len == -1) {
-				if (!strcmp(tmp, dentry.name))
-					return dentry.inode;
-			} else if (!strncmp(tmp, dentry.name, len)) {
-				ret = find_file(sb, get_data_zone(inode.i_zone[0]), tmp + len);
-			} else {
-				// if final character is '/', finish searching.
-				if (!strcmp(tmp + len, "/"))
-					return dentry.inode;
-			}
-		} else if (ftype == I_FT_REGULAR) {
-			if (!strcmp(dentry.name, tmp))
-				return dentry.inode;
+		case 'g':
+			frag = 1;
+			break;
+		case 'f':
+			test_file = optarg;
+			break;
+		case 'e':
+			if ((format = emit_parse_format(optarg)) < 0)
+				goto usage;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind < argc && (backend = blkio_parse_backend(argv[optind++])) < 0)
+		goto usage;
+	if (optind < argc || (format >= 0 && !out_path))
+		goto usage;
+
+	if (out_path) {
+		out = emit_open(out_path, format < 0 ? EMIT_NDJSON : format);
+		if (!out) {
+			printf("can not open %s\n", out_path);
+			exit(-1);
 		}
-		if (ret)
-			return ret;
-
-		offset += sizeof(dentry) - 1;
 	}
 
-	return 0;
-
-}
-
-int main(int argc, char **argv)
-{
-	struct minix_superblock sb;
-	unsigned long size = 0;
-
-	size = get_file_size();
-	file_system = map2memory(size);
-	assert(file_system != NULL);
+	image_io = blkio_open(test_file, backend);
+	assert(image_io != NULL);
+
+	// only the mapping is used in place; without it every zone and inode
+	// is read through a block cache, so the image is never copied whole.
+	size = blkio_size(image_io);
+	if (backend == BLKIO_MMAP) {
+		file_system = blkio_load(image_io);
+		assert(file_system != NULL);
+	} else {
+		bcache = bcache_create(image_io, 0x400, 1024 * 1024);
+	}
+	file_size = size;
 
+	mfs.image = file_system;
+	mfs.size = size;
+	mfs.bcache = bcache;
 	read_superblock(&sb);
+	mfs.inode_table = get_inode_table_address(sb);
 
 	print_superblock(&sb);
 
 	printf("first data zone is 0x%x\n", get_first_data_zone(sb));
 
-	directory_walk(&sb, get_first_data_zone(sb));
+	check_bitmaps(&sb, size);
+	if (frag)
+		frag_report(&sb);
+
+	dcache = dcache_create(1024);
+
+	directory_walk(&sb, MINIX_ROOT_INO);
 
 	find_file_test(&sb);
 	read_file_test(&sb);
 
-	munmap(file_system, size);
+	dcache_destroy(dcache);
+	if (bcache)
+		bcache_destroy(bcache);
+	if (file_system)
+		blkio_unload(image_io, file_system);
+	blkio_close(image_io);
+
+	if (out) {
+		unsigned long records = emit_records(out);
+
+		if (emit_close(out) < 0) {
+			printf("writing %s failed\n", out_path);
+			exit(-1);
+		}
+		printf("%lu records written to %s\n", records, out_path);
+	}
 
 	return 0;
+
+usage:
+	printf("usage: %s [-v] [-g] [-f image] [-e ndjson|binary] [-o file] [mmap|pread|uring]\n", argv[0]);
+	exit(-1);
 }
 
 static void read_file_test(struct minix_superblock *sb)
@@ -263,27 +291,141 @@ static void read_file_test(struct minix_superblock *sb)
 
 static void find_file_test(struct minix_superblock *sb)
 {
+	static const char * const paths[] = {
+		"/dir_a/dir_b/foobar.txt",
+		"/dir_A/dir_B",
+		"/dir_A/dir_B/",
+		"/test.txt",
+		"/dir_A/dir_C",
+	};
+	struct dcache_stat st;
 	u_int16_t ret;
+	int pass;
+	int i;
 
 	printf(">>>>>>>>>>find_file() test <<<<<<<<<<<<<<<<\n");
-	ret = find_file(sb, get_first_data_zone(*sb), "/dir_a/dir_b/foobar.txt");
-	printf("file %s %s\n", "/dir_a/dir_b/foobar.txt", ret != 0 ? "Found" : "Not found");
-
-	ret = find_file(sb, get_first_data_zone(*sb), "/dir_A/dir_B");
-	printf("file %s %s\n", "/dir_A/dir_B", ret != 0 ? "Found" : "Not found");
+	// second pass is answered from the dcache.
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+			ret = find_file(sb, paths[i]);
+			if (!pass)
+				printf("file %s %s\n", paths[i], ret != 0 ? "Found" : "Not found");
+		}
+	}
 
-	ret = find_file(sb, get_first_data_zone(*sb), "/dir_A/dir_B/");
-	printf("file %s %s\n", "/dir_A/dir_B/", ret != 0 ? "Found" : "Not found");
-	
-	ret = find_file(sb, get_first_data_zone(*sb), "/test.txt");
-	printf("file %s %s\n", "/test.txt", ret != 0 ? "Found" : "Not found");
+	dcache_get_stat(dcache, &st);
+	printf("dcache: %lu entries, %lu hits, %lu negative hits, %lu misses\n",
+	       st.entries, st.hits, st.negative_hits, st.misses);
+	if (bcache) {
+		struct bcache_stat bst;
 
-	ret = find_file(sb, get_first_data_zone(*sb), "/dir_A/dir_C");
-	printf("file %s %s\n", "/dir_A/dir_C", ret != 0 ? "Found" : "Not found");
+		bcache_get_stat(bcache, &bst);
+		printf("block cache: superblock %lu/%lu directory %lu/%lu (hits/misses)\n",
+		       bst.hits[BCACHE_SUPER], bst.misses[BCACHE_SUPER],
+		       bst.hits[BCACHE_DIR], bst.misses[BCACHE_DIR]);
+	}
 	printf(">>>>>>>>>>find_file() test <<<<<<<<<<<<<<<<\n");
 }
 
 
+static void check_bitmaps(const struct minix_superblock *sb, unsigned long size)
+{
+	struct bitmap_stat inodes;
+	struct bitmap_stat zones;
+	unsigned char *imap;
+	unsigned char *zmap;
+	// bit 0 of both maps is reserved and always set.
+	unsigned long inode_bits = sb->s_ninodes + 1;
+	unsigned long zone_bits = get_nr_zones(*sb) - sb->s_firstdatazone + 1;
+
+	if (get_nr_zones(*sb) < sb->s_firstdatazone ||
+	    inode_bits > sb->s_imap_blocks * 0x400UL * 8 ||
+	    zone_bits > sb->s_zmap_blocks * 0x400UL * 8 ||
+	    (get_zone_bitmap_address(*sb)) + sb->s_zmap_blocks * 0x400UL > size) {
+		printf("bitmaps do not fit in s_imap_blocks/s_zmap_blocks\n");
+		return ;
+	}
+
+	imap = minix_copy_blocks(&mfs, get_inode_bitmap_address(*sb) / 0x400, sb->s_imap_blocks, BCACHE_BITMAP);
+	zmap = minix_copy_blocks(&mfs, (get_zone_bitmap_address(*sb)) / 0x400, sb->s_zmap_blocks, BCACHE_BITMAP);
+	if (!imap || !zmap) {
+		printf("can not read the bitmaps\n");
+		goto out;
+	}
+	bitmap_analyze(imap, inode_bits, &inodes);
+	bitmap_analyze(zmap, zone_bits, &zones);
+
+	printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
+	printf("Bitmaps recounted with %s popcount\n", bitmap_popcount_impl());
+	printf("free inodes: %lu of %u\n", inodes.free, sb->s_ninodes);
+	printf("free zones: %lu of %lu in %lu runs\n", zones.free, zone_bits - 1, zones.free_runs);
+	if (zones.longest_free)
+		printf("longest free run: %lu zones at zone 0x%lx\n", zones.longest_free,
+		       zones.longest_free_start + sb->s_firstdatazone - 1);
+	if (!(imap[0] & 1) || !(zmap[0] & 1))
+		printf("reserved bit 0 is clear\n");
+	printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n\n");
+
+out:
+	free(imap);
+	free(zmap);
+}
+
+static pthread_mutex_t frag_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void print_frag(void *arg, const struct frag_file *f)
+{
+	if (!verbose && !out)
+		return ;
+
+	pthread_mutex_lock(&frag_lock);
+	if (verbose)
+		printf("inode 0x%llx: %llu zones in %llu extents : %llu holes : ratio %.3f : distance %.1f\n",
+		       (unsigned long long) f->ino, (unsigned long long) f->blocks,
+		       (unsigned long long) f->extents, (unsigned long long) f->holes,
+		       frag_file_ratio(f), frag_file_avg_distance(f));
+
+	emit_begin(out, "frag_file");
+	emit_u64(out, "inode", f->ino);
+	emit_u64(out, "size", f->size);
+	emit_u64(out, "blocks", f->blocks);
+	emit_u64(out, "extents", f->extents);
+	emit_u64(out, "holes", f->holes);
+	emit_u64(out, "hole_runs", f->hole_runs);
+	emit_u64(out, "distance", f->distance);
+	emit_end(out);
+	pthread_mutex_unlock(&frag_lock);
+}
+
+// Fragmentation and holes of the zone trees, scanned in parallel.
+static void frag_report(const struct minix_superblock *sb)
+{
+	struct minix_frag_report report;
+	struct workpool *pool = workpool_create(0);
+	int i;
+
+	if (minix_frag_scan(&mfs, sb->s_ninodes, pool, print_frag, NULL, &report) < 0) {
+		printf("no inodes to scan\n");
+		workpool_destroy(pool);
+		return ;
+	}
+	workpool_destroy(pool);
+
+	printf("%llu files, %llu fragmented, %llu sparse : %llu zones in %llu extents : %llu holes in %llu runs : ratio %.4f : distance %.2f : %lu errors\n",
+	       (unsigned long long) report.total.files, (unsigned long long) report.total.fragmented,
+	       (unsigned long long) report.total.sparse, (unsigned long long) report.total.blocks,
+	       (unsigned long long) report.total.extents, (unsigned long long) report.total.holes,
+	       (unsigned long long) report.total.hole_runs, frag_stat_ratio(&report.total),
+	       frag_stat_avg_distance(&report.total), report.errors);
+
+	printf("extents per file:");
+	for (i = 0; i < FRAG_HIST_BUCKETS; i++) {
+		if (report.total.extents_hist[i])
+			printf(" <%llu:%llu", 1ULL << i, (unsigned long long) report.total.extents_hist[i]);
+	}
+	printf("\n");
+}
+
 static void print_superblock(const struct minix_superblock *sb)
 {
 	printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
@@ -296,7 +438,7 @@ static void print_superblock(const struct minix_superblock *sb)
 	printf("s_log_zone_size: 0x%x\n", sb->s_log_zone_size);
 	printf("s_max_size: 0x%x\n", sb->s_max_size);
 	printf("s_magic: 0x%x\n", sb->s_magic);
-	printf("s_pad: 0x%x\n", sb->s_pad);
+	printf("s_state: 0x%x\n", sb->s_state);
 	printf("s_zones: 0x%x\n", sb->s_zones);
 	printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n\n");
 }